@@ -1,5 +1,6 @@
 #include <WiFi.h>
 #include <WebServer.h>
+#include <DNSServer.h> // DNS del portal cautivo de configuración WiFi
 #include <Preferences.h>
 #include <HardwareSerial.h>
 #include <ArduinoJson.h>
@@ -7,8 +8,19 @@
 #include <SD.h>
 #include <SPI.h>
 #include <FS.h> // Para el sistema de archivos (SPIFFS o LittleFS)
-#include <NTPClient.h> // Para obtener la hora por NTP
-#include <WiFiUdp.h>   // Necesario para NTPClient
+#include <WiFiUdp.h>   // Consultas NTP sin bloquear (ver serviceNtp)
+#include <HTTPClient.h> // Webhook de las alertas
+#include <esp_timer.h> // Reloj monotónico de 64 bits en microsegundos
+#include "adr_lora.h"  // Tabla de tasas y margen de enlace compartidos con el transmisor
+#include "rylr998_at.h" // Motor de comandos AT no bloqueante compartido con el transmisor
+#include "config_blob.h" // Configuración en un único blob de NVS con versión y CRC
+#include "gzip_stream.h" // Compresión gzip al vuelo de las descargas
+#include "sd_journal.h" // Escritura en SD con diario y recuperación tras un corte de corriente
+#include "anomaly_detector.h" // Marcas de lecturas sospechosas por nodo y sensor
+#include "api_encoding.h" // CBOR y registros binarios de /api/data y /api/history
+#include "json_writer.h" // JSON de la API sin memoria dinámica
+#include <PubSubClient.h> // Cliente MQTT de la publicación hacia el backend
+#include <unistd.h>     // truncate() sobre la SD montada en /sd
 
 // === Configuración de Pines y Módulos ===
 #define LORA_RX 16
@@ -30,16 +42,64 @@ const long utcOffsetInSeconds = -5 * 3600;
 // Offset para Lima, Perú (-5 horas)
 const char* ntpServer = "pool.ntp.org";
 
+const unsigned long NTP_RESYNC_INTERVAL = 6UL * 3600UL * 1000UL; // Re-sincronizar NTP cada 6 horas
+const unsigned long NTP_TIMEOUT = 1500;         // Espera de la respuesta, sondeada desde loop()
+const unsigned long NTP_RETRY_INTERVAL = 30000; // Entre intentos fallidos (o sin hora todavía)
+const uint16_t NTP_LOCAL_PORT = 1337;
+// hostByName() bloquea (segundos si el DNS no responde): la dirección se conserva entre fallos
+const int NTP_RESOLVE_AFTER_FAILURES = 4;                      // Fallos seguidos antes de volver a resolver
+const unsigned long NTP_RESOLVE_INTERVAL = 24UL * 3600UL * 1000UL; // Renovación de la dirección del pool
+const unsigned long NTP_RESOLVE_RETRY = 600000;                // Como mucho una consulta DNS cada 10 min
+const uint32_t NTP_UNIX_OFFSET = 2208988800UL;  // Segundos de 1900 a 1970
+const long MAX_CLOCK_DRIFT_PPM = 500; // Límite de la corrección de deriva del cristal
+const time_t SECONDS_PER_DAY = 86400;
+
 const unsigned long SD_SAVE_INTERVAL = 60000;
 // Guardar cada 60 segundos
 const int MAX_HISTORY = 50; // Máximo de registros en el historial en RAM
 
+// Columnas de los archivos diarios. node/seq identifican cada trama para fusionar receptores,
+// rssi/snr registran la calidad del enlace con la que se recibió y crc (CRC-16 de la línea,
+// ver sd_journal.h) delata las líneas rotas por un corte de corriente.
+const char* LOG_CSV_HEADER = "timestamp,temperature,humidity,soil_moisture,lux,node,seq,rssi,snr,flags,crc";
+
+const int MAX_NODES = 8; // Máximo de transmisores con estadísticas de enlace
+
 // === Objetos Globales ===
 HardwareSerial LoRaSerial(2);
-WebServer server(80);
+Rylr998At<HardwareSerial> lora(LoRaSerial, millis);
+// WebServer que deja leer argumentos (también el cuerpo, "plain") y cabeceras de la petición en su
+// sitio: arg() y header() devuelven una copia en un String nuevo en cada llamada
+class ApiServer : public WebServer {
+ public:
+  ApiServer(int port) : WebServer(port) {}
+  const String* argValue(const char* name) {
+    for (int i = 0; i < _currentArgCount; i++) {
+      if (strcmp(_currentArgs[i].key.c_str(), name) == 0) return &_currentArgs[i].value;
+    }
+    return nullptr;
+  }
+  const String* headerValue(const char* name) {
+    for (int i = 0; i < _headerKeysCount; i++) {
+      if (strcasecmp(_currentHeaders[i].key.c_str(), name) == 0) return &_currentHeaders[i].value;
+    }
+    return nullptr;
+  }
+};
+ApiServer server(80);
 Preferences preferences;
 WiFiUDP ntpUDP;
-NTPClient timeClient(ntpUDP, ntpServer, utcOffsetInSeconds);
+// Petición NTP en curso: se envía y se sondea la respuesta en cada loop(), sin esperar.
+// La dirección del servidor se resuelve al principio y solo se renueva tras varios fallos seguidos
+// o una vez al día, nunca más de una consulta DNS cada NTP_RESOLVE_RETRY.
+struct NtpRequest {
+  bool pending = false;
+  unsigned long sentAt = 0;
+  unsigned long lastAttempt = 0; // 0 = ninguno todavía
+  uint32_t serverIp = 0;
+  unsigned long lastResolve = 0; // Última consulta DNS (0 = ninguna)
+  int failures = 0;              // Peticiones seguidas sin respuesta
+} ntpRequest;
 
 // === Estructuras de Datos ===
 struct SensorData {
@@ -49,6 +109,11 @@ struct SensorData {
   int soilMoisture = 0;
   unsigned long lastUpdate = 0;
   // Timestamp millis del ESP32
+  int node = 0;  // Dirección LoRa del transmisor
+  long seq = -1; // Número de secuencia de la trama (-1 si el transmisor no lo envía)
+  int rssi = 0;  // dBm reportado por el RYLR998
+  int snr = 0;   // dB reportado por el RYLR998
+  uint16_t flags = 0; // Marcas de anomaly_detector.h de la lectura actual
   bool dataValid = false;
 } sensorData;
 
@@ -57,8 +122,67 @@ struct DataPoint {
   // Timestamp millis del ESP32 para el historial interno
   float temperature, humidity, lux;
   int soilMoisture;
+  int node;
+  long seq;
+  int16_t rssi;
+  int8_t snr;
+  uint16_t flags; // 4 bits por sensor (ANOMALY_ZERO/STUCK/RATE/OUTLIER); 0 = lectura normal
 } dataHistory[MAX_HISTORY];
 
+// Lecturas recibidas antes de sincronizar NTP, con marca millis() para reconstruir su hora real
+const int MAX_PENDING_RECORDS = 240; // ~1 hora de lecturas a 15 s
+DataPoint pendingRecords[MAX_PENDING_RECORDS];
+// Si la SD falla al volcarla, la cola se reintenta desde loop() con espera creciente
+const unsigned long PENDING_RETRY_MIN = 5000;
+const unsigned long PENDING_RETRY_MAX = 300000;
+struct PendingRetry {
+  unsigned long lastAttempt = 0;
+  unsigned long delay = 0; // 0 = sin fallos: se intenta en cuanto haya hora
+} pendingRetry;
+
+// Muestras desempaquetadas de la última trama en lote ("B:")
+const int MAX_BATCH_SAMPLES = 16;
+DataPoint batchPoints[MAX_BATCH_SAMPLES];
+
+// Estadísticas de enlace por nodo con estimadores en línea de tamaño fijo (sin guardar muestras)
+struct LinkStats {
+  int node = -1;                 // -1 = entrada libre
+  unsigned long packets = 0;     // Tramas recibidas
+  unsigned long readings = 0;    // Lecturas recibidas (una trama en lote trae varias)
+  unsigned long lost = 0;        // Lecturas perdidas estimadas por saltos de secuencia (la secuencia cuenta lecturas)
+  unsigned long duplicates = 0;  // Tramas repetidas (misma secuencia)
+  long lastSeq = -1;
+  float rssiMean = 0, rssiMin = 0, rssiP10 = 0;
+  float snrMean = 0, snrMin = 0, snrP10 = 0;
+  unsigned long lastArrival = 0; // millis() de la última trama
+  float meanInterval = 0;        // Intervalo medio entre tramas (ms)
+  float jitter = 0;              // Variación del intervalo entre llegadas (ms, estilo RFC 3550)
+  int adrSamples = 0;            // Tramas recibidas con la tasa actual (0 = reiniciar SNR)
+  bool adrAcked = false;         // Confirmó el cambio de tasa en curso
+  bool adrConfirmPending = false; // Falta enviarle ADROK con la tasa nueva
+  String pendingConfig;           // Downlink "CFG:..." de filtrado hasta que el nodo lo confirme
+  AnomalyState anomaly;           // Media, varianza y último valor aceptado de cada sensor
+  unsigned long suspect = 0;      // Lecturas con alguna marca
+} linkStats[MAX_NODES];
+AnomalyConfig anomalyConfig; // Límites por sensor de la detección de lecturas sospechosas
+
+// === Tasa de datos adaptativa (ADR) ===
+const unsigned long ADR_ACTIVE_WINDOW = 600000;   // Nodos oídos en los últimos 10 min participan en la decisión
+const unsigned long ADR_CHANGE_TIMEOUT = 300000;  // Se aborta el cambio si no todos confirman en 5 min
+const unsigned long ADR_SILENCE_TIMEOUT = 900000; // Nodo oído con la tasa actual y callado 15 min = perdido
+const unsigned long ADR_HOLDOFF = 3600000;        // Tras un aborto o una pérdida, 1 h sin subir de tasa
+struct AdrState {
+  int rate = ADR_DEFAULT_RATE; // Índice en ADR_RATES usado por toda la red
+  int targetRate = -1;         // Cambio en curso (-1 = ninguno)
+  unsigned long changeStarted = 0;
+  unsigned long lastFrame = 0;
+  unsigned long holdoffStarted = 0;
+  bool holdoff = false;        // Da tiempo a los nodos perdidos a volver solos a la tasa por defecto
+} adrState;
+
+const float LINK_MEAN_ALPHA = 0.1;    // Peso de la media móvil exponencial
+const float RSSI_QUANTILE_STEP = 0.5; // Paso del estimador de percentil (dB)
+
 struct SensorRanges {
   float tempMin = -40; float tempMax = 80;
   float humMin = 0; float humMax = 100;
@@ -66,14 +190,487 @@ struct SensorRanges {
   int soilMin = 0; int soilMax = 100;
 } sensorRanges;
 
+// === Motor de alertas por rangos ===
+// Las reglas se evalúan una vez por lectura nueva (no en cada vuelta de loop()). Cada regla vigila un
+// sensor de un nodo (o de todos), entra en alerta fuera de [min, max] y sale al volver a
+// [min + histéresis, max - histéresis]; el cambio solo se acepta si la condición se mantiene dwell segundos.
+const int MAX_ALERT_RULES = 16;
+const uint16_t ALERT_ANY_NODE = 0xFFFF;
+enum { ALERT_TEMP, ALERT_HUM, ALERT_LUX, ALERT_SOIL, ALERT_SENSORS };
+static_assert(ALERT_TEMP == ANOMALY_TEMP && ALERT_HUM == ANOMALY_HUM && ALERT_LUX == ANOMALY_LUX &&
+              ALERT_SOIL == ANOMALY_SOIL, "Mismo orden de sensores en las marcas");
+const char* ALERT_SENSOR_NAMES[ALERT_SENSORS] = {"temperature", "humidity", "lux", "soilMoisture"};
+const uint8_t ALERT_ACTION_GPIO = 0x01;    // Pin en alto mientras alguna regla que lo usa está en alerta
+const uint8_t ALERT_ACTION_LOG = 0x02;     // Línea en /alerts.csv de la SD
+const uint8_t ALERT_ACTION_SSE = 0x04;     // Evento "alert" a los clientes de /api/events
+const uint8_t ALERT_ACTION_WEBHOOK = 0x08; // POST JSON a la URL configurada
+const char* ALERT_ACTION_NAMES[] = {"gpio", "log", "sse", "webhook"};
+const char* ALERT_LOG_FILE = "/alerts.csv";
+const int MAX_SSE_CLIENTS = 4;
+const unsigned long SSE_KEEPALIVE_INTERVAL = 15000; // Comentario periódico para detectar clientes caídos
+// El webhook lo envía su propia tarea (núcleo 0, como MQTT): HTTPClient es bloqueante y un
+// destino caído tardaría hasta 2 × WEBHOOK_TIMEOUT_MS por evento en loop()
+const int MAX_WEBHOOK_QUEUE = 8;
+const unsigned long WEBHOOK_TIMEOUT_MS = 1500;
+const int WEBHOOK_URL_MAX = 128;
+const int WEBHOOK_BODY_MAX = 256;
+
+// Regla tal como se guarda en el blob de configuración (20 bytes por regla)
+struct AlertRule {
+  uint16_t node;     // Dirección del transmisor o ALERT_ANY_NODE
+  uint8_t sensor;    // ALERT_TEMP, ALERT_HUM, ALERT_LUX o ALERT_SOIL
+  uint8_t actions;   // Máscara de ALERT_ACTION_*
+  float min, max;
+  float hysteresis;
+  uint16_t dwellS;
+  uint8_t gpio;
+  uint8_t reserved;
+};
+
+// Tabla compilada: umbrales de entrada y salida ya calculados y permanencia en ms
+struct CompiledAlertRule {
+  float enterLow, enterHigh; // Fuera de este intervalo se entra en alerta
+  float clearLow, clearHigh; // Dentro de este intervalo se sale de la alerta
+  unsigned long dwellMs;
+  uint16_t node;
+  uint8_t sensor, actions, gpio;
+};
+
+// Estado de cada regla por nodo (índice de la entrada en linkStats)
+struct AlertRuleState {
+  bool active = false;
+  bool pending = false;      // La condición contraria se cumple desde `since`
+  unsigned long since = 0;
+};
+
+AlertRule alertRules[MAX_ALERT_RULES];
+CompiledAlertRule compiledAlerts[MAX_ALERT_RULES];
+AlertRuleState alertStates[MAX_ALERT_RULES][MAX_NODES];
+int alertRuleCount = 0;
+String webhookUrl = "";
+// Evento completo por valor: la tarea no comparte ningún String con loop()
+struct WebhookMessage {
+  char url[WEBHOOK_URL_MAX];
+  char body[WEBHOOK_BODY_MAX];
+};
+QueueHandle_t webhookQueue = nullptr;
+volatile unsigned long webhookSent = 0, webhookFailed = 0; // Los escribe la tarea del webhook
+unsigned long webhookDropped = 0;
+WiFiClient sseClients[MAX_SSE_CLIENTS];
+unsigned long lastSseKeepalive = 0;
+
+// Configuración persistente: rangos, reglas y webhook en el blob "config" (config_blob.h).
+// Los campos nuevos van al final y suben RECEIVER_CONFIG_VERSION.
+const uint16_t RECEIVER_CONFIG_VERSION = 1;
+struct ReceiverConfig {
+  SensorRanges ranges;
+  uint8_t alertRuleCount = 0;
+  AlertRule alertRules[MAX_ALERT_RULES];
+  char webhookUrl[WEBHOOK_URL_MAX] = "";
+};
+// Claves sueltas anteriores al blob, que se migran una vez y se borran
+const char* LEGACY_CONFIG_KEYS[] = {"tempMin", "tempMax", "humMin", "humMax", "luxMin", "luxMax",
+                                    "soilMin", "soilMax", "rules", "webhook"};
+
+// === Descargas del registro en SD ===
+// /api/download entrega un archivo diario o varios días concatenados (?from=&to=) como un único
+// flujo de bytes formado por tramos; admite Range para reanudar y ?gzip=1 para comprimir al vuelo.
+const int MAX_DOWNLOAD_DAYS = 93;      // Días por petición (un trimestre)
+const size_t DOWNLOAD_SLICE = 1460;    // Bytes por trozo (un segmento TCP); entre trozos se atiende la radio
+struct DownloadSegment {
+  char path[32];       // Archivo diario; vacío = cabecera CSV desde RAM
+  uint32_t offset;     // Primer byte del archivo que entra en la descarga
+  uint32_t length;
+};
+DownloadSegment downloadSegments[MAX_DOWNLOAD_DAYS + 1];
+GzipStream<11> downloadGzip; // Ventana fija de 2 KB, ~12.7 KB en total
+
+// === Índice del archivo en SD ===
+// Un registro binario de tamaño fijo por día en /data/archive.idx (tamaño, lecturas y mínimo/máximo
+// de cada sensor), para listar meses de datos sin recorrer el directorio FAT. El día en curso vive en
+// RAM y se guarda cada ARCHIVE_SAVE_INTERVAL y al cambiar de día; si al arrancar el tamaño del archivo
+// no coincide con el índice (corte de corriente) ese día se vuelve a contar.
+const char* ARCHIVE_INDEX_FILE = "/data/archive.idx";
+// Índice reescrito entero (removeArchiveDays): FAT no renombra sobre un archivo existente, así que la
+// copia completa se cierra antes de borrar el original; si falta el índice al arrancar, se recupera de aquí
+const char* ARCHIVE_INDEX_TMP = "/data/archive.tmp";
+const unsigned long ARCHIVE_SAVE_INTERVAL = 600000; // 10 minutos
+const int ARCHIVE_SCAN_LINES = 100;                 // Líneas por vuelta de loop() al reconstruir
+struct ArchiveDay {
+  uint32_t day = 0;       // Medianoche en hora local (epoch); 0 = entrada vacía
+  uint32_t size = 0;      // Bytes del archivo diario
+  uint32_t records = 0;
+  float minValue[ALERT_SENSORS];  // Mismo orden que ALERT_SENSOR_NAMES
+  float maxValue[ALERT_SENSORS];
+};
+ArchiveDay archiveToday;
+bool archiveTodayDirty = false;
+unsigned long lastArchiveSave = 0;
+// Reconstrucción incremental: todos los archivos de /data (índice ausente) o solo uno
+struct ArchiveScan {
+  bool active = false;
+  bool allFiles = false;
+  File root;
+  File file;
+  uint32_t limit = 0; // Datos útiles del archivo en curso (sin el relleno de la preasignación)
+  ArchiveDay entry;
+} archiveScan;
+
+// === Retención y resumen de registros antiguos ===
+// Los archivos diarios con más de RAW_RETENTION_DAYS se resumen en filas horarias por nodo
+// (mínimo/máximo/media) dentro de /data/hourly_AAAA-MM.csv y se borran. Si el espacio libre baja de
+// RETENTION_LOW_FREE_PERCENT se adelanta el resumen de los días más antiguos y, cuando ya no quedan
+// días crudos que resumir, se borran los meses horarios más antiguos hasta superar RETENTION_OK_FREE_PERCENT.
+// Todo avanza por partes desde loop() para no frenar la recepción LoRa.
+// Antes de añadir las filas de un día se escribe ROLLUP_MARKER_FILE con el tamaño previo del archivo
+// horario; si la corriente se corta antes de borrar el día crudo, la próxima revisión recorta el archivo
+// horario a ese tamaño y el día se resume de nuevo (sin filas duplicadas).
+const int RAW_RETENTION_DAYS = 30;
+const int RETENTION_LOW_FREE_PERCENT = 10;
+const int RETENTION_OK_FREE_PERCENT = 15;
+const unsigned long RETENTION_CHECK_INTERVAL = 3600000; // Revisión horaria (o en cuanto termina un paso)
+const int RETENTION_SLICE_LINES = 100;
+const char* ROLLUP_MARKER_FILE = "/data/rollup.pending";
+const uint32_t ROLLUP_MARKER_MAGIC = 0x4C4C4F52; // "ROLL"
+struct RollupMarker {
+  uint32_t magic;
+  uint32_t day;          // Día que se está resumiendo
+  uint32_t hourlyOffset; // Tamaño del archivo horario antes de añadir sus filas (0 = no existía)
+};
+const char* HOURLY_CSV_HEADER = "hour,node,samples,temperature_min,temperature_max,temperature_mean,"
+                                "humidity_min,humidity_max,humidity_mean,lux_min,lux_max,lux_mean,"
+                                "soil_moisture_min,soil_moisture_max,soil_moisture_mean";
+struct RollupCell {
+  uint16_t samples;
+  uint16_t valid[ALERT_SENSORS]; // Lecturas sin marca de anomalía de cada sensor
+  float minValue[ALERT_SENSORS], maxValue[ALERT_SENSORS], sum[ALERT_SENSORS];
+};
+struct RetentionJob {
+  bool active = false;          // Resumen de un día en curso
+  bool lowSpace = false;        // Por debajo de la marca de agua hasta recuperar RETENTION_OK_FREE_PERCENT
+  bool checkNow = true;
+  bool recovered = false;       // Marca de resumen interrumpido ya revisada en este arranque
+  unsigned long lastCheck = 0;
+  File file;
+  uint32_t limit = 0;
+  uint32_t day = 0;
+  int nodes[MAX_NODES];         // Dirección del nodo de cada columna de rollupCells
+  int nodeCount = 0;
+  unsigned long daysRolledUp = 0, monthsDeleted = 0;
+} retention;
+RollupCell rollupCells[24][MAX_NODES]; // Un día: 24 horas x nodos (~10 KB)
+unsigned long sdWriteErrors = 0;       // Escrituras fallidas en la SD (tarjeta llena o retirada)
+
+// === Registro con diario en SD ===
+// Las lecturas se añaden a los archivos diarios a través de sdJournal: primero se copian a
+// /data/journal.bin, después al CSV; la confirmación viaja con las ranuras del lote siguiente. Cada
+// append son dos aperturas/escrituras/cierres (diario y CSV; herramientas/prueba_journal.cpp mide
+// 2,03 de media), no una sola escritura de sector. Al arrancar se repite lo que quedó sin
+// confirmar y se truncan las líneas rotas de la cola del archivo (lectura acotada a ~14 KB).
+const char* JOURNAL_FILE = "/data/journal.bin";
+const char* SD_MOUNT_POINT = "/sd"; // Punto de montaje por defecto de SD.begin()
+const size_t LOG_LINE_MAX = 192;    // Línea CSV con su crc; las normales rondan 75 bytes
+
+// === Preasignación de los archivos diarios ===
+// Cada append que hace crecer un archivo obliga a FAT a buscar un cluster libre y a reescribir la
+// tabla y la entrada de directorio: son los picos de decenas de ms en loop(). Con la preasignación,
+// serviceLogPrealloc() prepara por partes un archivo de reserva de LOG_PREALLOC_BYTES a ceros, que
+// ensureLogFile() renombra al llegar un día nuevo. Las lecturas se escriben en su sitio sobre el
+// relleno (un sector, sin tocar FAT ni el tamaño) y el primer byte NUL marca el final de los datos.
+// Al cambiar de día el archivo anterior se trunca a sus datos, así que solo el de hoy lleva relleno;
+// los días pasados que crea writeRecordsToSD() no usan la reserva.
+const bool SD_PREALLOCATE_LOGS = true; // false = append clásico (para comparar latencias)
+const uint32_t LOG_PREALLOC_BYTES = 262144; // ~1440 lecturas/día de ~75 bytes, con margen
+const uint32_t LOG_PREALLOC_SLICE = 4096;   // Bytes de reserva escritos por vuelta de loop()
+const char* LOG_SPARE_FILE = "/data/prealloc.tmp";
+long spareBytes = -1; // Tamaño del archivo de reserva (-1 = sin medir)
+
+// Latencia de las escrituras del registro en buckets de potencias de 2 (µs)
+const int LATENCY_BUCKETS = 24;
+struct WriteLatency {
+  unsigned long samples = 0;
+  uint32_t maxUs = 0;
+  unsigned long buckets[LATENCY_BUCKETS] = {};
+} logWriteLatency;
+
+struct SdCardFs {
+  char cachedPath[32] = ""; // Último archivo diario medido
+  long cachedEnd = 0;
+
+  static bool isLogFile(const char* path) { return strncmp(path, "/data/sensors_", 14) == 0; }
+
+  // Tamaño útil; en un archivo diario preasignado llega hasta el primer byte NUL del relleno
+  long size(const char* path) {
+    bool log = isLogFile(path);
+    if (log && strcmp(path, cachedPath) == 0) return cachedEnd;
+    File file = SD.open(path, FILE_READ);
+    if (!file) return -1;
+    long length = file.size();
+    if (log) {
+      length = dataEnd(file, length);
+      strlcpy(cachedPath, path, sizeof(cachedPath));
+      cachedEnd = length;
+    }
+    file.close();
+    return length;
+  }
+  // Los datos no contienen NUL y el relleno es todo NUL: búsqueda binaria (~18 lecturas)
+  static long dataEnd(File& file, long length) {
+    if (length == 0 || !file.seek(length - 1) || file.read() != 0) return length;
+    long low = 0, high = length - 1;
+    while (low < high) {
+      long mid = (low + high) / 2;
+      file.seek(mid);
+      if (file.read() == 0) high = mid;
+      else low = mid + 1;
+    }
+    return low;
+  }
+  size_t read(const char* path, uint32_t offset, uint8_t* data, size_t length) {
+    File file = SD.open(path, FILE_READ);
+    if (!file) return 0;
+    size_t n = file.seek(offset) ? file.read(data, length) : 0;
+    file.close();
+    return n;
+  }
+  bool write(const char* path, uint32_t offset, const uint8_t* data, size_t length) {
+    if (isLogFile(path)) cachedPath[0] = '\0';
+    File file = SD.open(path, SD.exists(path) ? "r+" : "w");
+    if (!file) return false;
+    bool ok = file.seek(offset) && file.write(data, length) == length;
+    file.close(); // close() vuelca los datos y la entrada de directorio
+    return ok;
+  }
+  // Escribe tras los datos útiles: sobre el relleno si lo hay, al final del archivo si no
+  bool append(const char* path, const uint8_t* data, size_t length, uint32_t& newSize) {
+    long end = size(path);
+    File file = SD.open(path, end >= 0 ? "r+" : "w");
+    if (!file) return false;
+    if (end < 0) end = 0;
+    bool ok = file.seek(end) && file.write(data, length) == length;
+    file.close();
+    newSize = end + length;
+    if (isLogFile(path)) {
+      strlcpy(cachedPath, ok ? path : "", sizeof(cachedPath)); // Tras un fallo se vuelve a medir
+      cachedEnd = newSize;
+    }
+    return ok;
+  }
+  // En un archivo preasignado se rellena con NUL en lugar de acortarlo, para conservar la reserva
+  bool truncate(const char* path, uint32_t length) {
+    long end = size(path);
+    File file = SD.open(path, FILE_READ);
+    long physical = file ? file.size() : -1;
+    if (file) file.close();
+    if (isLogFile(path)) cachedPath[0] = '\0';
+    if (physical > end && end >= (long)length) {
+      const uint8_t zeros[64] = {0};
+      file = SD.open(path, "r+");
+      bool ok = file && file.seek(length);
+      for (long left = end - length; ok && left > 0; left -= sizeof(zeros)) {
+        size_t chunk = left < (long)sizeof(zeros) ? left : sizeof(zeros);
+        ok = file.write(zeros, chunk) == chunk;
+      }
+      if (file) file.close();
+      return ok;
+    }
+    return ::truncate((String(SD_MOUNT_POINT) + path).c_str(), length) == 0;
+  }
+  // Devuelve a la tarjeta el relleno que sobra de un archivo preasignado
+  void release(const char* path) {
+    long end = size(path);
+    File file = SD.open(path, FILE_READ);
+    long physical = file ? file.size() : -1;
+    if (file) file.close();
+    if (end >= 0 && physical > end) ::truncate((String(SD_MOUNT_POINT) + path).c_str(), end);
+  }
+  // Igual que logFileForEpoch()
+  void dayPath(uint32_t day, char* out, size_t outSize) {
+    time_t epochTime = day;
+    strftime(out, outSize, "/data/sensors_%Y-%m-%d.csv", gmtime(&epochTime));
+  }
+} sdCardFs;
+SdJournal<SdCardFs> sdJournal(sdCardFs, JOURNAL_FILE);
+bool journalReady = false;
+
+// Reloj local: mapea esp_timer a hora epoch (ya con offset local) y corrige la deriva entre sincronizaciones
+struct LocalClock {
+  time_t baseEpoch = 0;      // Hora NTP en la última sincronización
+  int64_t baseMicros = 0;    // esp_timer_get_time() en la última sincronización
+  long driftPpm = 0;         // Deriva estimada del reloj local (positiva = adelanta)
+  unsigned long lastSyncMillis = 0;
+  time_t dayStart = 0;       // Medianoche del día en caché
+  char datePrefix[12] = "";  // "AAAA-MM-DD " del día en caché
+} localClock;
+
+// === Publicación MQTT ===
+// Las lecturas nuevas se agrupan en lotes de líneas CSV (mismo formato y crc que el registro en SD)
+// y se publican en MQTT_TOPIC. El cliente (PubSubClient, bloqueante) vive en su propia tarea en el
+// núcleo 0: loop() solo deja lotes en mqttQueue sin esperar, así que ni un broker caído ni una
+// conexión lenta frenan la radio. Sin conexión, o con la cola llena, los lotes van a la bandeja de
+// salida en SD (anillo de MQTT_OUTBOX_SLOTS lotes; llena, se pisa el más antiguo) y al volver la
+// conexión se vacía en orden, un lote cada MQTT_DRAIN_INTERVAL. La SD solo la toca loop().
+// Entrega QoS 0: el registro diario en SD sigue siendo la copia de referencia.
+const bool MQTT_ENABLED = true;
+const char* MQTT_HOST = "192.168.1.50"; // Mosquitto en la red local (o herramientas/broker_mqtt.cpp)
+const uint16_t MQTT_PORT = 1883;
+const char* MQTT_CLIENT_ID = "esp32-telemetria";
+const char* MQTT_TOPIC = "telemetria/lecturas";
+const size_t MQTT_BATCH_BYTES = 1000;           // Carga útil por lote (~13 lecturas)
+const unsigned long MQTT_BATCH_MAX_AGE = 10000; // Un lote a medias sale a los 10 s
+const int MQTT_QUEUE_DEPTH = 8;                 // Lotes en RAM entre loop() y la tarea
+const unsigned long MQTT_DRAIN_INTERVAL = 250;  // Vaciado de la bandeja: 4 lotes/s como máximo
+const unsigned long MQTT_RETRY_MAX = 60000;     // Espera máxima entre intentos de conexión
+const char* MQTT_OUTBOX_FILE = "/data/outbox.bin";
+const uint32_t MQTT_OUTBOX_SLOTS = 2048;        // 2 MB (~26.000 lecturas)
+const uint32_t MQTT_OUTBOX_SLOT_SIZE = 1024;
+const uint32_t MQTT_OUTBOX_DATA = 512;          // Las ranuras empiezan tras el sector de cabecera
+const uint32_t MQTT_OUTBOX_MAGIC = 0x584F424D;  // "MBOX"
+struct MqttMessage {
+  uint16_t length;
+  uint16_t readings;
+  char payload[MQTT_BATCH_BYTES];
+};
+static_assert(sizeof(MqttMessage) <= MQTT_OUTBOX_SLOT_SIZE, "Un lote por ranura de la bandeja");
+// Cabecera de la bandeja; head y tail solo crecen (ranura = contador % MQTT_OUTBOX_SLOTS)
+struct MqttOutboxHeader {
+  uint32_t magic = MQTT_OUTBOX_MAGIC;
+  uint32_t head = 0, tail = 0;
+  uint32_t overwritten = 0; // Lotes pisados con la bandeja llena
+} mqttOutbox;
+bool mqttOutboxReady = false;
+MqttMessage mqttBatch;               // Lote en construcción (solo loop())
+unsigned long mqttBatchStarted = 0;
+QueueHandle_t mqttQueue = nullptr;
+volatile bool mqttConnected = false; // Lo escribe la tarea MQTT
+struct MqttStats {
+  // Tarea MQTT (única que escribe estos)
+  volatile uint32_t batches = 0, readings = 0, bytes = 0;
+  volatile uint32_t publishErrors = 0, connects = 0, connectFailures = 0;
+  volatile uint32_t lastPublishUs = 0, maxPublishUs = 0;
+  // loop()
+  uint32_t direct = 0, outboxed = 0, drained = 0, lost = 0; // lost: sin cola ni SD
+  uint32_t windowReadings = 0;
+  unsigned long windowStart = 0;
+  float readingsPerMin = 0; // Publicadas en el último minuto completo
+} mqttStats;
+
+// === Respuestas de la API ===
+// /api/data y /api/history negocian el formato: ?format=json|cbor|bin, o la cabecera Accept
+// (application/cbor, application/octet-stream). Las rutas de consulta (/api/data, /api/history,
+// /api/sd-info, /api/ranges, /api/link, /api/rules, /api/mqtt, /api/sync) escriben la respuesta
+// con JsonWriter, CborWriter o writeLogLine() en un búfer de apiPool y la envían desde ahí: ni
+// DynamicJsonDocument ni String en el código de la ruta, para que días de sondeo no fragmenten el
+// heap (las cabeceras que arma WebServer quedan aparte). Los cuerpos planos de POST /api/ranges y
+// /api/node-config se leen en el propio String del servidor (ApiServer::argValue) con
+// JsonFlatReader. Siguen reservando: /api/wifi (cadenas de WiFi.SSID() y compañía, solo el portal)
+// y POST /api/rules (ArduinoJson, listas anidadas). herramientas/contar_asignaciones.cpp cuenta
+// las reservas por petición de las rutas convertidas.
+enum ApiFormat { API_FORMAT_JSON, API_FORMAT_CBOR, API_FORMAT_BINARY };
+const char* API_CBOR_HISTORY_FIELDS[] = {"timestamp", "temperature", "humidity", "lux", "soilMoisture", "flags"};
+const int API_POOL_BUFFERS = 2;      // Una petición a la vez; el segundo, para /api/encode-bench
+const size_t API_BUFFER_SIZE = 6144; // Historial completo en JSON (~115 bytes por punto)
+uint8_t apiPool[API_POOL_BUFFERS][API_BUFFER_SIZE];
+bool apiPoolInUse[API_POOL_BUFFERS] = {};
+static_assert(sizeof(ApiBinaryHeader) + MAX_HISTORY * sizeof(ApiBinaryRecord) <= API_BUFFER_SIZE,
+              "Historial binario mayor que un búfer de la API");
+struct ApiPoolStats {
+  uint32_t acquired = 0;
+  uint32_t exhausted = 0; // Peticiones sin búfer libre (503)
+  uint32_t overflows = 0; // Respuestas que no cabían (500)
+} apiPoolStats;
+
+// Búfer del pool mientras dura el manejador; se libera en cualquier return
+struct ApiBuffer {
+  uint8_t* data = nullptr;
+  int slot = -1;
+
+  ApiBuffer() {
+    for (int i = 0; i < API_POOL_BUFFERS && slot < 0; i++) {
+      if (!apiPoolInUse[i]) slot = i;
+    }
+    if (slot < 0) {
+      apiPoolStats.exhausted++;
+      return;
+    }
+    apiPoolInUse[slot] = true;
+    data = apiPool[slot];
+    apiPoolStats.acquired++;
+  }
+  ~ApiBuffer() {
+    if (slot >= 0) apiPoolInUse[slot] = false;
+  }
+  ApiBuffer(const ApiBuffer&) = delete;
+  ApiBuffer& operator=(const ApiBuffer&) = delete;
+  char* text() { return (char*)data; }
+};
+
+// === Conexión WiFi y portal de configuración ===
+// Sin credenciales, o sin red durante WIFI_PORTAL_AFTER, se abre el punto de acceso
+// PORTAL_SSID_PREFIX-XXXX con un DNS que responde a todo con la IP del ESP32: el móvil muestra /portal
+// como portal cautivo. La radio, la SD y la publicación MQTT siguen funcionando mientras tanto.
+// Tras cada conexión se guardan BSSID, canal e IP (WifiCache, blob en NVS); la siguiente va directa
+// a ese AP y canal con IP fija, sin búsqueda de canales ni DHCP (cientos de ms en lugar de segundos).
+// Si en WIFI_FAST_TIMEOUT no asocia, se repite con búsqueda completa y DHCP.
+const unsigned long WIFI_FAST_TIMEOUT = 3000;
+const unsigned long WIFI_RETRY_INTERVAL = 15000; // Nuevo intento tras una búsqueda completa sin éxito
+const unsigned long WIFI_BOOT_WAIT = 2000;       // setup() espera la conexión rápida antes de seguir
+const unsigned long WIFI_PORTAL_AFTER = 300000;  // Sin red 5 min con credenciales: también el portal
+const unsigned long PORTAL_LINGER = 60000;       // Tras conectar, el portal sigue 1 min mostrando la IP
+const unsigned long WIFI_CREDENTIALS_TIMEOUT = 30000; // Credenciales del portal sin red: se vuelve a las anteriores
+const unsigned long WIFI_CREDENTIALS_SETTLE = 1000;   // WL_CONNECTED de la red anterior tras el cambio no cuenta
+const bool WIFI_CACHE_STATIC_IP = true;          // Reusar la IP de DHCP como fija (reservarla en el router)
+const char* PORTAL_SSID_PREFIX = "Telemetria";
+const char* PORTAL_PASSWORD = "telemetria";      // "" = red abierta
+const char* WIFI_CACHE_KEY = "wifiCache";
+const uint16_t WIFI_CACHE_VERSION = 1;
+struct WifiCache {
+  uint8_t bssid[6] = {0};
+  uint8_t channel = 0;  // 0 = sin caché
+  uint8_t reserved = 0; // Sin relleno indefinido: la caché se compara con memcmp
+  uint32_t ip = 0, gateway = 0, subnet = 0, dns = 0;
+} wifiCache;
+struct WifiAttempt {
+  unsigned long startedAt = 0;
+  bool fast = false; // Con BSSID, canal e IP de la caché
+  bool active = false;
+} wifiAttempt;
+struct WifiStats {
+  unsigned long bootToOnlineMs = 0; // Desde el arranque hasta la primera IP (0 = aún no)
+  unsigned long lastConnectMs = 0;  // Del último intento a tener IP
+  bool lastFast = false;
+  uint32_t connects = 0, fastConnects = 0, fastFailures = 0;
+  uint32_t outages = 0;
+  bool outageActive = false;
+  unsigned long outageStart = 0, lastOutageMs = 0, totalOutageMs = 0;
+  unsigned long readingsAtOutage = 0, lostAtOutage = 0;
+  unsigned long readingsDuringOutages = 0;     // Lecturas LoRa recibidas sin WiFi (van a la SD y a la bandeja)
+  unsigned long readingsLostDuringOutages = 0; // Saltos de secuencia durante los cortes
+} wifiStats;
+struct CaptivePortal {
+  bool active = false;
+  char apSsid[24] = "";
+  bool closing = false;            // Ya hay conexión: se cierra PORTAL_LINGER después de connectedAt
+  unsigned long connectedAt = 0;
+  bool credentialsPending = false; // Recibidas por el portal; se guardan en NVS al conectar
+  unsigned long credentialsAt = 0;
+  bool credentialsFailed = false;  // Las últimas no conectaron en WIFI_CREDENTIALS_TIMEOUT
+  String previousSsid, previousPassword; // Las que funcionaban, para volver a ellas
+  WifiCache previousCache;
+} portal;
+DNSServer dnsServer;
+
 // === Variables de Estado ===
 int historyIndex = 0, historyCount = 0;
+int pendingIndex = 0, pendingCount = 0;
+unsigned long pendingDropped = 0; // Lecturas descartadas por cola llena
 String ssid = "";
 String password = "";
 bool wifiConnected = false;
 bool sdCardAvailable = false;
 unsigned long lastSdSave = 0;
 String currentLogFile = "";
+time_t currentLogDayStart = 0; // Medianoche del día de currentLogFile
 // Nombre del archivo de log actual en SD
 bool timeSynchronized = false;
 // Bandera para saber si la hora está sincronizada
@@ -87,31 +684,140 @@ void initializeSD();
 bool initializeLogFile(); // Modificado para retornar bool
 void saveToSD();
 String getFormattedDateTime();
+String formatLogLine(const char* timestamp, const DataPoint& point);
+size_t writeLogLine(char* out, size_t size, const char* timestamp, const DataPoint& point);
+DataPoint currentDataPoint();
+void syncLocalClock(time_t ntpEpoch);
+void serviceNtp();
+bool sendNtpRequest();
+bool readNtpResponse(time_t& epoch);
+time_t clockNow();
+void formatTimestamp(time_t epochTime, char* out);
+String logFileForEpoch(time_t epochTime);
+bool ensureLogFile(const String& path, bool preallocate);
+bool appendLogLines(time_t dayStart, const String& lines, uint32_t& size);
+void serviceLogPrealloc();
+void recordWriteLatency(uint32_t micros);
+uint32_t writeLatencyPercentile(float fraction);
+void queuePendingRecord(const DataPoint& point);
+void flushPendingRecords();
+void servicePendingRecords();
+int writeRecordsToSD(const DataPoint& (*recordAt)(int), int count);
 void initializeLoRa();
+void waitLoRaIdle(unsigned long maxMs);
+void onLoRaCommand(const char* command, int result);
 void initializeWiFi();
 void loadWiFiCredentials();
-void requestWiFiCredentials();
-bool connectToWiFi();
+void beginWiFiConnect(bool fast);
 void checkWiFiConnection();
+void onWiFiOnline();
+void revertWiFiCredentials();
+void saveWifiCache();
+void linkTotals(unsigned long& readings, unsigned long& lost);
+void startPortal();
+void stopPortal();
+void servicePortal();
+void initializeMqtt();
+void mqttTask(void* parameter);
+void publishReading(time_t epochTime, const DataPoint& point);
+void submitMqttBatch();
+bool pushMqttOutbox(const MqttMessage& message);
+bool writeMqttOutboxHeader();
+void serviceMqtt();
 void initializeMDNS();
 void initializeWebServer();
-void initializeNTP();
 void processLoRaData();
-void parseAndStoreSensorData(String payload);
+void handleLoRaFrame(const RylrFrame& frame);
+void parseAndStoreSensorData(int node, String payload, int rssi, int snr);
+void parseAndStoreBatch(int node, String payload, int rssi, int snr);
+LinkStats* linkStatsForNode(int node);
+bool updateLinkStats(int node, long seq, int samples, int rssi, int snr);
+void applyLoRaRate(int rate);
+void sendDownlink(int node, const String& message);
+void runAdr(int node, bool linkCheck);
+void startAdrChange(int rate);
+void handleAdrAck(int node, int rate);
+void sendPendingConfig(int node);
+void checkAdrFallback();
 void addToHistory();
+void addPointToHistory(const DataPoint& point);
+void checkAnomalies(DataPoint& point);
+void anomalyReasons(uint16_t flags, int sensor, char* out, size_t size);
+uint16_t logLineFlags(const String& line);
 void printReceivedData();
-void loadSensorRanges();
-void saveSensorRanges();
-void checkSensorRanges(); // Nueva función
+void loadConfig();
+bool loadLegacyConfig(ReceiverConfig& config);
+void saveConfig();
+void updateRangeLed(const float* values);
+bool alertPinAllowed(int gpio);
+void compileAlertRules();
+void evaluateAlerts(const DataPoint& point);
+void fireAlert(int ruleIndex, const DataPoint& point, float value, bool active);
+void updateAlertOutputs();
+void logAlert(const String& line);
+void broadcastSse(const String& event, const String& data);
+void initializeWebhook();
+void webhookTask(void* parameter);
+void queueWebhook(const String& body);
+void serviceAlertOutputs();
 void handleRoot();
 void handleCSS();
 void handleJS();
 void handleAPIData();
 void handleAPIHistory();
+void buildDataJson(JsonWriter& json);
+void buildHistoryJson(JsonWriter& json);
+ApiFormat requestedApiFormat();
+void sendApiBuffer(ApiFormat format, const uint8_t* data, size_t length);
+void sendApiJson(int code, const JsonWriter& json);
+void sendApiBusy();
+uint32_t apiStatusBits();
+ApiBinaryRecord toBinaryRecord(const DataPoint& point);
+size_t encodeDataCbor(uint8_t* out, size_t capacity);
+size_t encodeHistoryCbor(uint8_t* out, size_t capacity);
+size_t encodeDataBinary(uint8_t* out, size_t capacity);
+size_t encodeHistoryBinary(uint8_t* out, size_t capacity);
+void handleAPIEncodeBench();
+void handleAPISystem();
 void handleSDInfo();
-void handleDownloadData();
+void handleDownload();
+void handleAPIArchive();
+void initializeArchive();
+void addToArchiveDay(ArchiveDay& entry, const DataPoint& point);
+void mergeArchiveDay(const ArchiveDay& delta, uint32_t fileSize);
+bool readArchiveDay(uint32_t day, ArchiveDay& entry);
+void writeArchiveDay(const ArchiveDay& entry);
+void startArchiveScan(const String& path);
+void serviceArchive();
+void removeArchiveDays(uint32_t fromDay, uint32_t toDay, bool rolledUpOnly);
+void serviceRetention();
+void recoverRollup();
+void undoHourlyAppend(const String& hourlyPath, uint32_t offset);
+int sdFreePercent();
+void startRollup(uint32_t day);
+void continueRollup();
+bool finishRollup();
+bool deleteOldestHourlyMonth();
+String hourlyFileForEpoch(time_t epochTime);
+String archiveDayJson(const ArchiveDay& entry);
+int buildDownloadSegments(time_t fromDay, time_t toDay);
+bool addDownloadSegment(int& count, const String& path, bool skipHeader);
+int parseRangeHeader(const String& header, uint32_t total, uint32_t& start, uint32_t& end);
+time_t parseDateArg(const String& text);
+uint32_t sendDownloadSegments(int count, uint32_t start, uint32_t length, bool gzip);
+void sendGzipChunk(const uint8_t* data, size_t length, void* context);
 void handleAPI_GetRanges();   // Nueva función para obtener rangos
 void handleAPI_SetRanges();   // Nueva función para establecer rangos
+void handleAPISync();
+void handleAPILink();
+void handleAPINodeConfig();
+void handleAPI_GetRules();
+void handleAPI_SetRules();
+void handleAPIEvents();
+void handleAPIMqtt();
+void handlePortal();
+void handleAPIWifiStatus();
+void handleAPIWifiSet();
 void handleNotFound();
 
 // === Implementación de Funciones ===
@@ -124,19 +830,17 @@ void setup() {
   digitalWrite(LED_PIN, LOW); // Asegurarse de que el LED esté apagado al inicio
 
   preferences.begin("sensor-config", false); // Usar un namespace para las preferencias
-  loadSensorRanges(); // Cargar los rangos al inicio
+  loadConfig(); // Rangos y reglas de alerta con una sola lectura de NVS
 
   initializeSD();
   initializeLoRa();
-  initializeWiFi();
-  // WiFi se conecta aquí
+  initializeWiFi(); // Conexión rápida con la caché, o portal de configuración; sin esperas largas
+  initializeWebServer(); // Después del WiFi (pila TCP iniciada); también sirve el portal
+  initializeMqtt(); // Después de la SD: la bandeja de salida se carga de ella
+  initializeWebhook();
+  // NTP y mDNS arrancan en onWiFiOnline(); la hora se sincroniza desde loop()
 
-  if (wifiConnected) {
-    initializeNTP();
-    // Inicia NTP solo si WiFi está conectado
-    initializeWebServer();
-    initializeMDNS();
-  } else {
+  if (!wifiConnected) {
     Serial.println("WiFi no conectado. Algunas funciones estarán limitadas.");
   }
 
@@ -150,29 +854,23 @@ void setup() {
 }
 
 void loop() {
-  if (wifiConnected) {
+  checkWiFiConnection(); // Sin esperas: también reintenta cuando ya no hay red
+  servicePortal(); // DNS del portal cautivo y su cierre tras conectar
+  if (wifiConnected || portal.active) {
     server.handleClient();
-    checkWiFiConnection();
-
-    // Actualizar hora NTP. Si no está sincronizada, intenta de nuevo.
-    if (!timeSynchronized) {
-      if (timeClient.update()) {
-        timeSynchronized = true;
-        Serial.println("Hora NTP sincronizada: " + timeClient.getFormattedTime());
-        // Intentar inicializar el archivo de log si NTP se acaba de sincronizar
-        if (sdCardAvailable) { // Asegurarse que SD esté disponible antes de intentar crear archivo
-            if (!initializeLogFile()) {
-                Serial.println("ADVERTENCIA: No se pudo crear el archivo de log con fecha NTP, intentando sin fecha.");
-            }
-        }
-      } else {
-        Serial.println("NTP: Fallo al actualizar o ya actualizado.");
-      }
-    }
+  }
+  if (wifiConnected) {
+    serviceNtp(); // Primera sincronización y re-sincronizaciones, sin bloquear
   }
 
   processLoRaData();
-  checkSensorRanges(); // Verificar los rangos en cada ciclo del loop
+  checkAdrFallback();
+  serviceAlertOutputs(); // Mantenimiento de clientes SSE (el webhook va en su tarea)
+  serviceArchive(); // Guardado del índice del día y reconstrucción por partes
+  serviceRetention(); // Resumen y borrado de registros antiguos por partes
+  serviceLogPrealloc(); // Archivo de reserva para el próximo día
+  serviceMqtt(); // Lote a medias, vaciado de la bandeja de salida y tasa de publicación
+  servicePendingRecords(); // Reintento del volcado de la cola previa a NTP si la SD falló
 
   // Control del LED
   if (ledOnStartTime > 0 && millis() - ledOnStartTime >= LED_ON_DURATION) {
@@ -224,6 +922,18 @@ void initializeSD() {
     SD.mkdir("/data");
     Serial.println("Directorio /data creado");
   }
+
+  // Recuperación tras un corte: no necesita la hora, el diario guarda a qué día pertenece cada línea
+  journalReady = sdJournal.begin();
+  if (!journalReady) {
+    Serial.println("ADVERTENCIA: no se pudo crear " + String(JOURNAL_FILE) + "; escritura sin diario");
+  } else {
+    const JournalRecovery& recovery = sdJournal.recover();
+    if (recovery.replayed > 0 || recovery.droppedLines > 0) {
+      Serial.println("Recuperación SD: " + String(recovery.replayed) + " lecturas reescritas desde el diario, " +
+                     String(recovery.droppedLines) + " líneas rotas quitadas (" + String(recovery.truncatedBytes) + " bytes)");
+    }
+  }
   // initializeLogFile() ya no se llama aquí, solo cuando NTP sincroniza
 }
 
@@ -234,38 +944,61 @@ bool initializeLogFile() {
     return false;
   }
   
+  // El cambio de día se detecta comparando con la medianoche del archivo actual,
+  // sin reconstruir el nombre del archivo en cada escritura
+  time_t now = clockNow();
+  if (currentLogFile != "" && now >= currentLogDayStart && now < currentLogDayStart + SECONDS_PER_DAY) {
+    return true;
+  }
+
+  // El archivo que deja de ser el de hoy se trunca a sus datos: tras un reinicio es el último día
+  // que registró el diario
+  if (currentLogFile != "") {
+    sdCardFs.release(currentLogFile.c_str());
+  } else if (sdJournal.lastDay() != 0 && sdJournal.lastDay() != (uint32_t)(now - now % SECONDS_PER_DAY)) {
+    sdCardFs.release(logFileForEpoch(sdJournal.lastDay()).c_str());
+  }
+
   // Generar nombre de archivo basado en la fecha real (AAAA-MM-DD)
-  // getFormattedTime() devuelve "HH:MM:SS" si se usa sin getEpochTime()
-  // Necesitamos la fecha completa, así que usamos getEpochTime() y gmtime
-  time_t epochTime = timeClient.getEpochTime();
-  struct tm *ptm = gmtime ((time_t *)&epochTime); 
-  
+  currentLogDayStart = now - now % SECONDS_PER_DAY;
+  currentLogFile = logFileForEpoch(now);
+  return ensureLogFile(currentLogFile, true);
+}
+
+// Nombre del archivo diario (/data/sensors_AAAA-MM-DD.csv) que corresponde a un instante dado
+String logFileForEpoch(time_t epochTime) {
+  // getFormattedTime() devuelve "HH:MM:SS", así que usamos gmtime para obtener la fecha completa
+  struct tm *ptm = gmtime(&epochTime);
+
   char dateBuffer[11]; //YYYY-MM-DD + null terminator
   sprintf(dateBuffer, "%04d-%02d-%02d", ptm->tm_year + 1900, ptm->tm_mon + 1, ptm->tm_mday);
-  String newLogFile = "/data/sensors_" + String(dateBuffer) + ".csv";
-
-  // Solo re-crea si el archivo es nuevo para el día
-  if (currentLogFile != newLogFile) {
-    currentLogFile = newLogFile;
-    if (!SD.exists(currentLogFile)) {
-      File file = SD.open(currentLogFile, FILE_WRITE);
-      if (file) {
-        // Orden de columnas: timestamp,temperature,humidity,soil_moisture,lux
-        file.println("timestamp,temperature,humidity,soil_moisture,lux");
-        file.close();
-        Serial.println("Archivo de log creado/actualizado: " + currentLogFile);
-        return true;
-      } else {
-        Serial.println("Error al abrir/crear archivo de log: " + currentLogFile + ". Verifique la tarjeta SD.");
-        return false;
-      }
-    } else {
-      Serial.println("Archivo de log existente para hoy: " + currentLogFile);
-      return true; // El archivo ya existe, es válido
+  return "/data/sensors_" + String(dateBuffer) + ".csv";
+}
+
+// Crea el archivo con su cabecera si todavía no existe. Solo el de hoy (preallocate) se crea sobre
+// la reserva: un día pasado no se trunca después y guardaría el relleno para siempre.
+bool ensureLogFile(const String& path, bool preallocate) {
+  if (SD.exists(path)) {
+    return true; // El archivo ya existe, es válido
+  }
+  if (SD_PREALLOCATE_LOGS && preallocate && spareBytes >= (long)LOG_PREALLOC_BYTES && SD.rename(LOG_SPARE_FILE, path)) {
+    spareBytes = 0;
+    String header = String(LOG_CSV_HEADER) + "\n";
+    if (sdCardFs.write(path.c_str(), 0, (const uint8_t*)header.c_str(), header.length())) {
+      Serial.println("Archivo de log preasignado: " + path);
+      return true;
     }
+    SD.remove(path); // Sin cabecera no sirve: se crea como archivo normal
   }
+  File file = SD.open(path, FILE_WRITE);
+  if (!file) {
+    Serial.println("Error al abrir/crear archivo de log: " + path + ". Verifique la tarjeta SD.");
+    return false;
+  }
+  file.print(String(LOG_CSV_HEADER) + "\n"); // Solo '\n', como las líneas de datos
+  file.close();
+  Serial.println("Archivo de log creado/actualizado: " + path);
   return true;
-  // Si el archivo actual es el mismo, no hacemos nada
 }
 
 void saveToSD() {
@@ -281,75 +1014,873 @@ void saveToSD() {
       return;
   }
 
-  File file = SD.open(currentLogFile, FILE_APPEND);
-  if (!file) {
-    Serial.println("Error al abrir archivo para escritura: " + currentLogFile);
+  char timestamp[20];
+  formatTimestamp(clockNow(), timestamp);
+
+  ArchiveDay delta;
+  delta.day = currentLogDayStart;
+  addToArchiveDay(delta, currentDataPoint());
+  uint32_t size;
+  if (!appendLogLines(currentLogDayStart, formatLogLine(timestamp, currentDataPoint()) + "\n", size)) {
+    Serial.println("Error al escribir en " + currentLogFile);
+    sdWriteErrors++;
+    retention.checkNow = true; // Puede ser la tarjeta llena
     return;
   }
+  mergeArchiveDay(delta, size);
 
-  // Formato CSV: hora_fecha, temperatura, humedad, humedad_suelo, nivel_luz
-  String dataLine = getFormattedDateTime() + "," + // Hora y Fecha real
-                   String(sensorData.temperature, 2) + "," + // Temperatura
-                   String(sensorData.humidity, 2) + "," + // Humedad
-                   String(sensorData.soilMoisture) + "," + // Humedad del suelo
-                   String(sensorData.lux, 1);
-  // Nivel de luz
+  Serial.println("Datos guardados en SD: " + String(sensorData.temperature, 1) + "°C at " + timestamp);
+}
 
-  file.println(dataLine);
-  file.close();
+// Formato CSV: hora_fecha, temperatura, humedad, humedad_suelo, nivel_luz, nodo, secuencia, rssi, snr, marcas, crc
+String formatLogLine(const char* timestamp, const DataPoint& point) {
+  char line[LOG_LINE_MAX];
+  writeLogLine(line, sizeof(line), timestamp, point);
+  return String(line);
+}
 
-  Serial.println("Datos guardados en SD: " + String(sensorData.temperature, 1) + "°C at " + getFormattedDateTime());
+// La misma línea (sin '\n') en un búfer del llamador; retorna su longitud, 0 si no cabe. Los float
+// pasan por dtostrf() como String(valor, decimales), así el texto no cambia.
+size_t writeLogLine(char* out, size_t size, const char* timestamp, const DataPoint& point) {
+  char temperature[48], humidity[48], lux[48], seq[24] = ""; // dtostrf() no recorta: hasta 3.4e38
+  dtostrf(point.temperature, 4, 2, temperature);
+  dtostrf(point.humidity, 4, 2, humidity);
+  dtostrf(point.lux, 3, 1, lux);
+  if (point.seq >= 0) snprintf(seq, sizeof(seq), "%ld", (long)point.seq);
+  int length = snprintf(out, size, "%s,%s,%s,%d,%s,%d,%s,%d,%d,%x", timestamp, temperature, humidity,
+                        point.soilMoisture, lux, point.node, seq, point.rssi, point.snr,
+                        point.flags); // Marcas de anomaly_detector.h (0 = lectura normal)
+  if (length < 0 || (size_t)length + 6 > size) { // Sitio para ",xxxx" y el '\0'
+    if (size > 0) out[0] = '\0';
+    return 0;
+  }
+  journalLineCrc(out, length, out + length);
+  return length + 5;
+}
+
+// Añade líneas terminadas en '\n' al archivo del día; size recibe su tamaño final
+bool appendLogLines(time_t dayStart, const String& lines, uint32_t& size) {
+  int64_t start = esp_timer_get_time();
+  bool ok = journalReady ? sdJournal.append(dayStart, lines.c_str(), lines.length(), size)
+                         : sdCardFs.append(logFileForEpoch(dayStart).c_str(), (const uint8_t*)lines.c_str(),
+                                           lines.length(), size);
+  recordWriteLatency(esp_timer_get_time() - start);
+  return ok;
+}
+
+// Prepara LOG_SPARE_FILE a ceros, LOG_PREALLOC_SLICE bytes por vuelta. Escribirlo de seguido en una
+// tarjeta poco fragmentada deja sus clusters contiguos.
+void serviceLogPrealloc() {
+  if (!SD_PREALLOCATE_LOGS || !sdCardAvailable || retention.lowSpace) return;
+  if (spareBytes < 0) {
+    File spare = SD.open(LOG_SPARE_FILE, FILE_READ);
+    spareBytes = spare ? spare.size() : 0;
+    if (spare) spare.close();
+  }
+  if (spareBytes >= (long)LOG_PREALLOC_BYTES) return;
+
+  static const uint8_t zeros[512] = {0};
+  File spare = SD.open(LOG_SPARE_FILE, FILE_APPEND);
+  if (!spare) return;
+  for (uint32_t n = 0; n < LOG_PREALLOC_SLICE && spare.write(zeros, sizeof(zeros)) == sizeof(zeros); n += sizeof(zeros)) {}
+  spareBytes = spare.position();
+  spare.close();
+}
+
+void recordWriteLatency(uint32_t micros) {
+  int bucket = 0;
+  while (bucket < LATENCY_BUCKETS - 1 && micros >= (2u << bucket)) bucket++;
+  logWriteLatency.buckets[bucket]++;
+  logWriteLatency.samples++;
+  logWriteLatency.maxUs = max(logWriteLatency.maxUs, micros);
+}
+
+// Límite superior (µs) del bucket que contiene el percentil pedido
+uint32_t writeLatencyPercentile(float fraction) {
+  unsigned long target = (unsigned long)(fraction * logWriteLatency.samples);
+  unsigned long seen = 0;
+  for (int bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+    seen += logWriteLatency.buckets[bucket];
+    if (seen > target) return min(2u << bucket, logWriteLatency.maxUs);
+  }
+  return logWriteLatency.maxUs;
+}
+
+// Lectura actual en forma de registro de historial
+DataPoint currentDataPoint() {
+  return {sensorData.lastUpdate, sensorData.temperature, sensorData.humidity, sensorData.lux,
+          sensorData.soilMoisture, sensorData.node, sensorData.seq,
+          (int16_t)sensorData.rssi, (int8_t)sensorData.snr, sensorData.flags};
 }
 
 String getFormattedDateTime() {
   if (!timeSynchronized) {
     return "TIME_NOT_SET";
   }
-  // Retorna la fecha y hora en formato YYYY-MM-DD HH:MM:SS
-  time_t epochTime = timeClient.getEpochTime();
-  struct tm *ptm = gmtime ((time_t *)&epochTime); 
-  
   char buffer[20];
-  // Formato YYYY-MM-DD HH:MM:SS
-  sprintf(buffer, "%04d-%02d-%02d %02d:%02d:%02d", 
-          ptm->tm_year + 1900, ptm->tm_mon + 1, ptm->tm_mday,
-          ptm->tm_hour, ptm->tm_min, ptm->tm_sec);
+  formatTimestamp(clockNow(), buffer);
   return String(buffer);
 }
 
+// Ajusta el reloj local a la hora NTP y re-estima la deriva con el intervalo transcurrido
+void syncLocalClock(time_t ntpEpoch) {
+  int64_t nowMicros = esp_timer_get_time();
+
+  if (timeSynchronized) {
+    int64_t elapsedMicros = nowMicros - localClock.baseMicros;
+    // Con resolución de 1 s en NTP, solo se estima la deriva sobre intervalos largos
+    if (elapsedMicros >= 3600LL * 1000000LL) {
+      int64_t expectedMicros = (int64_t)(ntpEpoch - localClock.baseEpoch) * 1000000LL;
+      long measuredPpm = (long)((elapsedMicros - expectedMicros) * 1000000LL / elapsedMicros);
+      measuredPpm = constrain(measuredPpm, -MAX_CLOCK_DRIFT_PPM, MAX_CLOCK_DRIFT_PPM);
+      // Promedio exponencial para suavizar el error de cuantización de NTP
+      localClock.driftPpm = (localClock.driftPpm + measuredPpm) / 2;
+      Serial.printf("Reloj: error de %ld s, deriva estimada %ld ppm\n",
+                    (long)(clockNow() - ntpEpoch), localClock.driftPpm);
+    }
+  }
 
-void initializeLoRa() {
-  LoRaSerial.begin(115200, SERIAL_8N1, LORA_RX, LORA_TX);
-  delay(1000);
-  // Dar tiempo al módulo LoRa para inicializar
+  localClock.baseEpoch = ntpEpoch;
+  localClock.baseMicros = nowMicros;
+  localClock.lastSyncMillis = millis();
+  localClock.dayStart = 0; // Forzar recálculo de la fecha en caché
+  timeSynchronized = true;
+}
+
+// Sincroniza con NTP al conectar y re-sincroniza cada NTP_RESYNC_INTERVAL para corregir la deriva.
+// La respuesta se sondea en cada llamada: un servidor que no responde no detiene la recepción LoRa.
+void serviceNtp() {
+  if (ntpRequest.pending) {
+    time_t epoch;
+    if (readNtpResponse(epoch)) {
+      ntpRequest.pending = false;
+      ntpRequest.failures = 0;
+      bool firstSync = !timeSynchronized;
+      syncLocalClock(epoch);
+      if (!firstSync) {
+        Serial.println("Hora NTP re-sincronizada: " + getFormattedDateTime());
+        return;
+      }
+      Serial.println("Hora NTP sincronizada: " + getFormattedDateTime());
+      // Intentar inicializar el archivo de log si NTP se acaba de sincronizar
+      if (sdCardAvailable) { // Asegurarse que SD esté disponible antes de intentar crear archivo
+          if (!initializeLogFile()) {
+              Serial.println("ADVERTENCIA: No se pudo crear el archivo de log con fecha NTP, intentando sin fecha.");
+          }
+          initializeArchive(); // Antes del volcado: el índice necesita saber qué día es hoy
+          flushPendingRecords(); // Volcar lecturas recibidas antes de la sincronización
+      }
+    } else if (millis() - ntpRequest.sentAt >= NTP_TIMEOUT) {
+      ntpRequest.pending = false;
+      ntpRequest.failures++; // Tras NTP_RESOLVE_AFTER_FAILURES se vuelve a resolver el pool
+      Serial.println(timeSynchronized ? "NTP: Fallo en la re-sincronización, se mantiene el reloj local."
+                                      : "NTP: Sin respuesta, se reintentará.");
+    }
+    return;
+  }
+
+  if (timeSynchronized && millis() - localClock.lastSyncMillis < NTP_RESYNC_INTERVAL) return;
+  if (ntpRequest.lastAttempt != 0 && millis() - ntpRequest.lastAttempt < NTP_RETRY_INTERVAL) return;
+  ntpRequest.lastAttempt = millis();
+  ntpRequest.pending = sendNtpRequest();
+  ntpRequest.sentAt = millis();
+}
 
-  String commands[] = {
-    "AT+RESET",
-    "AT+ADDRESS=" + String(loraConfig.address),
-    "AT+NETWORKID=" + String(loraConfig.networkId),
-    "AT+PARAMETER=12,4,1,7" // Spreading Factor, Bandwidth, Coding Rate, CRC
-  };
-  for (int i = 0; i < 4; i++) {
-    LoRaSerial.println(commands[i]);
-    delay(i == 0 ? 2000 : 500); // Más tiempo para el RESET
-    while (LoRaSerial.available()) { // Limpiar buffer serial LoRa
-      LoRaSerial.read();
+// Petición SNTP (modo cliente, versión 4) al servidor configurado
+bool sendNtpRequest() {
+  bool needResolve = ntpRequest.serverIp == 0 || ntpRequest.failures >= NTP_RESOLVE_AFTER_FAILURES ||
+                     millis() - ntpRequest.lastResolve >= NTP_RESOLVE_INTERVAL;
+  bool canResolve = ntpRequest.lastResolve == 0 || millis() - ntpRequest.lastResolve >= NTP_RESOLVE_RETRY;
+  if (needResolve && canResolve) {
+    ntpRequest.lastResolve = millis();
+    IPAddress address;
+    if (WiFi.hostByName(ntpServer, address)) {
+      ntpRequest.serverIp = address;
+      ntpRequest.failures = 0;
+    } else {
+      Serial.println("NTP: No se pudo resolver " + String(ntpServer) +
+                     (ntpRequest.serverIp != 0 ? ", se mantiene la dirección anterior" : ""));
     }
   }
+  if (ntpRequest.serverIp == 0) return false;
+  uint8_t packet[48] = {0};
+  packet[0] = 0x23; // LI 0, versión 4, modo 3 (cliente)
+  while (ntpUDP.parsePacket() > 0) ntpUDP.flush(); // Respuestas tardías de intentos anteriores
+  if (!ntpUDP.beginPacket(IPAddress(ntpRequest.serverIp), 123)) return false;
+  ntpUDP.write(packet, sizeof(packet));
+  return ntpUDP.endPacket();
+}
+
+// Hora local (con utcOffsetInSeconds) de la respuesta, si ya llegó
+bool readNtpResponse(time_t& epoch) {
+  if (ntpUDP.parsePacket() < 48) return false;
+  uint8_t packet[48];
+  if (ntpUDP.read(packet, sizeof(packet)) < 48) return false;
+  if ((packet[0] & 0x07) != 4 || packet[1] == 0) return false; // Solo respuestas de servidor con estrato
+  uint32_t seconds = (uint32_t)packet[40] << 24 | (uint32_t)packet[41] << 16 | (uint32_t)packet[42] << 8 | packet[43];
+  if (seconds < NTP_UNIX_OFFSET) return false;
+  epoch = (time_t)(seconds - NTP_UNIX_OFFSET) + utcOffsetInSeconds;
+  return true;
+}
+
+// Hora epoch actual según el reloj local corregido por deriva
+time_t clockNow() {
+  int64_t elapsedMicros = esp_timer_get_time() - localClock.baseMicros;
+  elapsedMicros -= elapsedMicros / 1000000LL * localClock.driftPpm;
+  return localClock.baseEpoch + (time_t)(elapsedMicros / 1000000LL);
+}
+
+// Escribe "AAAA-MM-DD HH:MM:SS" en out (mínimo 20 bytes).
+// La fecha del día se cachea; dentro del mismo día solo se calculan horas, minutos y segundos.
+void formatTimestamp(time_t epochTime, char* out) {
+  if (localClock.dayStart == 0 || epochTime < localClock.dayStart || epochTime >= localClock.dayStart + SECONDS_PER_DAY) {
+    localClock.dayStart = epochTime - epochTime % SECONDS_PER_DAY;
+    struct tm *ptm = gmtime(&localClock.dayStart);
+    sprintf(localClock.datePrefix, "%04d-%02d-%02d ", ptm->tm_year + 1900, ptm->tm_mon + 1, ptm->tm_mday);
+  }
+
+  uint32_t secondsOfDay = epochTime - localClock.dayStart;
+  uint32_t hours = secondsOfDay / 3600;
+  uint32_t minutes = (secondsOfDay / 60) % 60;
+  uint32_t seconds = secondsOfDay % 60;
+
+  memcpy(out, localClock.datePrefix, 11);
+  out[11] = '0' + hours / 10;   out[12] = '0' + hours % 10;   out[13] = ':';
+  out[14] = '0' + minutes / 10; out[15] = '0' + minutes % 10; out[16] = ':';
+  out[17] = '0' + seconds / 10; out[18] = '0' + seconds % 10; out[19] = '\0';
+}
+
+// Guarda una lectura en la cola en RAM mientras no hay hora NTP.
+// Si la cola se llena se sobrescribe la lectura más antigua.
+void queuePendingRecord(const DataPoint& point) {
+  if (pendingCount == MAX_PENDING_RECORDS) {
+    pendingDropped++;
+  }
+  pendingRecords[pendingIndex] = point;
+  pendingIndex = (pendingIndex + 1) % MAX_PENDING_RECORDS;
+  if (pendingCount < MAX_PENDING_RECORDS) pendingCount++;
+  Serial.println("Hora no sincronizada: lectura en cola (" + String(pendingCount) + "/" + String(MAX_PENDING_RECORDS) + ")");
+}
+
+// Convierte las marcas millis() de la cola a hora real y las escribe en sus archivos diarios.
+void flushPendingRecords() {
+  if (pendingCount == 0 || !timeSynchronized) return;
+
+  int written = 0;
+  if (sdCardAvailable) {
+    written = writeRecordsToSD([](int i) -> const DataPoint& {
+      return pendingRecords[(pendingIndex - pendingCount + i + MAX_PENDING_RECORDS) % MAX_PENDING_RECORDS];
+    }, pendingCount);
+  }
+  pendingRetry.lastAttempt = millis();
+  if (written < pendingCount) {
+    pendingRetry.delay = pendingRetry.delay == 0 ? PENDING_RETRY_MIN : min(pendingRetry.delay * 2, PENDING_RETRY_MAX);
+    Serial.println("Cola previa a NTP: " + String(pendingCount - written) + " lecturas sin escribir, reintento en " +
+                   String(pendingRetry.delay / 1000) + " s");
+  } else {
+    pendingRetry.delay = 0;
+  }
+  if (written == 0) return;
+
+  Serial.println("Cola previa a NTP volcada en SD: " + String(written) + " lecturas" +
+                 (pendingDropped > 0 ? " (" + String(pendingDropped) + " descartadas por cola llena)" : ""));
+  // Se publican las ya escritas; las demás (fallo de SD) se conservan para el siguiente intento
+  time_t nowEpoch = clockNow();
+  for (int i = 0; i < written; i++) {
+    const DataPoint& record = pendingRecords[(pendingIndex - pendingCount + i + MAX_PENDING_RECORDS) % MAX_PENDING_RECORDS];
+    publishReading(nowEpoch - (time_t)((millis() - record.timestamp) / 1000), record);
+  }
+  pendingCount -= written;
+  pendingDropped = 0;
+}
+
+// Las lecturas que no se pudieron escribir siguen en la cola hasta que la SD responda
+void servicePendingRecords() {
+  if (pendingCount == 0 || !timeSynchronized) return;
+  if (millis() - pendingRetry.lastAttempt < pendingRetry.delay) return;
+  flushPendingRecords();
+}
+
+// Escribe registros con marca millis() en los archivos diarios que les corresponden.
+// Los registros consecutivos de un mismo día se agrupan en un único print() por archivo.
+// Retorna cuántos registros (desde el primero) quedaron escritos.
+int writeRecordsToSD(const DataPoint& (*recordAt)(int), int count) {
+  time_t nowEpoch = clockNow();
+  unsigned long nowMillis = millis();
+  int written = 0;
+
+  int i = 0;
+  while (i < count) {
+    time_t firstEpoch = nowEpoch - (time_t)((nowMillis - recordAt(i).timestamp) / 1000);
+    time_t dayStart = firstEpoch - firstEpoch % SECONDS_PER_DAY;
+    String path = logFileForEpoch(firstEpoch);
+    String batch = "";
+    ArchiveDay delta;
+    delta.day = dayStart;
+
+    // Acumular las lecturas consecutivas que caen en el mismo archivo diario
+    while (i < count) {
+      const DataPoint& rec = recordAt(i);
+      time_t recEpoch = nowEpoch - (time_t)((nowMillis - rec.timestamp) / 1000);
+      if (recEpoch < dayStart || recEpoch >= dayStart + SECONDS_PER_DAY) break;
+      char timestamp[20];
+      formatTimestamp(recEpoch, timestamp);
+      batch += formatLogLine(timestamp, rec) + "\n";
+      addToArchiveDay(delta, rec);
+      i++;
+    }
+
+    if (!ensureLogFile(path, path == currentLogFile)) break;
+    uint32_t size;
+    if (!appendLogLines(dayStart, batch, size)) {
+      Serial.println("Error al escribir en " + path);
+      sdWriteErrors++;
+      retention.checkNow = true;
+      break;
+    }
+    mergeArchiveDay(delta, size);
+    written = i;
+  }
+  return written;
+}
+
+
+// Carga la entrada de hoy del índice. Sin índice se reconstruye entero; si el archivo de hoy no
+// mide lo que dice el índice (lecturas escritas después del último guardado) se recuenta solo ese.
+void initializeArchive() {
+  if (!sdCardAvailable || !timeSynchronized) return;
+  time_t now = clockNow();
+  uint32_t today = now - now % SECONDS_PER_DAY;
+  String todayFile = logFileForEpoch(now);
+
+  // Corte entre borrar el índice y renombrar su copia completa
+  if (!SD.exists(ARCHIVE_INDEX_FILE) && SD.exists(ARCHIVE_INDEX_TMP) &&
+      sdCardFs.size(ARCHIVE_INDEX_TMP) % sizeof(ArchiveDay) == 0 && SD.rename(ARCHIVE_INDEX_TMP, ARCHIVE_INDEX_FILE)) {
+    Serial.println("Índice del archivo recuperado de " + String(ARCHIVE_INDEX_TMP));
+  }
+
+  if (!SD.exists(ARCHIVE_INDEX_FILE)) {
+    Serial.println("Índice del archivo ausente: reconstruyendo desde /data");
+    archiveToday = ArchiveDay();
+    archiveToday.day = today;
+    startArchiveScan("");
+    return;
+  }
+
+  if (!readArchiveDay(today, archiveToday)) {
+    archiveToday = ArchiveDay();
+    archiveToday.day = today;
+  }
+  long size = sdCardFs.size(todayFile.c_str());
+  if (size < 0) size = 0;
+  if ((uint32_t)size != archiveToday.size) {
+    Serial.println("Índice desactualizado para " + todayFile + ": recontando");
+    startArchiveScan(todayFile);
+  }
+}
+
+// Las lecturas sospechosas cuentan en records pero no en mínimo/máximo (mínimo > máximo = sin datos)
+void addToArchiveDay(ArchiveDay& entry, const DataPoint& point) {
+  const float values[ALERT_SENSORS] = {point.temperature, point.humidity, point.lux, (float)point.soilMoisture};
+  for (int s = 0; s < ALERT_SENSORS; s++) {
+    bool suspect = anomalySuspect(point.flags, s);
+    float low = suspect ? INFINITY : values[s], high = suspect ? -INFINITY : values[s];
+    entry.minValue[s] = entry.records == 0 ? low : min(entry.minValue[s], low);
+    entry.maxValue[s] = entry.records == 0 ? high : max(entry.maxValue[s], high);
+  }
+  entry.records++;
+}
+
+// Suma al índice las lecturas recién escritas en el archivo de delta.day
+void mergeArchiveDay(const ArchiveDay& delta, uint32_t fileSize) {
+  // El día que se está recontando ya incluye lo que se acaba de añadir al archivo
+  if (archiveScan.active && archiveScan.file && archiveScan.entry.day == delta.day) return;
+
+  ArchiveDay entry;
+  if (delta.day > archiveToday.day) { // Cambio de día: el anterior queda cerrado en la SD
+    if (archiveToday.day != 0 && archiveToday.records > 0) writeArchiveDay(archiveToday);
+    archiveToday = ArchiveDay();
+    archiveToday.day = delta.day;
+  }
+  bool today = delta.day == archiveToday.day;
+  if (today) {
+    entry = archiveToday;
+  } else if (!readArchiveDay(delta.day, entry)) { // Lecturas atrasadas de un día anterior
+    entry = ArchiveDay();
+    entry.day = delta.day;
+  }
+
+  for (int s = 0; s < ALERT_SENSORS; s++) {
+    entry.minValue[s] = entry.records == 0 ? delta.minValue[s] : min(entry.minValue[s], delta.minValue[s]);
+    entry.maxValue[s] = entry.records == 0 ? delta.maxValue[s] : max(entry.maxValue[s], delta.maxValue[s]);
+  }
+  entry.records += delta.records;
+  entry.size = fileSize;
+
+  if (today) {
+    archiveToday = entry;
+    archiveTodayDirty = true;
+  } else {
+    writeArchiveDay(entry);
+  }
+}
+
+// Busca desde el final: casi todas las consultas y actualizaciones son de días recientes
+bool readArchiveDay(uint32_t day, ArchiveDay& entry) {
+  File file = SD.open(ARCHIVE_INDEX_FILE, FILE_READ);
+  if (!file) return false;
+  bool found = false;
+  ArchiveDay candidate;
+  for (long i = (long)(file.size() / sizeof(ArchiveDay)) - 1; i >= 0 && !found; i--) {
+    file.seek(i * sizeof(ArchiveDay));
+    found = file.read((uint8_t*)&candidate, sizeof(ArchiveDay)) == sizeof(ArchiveDay) && candidate.day == day;
+  }
+  file.close();
+  if (found) entry = candidate;
+  return found;
+}
+
+// Reescribe el registro del día en su sitio o lo añade al final
+void writeArchiveDay(const ArchiveDay& entry) {
+  File file = SD.open(ARCHIVE_INDEX_FILE, SD.exists(ARCHIVE_INDEX_FILE) ? "r+" : "w");
+  if (!file) {
+    Serial.println("Error al abrir " + String(ARCHIVE_INDEX_FILE));
+    return;
+  }
+  long count = file.size() / sizeof(ArchiveDay);
+  long slot = count;
+  ArchiveDay existing;
+  for (long i = count - 1; i >= 0; i--) {
+    file.seek(i * sizeof(ArchiveDay));
+    if (file.read((uint8_t*)&existing, sizeof(ArchiveDay)) == sizeof(ArchiveDay) && existing.day == entry.day) {
+      slot = i;
+      break;
+    }
+  }
+  file.seek(slot * sizeof(ArchiveDay));
+  file.write((const uint8_t*)&entry, sizeof(ArchiveDay));
+  file.close();
+}
+
+// path vacío = todos los archivos de /data (el índice se crea de nuevo)
+void startArchiveScan(const String& path) {
+  if (archiveScan.file) archiveScan.file.close();
+  if (archiveScan.root) archiveScan.root.close();
+  archiveScan = ArchiveScan();
+  archiveScan.allFiles = path.length() == 0;
+  if (archiveScan.allFiles) {
+    SD.remove(ARCHIVE_INDEX_FILE);
+    SD.remove(ARCHIVE_INDEX_TMP); // Una copia vieja no debe sustituir al índice que se reconstruye
+    archiveScan.root = SD.open("/data");
+    if (!archiveScan.root) return;
+  } else {
+    archiveScan.file = SD.open(path, FILE_READ);
+    if (!archiveScan.file) return;
+    archiveScan.limit = sdCardFs.size(path.c_str());
+    archiveScan.entry.day = parseDateArg(path.substring(path.indexOf('_') + 1));
+    archiveScan.file.readStringUntil('\n'); // Cabecera
+  }
+  archiveScan.active = true;
+}
+
+// En cada vuelta de loop(): guarda el día en curso si toca y avanza la reconstrucción unas líneas
+void serviceArchive() {
+  if (archiveTodayDirty && millis() - lastArchiveSave >= ARCHIVE_SAVE_INTERVAL) {
+    writeArchiveDay(archiveToday);
+    archiveTodayDirty = false;
+    lastArchiveSave = millis();
+  }
+  if (!archiveScan.active) return;
+
+  if (!archiveScan.file) { // Siguiente archivo diario del directorio
+    File next = archiveScan.root.openNextFile();
+    while (next) {
+      String name = next.name();
+      name = name.substring(name.lastIndexOf('/') + 1);
+      if (!next.isDirectory() && name.startsWith("sensors_") && name.endsWith(".csv")) break;
+      next = archiveScan.root.openNextFile();
+    }
+    if (!next) {
+      archiveScan.root.close();
+      archiveScan.active = false;
+      readArchiveDay(archiveToday.day, archiveToday);
+      Serial.println("Índice del archivo reconstruido");
+      return;
+    }
+    String name = next.name();
+    archiveScan.entry = ArchiveDay();
+    archiveScan.entry.day = parseDateArg(name.substring(name.lastIndexOf('_') + 1));
+    archiveScan.file = next;
+    archiveScan.limit = sdCardFs.size(("/data/" + name.substring(name.lastIndexOf('/') + 1)).c_str());
+    archiveScan.file.readStringUntil('\n'); // Cabecera
+    return;
+  }
+
+  // Columnas: timestamp,temperature,humidity,soil_moisture,lux,...
+  for (int n = 0; n < ARCHIVE_SCAN_LINES && archiveScan.file.position() < archiveScan.limit; n++) {
+    String line = archiveScan.file.readStringUntil('\n');
+    int c1 = line.indexOf(','), c2 = line.indexOf(',', c1 + 1), c3 = line.indexOf(',', c2 + 1);
+    int c4 = line.indexOf(',', c3 + 1), c5 = line.indexOf(',', c4 + 1);
+    if (c1 < 0 || c2 < 0 || c3 < 0 || c4 < 0) continue;
+    DataPoint point = {};
+    point.temperature = line.substring(c1 + 1, c2).toFloat();
+    point.humidity = line.substring(c2 + 1, c3).toFloat();
+    point.soilMoisture = line.substring(c3 + 1, c4).toInt();
+    point.lux = (c5 < 0 ? line.substring(c4 + 1) : line.substring(c4 + 1, c5)).toFloat();
+    point.flags = logLineFlags(line);
+    addToArchiveDay(archiveScan.entry, point);
+  }
+  if (archiveScan.file.position() < archiveScan.limit) return;
+
+  archiveScan.entry.size = archiveScan.limit;
+  archiveScan.file.close();
+  if (archiveScan.entry.day == archiveToday.day) {
+    archiveToday = archiveScan.entry;
+    archiveTodayDirty = false;
+  }
+  writeArchiveDay(archiveScan.entry);
+  if (!archiveScan.allFiles) {
+    archiveScan.active = false;
+    Serial.println("Índice del día recontado: " + String(archiveScan.entry.records) + " lecturas");
+  }
+}
+
+// Reescribe el índice sin los días del intervalo (sus archivos ya no existen). Con rolledUpOnly solo
+// se quitan los ya resumidos (size 0): los días crudos del mismo intervalo siguen en la SD.
+void removeArchiveDays(uint32_t fromDay, uint32_t toDay, bool rolledUpOnly) {
+  File source = SD.open(ARCHIVE_INDEX_FILE, FILE_READ);
+  File target = SD.open(ARCHIVE_INDEX_TMP, FILE_WRITE);
+  if (!source || !target) {
+    if (source) source.close();
+    if (target) target.close();
+    return;
+  }
+  ArchiveDay entry;
+  bool complete = true;
+  while (source.read((uint8_t*)&entry, sizeof(ArchiveDay)) == sizeof(ArchiveDay)) {
+    bool removed = entry.day >= fromDay && entry.day <= toDay && (!rolledUpOnly || entry.size == 0);
+    if (!removed && target.write((const uint8_t*)&entry, sizeof(ArchiveDay)) != sizeof(ArchiveDay)) complete = false;
+  }
+  source.close();
+  target.close();
+  if (!complete) { // SD llena: se conserva el índice anterior
+    SD.remove(ARCHIVE_INDEX_TMP);
+    sdWriteErrors++;
+    return;
+  }
+  // La copia ya está completa en la SD: un corte aquí se recupera en initializeArchive()
+  SD.remove(ARCHIVE_INDEX_FILE);
+  SD.rename(ARCHIVE_INDEX_TMP, ARCHIVE_INDEX_FILE);
+}
+
+int sdFreePercent() {
+  uint64_t total = SD.totalBytes();
+  return total > 0 ? (int)((total - SD.usedBytes()) * 100 / total) : 0;
+}
+
+// /data/hourly_AAAA-MM.csv del mes de un instante
+String hourlyFileForEpoch(time_t epochTime) {
+  struct tm *ptm = gmtime(&epochTime);
+  char buffer[28];
+  sprintf(buffer, "/data/hourly_%04d-%02d.csv", ptm->tm_year + 1900, ptm->tm_mon + 1);
+  return String(buffer);
+}
+
+void serviceRetention() {
+  if (!sdCardAvailable || !timeSynchronized || archiveScan.active) return; // El índice debe estar completo
+  if (!retention.recovered) {
+    retention.recovered = true;
+    recoverRollup();
+  }
+  if (retention.active) {
+    continueRollup();
+    return;
+  }
+  if (!retention.checkNow && millis() - retention.lastCheck < RETENTION_CHECK_INTERVAL) return;
+  retention.checkNow = false;
+  retention.lastCheck = millis();
+
+  int freePercent = sdFreePercent();
+  if (freePercent < RETENTION_LOW_FREE_PERCENT && !retention.lowSpace) {
+    Serial.println("SD con " + String(freePercent) + "% libre: liberando espacio");
+    retention.lowSpace = true;
+  } else if (freePercent >= RETENTION_OK_FREE_PERCENT) {
+    retention.lowSpace = false;
+  }
+
+  // Día crudo más antiguo según el índice (nunca el de hoy)
+  uint32_t oldestRaw = 0;
+  File index = SD.open(ARCHIVE_INDEX_FILE, FILE_READ);
+  ArchiveDay entry;
+  while (index && index.read((uint8_t*)&entry, sizeof(ArchiveDay)) == sizeof(ArchiveDay)) {
+    if (entry.size > 0 && entry.day < archiveToday.day && (oldestRaw == 0 || entry.day < oldestRaw)) oldestRaw = entry.day;
+  }
+  if (index) index.close();
+
+  bool expired = oldestRaw > 0 && oldestRaw + RAW_RETENTION_DAYS * SECONDS_PER_DAY <= archiveToday.day;
+  if (expired || (retention.lowSpace && oldestRaw > 0)) {
+    startRollup(oldestRaw);
+  } else if (retention.lowSpace && !deleteOldestHourlyMonth()) {
+    Serial.println("ADVERTENCIA: SD casi llena y sin datos antiguos que borrar");
+  }
+}
+
+void startRollup(uint32_t day) {
+  String path = logFileForEpoch(day);
+  retention.file = SD.open(path, FILE_READ);
+  if (!retention.file) { // El índice apunta a un archivo borrado a mano
+    removeArchiveDays(day, day, false);
+    retention.checkNow = true;
+    return;
+  }
+  retention.limit = sdCardFs.size(path.c_str());
+  retention.file.readStringUntil('\n'); // Cabecera
+  retention.day = day;
+  retention.nodeCount = 0;
+  memset(rollupCells, 0, sizeof(rollupCells));
+  retention.active = true;
+  Serial.println("Resumiendo " + path + " en " + hourlyFileForEpoch(day));
+}
+
+// Columnas: timestamp,temperature,humidity,soil_moisture,lux,node,...; los archivos antiguos sin
+// columna node cuentan como nodo 0
+void continueRollup() {
+  for (int n = 0; n < RETENTION_SLICE_LINES && retention.file.position() < retention.limit; n++) {
+    String line = retention.file.readStringUntil('\n');
+    int commas[6];
+    int found = 0;
+    for (int from = 0; found < 6; found++) {
+      commas[found] = line.indexOf(',', from);
+      if (commas[found] < 0) break;
+      from = commas[found] + 1;
+    }
+    if (found < 4 || line.length() < 13) continue;
+
+    int hour = line.substring(11, 13).toInt();
+    if (hour < 0 || hour > 23) continue;
+    int node = found >= 5 ? line.substring(commas[4] + 1, found >= 6 ? commas[5] : line.length()).toInt() : 0;
+    int column = 0;
+    while (column < retention.nodeCount && retention.nodes[column] != node) column++;
+    if (column == retention.nodeCount) {
+      if (retention.nodeCount == MAX_NODES) continue;
+      retention.nodes[retention.nodeCount++] = node;
+    }
+
+    const float values[ALERT_SENSORS] = {
+        line.substring(commas[0] + 1, commas[1]).toFloat(),                                   // temperature
+        line.substring(commas[1] + 1, commas[2]).toFloat(),                                   // humidity
+        (found >= 5 ? line.substring(commas[3] + 1, commas[4]) : line.substring(commas[3] + 1)).toFloat(), // lux
+        line.substring(commas[2] + 1, commas[3]).toFloat()};                                  // soil_moisture
+    uint16_t flags = logLineFlags(line);
+    RollupCell& cell = rollupCells[hour][column];
+    for (int s = 0; s < ALERT_SENSORS; s++) {
+      if (anomalySuspect(flags, s)) continue; // El resumen horario solo lleva lecturas normales
+      cell.minValue[s] = cell.valid[s] == 0 ? values[s] : min(cell.minValue[s], values[s]);
+      cell.maxValue[s] = cell.valid[s] == 0 ? values[s] : max(cell.maxValue[s], values[s]);
+      cell.sum[s] += values[s];
+      cell.valid[s]++;
+    }
+    cell.samples++;
+  }
+  if (retention.file.position() < retention.limit) return;
+
+  retention.file.close();
+  retention.active = false;
+  retention.checkNow = true; // Seguir con el siguiente día pendiente en la próxima vuelta
+  if (!finishRollup()) {
+    Serial.println("Error al escribir el resumen horario; el archivo diario se conserva");
+    sdWriteErrors++;
+    retention.lastCheck = millis();
+    retention.checkNow = false; // Reintentar en la próxima revisión
+  }
+}
+
+// Añade las filas horarias del día al archivo del mes y solo entonces borra el archivo crudo
+bool finishRollup() {
+  String rows = "";
+  char prefix[12];
+  time_t day = retention.day;
+  struct tm *ptm = gmtime(&day);
+  sprintf(prefix, "%04d-%02d-%02d ", ptm->tm_year + 1900, ptm->tm_mon + 1, ptm->tm_mday);
+  for (int hour = 0; hour < 24; hour++) {
+    for (int column = 0; column < retention.nodeCount; column++) {
+      const RollupCell& cell = rollupCells[hour][column];
+      if (cell.samples == 0) continue;
+      char hourText[4];
+      sprintf(hourText, "%02d", hour);
+      rows += String(prefix) + hourText + ":00:00," + String(retention.nodes[column]) + "," + String(cell.samples);
+      for (int s : {ALERT_TEMP, ALERT_HUM, ALERT_LUX, ALERT_SOIL}) {
+        if (cell.valid[s] == 0) { // Toda la hora marcada como sospechosa: campos vacíos
+          rows += ",,,";
+          continue;
+        }
+        rows += "," + String(cell.minValue[s], 2) + "," + String(cell.maxValue[s], 2) + "," +
+                String(cell.sum[s] / cell.valid[s], 2);
+      }
+      rows += "\n";
+    }
+  }
+
+  String hourlyPath = hourlyFileForEpoch(retention.day);
+  bool exists = SD.exists(hourlyPath);
+  long before = exists ? sdCardFs.size(hourlyPath.c_str()) : 0;
+  if (before < 0) return false;
+
+  // Marca antes de tocar el archivo horario (ver ROLLUP_MARKER_FILE)
+  RollupMarker marker = {ROLLUP_MARKER_MAGIC, retention.day, (uint32_t)before};
+  File markerFile = SD.open(ROLLUP_MARKER_FILE, FILE_WRITE);
+  if (!markerFile) return false;
+  bool marked = markerFile.write((const uint8_t*)&marker, sizeof(marker)) == sizeof(marker);
+  markerFile.close();
+  if (!marked) {
+    SD.remove(ROLLUP_MARKER_FILE);
+    return false;
+  }
+
+  File file = SD.open(hourlyPath, FILE_APPEND);
+  size_t expected = rows.length() + (exists ? 0 : strlen(HOURLY_CSV_HEADER) + 2);
+  size_t written = 0;
+  if (file) {
+    written = exists ? 0 : file.println(HOURLY_CSV_HEADER);
+    written += file.print(rows);
+    file.close();
+  }
+  if (written != expected) { // Sin filas a medias: el día se vuelve a intentar completo
+    undoHourlyAppend(hourlyPath, before);
+    SD.remove(ROLLUP_MARKER_FILE);
+    return false;
+  }
+
+  SD.remove(logFileForEpoch(retention.day));
+  ArchiveDay entry;
+  if (readArchiveDay(retention.day, entry)) {
+    entry.size = 0; // Resumido: sigue en el índice con sus mínimos y máximos
+    writeArchiveDay(entry);
+  }
+  SD.remove(ROLLUP_MARKER_FILE);
+  retention.daysRolledUp++;
+  Serial.println("Día resumido en " + hourlyPath + " (" + String(rows.length()) + " bytes)");
+  return true;
+}
+
+// Resumen cortado por un reinicio. Con el archivo crudo aún en la SD las filas horarias pueden estar a
+// medias: se quitan y el día se resume otra vez. Sin él, las filas están completas y solo falta el índice.
+void recoverRollup() {
+  File file = SD.open(ROLLUP_MARKER_FILE, FILE_READ);
+  if (!file) return;
+  RollupMarker marker;
+  bool valid = file.read((uint8_t*)&marker, sizeof(marker)) == sizeof(marker) && marker.magic == ROLLUP_MARKER_MAGIC;
+  file.close();
+  if (valid) { // Una marca incompleta se escribió antes de tocar el archivo horario: nada que deshacer
+    if (SD.exists(logFileForEpoch(marker.day))) {
+      undoHourlyAppend(hourlyFileForEpoch(marker.day), marker.hourlyOffset);
+      Serial.println("Resumen interrumpido de " + logFileForEpoch(marker.day) + ": filas horarias descartadas");
+    } else {
+      ArchiveDay entry;
+      if (readArchiveDay(marker.day, entry)) {
+        entry.size = 0;
+        writeArchiveDay(entry);
+      }
+    }
+  }
+  SD.remove(ROLLUP_MARKER_FILE);
+}
+
+// Deja el archivo horario como estaba antes de añadir un día (offset 0: no existía)
+void undoHourlyAppend(const String& hourlyPath, uint32_t offset) {
+  if (offset == 0) {
+    SD.remove(hourlyPath);
+  } else if (sdCardFs.size(hourlyPath.c_str()) > (long)offset) {
+    ::truncate((String(SD_MOUNT_POINT) + hourlyPath).c_str(), offset);
+  }
+}
+
+// Borra el mes horario más antiguo y sus días resumidos del índice; false si no queda ninguno.
+// Los días del mes que aún están en crudo se conservan y se resumirán en un archivo horario nuevo.
+bool deleteOldestHourlyMonth() {
+  uint32_t oldest = 0;
+  File index = SD.open(ARCHIVE_INDEX_FILE, FILE_READ);
+  ArchiveDay entry;
+  while (index && index.read((uint8_t*)&entry, sizeof(ArchiveDay)) == sizeof(ArchiveDay)) {
+    if (entry.size == 0 && (oldest == 0 || entry.day < oldest)) oldest = entry.day;
+  }
+  if (index) index.close();
+  if (oldest == 0) return false;
+
+  // Límites del mes en la misma base que el índice (medianoches por gmtime, sin mktime ni zona horaria)
+  static const uint8_t DAYS_IN_MONTH[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+  time_t oldestEpoch = oldest;
+  struct tm *month = gmtime(&oldestEpoch);
+  int year = month->tm_year + 1900;
+  bool leap = year % 4 == 0 && (year % 100 != 0 || year % 400 == 0);
+  int days = DAYS_IN_MONTH[month->tm_mon] + (month->tm_mon == 1 && leap ? 1 : 0);
+  uint32_t monthStart = oldest - (month->tm_mday - 1) * SECONDS_PER_DAY;
+  uint32_t monthEnd = monthStart + (days - 1) * SECONDS_PER_DAY;
+
+  String path = hourlyFileForEpoch(oldest);
+  SD.remove(path);
+  removeArchiveDays(monthStart, monthEnd, true);
+  retention.monthsDeleted++;
+  retention.checkNow = true; // Volver a medir el espacio libre
+  Serial.println("Espacio bajo: borrado " + path);
+  return true;
+}
+
+void initializeLoRa() {
+  // Tasa acordada con los nodos antes del último reinicio
+  adrState.rate = constrain(preferences.getInt("adrRate", ADR_DEFAULT_RATE), 0, ADR_RATE_COUNT - 1);
+
+  // Una trama larga ocupa ~270 bytes: con el búfer por defecto (256) se perderían bytes
+  // si loop() tarda en volver a leer el puerto
+  LoRaSerial.setRxBufferSize(1024);
+  LoRaSerial.begin(115200, SERIAL_8N1, LORA_RX, LORA_TX);
+  lora.onFrame(handleLoRaFrame);
+
+  // El RESET termina con +READY; cada comando espera su respuesta en lugar de un retardo fijo
+  lora.send("AT+RESET", 3000, onLoRaCommand);
+  lora.send(("AT+ADDRESS=" + String(loraConfig.address)).c_str(), 500, onLoRaCommand);
+  lora.send(("AT+NETWORKID=" + String(loraConfig.networkId)).c_str(), 500, onLoRaCommand);
+  applyLoRaRate(adrState.rate); // Spreading Factor, Bandwidth, Coding Rate, Preámbulo
+  waitLoRaIdle(5000);
 
   Serial.println("LoRa configurado como receptor");
 }
 
+// Atiende el módulo hasta vaciar la cola de comandos (solo en el arranque)
+void waitLoRaIdle(unsigned long maxMs) {
+  unsigned long start = millis();
+  while (!lora.idle() && millis() - start < maxMs) {
+    lora.poll();
+    delay(1);
+  }
+}
+
+void onLoRaCommand(const char* command, int result) {
+  if (result == RYLR_OK) return;
+  Serial.println("LoRa: " + String(command) + (result == RYLR_TIMEOUT ? " sin respuesta" : " -> +ERR=" + String(result)));
+}
+
 void initializeWiFi() {
+  WiFi.persistent(false);       // Credenciales y caché van a nuestro NVS; begin() no escribe en flash
+  WiFi.setAutoReconnect(false); // La reconexión la lleva checkWiFiConnection()
+  WiFi.mode(WIFI_STA);
   loadWiFiCredentials();
-  if (ssid.length() > 0) {
-    Serial.println("Intentando conectar con credenciales guardadas...");
-    connectToWiFi();
+  if (ssid.length() == 0) {
+    Serial.println("Configuración WiFi necesaria");
+    startPortal();
+    return;
   }
 
+  Serial.println("Intentando conectar con credenciales guardadas...");
+  beginWiFiConnect(true);
+  // La conexión con la caché tarda cientos de ms: se espera un poco para arrancar ya con red
+  unsigned long start = millis();
+  while (!wifiConnected && millis() - start < WIFI_BOOT_WAIT) {
+    delay(20);
+    checkWiFiConnection();
+  }
   if (!wifiConnected) {
-    Serial.println("Configuración WiFi necesaria");
-    requestWiFiCredentials();
+    Serial.println("WiFi aún sin conexión; se sigue intentando en segundo plano");
   }
 }
 
@@ -359,72 +1890,343 @@ void loadWiFiCredentials() {
 
   if (ssid.length() > 0) {
     Serial.println("Credenciales WiFi encontradas");
+    if (loadConfigBlob(preferences, WIFI_CACHE_KEY, WIFI_CACHE_VERSION, wifiCache) > 0 && wifiCache.channel != 0) {
+      Serial.println("Caché WiFi: canal " + String(wifiCache.channel) + ", IP " + IPAddress(wifiCache.ip).toString());
+    }
   }
 }
 
-void requestWiFiCredentials() {
-  Serial.println("\n=== CONFIGURACIÓN WIFI ===");
-  Serial.print("SSID: ");
-  while (!Serial.available()) delay(100);
-  ssid = Serial.readStringUntil('\n');
-  ssid.trim();
+// Lanza un intento de conexión y vuelve enseguida; checkWiFiConnection() sigue su resultado
+void beginWiFiConnect(bool fast) {
+  fast = fast && wifiCache.channel != 0;
+  WiFi.disconnect(); // Cancela el intento anterior o la conexión a otra red
+  if (fast && WIFI_CACHE_STATIC_IP && wifiCache.ip != 0) {
+    WiFi.config(IPAddress(wifiCache.ip), IPAddress(wifiCache.gateway), IPAddress(wifiCache.subnet), IPAddress(wifiCache.dns));
+  } else {
+    WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE); // DHCP
+  }
+  if (fast) {
+    WiFi.begin(ssid.c_str(), password.c_str(), wifiCache.channel, wifiCache.bssid);
+  } else {
+    WiFi.begin(ssid.c_str(), password.c_str());
+  }
+  wifiAttempt.startedAt = millis();
+  wifiAttempt.fast = fast;
+  wifiAttempt.active = true;
+  Serial.println("Conectando a " + ssid + (fast ? " (caché)" : " (búsqueda completa)"));
+}
 
-  Serial.print("Password: ");
-  while (!Serial.available()) delay(100);
-  password = Serial.readStringUntil('\n');
-  password.trim();
+// Sin bucles de espera: el intento de reconexión sigue en segundo plano mientras loop() atiende la
+// radio, y se repite cada WIFI_RETRY_INTERVAL hasta que vuelve la red
+void checkWiFiConnection() {
+  bool connected = WiFi.status() == WL_CONNECTED;
+  // Justo tras cambiar de red el estado puede ser aún el de la conexión anterior
+  if (portal.credentialsPending && millis() - portal.credentialsAt < WIFI_CREDENTIALS_SETTLE) connected = false;
+  if (!connected && portal.credentialsPending && millis() - portal.credentialsAt >= WIFI_CREDENTIALS_TIMEOUT) {
+    revertWiFiCredentials();
+  }
+  if (connected && !wifiConnected) {
+    onWiFiOnline();
+  } else if (!connected && wifiConnected) {
+    Serial.println("WiFi desconectado. Reintentando en segundo plano...");
+    wifiConnected = false;
+    wifiStats.outages++;
+    wifiStats.outageActive = true;
+    wifiStats.outageStart = millis();
+    linkTotals(wifiStats.readingsAtOutage, wifiStats.lostAtOutage);
+    beginWiFiConnect(true); // El AP suele volver en el mismo canal
+  } else if (!connected && ssid.length() > 0) {
+    unsigned long elapsed = millis() - wifiAttempt.startedAt;
+    if (wifiAttempt.active && wifiAttempt.fast && elapsed >= WIFI_FAST_TIMEOUT) {
+      wifiStats.fastFailures++;
+      Serial.println("Sin respuesta con la caché WiFi: búsqueda completa");
+      beginWiFiConnect(false);
+    } else if (!wifiAttempt.active || elapsed >= WIFI_RETRY_INTERVAL) {
+      beginWiFiConnect(true);
+    }
+  }
 
-  if (connectToWiFi()) {
+  // Demasiado tiempo sin red (credenciales viejas, red cambiada): el portal se abre también
+  unsigned long offlineSince = wifiStats.outageActive ? wifiStats.outageStart : 0;
+  if (!wifiConnected && !portal.active && (wifiStats.bootToOnlineMs == 0 || wifiStats.outageActive) &&
+      millis() - offlineSince >= WIFI_PORTAL_AFTER) {
+    startPortal();
+  }
+}
+
+// Las credenciales del portal no conectaron: se vuelve a la red anterior (o a ninguna la primera vez)
+void revertWiFiCredentials() {
+  Serial.println("Sin conexión a " + ssid + " en " + String(WIFI_CREDENTIALS_TIMEOUT / 1000) +
+                 " s: se vuelve a la red anterior");
+  ssid = portal.previousSsid;
+  password = portal.previousPassword;
+  wifiCache = portal.previousCache;
+  portal.credentialsPending = false;
+  portal.credentialsFailed = true;
+  if (ssid.length() > 0) {
+    beginWiFiConnect(true);
+  } else {
+    WiFi.disconnect();
+    wifiAttempt.active = false;
+  }
+}
+
+// Tiempo hasta tener IP, balance del corte si lo hubo y, la primera vez, NTP y mDNS
+void onWiFiOnline() {
+  wifiConnected = true;
+  wifiAttempt.active = false;
+  wifiStats.lastConnectMs = millis() - wifiAttempt.startedAt;
+  wifiStats.lastFast = wifiAttempt.fast;
+  wifiStats.connects++;
+  if (wifiAttempt.fast) wifiStats.fastConnects++;
+  Serial.println("✓ WiFi en línea en " + String(wifiStats.lastConnectMs) + " ms (" +
+                 (wifiAttempt.fast ? "caché" : "búsqueda completa") + "): " + WiFi.localIP().toString());
+
+  if (wifiStats.outageActive) {
+    unsigned long readings, lost;
+    linkTotals(readings, lost);
+    wifiStats.outageActive = false;
+    wifiStats.lastOutageMs = millis() - wifiStats.outageStart;
+    wifiStats.totalOutageMs += wifiStats.lastOutageMs;
+    wifiStats.readingsDuringOutages += readings - wifiStats.readingsAtOutage;
+    wifiStats.readingsLostDuringOutages += lost - wifiStats.lostAtOutage;
+    Serial.println("Corte de WiFi de " + String(wifiStats.lastOutageMs / 1000) + " s: " +
+                   String(readings - wifiStats.readingsAtOutage) + " lecturas recibidas, " +
+                   String(lost - wifiStats.lostAtOutage) + " perdidas");
+  }
+  if (wifiStats.bootToOnlineMs == 0) {
+    wifiStats.bootToOnlineMs = millis();
+    ntpUDP.begin(NTP_LOCAL_PORT); // La sincronización la hace serviceNtp() sin bloquear
+    initializeMDNS();
+  }
+
+  saveWifiCache();
+  if (portal.credentialsPending) {
     preferences.putString("ssid", ssid);
     preferences.putString("password", password);
+    portal.credentialsPending = false;
+    portal.credentialsFailed = false;
     Serial.println("Credenciales guardadas");
-  } else {
-    Serial.println("No se pudo conectar. Reinicie el ESP32 o reingrese las credenciales.");
-    // En un entorno de producción, podrías implementar un portal cautivo aquí.
-    while(true) delay(1000);
-    // Bloquea el ESP32 si no hay conexión WiFi
   }
+  if (portal.active) {
+    portal.closing = true;
+    portal.connectedAt = millis();
+  }
+}
+
+// BSSID, canal e IP de la conexión actual; solo se escribe en NVS si han cambiado
+void saveWifiCache() {
+  WifiCache current;
+  memcpy(current.bssid, WiFi.BSSID(), sizeof(current.bssid));
+  current.channel = WiFi.channel();
+  current.ip = WiFi.localIP();
+  current.gateway = WiFi.gatewayIP();
+  current.subnet = WiFi.subnetMask();
+  current.dns = WiFi.dnsIP();
+  if (memcmp(&current, &wifiCache, sizeof(current)) == 0) return;
+  wifiCache = current;
+  if (saveConfigBlob(preferences, WIFI_CACHE_KEY, WIFI_CACHE_VERSION, wifiCache)) {
+    Serial.println("Caché WiFi actualizada: canal " + String(wifiCache.channel) + ", IP " + WiFi.localIP().toString());
+  }
+}
+
+// Lecturas recibidas y perdidas (saltos de secuencia) de todos los nodos
+void linkTotals(unsigned long& readings, unsigned long& lost) {
+  readings = 0;
+  lost = 0;
+  for (int i = 0; i < MAX_NODES; i++) {
+    if (linkStats[i].node < 0) continue;
+    readings += linkStats[i].readings;
+    lost += linkStats[i].lost;
+  }
+}
+
+// Punto de acceso con DNS comodín; el intento de conexión como estación sigue en paralelo (AP+STA).
+// Al asociar como estación el AP pasa al canal de la red, así que el móvil puede reconectarse.
+void startPortal() {
+  uint8_t mac[6];
+  WiFi.macAddress(mac);
+  snprintf(portal.apSsid, sizeof(portal.apSsid), "%s-%02X%02X", PORTAL_SSID_PREFIX, mac[4], mac[5]);
+  WiFi.mode(WIFI_AP_STA);
+  WiFi.softAP(portal.apSsid, strlen(PORTAL_PASSWORD) > 0 ? PORTAL_PASSWORD : nullptr);
+  dnsServer.start(53, "*", WiFi.softAPIP());
+  WiFi.scanNetworks(true); // Redes para la lista del formulario, sin esperar
+  portal.active = true;
+  portal.closing = false;
+  Serial.println("Portal de configuración: red " + String(portal.apSsid) + ", http://" + WiFi.softAPIP().toString() + "/portal");
 }
 
-bool connectToWiFi() {
+void stopPortal() {
+  dnsServer.stop();
+  WiFi.softAPdisconnect(true);
   WiFi.mode(WIFI_STA);
-  WiFi.begin(ssid.c_str(), password.c_str());
-  Serial.print("Conectando a " + ssid);
-  unsigned long startTime = millis();
-  while (WiFi.status() != WL_CONNECTED && millis() - startTime < 30000) { // Esperar hasta 30 segundos
-    delay(500);
-    Serial.print(".");
+  WiFi.scanDelete();
+  portal.active = false;
+  portal.closing = false;
+  Serial.println("Portal de configuración cerrado");
+}
+
+void servicePortal() {
+  if (!portal.active) return;
+  dnsServer.processNextRequest();
+  if (portal.closing && millis() - portal.connectedAt >= PORTAL_LINGER) stopPortal();
+}
+
+// Cola hacia la tarea MQTT y bandeja de salida de la SD (se conserva entre reinicios)
+void initializeMqtt() {
+  if (!MQTT_ENABLED) return;
+  mqttQueue = xQueueCreate(MQTT_QUEUE_DEPTH, sizeof(MqttMessage));
+  if (mqttQueue == nullptr) {
+    Serial.println("MQTT: sin memoria para la cola; publicación desactivada");
+    return;
   }
+  if (sdCardAvailable) {
+    MqttOutboxHeader stored;
+    bool valid = sdCardFs.read(MQTT_OUTBOX_FILE, 0, (uint8_t*)&stored, sizeof(stored)) == sizeof(stored) &&
+                 stored.magic == MQTT_OUTBOX_MAGIC && stored.head - stored.tail <= MQTT_OUTBOX_SLOTS;
+    if (valid) mqttOutbox = stored;
+    mqttOutboxReady = valid || writeMqttOutboxHeader();
+    if (mqttOutbox.head != mqttOutbox.tail) {
+      Serial.println("MQTT: " + String(mqttOutbox.head - mqttOutbox.tail) + " lotes pendientes en " + MQTT_OUTBOX_FILE);
+    }
+  }
+  xTaskCreatePinnedToCore(mqttTask, "mqtt", 6144, nullptr, 1, nullptr, 0);
+  Serial.println("MQTT: publicando en " + String(MQTT_HOST) + ":" + String(MQTT_PORT) + " " + MQTT_TOPIC);
+}
 
-  wifiConnected = (WiFi.status() == WL_CONNECTED);
+// Tarea del núcleo 0: conexión con espera exponencial y publicación de los lotes de la cola. Un lote
+// que no se pudo publicar se conserva y se reintenta tras reconectar (la cola se llena y loop()
+// desvía los siguientes a la SD).
+void mqttTask(void* parameter) {
+  WiFiClient network;
+  PubSubClient client(network);
+  client.setServer(MQTT_HOST, MQTT_PORT);
+  client.setBufferSize(MQTT_BATCH_BYTES + 64); // Cabecera MQTT + tema
+  client.setSocketTimeout(5);
+  static MqttMessage message; // Fuera de la pila de la tarea
+  bool holding = false;
+  unsigned long retryAt = 0, retryDelay = 1000;
+
+  for (;;) {
+    if (WiFi.status() != WL_CONNECTED) {
+      mqttConnected = false;
+      vTaskDelay(pdMS_TO_TICKS(500));
+      continue;
+    }
+    if (!client.connected()) {
+      mqttConnected = false;
+      if ((long)(millis() - retryAt) < 0) {
+        vTaskDelay(pdMS_TO_TICKS(100));
+        continue;
+      }
+      if (!client.connect(MQTT_CLIENT_ID)) {
+        mqttStats.connectFailures++;
+        retryAt = millis() + retryDelay;
+        retryDelay = min(retryDelay * 2, MQTT_RETRY_MAX);
+        continue;
+      }
+      mqttStats.connects++;
+      retryDelay = 1000;
+    }
+    mqttConnected = true;
+    client.loop(); // PINGREQ/PINGRESP
+
+    if (!holding) holding = xQueueReceive(mqttQueue, &message, pdMS_TO_TICKS(100)) == pdTRUE;
+    if (!holding) continue;
+    int64_t start = esp_timer_get_time();
+    if (client.publish(MQTT_TOPIC, (const uint8_t*)message.payload, message.length)) {
+      uint32_t elapsed = esp_timer_get_time() - start;
+      mqttStats.lastPublishUs = elapsed;
+      if (elapsed > mqttStats.maxPublishUs) mqttStats.maxPublishUs = elapsed;
+      mqttStats.batches++;
+      mqttStats.readings += message.readings;
+      mqttStats.bytes += message.length;
+      holding = false;
+    } else {
+      mqttStats.publishErrors++;
+      client.disconnect(); // Reconexión limpia en la próxima vuelta
+    }
+  }
+}
 
-  if (wifiConnected) {
-    Serial.println("\n✓ WiFi conectado: " + WiFi.localIP().toString());
+// Añade una lectura (línea CSV del registro) al lote en construcción
+void publishReading(time_t epochTime, const DataPoint& point) {
+  if (mqttQueue == nullptr) return;
+  char timestamp[20];
+  formatTimestamp(epochTime, timestamp);
+  String line = formatLogLine(timestamp, point) + "\n";
+  if (mqttBatch.length + line.length() > MQTT_BATCH_BYTES) submitMqttBatch();
+  if (mqttBatch.length == 0) mqttBatchStarted = millis();
+  memcpy(mqttBatch.payload + mqttBatch.length, line.c_str(), line.length());
+  mqttBatch.length += line.length();
+  mqttBatch.readings++;
+}
+
+// Directo a la tarea si hay conexión, nada esperando en la SD (se respeta el orden) y sitio en la
+// cola; si no, a la bandeja de salida. Nunca espera.
+void submitMqttBatch() {
+  if (mqttBatch.length == 0) return;
+  bool direct = mqttConnected && mqttOutbox.head == mqttOutbox.tail &&
+                xQueueSend(mqttQueue, &mqttBatch, 0) == pdTRUE;
+  if (direct) {
+    mqttStats.direct++;
+  } else if (pushMqttOutbox(mqttBatch)) {
+    mqttStats.outboxed++;
+  } else if (xQueueSend(mqttQueue, &mqttBatch, 0) == pdTRUE) { // Sin SD: esperar en RAM
+    mqttStats.direct++;
   } else {
-    Serial.println("\n✗ Error de conexión WiFi");
+    mqttStats.lost += mqttBatch.readings;
   }
+  mqttBatch.length = 0;
+  mqttBatch.readings = 0;
+}
 
-  return wifiConnected;
+bool pushMqttOutbox(const MqttMessage& message) {
+  if (!sdCardAvailable || !mqttOutboxReady) return false;
+  uint32_t offset = MQTT_OUTBOX_DATA + (mqttOutbox.head % MQTT_OUTBOX_SLOTS) * MQTT_OUTBOX_SLOT_SIZE;
+  if (!sdCardFs.write(MQTT_OUTBOX_FILE, offset, (const uint8_t*)&message, sizeof(uint16_t) * 2 + message.length)) {
+    return false;
+  }
+  mqttOutbox.head++;
+  if (mqttOutbox.head - mqttOutbox.tail > MQTT_OUTBOX_SLOTS) { // Llena: se pierde el lote más antiguo
+    mqttOutbox.tail++;
+    mqttOutbox.overwritten++;
+  }
+  return writeMqttOutboxHeader();
 }
 
-void checkWiFiConnection() {
-  if (WiFi.status() != WL_CONNECTED && wifiConnected) {
-    Serial.println("WiFi desconectado. Intentando reconectar...");
-    wifiConnected = false;
-    WiFi.reconnect();
-    unsigned long startTime = millis();
-    while (WiFi.status() != WL_CONNECTED && millis() - startTime < 10000) { // Esperar 10 segundos
-      delay(500);
-      Serial.print(".");
-    }
-    wifiConnected = (WiFi.status() == WL_CONNECTED);
-    if (wifiConnected) {
-      Serial.println("\nWiFi reconectado.");
-      // No llamar initializeNTP() aquí directamente, loop() lo manejará.
-    } else {
-      Serial.println("\nNo se pudo reconectar WiFi.");
+bool writeMqttOutboxHeader() {
+  return sdCardFs.write(MQTT_OUTBOX_FILE, 0, (const uint8_t*)&mqttOutbox, sizeof(mqttOutbox));
+}
+
+// Desde loop(): cierra el lote a medias, pasa un lote de la bandeja a la cola cada
+// MQTT_DRAIN_INTERVAL (dejando media cola libre para las lecturas en vivo) y mide la tasa
+void serviceMqtt() {
+  if (mqttQueue == nullptr) return;
+  if (mqttBatch.length > 0 && millis() - mqttBatchStarted >= MQTT_BATCH_MAX_AGE) submitMqttBatch();
+
+  static unsigned long lastDrain = 0;
+  if (mqttConnected && mqttOutbox.head != mqttOutbox.tail && millis() - lastDrain >= MQTT_DRAIN_INTERVAL &&
+      uxQueueSpacesAvailable(mqttQueue) > MQTT_QUEUE_DEPTH / 2) {
+    lastDrain = millis();
+    static MqttMessage message;
+    uint32_t offset = MQTT_OUTBOX_DATA + (mqttOutbox.tail % MQTT_OUTBOX_SLOTS) * MQTT_OUTBOX_SLOT_SIZE;
+    size_t n = sdCardFs.read(MQTT_OUTBOX_FILE, offset, (uint8_t*)&message, sizeof(message));
+    bool valid = n >= sizeof(uint16_t) * 2 && message.length <= MQTT_BATCH_BYTES;
+    if (!valid || xQueueSend(mqttQueue, &message, 0) == pdTRUE) {
+      mqttOutbox.tail++; // Una ranura ilegible se salta
+      if (valid) mqttStats.drained++;
+      writeMqttOutboxHeader();
+      if (mqttOutbox.head == mqttOutbox.tail) Serial.println("MQTT: bandeja de salida vaciada");
     }
   }
+
+  if (millis() - mqttStats.windowStart >= 60000) {
+    uint32_t readings = mqttStats.readings;
+    mqttStats.readingsPerMin = (readings - mqttStats.windowReadings) * 60000.0 / (millis() - mqttStats.windowStart);
+    mqttStats.windowReadings = readings;
+    mqttStats.windowStart = millis();
+  }
 }
 
 void initializeMDNS() {
@@ -439,75 +2241,69 @@ void initializeWebServer() {
   server.on("/", handleRoot);
   server.on("/api/data", handleAPIData);
   server.on("/api/history", handleAPIHistory);
+  server.on("/api/encode-bench", HTTP_GET, handleAPIEncodeBench); // Tiempo y tamaño de JSON, CBOR y binario
+  server.on("/api/system", HTTP_GET, handleAPISystem); // Heap y búferes de respuesta de la API
+  server.on("/portal", HTTP_GET, handlePortal);         // Configuración WiFi (portal cautivo)
+  server.on("/api/wifi", HTTP_GET, handleAPIWifiStatus); // Conexión, tiempo hasta tener red y cortes
+  server.on("/api/wifi", HTTP_POST, handleAPIWifiSet);   // Nuevas credenciales (formulario del portal)
   server.on("/api/sd-info", handleSDInfo);
-  server.on("/api/download-data", handleDownloadData);
+  server.on("/api/download", HTTP_GET, handleDownload); // Archivo del día o ?from=&to=, con Range y ?gzip=1
+  server.on("/api/download-data", handleDownload); // Ruta anterior, descarga el archivo del día
+  server.on("/api/archive", HTTP_GET, handleAPIArchive); // Días disponibles en la SD (índice)
   server.on("/api/ranges", HTTP_GET, handleAPI_GetRanges); // Nueva ruta para obtener rangos
   server.on("/api/ranges", HTTP_POST, handleAPI_SetRanges); // Nueva ruta para establecer rangos
+  server.on("/api/sync", HTTP_GET, handleAPISync); // Registros recientes para otros receptores
+  server.on("/api/link", HTTP_GET, handleAPILink); // Calidad de enlace por nodo
+  server.on("/api/node-config", HTTP_POST, handleAPINodeConfig); // Umbrales de filtrado de un nodo
+  server.on("/api/rules", HTTP_GET, handleAPI_GetRules);   // Reglas de alerta y su estado
+  server.on("/api/rules", HTTP_POST, handleAPI_SetRules);  // Reemplaza la tabla de reglas
+  server.on("/api/events", HTTP_GET, handleAPIEvents);     // Alertas en vivo (Server-Sent Events)
+  server.on("/api/mqtt", HTTP_GET, handleAPIMqtt);         // Estado de la publicación MQTT
   server.on("/style.css", handleCSS);
   server.on("/script.js", handleJS);
   server.onNotFound(handleNotFound);
+  const char* headerKeys[] = {"Range", "Accept"}; // WebServer solo guarda las cabeceras pedidas
+  server.collectHeaders(headerKeys, 2);
 
   server.begin();
   Serial.println("Servidor web iniciado en puerto 80");
 }
 
-void initializeNTP() {
-  Serial.print("Sincronizando hora NTP...");
-  timeClient.begin();
-  timeClient.setTimeOffset(utcOffsetInSeconds);
-  unsigned long startTime = millis();
-  while(!timeClient.update() && millis() - startTime < 15000) { // Intentar sincronizar por 15 segundos
-    Serial.print(".");
-    delay(500);
-  }
-  if (timeClient.isTimeSet()) {
-    timeSynchronized = true;
-    Serial.println("\n✓ Hora NTP sincronizada: " + timeClient.getFormattedTime());
-    if (sdCardAvailable) { // Solo intentar crear el archivo de log si la SD está disponible
-        if (!initializeLogFile()) { // Llamar y verificar si se pudo crear
-            Serial.println("ADVERTENCIA: Fallo al crear archivo de log inicial con fecha NTP.");
-        }
-    }
-  } else {
-    timeSynchronized = false;
-    Serial.println("\n✗ No se pudo sincronizar la hora NTP. Los datos en SD no tendrán fecha/hora real.");
-  }
+// Lee el módulo sin bloquear; las tramas recibidas llegan a handleLoRaFrame()
+void processLoRaData() {
+  lora.poll();
 }
 
-void processLoRaData() {
-  if (!LoRaSerial.available()) return;
-
-  String received = LoRaSerial.readString();
-  received.trim();
-  // Validar si el mensaje es un +RCV=
-  if (received.indexOf("+RCV=") < 0) {
-    Serial.println("LoRa (no data): " + received);
-    // Mostrar mensajes AT+OK, etc.
+void handleLoRaFrame(const RylrFrame& frame) {
+  int node = frame.address;
+  String payload = frame.data;
+  int rssi = frame.rssi;
+  int snr = frame.snr;
+
+  Serial.println("Datos LoRa (nodo " + String(node) + ", RSSI " + String(rssi) + " dBm, SNR " + String(snr) + " dB): " + payload);
+  if (payload.startsWith("ACK:ADR,")) { // Confirmación de cambio de tasa, sin datos de sensores
+    handleAdrAck(node, payload.substring(8).toInt());
     return;
   }
-
-  // Extraer payload: +RCV=address,length,data,RSSI,SNR
-  int firstComma = received.indexOf(",");
-  int secondComma = received.indexOf(",", firstComma + 1);
-  if (firstComma == -1 || secondComma == -1) {
-    Serial.println("LoRa (mal formato): " + received);
+  if (payload == "ACK:CFG") { // El nodo aplicó los umbrales de filtrado
+    linkStatsForNode(node)->pendingConfig = "";
+    Serial.println("Nodo " + String(node) + ": configuración de filtrado aplicada");
     return;
   }
-
-  String lengthStr = received.substring(firstComma + 1, secondComma);
-  int dataLength = lengthStr.toInt();
-  int dataStart = secondComma + 1;
-  String payload = received.substring(dataStart, dataStart + dataLength);
-
-  Serial.println("Datos LoRa: " + payload); 
-  parseAndStoreSensorData(payload);
+  if (payload.startsWith("B:")) { // Varias lecturas en una sola trama
+    parseAndStoreBatch(node, payload, rssi, snr);
+    return;
+  }
+  parseAndStoreSensorData(node, payload, rssi, snr);
 }
 
-void parseAndStoreSensorData(String payload) {
+void parseAndStoreSensorData(int node, String payload, int rssi, int snr) {
   float newTemp = 0, newHum = 0, newLux = 0;
   int newSoil = 0;
+  long newSeq = -1;
+  bool linkCheck = false;
   bool tempSet = false, humSet = false, luxSet = false, soilSet = false;
-  // Parsear formato: T:temp,H:hum,L:lux,S:soil
+  // Parsear formato: T:temp,H:hum,L:lux,S:soil,Q:seq
   int start = 0, end = 0;
   while (end != -1) {
     end = payload.indexOf(',', start);
@@ -523,13 +2319,27 @@ void parseAndStoreSensorData(String payload) {
     }
     else if (param.startsWith("S:")) { newSoil = param.substring(2).toInt(); soilSet = true;
     }
+    else if (param.startsWith("Q:")) { newSeq = param.substring(2).toInt();
+    }
+    else if (param.startsWith("K:")) { linkCheck = true; // El nodo pide confirmación de que se le oye
+    }
 
     start = end + 1;
   }
 
+  bool isNew = updateLinkStats(node, newSeq, 1, rssi, snr); // Cuenta todas las tramas, también las repetidas
+  runAdr(node, linkCheck);
+  sendPendingConfig(node);
+  if (!isNew && newSeq >= 0) { // Reenvío: la lectura ya está en el historial, la SD y MQTT
+    Serial.println("Trama repetida del nodo " + String(node) + " (secuencia " + String(newSeq) + "), descartada");
+    return;
+  }
+
   bool changed = false;
-  if (sensorData.dataValid == false) { // Primera recepción válida
+  if (sensorData.dataValid == false || node != sensorData.node) { // Primera recepción válida o de otro nodo
       changed = true;
+  } else if (newSeq >= 0) { // El nodo ya filtra lo que no cambia: toda trama nueva cuenta (latidos incluidos)
+      changed = newSeq != sensorData.seq;
   } else { // Si ya tenemos datos, verificar si cambiaron
       if (tempSet && newTemp != sensorData.temperature) changed = true;
       if (humSet && newHum != sensorData.humidity) changed = true;
@@ -543,31 +2353,371 @@ void parseAndStoreSensorData(String payload) {
     sensorData.humidity = humSet ? newHum : sensorData.humidity;
     sensorData.lux = luxSet ? newLux : sensorData.lux;
     sensorData.soilMoisture = soilSet ? newSoil : sensorData.soilMoisture;
+    sensorData.node = node;
+    sensorData.seq = newSeq;
+    sensorData.rssi = rssi;
+    sensorData.snr = snr;
     
     sensorData.lastUpdate = millis();
     sensorData.dataValid = true;
     // Marcamos los datos como válidos
 
+    DataPoint point = currentDataPoint();
+    checkAnomalies(point);
+    sensorData.flags = point.flags;
+    if (timeSynchronized) publishReading(clockNow(), point);
+
     addToHistory();
     printReceivedData();
+    evaluateAlerts(currentDataPoint());
     // Guardar inmediatamente en SD si hay datos nuevos y la hora está sincronizada
     if (sdCardAvailable && timeSynchronized) {
       saveToSD();
     } else if (sdCardAvailable && !timeSynchronized) {
-        Serial.println("Datos recibidos pero no guardados en SD: Hora no sincronizada.");
+        queuePendingRecord(currentDataPoint()); // Se escribirá con su hora real cuando NTP sincronice
     }
   } else {
     Serial.println("Datos LoRa recibidos pero no hubo cambios significativos.");
   }
 }
 
+// Trama en lote: B:<seq>[,K];<edad_s>,<T*10>,<H*10>,<L>,<S>;<dt_s>,<dT>,<dH>,<dL>,<dS>;...
+// La primera muestra lleva su antigüedad en segundos al enviar y valores absolutos; las siguientes,
+// los segundos transcurridos desde la anterior y la diferencia de cada valor.
+void parseAndStoreBatch(int node, String payload, int rssi, int snr) {
+  int headerEnd = payload.indexOf(';');
+  if (headerEnd == -1) {
+    Serial.println("LoRa (lote mal formado): " + payload);
+    return;
+  }
+  String header = payload.substring(2, headerEnd);
+  long firstSeq = header.toInt();
+  bool linkCheck = header.indexOf(",K") >= 0;
+
+  // Desempaquetar de más antigua a más reciente acumulando las diferencias
+  long ageSeconds = 0, temp10 = 0, hum10 = 0, luxValue = 0, soilValue = 0;
+  int count = 0;
+  int start = headerEnd + 1;
+  while (start > 0 && start < (int)payload.length() && count < MAX_BATCH_SAMPLES) {
+    int end = payload.indexOf(';', start);
+    String group = (end == -1) ? payload.substring(start) : payload.substring(start, end);
+    long fields[5] = {0, 0, 0, 0, 0};
+    int fieldStart = 0;
+    for (int f = 0; f < 5; f++) {
+      int comma = group.indexOf(',', fieldStart);
+      fields[f] = (comma == -1 ? group.substring(fieldStart) : group.substring(fieldStart, comma)).toInt();
+      if (comma == -1) break;
+      fieldStart = comma + 1;
+    }
+
+    if (count == 0) {
+      ageSeconds = fields[0];
+      temp10 = fields[1]; hum10 = fields[2]; luxValue = fields[3]; soilValue = fields[4];
+    } else {
+      ageSeconds -= fields[0];
+      temp10 += fields[1]; hum10 += fields[2]; luxValue += fields[3]; soilValue += fields[4];
+    }
+
+    batchPoints[count] = {millis() - (unsigned long)max(ageSeconds, 0L) * 1000UL,
+                          temp10 / 10.0f, hum10 / 10.0f, (float)luxValue, (int)soilValue, node,
+                          firstSeq >= 0 ? (firstSeq + count) % 65536 : -1, (int16_t)rssi, (int8_t)snr};
+    count++;
+    start = end + 1;
+  }
+  if (count == 0) return;
+
+  bool isNew = updateLinkStats(node, firstSeq, count, rssi, snr);
+  runAdr(node, linkCheck);
+  sendPendingConfig(node);
+  if (!isNew) { // Sus lecturas ya están en el historial, la SD y MQTT
+    Serial.println("Lote repetido del nodo " + String(node) + " (secuencia " + String(firstSeq) + "), descartado");
+    return;
+  }
+
+  for (int i = 0; i < count; i++) {
+    checkAnomalies(batchPoints[i]);
+    if (timeSynchronized) publishReading(clockNow() - (time_t)((millis() - batchPoints[i].timestamp) / 1000), batchPoints[i]);
+    addPointToHistory(batchPoints[i]);
+    evaluateAlerts(batchPoints[i]); // En orden, con su marca de tiempo, para respetar la permanencia
+  }
+
+  // La muestra más reciente pasa a ser la lectura actual
+  const DataPoint& latest = batchPoints[count - 1];
+  sensorData.temperature = latest.temperature;
+  sensorData.humidity = latest.humidity;
+  sensorData.lux = latest.lux;
+  sensorData.soilMoisture = latest.soilMoisture;
+  sensorData.node = node;
+  sensorData.seq = latest.seq;
+  sensorData.rssi = rssi;
+  sensorData.snr = snr;
+  sensorData.flags = latest.flags;
+  sensorData.lastUpdate = millis();
+  sensorData.dataValid = true;
+  printReceivedData();
+
+  // Todas las muestras del lote se escriben en SD con una sola escritura
+  if (sdCardAvailable && timeSynchronized) {
+    int written = writeRecordsToSD([](int i) -> const DataPoint& { return batchPoints[i]; }, count);
+    Serial.println("Lote de " + String(count) + " lecturas guardado en SD (" + String(written) + " escritas)");
+  } else if (sdCardAvailable) {
+    for (int i = 0; i < count; i++) queuePendingRecord(batchPoints[i]);
+  }
+}
+
+// Entrada de estadísticas del nodo; se reutiliza la entrada libre o la más antigua
+LinkStats* linkStatsForNode(int node) {
+  LinkStats* oldest = &linkStats[0];
+  for (int i = 0; i < MAX_NODES; i++) {
+    if (linkStats[i].node == node) return &linkStats[i];
+    if (linkStats[i].node == -1) {
+      oldest = &linkStats[i];
+      break;
+    }
+    if (linkStats[i].lastArrival < oldest->lastArrival) oldest = &linkStats[i];
+  }
+  *oldest = LinkStats();
+  oldest->node = node;
+  for (int r = 0; r < MAX_ALERT_RULES; r++) alertStates[r][oldest - linkStats] = AlertRuleState();
+  return oldest;
+}
+
+// seq es la secuencia de la primera muestra de la trama y samples cuántas muestras trae.
+// Retorna false si la trama es repetida (reenvío o eco de otro receptor).
+bool updateLinkStats(int node, long seq, int samples, int rssi, int snr) {
+  LinkStats* stats = linkStatsForNode(node);
+  unsigned long now = millis();
+
+  if (stats->packets == 0) {
+    stats->rssiMean = stats->rssiMin = stats->rssiP10 = rssi;
+    stats->snrMean = stats->snrMin = stats->snrP10 = snr;
+  } else {
+    if (stats->adrSamples == 0) { // La SNR medida con otra tasa no es comparable
+      stats->snrMean = stats->snrMin = stats->snrP10 = snr;
+    }
+    stats->rssiMean += LINK_MEAN_ALPHA * (rssi - stats->rssiMean);
+    stats->snrMean += LINK_MEAN_ALPHA * (snr - stats->snrMean);
+    stats->rssiMin = min(stats->rssiMin, (float)rssi);
+    stats->snrMin = min(stats->snrMin, (float)snr);
+    // Percentil 10 por aproximación estocástica: sube 0.1·paso o baja 0.9·paso
+    stats->rssiP10 += RSSI_QUANTILE_STEP * (rssi < stats->rssiP10 ? -0.9 : 0.1);
+    stats->snrP10 += RSSI_QUANTILE_STEP * (snr < stats->snrP10 ? -0.9 : 0.1);
+
+    // Jitter entre llegadas: media exponencial de la desviación respecto al intervalo medio
+    float interval = now - stats->lastArrival;
+    if (stats->meanInterval == 0) stats->meanInterval = interval;
+    stats->jitter += (fabs(interval - stats->meanInterval) - stats->jitter) / 16.0;
+    stats->meanInterval += LINK_MEAN_ALPHA * (interval - stats->meanInterval);
+  }
+
+  // Pérdidas estimadas por saltos en la secuencia de 16 bits
+  if (seq >= 0) {
+    if (stats->lastSeq >= 0) {
+      long gap = (seq - stats->lastSeq + 65536) % 65536;
+      if (gap == 0 || gap > 65536 - 1000) { // Repetida o anterior a la última
+        stats->duplicates++;
+        stats->packets++;
+        stats->lastArrival = now;
+        return false;
+      } else if (gap < 1000) { // Saltos mayores se consideran reinicio del transmisor
+        stats->lost += gap - 1;
+      }
+    }
+    stats->lastSeq = (seq + samples - 1) % 65536;
+  }
+
+  stats->packets++;
+  stats->readings += samples;
+  stats->lastArrival = now;
+  return true;
+}
+
+// Configura el módulo con una tasa de ADR_RATES y la guarda para el siguiente arranque
+void applyLoRaRate(int rate) {
+  const LoRaRate& r = ADR_RATES[rate];
+  String command = "AT+PARAMETER=" + String(r.sf) + "," + String(r.bwCode) + "," +
+                   String(LORA_CODING_RATE) + "," + String(LORA_PREAMBLE);
+  lora.send(command.c_str(), 500, onLoRaCommand);
+  preferences.putInt("adrRate", rate);
+  Serial.printf("ADR: tasa %d (SF%d, BW %.1f kHz)\n", rate, r.sf, loraBandwidthHz(r.bwCode) / 1000.0);
+}
+
+void sendDownlink(int node, const String& message) {
+  lora.sendFrame(node, message.c_str(), message.length(), loraAirtimeMs(ADR_RATES[adrState.rate], message.length()),
+                 onLoRaCommand);
+  Serial.println("Downlink a nodo " + String(node) + ": " + message);
+}
+
+// Se ejecuta tras cada trama de datos. Los mensajes al nodo se envían justo después de oírlo,
+// mientras su RYLR998 sigue en recepción.
+void runAdr(int node, bool linkCheck) {
+  LinkStats* stats = linkStatsForNode(node);
+  unsigned long now = millis();
+  stats->adrSamples++;
+  adrState.lastFrame = now;
+
+  if (stats->adrConfirmPending || linkCheck) {
+    sendDownlink(node, "ADROK:" + String(adrState.rate));
+    stats->adrConfirmPending = false;
+    return;
+  }
+
+  if (adrState.targetRate >= 0) {
+    if (now - adrState.changeStarted > ADR_CHANGE_TIMEOUT) {
+      // Los nodos que ya confirmaron vuelven solos a la tasa actual al no recibir ADROK
+      Serial.println("ADR: cambio abortado, no todos los nodos confirmaron.");
+      adrState.targetRate = -1;
+      adrState.holdoff = true;
+      adrState.holdoffStarted = now;
+    } else if (!stats->adrAcked) {
+      sendDownlink(node, "ADR:" + String(adrState.targetRate));
+    }
+    return;
+  }
+
+  if (adrState.holdoff) {
+    if (now - adrState.holdoffStarted < ADR_HOLDOFF) return;
+    adrState.holdoff = false;
+  }
+
+  // La tasa de la red la limita el nodo activo con peor margen (percentil 10 de SNR)
+  int recommended = ADR_RATE_COUNT - 1;
+  for (int i = 0; i < MAX_NODES; i++) {
+    const LinkStats& other = linkStats[i];
+    if (other.node == -1 || now - other.lastArrival > ADR_ACTIVE_WINDOW) continue;
+    if (other.adrSamples < ADR_MIN_SAMPLES) return; // Historial insuficiente para decidir
+    recommended = min(recommended, adrRecommendedRate(other.snrP10, adrState.rate));
+  }
+
+  if (recommended != adrState.rate) {
+    startAdrChange(recommended);
+    sendDownlink(node, "ADR:" + String(recommended));
+  }
+}
+
+// Propone una tasa a la red; cada nodo la recibe tras su siguiente trama
+void startAdrChange(int rate) {
+  adrState.targetRate = rate;
+  adrState.changeStarted = millis();
+  for (int i = 0; i < MAX_NODES; i++) linkStats[i].adrAcked = false;
+  Serial.printf("ADR: proponiendo tasa %d (actual %d)\n", rate, adrState.rate);
+}
+
+// Los umbrales de filtrado se reenvían tras cada trama del nodo hasta que confirme con ACK:CFG
+void sendPendingConfig(int node) {
+  LinkStats* stats = linkStatsForNode(node);
+  if (stats->pendingConfig.length() > 0) sendDownlink(node, stats->pendingConfig);
+}
+
+// Cuando todos los nodos activos confirmaron, el receptor cambia también su configuración
+void handleAdrAck(int node, int rate) {
+  if (rate != adrState.targetRate) return;
+  LinkStats* stats = linkStatsForNode(node);
+  stats->adrAcked = true;
+  stats->lastArrival = millis();
+
+  for (int i = 0; i < MAX_NODES; i++) {
+    const LinkStats& other = linkStats[i];
+    if (other.node == -1 || millis() - other.lastArrival > ADR_ACTIVE_WINDOW) continue;
+    if (!other.adrAcked) return;
+  }
+
+  applyLoRaRate(adrState.targetRate);
+  adrState.rate = adrState.targetRate;
+  adrState.targetRate = -1;
+  adrState.lastFrame = millis();
+  for (int i = 0; i < MAX_NODES; i++) {
+    linkStats[i].adrSamples = 0;
+    linkStats[i].adrConfirmPending = true;
+  }
+}
+
+// Vuelta a la tasa por defecto cuando se pierde un nodo que ya se oía con la tasa actual.
+// El nodo perdido vuelve solo a la tasa por defecto al fallar sus confirmaciones de enlace.
+void checkAdrFallback() {
+  if (adrState.rate == ADR_DEFAULT_RATE) return;
+  unsigned long now = millis();
+
+  // Nadie se oye: no hay a quién avisar, el receptor cambia directamente
+  if (now - adrState.lastFrame > ADR_SILENCE_TIMEOUT) {
+    Serial.println("ADR: sin tramas con la tasa actual, volviendo a la tasa por defecto.");
+    applyLoRaRate(ADR_DEFAULT_RATE);
+    adrState.rate = ADR_DEFAULT_RATE;
+    adrState.targetRate = -1;
+    adrState.lastFrame = now;
+    adrState.holdoff = true;
+    adrState.holdoffStarted = now;
+    for (int i = 0; i < MAX_NODES; i++) linkStats[i].adrSamples = 0;
+    return;
+  }
+
+  if (adrState.targetRate == ADR_DEFAULT_RATE) return;
+  for (int i = 0; i < MAX_NODES; i++) {
+    LinkStats& stats = linkStats[i];
+    if (stats.node == -1 || stats.adrSamples == 0 || now - stats.lastArrival < ADR_SILENCE_TIMEOUT) continue;
+    Serial.println("ADR: nodo " + String(stats.node) + " perdido, volviendo a la tasa por defecto.");
+    stats.adrSamples = 0; // No volver a contarlo como perdido
+    adrState.holdoff = true;
+    adrState.holdoffStarted = now;
+    startAdrChange(ADR_DEFAULT_RATE);
+    return;
+  }
+}
 
 void addToHistory() {
-  dataHistory[historyIndex] = {millis(), sensorData.temperature, sensorData.humidity, sensorData.lux, sensorData.soilMoisture};
+  addPointToHistory(currentDataPoint());
+}
+
+void addPointToHistory(const DataPoint& point) {
+  dataHistory[historyIndex] = point;
   historyIndex = (historyIndex + 1) % MAX_HISTORY;
   if (historyCount < MAX_HISTORY) historyCount++;
 }
 
+// Marca la lectura con el detector del nodo (O(1), ~150 bytes de estado por nodo). Se llama una vez
+// por lectura nueva y en orden, antes de guardarla en el historial, la SD y las alertas.
+void checkAnomalies(DataPoint& point) {
+  LinkStats* stats = linkStatsForNode(point.node);
+  const float values[ANOMALY_SENSORS] = {point.temperature, point.humidity, point.lux, (float)point.soilMoisture};
+  point.flags = anomalyCheck(stats->anomaly, anomalyConfig, values, point.timestamp);
+  if (point.flags == 0) return;
+
+  stats->suspect++;
+  String message = "Lectura sospechosa del nodo " + String(point.node) + ":";
+  for (int s = 0; s < ALERT_SENSORS; s++) {
+    if (!anomalySuspect(point.flags, s)) continue;
+    char reasons[32];
+    anomalyReasons(point.flags, s, reasons, sizeof(reasons));
+    message += " " + String(ALERT_SENSOR_NAMES[s]) + " (" + reasons + ")";
+  }
+  Serial.println(message);
+}
+
+// "zero,rate"... para un sensor
+void anomalyReasons(uint16_t flags, int sensor, char* out, size_t size) {
+  size_t length = 0;
+  out[0] = '\0';
+  for (int r = 0; r < 4; r++) {
+    if (!((flags >> (4 * sensor + r)) & 1)) continue;
+    length += snprintf(out + length, size - length, "%s%s", length > 0 ? "," : "", ANOMALY_REASON_NAMES[r]);
+    if (length >= size) break;
+  }
+}
+
+// Columna flags de una línea del registro (hexadecimal, penúltima). Las líneas de antes de que
+// existiera (9 comas o menos) cuentan como normales.
+uint16_t logLineFlags(const String& line) {
+  int commas = 0, flagsStart = -1, crcStart = -1;
+  for (int i = 0; i < (int)line.length(); i++) {
+    if (line[i] != ',') continue;
+    commas++;
+    if (commas == 9) flagsStart = i + 1;
+    if (commas == 10) crcStart = i;
+  }
+  if (commas != 10) return 0;
+  return strtoul(line.substring(flagsStart, crcStart).c_str(), nullptr, 16);
+}
+
 void printReceivedData() {
   Serial.println("--- DATOS RECIBIDOS ---");
   Serial.println("T:" + String(sensorData.temperature, 1) + "°C | H:" + String(sensorData.humidity, 1) +
@@ -575,15 +2725,28 @@ void printReceivedData() {
   Serial.println("----------------------");
 }
 
-void loadSensorRanges() {
-  sensorRanges.tempMin = preferences.getFloat("tempMin", -40);
-  sensorRanges.tempMax = preferences.getFloat("tempMax", 80);
-  sensorRanges.humMin = preferences.getFloat("humMin", 0);
-  sensorRanges.humMax = preferences.getFloat("humMax", 100);
-  sensorRanges.luxMin = preferences.getFloat("luxMin", 0);
-  sensorRanges.luxMax = preferences.getFloat("luxMax", 100000);
-  sensorRanges.soilMin = preferences.getInt("soilMin", 0);
-  sensorRanges.soilMax = preferences.getInt("soilMax", 100);
+void loadConfig() {
+  ReceiverConfig config;
+  int version = loadConfigBlob(preferences, "config", RECEIVER_CONFIG_VERSION, config);
+  bool migrate = version > CONFIG_BLOB_MISSING && version < RECEIVER_CONFIG_VERSION;
+  if (version == CONFIG_BLOB_INVALID) {
+    Serial.println("Configuración en NVS dañada o de una versión posterior: valores por defecto.");
+  } else if (version == CONFIG_BLOB_MISSING && loadLegacyConfig(config)) {
+    Serial.println("Configuración antigua encontrada: se migra al blob único.");
+    migrate = true;
+  }
+
+  sensorRanges = config.ranges;
+  alertRuleCount = min((int)config.alertRuleCount, MAX_ALERT_RULES);
+  memcpy(alertRules, config.alertRules, sizeof(alertRules));
+  config.webhookUrl[WEBHOOK_URL_MAX - 1] = '\0';
+  webhookUrl = config.webhookUrl;
+  compileAlertRules();
+
+  if (migrate) {
+    saveConfig();
+    for (const char* key : LEGACY_CONFIG_KEYS) preferences.remove(key);
+  }
 
   Serial.println("Rangos cargados:");
   Serial.printf("Temp: %.1f - %.1f | Hum: %.1f - %.1f | Lux: %.0f - %.0f | Soil: %d - %d\n",
@@ -591,46 +2754,269 @@ void loadSensorRanges() {
                 sensorRanges.humMin, sensorRanges.humMax,
                 sensorRanges.luxMin, sensorRanges.luxMax,
                 sensorRanges.soilMin, sensorRanges.soilMax);
+  Serial.println("Reglas de alerta cargadas: " + String(alertRuleCount) +
+                 (webhookUrl.length() > 0 ? " (webhook " + webhookUrl + ")" : ""));
+}
+
+// Lee las claves sueltas de versiones anteriores; false si no hay ninguna
+bool loadLegacyConfig(ReceiverConfig& config) {
+  bool found = false;
+  for (const char* key : LEGACY_CONFIG_KEYS) found |= preferences.isKey(key);
+  if (!found) return false;
+
+  config.ranges.tempMin = preferences.getFloat("tempMin", config.ranges.tempMin);
+  config.ranges.tempMax = preferences.getFloat("tempMax", config.ranges.tempMax);
+  config.ranges.humMin = preferences.getFloat("humMin", config.ranges.humMin);
+  config.ranges.humMax = preferences.getFloat("humMax", config.ranges.humMax);
+  config.ranges.luxMin = preferences.getFloat("luxMin", config.ranges.luxMin);
+  config.ranges.luxMax = preferences.getFloat("luxMax", config.ranges.luxMax);
+  config.ranges.soilMin = preferences.getInt("soilMin", config.ranges.soilMin);
+  config.ranges.soilMax = preferences.getInt("soilMax", config.ranges.soilMax);
+
+  size_t length = preferences.getBytesLength("rules");
+  if (length > 0 && length % sizeof(AlertRule) == 0 && length <= sizeof(config.alertRules)) {
+    preferences.getBytes("rules", config.alertRules, length);
+    config.alertRuleCount = length / sizeof(AlertRule);
+  }
+  strlcpy(config.webhookUrl, preferences.getString("webhook", "").c_str(), WEBHOOK_URL_MAX);
+  return true;
+}
+
+// Una sola escritura en NVS para toda la configuración
+void saveConfig() {
+  ReceiverConfig config;
+  config.ranges = sensorRanges;
+  config.alertRuleCount = alertRuleCount;
+  memcpy(config.alertRules, alertRules, sizeof(alertRules));
+  strlcpy(config.webhookUrl, webhookUrl.c_str(), WEBHOOK_URL_MAX);
+
+  if (saveConfigBlob(preferences, "config", RECEIVER_CONFIG_VERSION, config)) {
+    Serial.println("Configuración guardada en memoria flash (" + String(sizeof(ReceiverConfig)) + " bytes).");
+  } else {
+    Serial.println("Error al guardar la configuración en memoria flash.");
+  }
+}
+
+// Indicador LED de siempre: encendido LED_ON_DURATION tras cada lectura con los cuatro valores dentro
+// de los rangos de /api/ranges, apagado en cuanto llega una fuera de rango
+void updateRangeLed(const float* values) {
+  bool allInRange = (values[ALERT_TEMP] >= sensorRanges.tempMin) & (values[ALERT_TEMP] <= sensorRanges.tempMax) &
+                    (values[ALERT_HUM] >= sensorRanges.humMin) & (values[ALERT_HUM] <= sensorRanges.humMax) &
+                    (values[ALERT_LUX] >= sensorRanges.luxMin) & (values[ALERT_LUX] <= sensorRanges.luxMax) &
+                    (values[ALERT_SOIL] >= sensorRanges.soilMin) & (values[ALERT_SOIL] <= sensorRanges.soilMax);
+
+  if (allInRange) {
+    if (ledOnStartTime == 0) {
+      digitalWrite(LED_PIN, HIGH);
+      Serial.println("¡Todos los valores dentro del rango! LED encendido por 15 segundos.");
+    }
+    ledOnStartTime = max(millis(), 1UL); // Cada lectura dentro de rango reinicia los 15 segundos
+  } else if (ledOnStartTime != 0) {
+    digitalWrite(LED_PIN, LOW);
+    ledOnStartTime = 0;
+    Serial.println("Valores fuera de rango. LED apagado.");
+  }
+}
+
+// Precalcula los umbrales para que evaluar una regla sean cuatro comparaciones sin ramas,
+// configura los pines de salida y reinicia el estado (las reglas pudieron cambiar de significado)
+// Pines que una regla puede manejar: ni los del propio firmware (LoRa, SD, LED, Serial), ni los de la
+// flash SPI (6-11, tocarlos cuelga el chip), ni los de arranque (0, 12, 15), ni los de solo entrada (34+)
+bool alertPinAllowed(int gpio) {
+  static const int RESERVED[] = {0, 1, 3, 6, 7, 8, 9, 10, 11, 12, 15, LED_PIN,
+                                 LORA_RX, LORA_TX, SD_CS, SD_MOSI, SD_MISO, SD_SCK};
+  if (gpio < 0 || gpio > 33) return false;
+  for (int reserved : RESERVED) {
+    if (gpio == reserved) return false;
+  }
+  return true;
+}
+
+void compileAlertRules() {
+  for (int i = 0; i < alertRuleCount; i++) {
+    const AlertRule& rule = alertRules[i];
+    CompiledAlertRule& compiled = compiledAlerts[i];
+    compiled.enterLow = rule.min;
+    compiled.enterHigh = rule.max;
+    compiled.clearLow = rule.min + rule.hysteresis;
+    compiled.clearHigh = rule.max - rule.hysteresis;
+    compiled.dwellMs = rule.dwellS * 1000UL;
+    compiled.node = rule.node;
+    compiled.sensor = rule.sensor;
+    compiled.actions = rule.actions;
+    compiled.gpio = rule.gpio;
+    if ((rule.actions & ALERT_ACTION_GPIO) && !alertPinAllowed(rule.gpio)) { // Guardada por una versión anterior
+      compiled.actions &= ~ALERT_ACTION_GPIO;
+      Serial.println("Regla " + String(i) + ": GPIO " + String(rule.gpio) + " reservado, acción gpio ignorada");
+    }
+    if (compiled.actions & ALERT_ACTION_GPIO) pinMode(rule.gpio, OUTPUT);
+  }
+  for (int r = 0; r < MAX_ALERT_RULES; r++) {
+    for (int n = 0; n < MAX_NODES; n++) alertStates[r][n] = AlertRuleState();
+  }
+  updateAlertOutputs();
+}
+
+// Se llama una vez por lectura nueva; O(reglas)
+void evaluateAlerts(const DataPoint& point) {
+  const float values[ALERT_SENSORS] = {point.temperature, point.humidity, point.lux, (float)point.soilMoisture};
+  if (point.flags == 0) updateRangeLed(values); // Una lectura sospechosa no enciende ni apaga el LED
+
+  int slot = linkStatsForNode(point.node) - linkStats;
+  for (int i = 0; i < alertRuleCount; i++) {
+    const CompiledAlertRule& rule = compiledAlerts[i];
+    if ((rule.node != ALERT_ANY_NODE) & (rule.node != point.node)) continue;
+    if (anomalySuspect(point.flags, rule.sensor)) continue; // La regla conserva su estado y permanencia
+
+    float value = values[rule.sensor];
+    AlertRuleState& state = alertStates[i][slot];
+    bool outside = (value < rule.enterLow) | (value > rule.enterHigh);
+    bool inside = (value >= rule.clearLow) & (value <= rule.clearHigh);
+    bool target = state.active ? !inside : outside; // Entre ambas bandas se mantiene el estado
+    if (target == state.active) {
+      state.pending = false;
+      continue;
+    }
+    if (!state.pending) {
+      state.pending = true;
+      state.since = point.timestamp;
+    }
+    // La permanencia se comprueba con cada lectura: el cambio se acepta en la primera que llegue
+    // después de cumplirse
+    if (point.timestamp - state.since < rule.dwellMs) continue;
+
+    state.active = target;
+    state.pending = false;
+    fireAlert(i, point, value, target);
+  }
+}
+
+void fireAlert(int ruleIndex, const DataPoint& point, float value, bool active) {
+  const AlertRule& rule = alertRules[ruleIndex];
+  const char* sensor = ALERT_SENSOR_NAMES[rule.sensor];
+  Serial.println(String(active ? "ALERTA" : "Fin de alerta") + " (regla " + String(ruleIndex) + ", nodo " +
+                 String(point.node) + "): " + sensor + "=" + String(value, 1) + " rango [" + String(rule.min, 1) +
+                 ", " + String(rule.max, 1) + "]");
+
+  if (rule.actions & ALERT_ACTION_GPIO) updateAlertOutputs();
+  if (rule.actions & ALERT_ACTION_LOG) {
+    logAlert(getFormattedDateTime() + "," + String(ruleIndex) + "," + String(point.node) + "," + sensor + "," +
+             String(value, 2) + "," + (active ? "on" : "off"));
+  }
+  if (rule.actions & (ALERT_ACTION_SSE | ALERT_ACTION_WEBHOOK)) {
+    String json = "{\"rule\":" + String(ruleIndex) + ",\"node\":" + String(point.node) + ",\"sensor\":\"" + sensor +
+                  "\",\"value\":" + String(value, 2) + ",\"min\":" + String(rule.min, 2) + ",\"max\":" +
+                  String(rule.max, 2) + ",\"active\":" + (active ? "true" : "false") + ",\"time\":\"" +
+                  getFormattedDateTime() + "\"}";
+    if (rule.actions & ALERT_ACTION_SSE) broadcastSse("alert", json);
+    if (rule.actions & ALERT_ACTION_WEBHOOK) queueWebhook(json);
+  }
+}
+
+// Cada pin queda en alto si alguna regla que lo usa está en alerta para algún nodo
+void updateAlertOutputs() {
+  for (int i = 0; i < alertRuleCount; i++) {
+    if (!(compiledAlerts[i].actions & ALERT_ACTION_GPIO)) continue;
+    bool level = false;
+    for (int j = 0; j < alertRuleCount; j++) {
+      if (!(compiledAlerts[j].actions & ALERT_ACTION_GPIO) || compiledAlerts[j].gpio != compiledAlerts[i].gpio) continue;
+      for (int n = 0; n < MAX_NODES; n++) level |= alertStates[j][n].active;
+    }
+    digitalWrite(compiledAlerts[i].gpio, level ? HIGH : LOW);
+  }
 }
 
-void saveSensorRanges() {
-  preferences.putFloat("tempMin", sensorRanges.tempMin);
-  preferences.putFloat("tempMax", sensorRanges.tempMax);
-  preferences.putFloat("humMin", sensorRanges.humMin);
-  preferences.putFloat("humMax", sensorRanges.humMax);
-  preferences.putFloat("luxMin", sensorRanges.luxMin);
-  preferences.putFloat("luxMax", sensorRanges.luxMax);
-  preferences.putInt("soilMin", sensorRanges.soilMin);
-  preferences.putInt("soilMax", sensorRanges.soilMax);
-
-  Serial.println("Rangos guardados en memoria flash.");
+void logAlert(const String& line) {
+  if (!sdCardAvailable) return;
+  bool exists = SD.exists(ALERT_LOG_FILE);
+  File file = SD.open(ALERT_LOG_FILE, FILE_APPEND);
+  if (!file) {
+    Serial.println("Error al abrir " + String(ALERT_LOG_FILE));
+    return;
+  }
+  if (!exists) file.println("timestamp,rule,node,sensor,value,state");
+  file.println(line);
+  file.close();
 }
 
-void checkSensorRanges() {
-  if (!sensorData.dataValid) return; // No verificar si no hay datos válidos
+void broadcastSse(const String& event, const String& data) {
+  String message = "event: " + event + "\ndata: " + data + "\n\n";
+  for (int i = 0; i < MAX_SSE_CLIENTS; i++) {
+    if (!sseClients[i].connected()) continue;
+    if (sseClients[i].print(message) == 0) sseClients[i].stop();
+  }
+}
 
-  bool tempInRange = (sensorData.temperature >= sensorRanges.tempMin && sensorData.temperature <= sensorRanges.tempMax);
-  bool humInRange = (sensorData.humidity >= sensorRanges.humMin && sensorData.humidity <= sensorRanges.humMax);
-  bool luxInRange = (sensorData.lux >= sensorRanges.luxMin && sensorData.lux <= sensorRanges.luxMax);
-  bool soilInRange = (sensorData.soilMoisture >= sensorRanges.soilMin && sensorData.soilMoisture <= sensorRanges.soilMax);
+// Cola hacia la tarea que hace los POST
+void initializeWebhook() {
+  webhookQueue = xQueueCreate(MAX_WEBHOOK_QUEUE, sizeof(WebhookMessage));
+  if (webhookQueue == nullptr) {
+    Serial.println("Webhook: sin memoria para la cola; avisos por webhook desactivados");
+    return;
+  }
+  xTaskCreatePinnedToCore(webhookTask, "webhook", 8192, nullptr, 1, nullptr, 0);
+}
 
-  if (tempInRange && humInRange && luxInRange && soilInRange) {
-    if (ledOnStartTime == 0) { // Si el LED no está ya encendido
-      digitalWrite(LED_PIN, HIGH);
-      ledOnStartTime = millis();
-      Serial.println("¡Todos los valores dentro del rango! LED encendido por 15 segundos.");
+// Tarea del núcleo 0: un POST por evento, en orden. Sin WiFi el evento espera a que vuelva la red;
+// un POST fallido no se reintenta (un receptor caído no debe acumular eventos viejos).
+void webhookTask(void* parameter) {
+  static WebhookMessage message; // Fuera de la pila de la tarea
+  for (;;) {
+    if (xQueueReceive(webhookQueue, &message, portMAX_DELAY) != pdTRUE) continue;
+    while (WiFi.status() != WL_CONNECTED) vTaskDelay(pdMS_TO_TICKS(500));
+
+    HTTPClient http;
+    http.setConnectTimeout(WEBHOOK_TIMEOUT_MS);
+    http.setTimeout(WEBHOOK_TIMEOUT_MS);
+    int code = -1;
+    if (http.begin(message.url)) {
+      http.addHeader("Content-Type", "application/json");
+      code = http.POST((uint8_t*)message.body, strlen(message.body));
+      http.end();
     }
-  } else {
-    if (ledOnStartTime != 0) { // Si el LED está encendido y los rangos ya no se cumplen
-      digitalWrite(LED_PIN, LOW);
-      ledOnStartTime = 0;
-      Serial.println("Valores fuera de rango. LED apagado.");
+    if (code >= 200 && code < 300) {
+      webhookSent++;
+    } else {
+      webhookFailed++;
+      Serial.printf("Webhook fallido (%d)\n", code);
+    }
+  }
+}
+
+// Solo copia el evento a la cola: loop() nunca espera a la red
+void queueWebhook(const String& body) {
+  if (webhookUrl.length() == 0 || webhookQueue == nullptr) return;
+  static WebhookMessage message; // Fuera de la pila de loop()
+  if (body.length() >= sizeof(message.body)) {
+    webhookDropped++;
+    return;
+  }
+  strlcpy(message.url, webhookUrl.c_str(), sizeof(message.url));
+  strlcpy(message.body, body.c_str(), sizeof(message.body));
+  if (xQueueSend(webhookQueue, &message, 0) != pdTRUE) { // Llena: se descarta el evento más antiguo
+    static WebhookMessage oldest;
+    xQueueReceive(webhookQueue, &oldest, 0);
+    webhookDropped++;
+    xQueueSend(webhookQueue, &message, 0);
+  }
+}
+
+void serviceAlertOutputs() {
+  if (millis() - lastSseKeepalive >= SSE_KEEPALIVE_INTERVAL) {
+    lastSseKeepalive = millis();
+    for (int i = 0; i < MAX_SSE_CLIENTS; i++) {
+      if (sseClients[i].connected() && sseClients[i].print(": ping\n\n") == 0) sseClients[i].stop();
     }
   }
 }
 
 
 void handleRoot() {
+  if (portal.active && !wifiConnected) { // Sin red todavía: el panel no tiene datos que mostrar
+    server.sendHeader("Location", "/portal");
+    server.send(302, "text/plain", "");
+    return;
+  }
   String html = R"(<!DOCTYPE html>
 <html lang='es'>
 <head>
@@ -690,6 +3076,16 @@ void handleRoot() {
                     <h3>Almacenamiento SD</h3>
                     <div class='sd-status' id='sd-status'>Verificando...</div>
                     <button onclick='downloadData()' class='download-btn'>📥 Descargar Datos</button>
+                    <div class='archive-controls'>
+                        <input type='month' id='archiveMonth' onchange='loadArchive()'>
+                        <button onclick='downloadMonth()' class='download-btn'>📦 Descargar mes (.gz)</button>
+                    </div>
+                    <div class='archive-list'>
+                        <table class='archive-table'>
+                            <thead><tr><th>Día</th><th>Registros</th><th>Temp. °C</th><th>Hum. %</th><th>Luz lux</th><th>Suelo %</th><th></th></tr></thead>
+                            <tbody id='archiveBody'><tr><td colspan='7'>Cargando...</td></tr></tbody>
+                        </table>
+                    </div>
                 </div>
             </div>
         </div>
@@ -854,6 +3250,31 @@ header h1 {
     background: #2980b9;
 }
 
+.archive-controls {
+    display: flex; gap: 10px; justify-content: center; flex-wrap: wrap;
+    margin: 15px 0 10px;
+}
+
+.archive-controls input {
+    padding: 8px; border: 1px solid #ccc; border-radius: 8px;
+}
+
+.archive-list {
+    max-height: 260px; overflow-y: auto;
+}
+
+.archive-table {
+    width: 100%; border-collapse: collapse; font-size: 0.85em;
+}
+
+.archive-table th, .archive-table td {
+    padding: 6px 8px; border-bottom: 1px solid #eee; text-align: center;
+}
+
+.archive-table a {
+    color: #3498db; text-decoration: none; margin: 0 4px;
+}
+
 .card {
     background: rgba(255, 255, 255, 0.95); border-radius: 12px;
     padding: 20px; box-shadow: 0 6px 20px rgba(0,0,0,0.1);
@@ -1084,6 +3505,9 @@ document.addEventListener('DOMContentLoaded', function() {
     initCharts();
     updateData();
     updateSDInfo();
+    const now = new Date();
+    document.getElementById('archiveMonth').value = `${now.getFullYear()}-${String(now.getMonth() + 1).padStart(2, '0')}`;
+    loadArchive();
     setInterval(updateData, 2000);
     setInterval(updateSDInfo, 10000);
 });
@@ -1120,16 +3544,22 @@ function initCharts() {
     });
 }
 
+// Marcas del receptor: 4 bits por sensor (0 temperatura, 1 humedad, 2 luz, 3 suelo)
+function suspect(d, sensor) {
+    return ((d.flags || 0) >> (4 * sensor)) & 0xF;
+}
+
 async function updateData() {
     try {
         const response = await fetch('/api/data');
         const data = await response.json();
         
         if (data.valid && data.lastUpdate > lastDataTime) {
-            document.getElementById('temperature').textContent = data.temperature.toFixed(1) + '°C';
-            document.getElementById('humidity').textContent = data.humidity.toFixed(1) + '%';
-            document.getElementById('light').textContent = Math.round(data.lux) + ' lux';
-            document.getElementById('soil').textContent = data.soilMoisture + '%';
+            const mark = sensor => suspect(data, sensor) ? ' ⚠' : ''; // Lectura marcada por el receptor
+            document.getElementById('temperature').textContent = data.temperature.toFixed(1) + '°C' + mark(0);
+            document.getElementById('humidity').textContent = data.humidity.toFixed(1) + '%' + mark(1);
+            document.getElementById('light').textContent = Math.round(data.lux) + ' lux' + mark(2);
+            document.getElementById('soil').textContent = data.soilMoisture + '%' + mark(3);
             // Muestra la hora del ESP32, no la del navegador, para reflejar el estado del ESP32
             document.getElementById('lastUpdate').textContent = new Date(data.lastUpdate).toLocaleTimeString();
             document.getElementById('status').textContent = 'En línea';
@@ -1188,12 +3618,13 @@ async function updateCharts() {
             });
 
             mainChart.data.labels = labels;
-            mainChart.data.datasets[0].data = history.map(d => d.temperature);
-            mainChart.data.datasets[1].data = history.map(d => d.humidity);
-            mainChart.data.datasets[2].data = history.map(d => d.soilMoisture);
+            // Las lecturas sospechosas quedan como huecos en la gráfica
+            mainChart.data.datasets[0].data = history.map(d => suspect(d, 0) ? null : d.temperature);
+            mainChart.data.datasets[1].data = history.map(d => suspect(d, 1) ? null : d.humidity);
+            mainChart.data.datasets[2].data = history.map(d => suspect(d, 3) ? null : d.soilMoisture);
             mainChart.update('none');
             lightChart.data.labels = labels;
-            lightChart.data.datasets[0].data = history.map(d => d.lux);
+            lightChart.data.datasets[0].data = history.map(d => suspect(d, 2) ? null : d.lux);
             lightChart.update('none');
         }
     } catch (error) {
@@ -1202,7 +3633,41 @@ async function updateCharts() {
 }
 
 function downloadData() {
-    window.open('/api/download-data', '_blank');
+    window.open('/api/download', '_blank');
+}
+
+// Primer y último día del mes elegido, como parámetros from/to
+function archiveMonthRange() {
+    const [year, month] = document.getElementById('archiveMonth').value.split('-').map(Number);
+    const lastDay = new Date(year, month, 0).getDate();
+    const prefix = `${year}-${String(month).padStart(2, '0')}`;
+    return `from=${prefix}-01&to=${prefix}-${String(lastDay).padStart(2, '0')}`;
+}
+
+async function loadArchive() {
+    const body = document.getElementById('archiveBody');
+    try {
+        const response = await fetch('/api/archive?' + archiveMonthRange());
+        const archive = await response.json();
+        const days = archive.days.sort((a, b) => b.date.localeCompare(a.date));
+        const range = (day, key) => day.min && day.min[key] !== null ? `${day.min[key].toFixed(1)} – ${day.max[key].toFixed(1)}` : '--';
+        body.innerHTML = days.length === 0
+            ? `<tr><td colspan='7'>${archive.indexing ? 'Indexando la SD...' : 'Sin datos este mes'}</td></tr>`
+            : days.map(day => `<tr><td>${day.date}</td><td>${day.records}</td>` +
+                `<td>${range(day, 'temperature')}</td><td>${range(day, 'humidity')}</td>` +
+                `<td>${range(day, 'lux')}</td><td>${range(day, 'soilMoisture')}</td>` +
+                (day.resolution === 'raw'
+                    ? `<td><a href='/api/download?from=${day.date}&to=${day.date}'>CSV</a>` +
+                      `<a href='/api/download?from=${day.date}&to=${day.date}&gzip=1'>.gz</a></td></tr>`
+                    : `<td>resumen horario</td></tr>`)).join('');
+    } catch (error) {
+        body.innerHTML = `<tr><td colspan='7'>Error de conexión</td></tr>`;
+        console.error('Error al obtener el archivo:', error);
+    }
+}
+
+function downloadMonth() {
+    window.open('/api/download?' + archiveMonthRange() + '&gzip=1', '_blank');
 }
 
 function openModal() {
@@ -1286,171 +3751,641 @@ async function saveRangesFromModal() {
 }
 
 void handleAPIData() {
-  DynamicJsonDocument doc(1024);
+  ApiBuffer buffer;
+  if (!buffer.data) return sendApiBusy();
+  ApiFormat format = requestedApiFormat();
+  if (format == API_FORMAT_CBOR) return sendApiBuffer(format, buffer.data, encodeDataCbor(buffer.data, API_BUFFER_SIZE));
+  if (format == API_FORMAT_BINARY) return sendApiBuffer(format, buffer.data, encodeDataBinary(buffer.data, API_BUFFER_SIZE));
+
+  JsonWriter json(buffer.text(), API_BUFFER_SIZE);
+  buildDataJson(json);
+  sendApiJson(200, json);
+}
+
+void handleAPIHistory() {
+  ApiBuffer buffer;
+  if (!buffer.data) return sendApiBusy();
+  ApiFormat format = requestedApiFormat();
+  if (format == API_FORMAT_CBOR) return sendApiBuffer(format, buffer.data, encodeHistoryCbor(buffer.data, API_BUFFER_SIZE));
+  if (format == API_FORMAT_BINARY) return sendApiBuffer(format, buffer.data, encodeHistoryBinary(buffer.data, API_BUFFER_SIZE));
+
+  JsonWriter json(buffer.text(), API_BUFFER_SIZE);
+  buildHistoryJson(json);
+  sendApiJson(200, json);
+}
+
+void buildDataJson(JsonWriter& json) {
+  json.beginObject();
+  json.field("temperature", sensorData.temperature);
+  json.field("humidity", sensorData.humidity);
+  json.field("lux", sensorData.lux);
+  json.field("soilMoisture", sensorData.soilMoisture);
+  json.field("flags", sensorData.flags);
+  if (sensorData.flags != 0) { // {"humidity":"zero"}: sensores sospechosos y motivos
+    json.beginObject("suspect");
+    for (int s = 0; s < ALERT_SENSORS; s++) {
+      if (!anomalySuspect(sensorData.flags, s)) continue;
+      char reasons[32];
+      anomalyReasons(sensorData.flags, s, reasons, sizeof(reasons));
+      json.field(ALERT_SENSOR_NAMES[s], reasons);
+    }
+    json.endObject();
+  }
+  json.field("lastUpdate", sensorData.lastUpdate);
+  json.field("valid", sensorData.dataValid);
+  json.field("uptime", millis());
+  json.field("sdAvailable", sdCardAvailable);
+  json.field("timeSynchronized", timeSynchronized); // Añadir estado de sincronización de hora
+  json.field("ledActive", ledOnStartTime > 0); // Estado actual del LED
+  json.endObject();
+}
 
-  doc["temperature"] = sensorData.temperature;
-  doc["humidity"] = sensorData.humidity;
-  doc["lux"] = sensorData.lux;
-  doc["soilMoisture"] = sensorData.soilMoisture;
-  doc["lastUpdate"] = sensorData.lastUpdate;
-  doc["valid"] = sensorData.dataValid;
-  doc["uptime"] = millis();
-  doc["sdAvailable"] = sdCardAvailable;
-  doc["timeSynchronized"] = timeSynchronized; // Añadir estado de sincronización de hora
-  doc["ledActive"] = (ledOnStartTime > 0); // Estado actual del LED
+void buildHistoryJson(JsonWriter& json) {
+  json.beginArray();
+  for (int i = 0; i < historyCount; i++) {
+    const DataPoint& point = dataHistory[(historyIndex - historyCount + i + MAX_HISTORY) % MAX_HISTORY];
+    json.beginObject();
+    json.field("timestamp", point.timestamp);
+    json.field("temperature", point.temperature);
+    json.field("humidity", point.humidity);
+    json.field("lux", point.lux);
+    json.field("soilMoisture", point.soilMoisture);
+    json.field("flags", point.flags);
+    json.endObject();
+  }
+  json.endArray();
+}
 
-  String response;
-  serializeJson(doc, response);
+// ?format= manda sobre Accept; sin ninguno de los dos, JSON como siempre
+ApiFormat requestedApiFormat() {
+  const String* format = server.argValue("format");
+  if (format) {
+    if (*format == "cbor") return API_FORMAT_CBOR;
+    if (*format == "bin") return API_FORMAT_BINARY;
+    return API_FORMAT_JSON;
+  }
+  const String* accept = server.headerValue("Accept");
+  if (accept && strstr(accept->c_str(), "application/cbor")) return API_FORMAT_CBOR;
+  if (accept && strstr(accept->c_str(), "application/octet-stream")) return API_FORMAT_BINARY;
+  return API_FORMAT_JSON;
+}
 
-  server.send(200, "application/json", response);
+void sendApiBuffer(ApiFormat format, const uint8_t* data, size_t length) {
+  if (length == 0) {
+    apiPoolStats.overflows++;
+    server.send(500, "text/plain", "Respuesta mayor que el búfer de la API");
+    return;
+  }
+  server.sendHeader("Vary", "Accept");
+  server.setContentLength(length);
+  server.send(200, format == API_FORMAT_CBOR ? "application/cbor" : "application/octet-stream", "");
+  server.sendContent((const char*)data, length);
 }
 
-void handleAPIHistory() {
-  DynamicJsonDocument doc(4096); // Ajustado para un historial más grande
-  JsonArray array = doc.to<JsonArray>();
+void sendApiJson(int code, const JsonWriter& json) {
+  if (json.overflow()) {
+    apiPoolStats.overflows++;
+    server.send(500, "text/plain", "Respuesta mayor que el búfer de la API");
+    return;
+  }
+  server.setContentLength(json.length());
+  server.send(code, "application/json", "");
+  server.sendContent(json.c_str(), json.length());
+}
+
+void sendApiBusy() {
+  server.send(503, "text/plain", "Sin búfer de respuesta libre");
+}
+
+uint32_t apiStatusBits() {
+  return (sensorData.dataValid ? API_STATUS_VALID : 0) | (sdCardAvailable ? API_STATUS_SD : 0) |
+         (timeSynchronized ? API_STATUS_TIME_SYNC : 0) | (ledOnStartTime > 0 ? API_STATUS_LED : 0);
+}
+
+ApiBinaryRecord toBinaryRecord(const DataPoint& point) {
+  ApiBinaryRecord record;
+  record.timestamp = point.timestamp;
+  record.temperature = point.temperature;
+  record.humidity = point.humidity;
+  record.lux = point.lux;
+  record.seq = point.seq;
+  record.soilMoisture = point.soilMoisture;
+  record.rssi = point.rssi;
+  record.flags = point.flags;
+  record.node = point.node;
+  record.snr = point.snr;
+  return record;
+}
+
+// Mismas claves que el JSON de /api/data; devuelve 0 si no cabe
+size_t encodeDataCbor(uint8_t* out, size_t capacity) {
+  CborWriter cbor(out, capacity);
+  cbor.map(sensorData.flags != 0 ? 12 : 11);
+  cbor.text("temperature");
+  cbor.number(sensorData.temperature);
+  cbor.text("humidity");
+  cbor.number(sensorData.humidity);
+  cbor.text("lux");
+  cbor.number(sensorData.lux);
+  cbor.text("soilMoisture");
+  cbor.integer(sensorData.soilMoisture);
+  cbor.text("flags");
+  cbor.integer(sensorData.flags);
+  if (sensorData.flags != 0) {
+    int suspects = 0;
+    for (int s = 0; s < ALERT_SENSORS; s++) suspects += anomalySuspect(sensorData.flags, s);
+    cbor.text("suspect");
+    cbor.map(suspects);
+    for (int s = 0; s < ALERT_SENSORS; s++) {
+      if (!anomalySuspect(sensorData.flags, s)) continue;
+      char reasons[32];
+      anomalyReasons(sensorData.flags, s, reasons, sizeof(reasons));
+      cbor.text(ALERT_SENSOR_NAMES[s]);
+      cbor.text(reasons);
+    }
+  }
+  cbor.text("lastUpdate");
+  cbor.integer(sensorData.lastUpdate);
+  cbor.text("valid");
+  cbor.boolean(sensorData.dataValid);
+  cbor.text("uptime");
+  cbor.integer(millis());
+  cbor.text("sdAvailable");
+  cbor.boolean(sdCardAvailable);
+  cbor.text("timeSynchronized");
+  cbor.boolean(timeSynchronized);
+  cbor.text("ledActive");
+  cbor.boolean(ledOnStartTime > 0);
+  return cbor.overflow ? 0 : cbor.length;
+}
 
+// {"fields":[...], "rows":[[timestamp, temperature, humidity, lux, soilMoisture, flags], ...]}
+size_t encodeHistoryCbor(uint8_t* out, size_t capacity) {
+  CborWriter cbor(out, capacity);
+  const size_t fields = sizeof(API_CBOR_HISTORY_FIELDS) / sizeof(API_CBOR_HISTORY_FIELDS[0]);
+  cbor.map(2);
+  cbor.text("fields");
+  cbor.array(fields);
+  for (size_t f = 0; f < fields; f++) cbor.text(API_CBOR_HISTORY_FIELDS[f]);
+  cbor.text("rows");
+  cbor.array(historyCount);
   for (int i = 0; i < historyCount; i++) {
-    int index = (historyIndex - historyCount + i + MAX_HISTORY) % MAX_HISTORY;
-    
-    JsonObject point = array.createNestedObject();
-    point["timestamp"] = dataHistory[index].timestamp;
-    point["temperature"] = dataHistory[index].temperature;
-    point["humidity"] = dataHistory[index].humidity;
-    point["lux"] = dataHistory[index].lux;
-    point["soilMoisture"] = dataHistory[index].soilMoisture;
+    const DataPoint& point = dataHistory[(historyIndex - historyCount + i + MAX_HISTORY) % MAX_HISTORY];
+    cbor.array(fields);
+    cbor.integer(point.timestamp);
+    cbor.number(point.temperature);
+    cbor.number(point.humidity);
+    cbor.number(point.lux);
+    cbor.integer(point.soilMoisture);
+    cbor.integer(point.flags);
   }
+  return cbor.overflow ? 0 : cbor.length;
+}
 
-  String response;
-  serializeJson(doc, response);
-  server.send(200, "application/json", response);
+// Cabecera y un registro con la lectura actual (timestamp = lastUpdate)
+size_t encodeDataBinary(uint8_t* out, size_t capacity) {
+  ApiBinaryHeader header;
+  size_t length = sizeof(header) + sizeof(ApiBinaryRecord);
+  if (length > capacity) return 0;
+  memcpy(header.magic, API_BINARY_MAGIC, sizeof(header.magic));
+  header.recordSize = sizeof(ApiBinaryRecord);
+  header.count = 1;
+  header.uptime = millis();
+  header.status = apiStatusBits();
+  ApiBinaryRecord record = toBinaryRecord(currentDataPoint());
+  memcpy(out, &header, sizeof(header));
+  memcpy(out + sizeof(header), &record, sizeof(record));
+  return length;
 }
 
-void handleSDInfo() {
-  DynamicJsonDocument doc(512);
-  doc["available"] = sdCardAvailable;
-  if (sdCardAvailable) {
-    doc["cardSize"] = SD.cardSize() / (1024 * 1024);
-    doc["usedSpace"] = SD.usedBytes() / (1024 * 1024);
-    doc["currentFile"] = currentLogFile;
-
-    // Contar registros en el archivo actual
-    int totalEntries = 0;
-    File file = SD.open(currentLogFile, FILE_READ);
-    if (file) {
-      // Saltar la primera línea (cabecera)
-      String header = file.readStringUntil('\n');
-      while (file.available()) {
-        String line = file.readStringUntil('\n');
-        if (line.length() > 0) { // Contar solo líneas con contenido
-          totalEntries++;
+size_t encodeHistoryBinary(uint8_t* out, size_t capacity) {
+  ApiBinaryHeader header;
+  size_t length = sizeof(header) + historyCount * sizeof(ApiBinaryRecord);
+  if (length > capacity) return 0;
+  memcpy(header.magic, API_BINARY_MAGIC, sizeof(header.magic));
+  header.recordSize = sizeof(ApiBinaryRecord);
+  header.count = historyCount;
+  header.uptime = millis();
+  header.status = apiStatusBits();
+  memcpy(out, &header, sizeof(header));
+  for (int i = 0; i < historyCount; i++) {
+    ApiBinaryRecord record = toBinaryRecord(dataHistory[(historyIndex - historyCount + i + MAX_HISTORY) % MAX_HISTORY]);
+    memcpy(out + sizeof(header) + i * sizeof(record), &record, sizeof(record));
+  }
+  return length;
+}
+
+// GET /api/encode-bench?n=100: codifica /api/data y /api/history n veces en cada formato (sin enviar)
+// y da el tiempo medio y el tamaño, con el historial actual
+void handleAPIEncodeBench() {
+  ApiBuffer response, scratch;
+  if (!response.data || !scratch.data) return sendApiBusy();
+  int n = server.hasArg("n") ? constrain(server.arg("n").toInt(), 1L, 1000L) : 100;
+  JsonWriter json(response.text(), API_BUFFER_SIZE);
+  json.beginObject();
+  json.field("iterations", n);
+  json.field("historyPoints", historyCount);
+  const char* names[] = {"json", "cbor", "bin"};
+
+  for (int endpoint = 0; endpoint < 2; endpoint++) {
+    json.beginObject(endpoint == 0 ? "data" : "history");
+    for (int format = API_FORMAT_JSON; format <= API_FORMAT_BINARY; format++) {
+      size_t bytes = 0;
+      int64_t start = esp_timer_get_time();
+      for (int i = 0; i < n; i++) {
+        if (format == API_FORMAT_JSON) {
+          JsonWriter encoded(scratch.text(), API_BUFFER_SIZE);
+          endpoint == 0 ? buildDataJson(encoded) : buildHistoryJson(encoded);
+          bytes = encoded.length();
+        } else if (format == API_FORMAT_CBOR) {
+          bytes = endpoint == 0 ? encodeDataCbor(scratch.data, API_BUFFER_SIZE) : encodeHistoryCbor(scratch.data, API_BUFFER_SIZE);
+        } else {
+          bytes = endpoint == 0 ? encodeDataBinary(scratch.data, API_BUFFER_SIZE) : encodeHistoryBinary(scratch.data, API_BUFFER_SIZE);
         }
       }
-      file.close();
+      json.beginObject(names[format]);
+      json.field("us", (float)(esp_timer_get_time() - start) / n);
+      json.field("bytes", (unsigned long)bytes);
+      json.endObject();
     }
-    doc["totalEntries"] = totalEntries;
-  } else {
-    doc["totalEntries"] = 0;
+    json.endObject();
   }
+  json.endObject();
+  sendApiJson(200, json);
+}
 
-  String response;
-  serializeJson(doc, response);
+// Heap libre, bloque libre más grande (fragmentación) y uso de los búferes de respuesta
+void handleAPISystem() {
+  ApiBuffer buffer;
+  if (!buffer.data) return sendApiBusy();
+  JsonWriter json(buffer.text(), API_BUFFER_SIZE);
+  json.beginObject();
+  json.field("uptime", millis());
+  json.field("freeHeap", ESP.getFreeHeap());
+  json.field("minFreeHeap", ESP.getMinFreeHeap());
+  json.field("maxAllocHeap", ESP.getMaxAllocHeap());
+  json.beginObject("responsePool");
+  json.field("buffers", API_POOL_BUFFERS);
+  json.field("bufferSize", (unsigned long)API_BUFFER_SIZE);
+  json.field("acquired", apiPoolStats.acquired);
+  json.field("exhausted", apiPoolStats.exhausted);
+  json.field("overflows", apiPoolStats.overflows);
+  json.endObject();
+  json.endObject();
+  sendApiJson(200, json);
+}
 
-  server.send(200, "application/json", response);
+void handleSDInfo() {
+  ApiBuffer buffer;
+  if (!buffer.data) return sendApiBusy();
+  JsonWriter json(buffer.text(), API_BUFFER_SIZE);
+  json.beginObject();
+  json.field("available", sdCardAvailable);
+  if (sdCardAvailable) {
+    json.field("cardSize", (unsigned long)(SD.cardSize() / (1024 * 1024)));
+    json.field("usedSpace", (unsigned long)(SD.usedBytes() / (1024 * 1024)));
+    json.field("currentFile", currentLogFile.c_str());
+
+    // Registros del día en curso según el índice, sin releer el archivo
+    json.field("totalEntries", archiveToday.records);
+    json.field("indexing", archiveScan.active);
+    json.field("freePercent", sdFreePercent());
+    json.field("lowSpace", retention.lowSpace);
+    json.field("writeErrors", sdWriteErrors);
+    json.field("daysRolledUp", retention.daysRolledUp);
+    json.field("monthsDeleted", retention.monthsDeleted);
+    json.field("journal", journalReady);
+    json.field("recoveredLines", sdJournal.stats().replayed);
+    json.field("droppedLines", sdJournal.stats().droppedLines);
+    json.field("preallocated", SD_PREALLOCATE_LOGS);
+    json.beginObject("writeLatency");
+    json.field("samples", logWriteLatency.samples);
+    json.field("p50Us", writeLatencyPercentile(0.50));
+    json.field("p99Us", writeLatencyPercentile(0.99));
+    json.field("maxUs", logWriteLatency.maxUs);
+    json.endObject();
+  } else {
+    json.field("totalEntries", 0);
+  }
+  json.endObject();
+  sendApiJson(200, json);
 }
 
-void handleDownloadData() {
+// GET /api/download                       archivo del día en curso
+// GET /api/download?from=AAAA-MM-DD&to=AAAA-MM-DD  días concatenados con una sola cabecera
+// Range: bytes=a-b | a- | -n reanuda una descarga sin comprimir (206 Partial Content).
+// ?gzip=1 comprime al vuelo (application/gzip, chunked); en ese modo se ignora Range.
+void handleDownload() {
   if (!sdCardAvailable) {
     server.send(404, "text/plain", "SD Card no disponible");
     return;
   }
 
-  // Si no hay un archivo de log actual, intentar abrir el último o el primero disponible
-  if (currentLogFile == "" || !SD.exists(currentLogFile)) {
-      Serial.println("currentLogFile no establecido o no existe, intentando encontrar un archivo CSV.");
-      File root = SD.open("/data");
-      if (root) {
-          File file = root.openNextFile();
-          while(file){
-              String fileName = file.name();
-              if (!file.isDirectory() && fileName.endsWith(".csv")) {
-                  currentLogFile = "/data/" + fileName;
-                  Serial.println("Usando archivo: " + currentLogFile);
-                  break;
-              }
-              file = root.openNextFile();
-          }
-          root.close();
-      }
-      if (currentLogFile == "" || !SD.exists(currentLogFile)) {
-          server.send(404, "text/plain", "No se encontró ningún archivo de datos en la SD.");
-          return;
+  int count;
+  String filename;
+  if (server.hasArg("from") || server.hasArg("to")) {
+    time_t fromDay = parseDateArg(server.arg("from"));
+    time_t toDay = server.hasArg("to") ? parseDateArg(server.arg("to")) : fromDay;
+    if (fromDay < 0 || toDay < 0 || toDay < fromDay) {
+      server.send(400, "text/plain", "Fechas inválidas: use from=AAAA-MM-DD&to=AAAA-MM-DD");
+      return;
+    }
+    if ((toDay - fromDay) / SECONDS_PER_DAY >= MAX_DOWNLOAD_DAYS) {
+      server.send(400, "text/plain", "Máximo " + String(MAX_DOWNLOAD_DAYS) + " días por descarga");
+      return;
+    }
+    count = buildDownloadSegments(fromDay, toDay);
+    filename = "sensors_" + server.arg("from") + "_" + (server.hasArg("to") ? server.arg("to") : server.arg("from")) + ".csv";
+  } else {
+    // Sin archivo del día (hora aún sin sincronizar) se entrega el día más reciente del índice
+    String path = currentLogFile;
+    if (path == "" || !SD.exists(path)) {
+      uint32_t latest = 0;
+      File index = SD.open(ARCHIVE_INDEX_FILE, FILE_READ);
+      ArchiveDay entry;
+      while (index && index.read((uint8_t*)&entry, sizeof(ArchiveDay)) == sizeof(ArchiveDay)) {
+        latest = max(latest, entry.day);
       }
+      if (index) index.close();
+      path = latest > 0 ? logFileForEpoch(latest) : "";
+    }
+    count = 0;
+    if (path != "") addDownloadSegment(count, path, false);
+    filename = path.substring(path.lastIndexOf('/') + 1);
+  }
+  if (count == 0) {
+    server.send(404, "text/plain", "No se encontró ningún archivo de datos en la SD.");
+    return;
   }
 
-  File file = SD.open(currentLogFile, FILE_READ);
-  if (!file) {
-    server.send(404, "text/plain", "Archivo no encontrado: " + currentLogFile);
+  // Tamaño fijado al empezar: lo que se escriba en el archivo del día durante la descarga queda fuera
+  uint32_t total = 0;
+  for (int i = 0; i < count; i++) total += downloadSegments[i].length;
+  if (total == 0) { // Archivos vacíos: sin bytes no hay rango posible (end = total - 1 daría la vuelta)
+    server.send(404, "text/plain", "Los archivos de datos del intervalo están vacíos.");
     return;
   }
 
-  server.setContentLength(file.size());
-  server.sendHeader("Content-Disposition", "attachment; filename=" + currentLogFile.substring(currentLogFile.lastIndexOf('/') + 1));
-  server.send(200, "text/csv", "");
-  // Envía la cabecera, luego los datos
+  bool gzip = server.arg("gzip") == "1";
+  if (gzip) {
+    server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+    server.sendHeader("Content-Disposition", "attachment; filename=" + filename + ".gz");
+    server.send(200, "application/gzip", "");
+    uint32_t sent = sendDownloadSegments(count, 0, total, true);
+    Serial.println("Descarga gzip de " + filename + ": " + String(sent) + " bytes -> " + String(downloadGzip.totalOut()) + " bytes");
+    return;
+  }
 
-  WiFiClient client = server.client();
-  if (client.connected()) { // Asegurarse de que el cliente aún está conectado
-    size_t bytesSent = 0;
-    uint8_t buffer[1024];
-    while (file.available() && client.connected()) {
-      size_t bytesRead = file.read(buffer, sizeof(buffer));
-      bytesSent += client.write(buffer, bytesRead);
-    }
-    Serial.printf("Descarga de %s completa. Bytes enviados: %zu\n", currentLogFile.c_str(), bytesSent);
-  } else {
-    Serial.println("Cliente desconectado durante la descarga.");
+  uint32_t start = 0, end = total - 1;
+  int range = parseRangeHeader(server.header("Range"), total, start, end);
+  if (range < 0) {
+    server.sendHeader("Content-Range", "bytes */" + String(total));
+    server.send(416, "text/plain", "Rango no satisfacible");
+    return;
   }
-  
+  server.sendHeader("Accept-Ranges", "bytes");
+  server.sendHeader("Content-Disposition", "attachment; filename=" + filename);
+  if (range > 0) {
+    server.sendHeader("Content-Range", "bytes " + String(start) + "-" + String(end) + "/" + String(total));
+  }
+  server.setContentLength(end - start + 1);
+  server.send(range > 0 ? 206 : 200, "text/csv", "");
+
+  uint32_t sent = sendDownloadSegments(count, start, end - start + 1, false);
+  Serial.println("Descarga de " + filename + " (" + String(start) + "-" + String(end) + " de " + String(total) + ") " +
+                 (sent == end - start + 1 ? "completa" : "interrumpida") + ". Bytes enviados: " + String(sent));
+}
+
+// GET /api/archive[?from=AAAA-MM-DD&to=AAAA-MM-DD]
+// {"indexing":false,"days":[{"date":"2026-01-01","file":"/data/sensors_2026-01-01.csv","size":301234,
+//   "records":5760,"min":{"temperature":12.1,...},"max":{...}}, ...]} en el orden del índice.
+// Se envía por partes leyendo el índice, sin recorrer /data ni cargar la lista completa en RAM.
+void handleAPIArchive() {
+  if (!sdCardAvailable) {
+    server.send(404, "application/json", "{\"days\":[]}");
+    return;
+  }
+  time_t fromDay = server.hasArg("from") ? parseDateArg(server.arg("from")) : 0;
+  time_t toDay = server.hasArg("to") ? parseDateArg(server.arg("to")) : 0x7fffffff;
+  if (fromDay < 0 || toDay < 0) {
+    server.send(400, "text/plain", "Fechas inválidas: use from=AAAA-MM-DD&to=AAAA-MM-DD");
+    return;
+  }
+
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, "application/json", "");
+  server.sendContent(String("{\"indexing\":") + (archiveScan.active ? "true" : "false") + ",\"days\":[");
+
+  bool first = true;
+  bool todayListed = false;
+  File index = SD.open(ARCHIVE_INDEX_FILE, FILE_READ);
+  ArchiveDay entry;
+  String chunk = "";
+  while (index && index.read((uint8_t*)&entry, sizeof(ArchiveDay)) == sizeof(ArchiveDay)) {
+    if (entry.day == archiveToday.day) { // El día en curso va con los datos en RAM
+      entry = archiveToday;
+      todayListed = true;
+    }
+    if (entry.day < (uint32_t)fromDay || entry.day > (uint32_t)toDay) continue;
+    chunk += (first ? "" : ",") + archiveDayJson(entry);
+    first = false;
+    if (chunk.length() > 1024) {
+      server.sendContent(chunk);
+      chunk = "";
+    }
+  }
+  if (index) index.close();
+  if (!todayListed && archiveToday.records > 0 && archiveToday.day >= (uint32_t)fromDay &&
+      archiveToday.day <= (uint32_t)toDay) {
+    chunk += (first ? "" : ",") + archiveDayJson(archiveToday);
+  }
+  server.sendContent(chunk + "]}");
+}
+
+String archiveDayJson(const ArchiveDay& entry) {
+  String path = logFileForEpoch(entry.day);
+  String date = path.substring(path.indexOf('_') + 1, path.lastIndexOf('.'));
+  // size 0: el día ya se resumió en filas horarias (ver serviceRetention())
+  String json = "{\"date\":\"" + date + "\",\"file\":\"" + (entry.size > 0 ? path : hourlyFileForEpoch(entry.day)) +
+                "\",\"resolution\":\"" + (entry.size > 0 ? "raw" : "hourly") + "\",\"size\":" + String(entry.size) +
+                ",\"records\":" + String(entry.records);
+  const char* bounds[] = {"min", "max"};
+  for (int b = 0; b < 2 && entry.records > 0; b++) {
+    json += ",\"" + String(bounds[b]) + "\":{";
+    for (int s = 0; s < ALERT_SENSORS; s++) {
+      float value = b == 0 ? entry.minValue[s] : entry.maxValue[s];
+      bool empty = entry.minValue[s] > entry.maxValue[s]; // Solo lecturas sospechosas
+      json += (s > 0 ? ",\"" : "\"") + String(ALERT_SENSOR_NAMES[s]) + "\":" + (empty ? String("null") : String(value, 1));
+    }
+    json += "}";
+  }
+  return json + "}";
+}
+
+// Cabecera CSV única seguida del cuerpo de cada archivo diario existente entre ambas fechas
+int buildDownloadSegments(time_t fromDay, time_t toDay) {
+  int count = 1;
+  DownloadSegment& header = downloadSegments[0];
+  header.path[0] = '\0';
+  header.offset = 0;
+  header.length = strlen(LOG_CSV_HEADER) + 1;
+  for (time_t day = fromDay; day <= toDay; day += SECONDS_PER_DAY) {
+    addDownloadSegment(count, logFileForEpoch(day), true);
+  }
+  return count > 1 ? count : 0;
+}
+
+// Los archivos antiguos sin columnas node/seq/rssi/snr se entregan tal cual: sus líneas
+// simplemente tienen menos campos que la cabecera común
+bool addDownloadSegment(int& count, const String& path, bool skipHeader) {
+  File file = SD.open(path, FILE_READ);
+  if (!file) return false;
+  DownloadSegment& segment = downloadSegments[count];
+  strlcpy(segment.path, path.c_str(), sizeof(segment.path));
+  segment.offset = skipHeader ? file.readStringUntil('\n').length() + 1 : 0;
   file.close();
+  uint32_t size = sdCardFs.size(path.c_str()); // Sin el relleno del archivo de hoy
+  if (segment.offset >= size) return false; // Solo cabecera
+  segment.length = size - segment.offset;
+  count++;
+  return true;
 }
 
-void handleAPI_GetRanges() {
-  DynamicJsonDocument doc(512);
-  doc["tempMin"] = sensorRanges.tempMin;
-  doc["tempMax"] = sensorRanges.tempMax;
-  doc["humMin"] = sensorRanges.humMin;
-  doc["humMax"] = sensorRanges.humMax;
-  doc["luxMin"] = sensorRanges.luxMin;
-  doc["luxMax"] = sensorRanges.luxMax;
-  doc["soilMin"] = sensorRanges.soilMin;
-  doc["soilMax"] = sensorRanges.soilMax;
+// 0 = sin Range (o con varios rangos, que se responden completos), 1 = rango válido, -1 = fuera del archivo
+int parseRangeHeader(const String& header, uint32_t total, uint32_t& start, uint32_t& end) {
+  if (!header.startsWith("bytes=") || header.indexOf(',') >= 0) return 0;
+  int dash = header.indexOf('-');
+  if (dash < 0) return 0;
+  String first = header.substring(6, dash);
+  String last = header.substring(dash + 1);
+  first.trim();
+  last.trim();
+  if (first.length() == 0) { // Sufijo: los últimos n bytes
+    uint32_t suffix = last.toInt();
+    if (suffix == 0) return -1;
+    start = suffix >= total ? 0 : total - suffix;
+    end = total - 1;
+    return 1;
+  }
+  start = first.toInt();
+  end = last.length() > 0 ? min((uint32_t)last.toInt(), total - 1) : total - 1;
+  if (start >= total || end < start) return -1;
+  return 1;
+}
 
-  String response;
-  serializeJson(doc, response);
-  server.send(200, "application/json", response);
+// "AAAA-MM-DD" a la medianoche (hora local, como logFileForEpoch); -1 si no es válida
+time_t parseDateArg(const String& text) {
+  int year, month, day;
+  if (sscanf(text.c_str(), "%d-%d-%d", &year, &month, &day) != 3 || month < 1 || month > 12 || day < 1 || day > 31) {
+    return -1;
+  }
+  struct tm date = {};
+  date.tm_year = year - 1900;
+  date.tm_mon = month - 1;
+  date.tm_mday = day;
+  return mktime(&date); // Sin zona horaria configurada mktime trabaja en UTC, igual que gmtime
 }
 
-void handleAPI_SetRanges() {
-  DynamicJsonDocument doc(512);
-  String requestBody = server.arg("plain");
-  DeserializationError error = deserializeJson(doc, requestBody);
+// Envía `length` bytes del flujo desde `start`, trozo a trozo. Entre trozos atiende la radio para
+// que las tramas LoRa se sigan registrando durante descargas largas. Retorna los bytes leídos.
+uint32_t sendDownloadSegments(int count, uint32_t start, uint32_t length, bool gzip) {
+  WiFiClient client = server.client();
+  uint8_t buffer[DOWNLOAD_SLICE];
+  uint32_t sent = 0;
+  if (gzip) downloadGzip.begin(sendGzipChunk, nullptr);
+
+  uint32_t segmentStart = 0;
+  for (int i = 0; i < count && sent < length && client.connected(); i++) {
+    const DownloadSegment& segment = downloadSegments[i];
+    uint32_t segmentEnd = segmentStart + segment.length;
+    if (start + sent >= segmentEnd) {
+      segmentStart = segmentEnd;
+      continue;
+    }
+
+    uint32_t position = start + sent - segmentStart; // Dentro del tramo
+    File file;
+    if (segment.path[0] != '\0') {
+      file = SD.open(segment.path, FILE_READ);
+      if (!file || !file.seek(segment.offset + position)) {
+        Serial.println("Error al leer " + String(segment.path) + " durante la descarga");
+        break;
+      }
+    }
+
+    while (position < segment.length && sent < length && client.connected()) {
+      size_t chunk = min((uint32_t)DOWNLOAD_SLICE, min(segment.length - position, length - sent));
+      if (segment.path[0] == '\0') {
+        String header = String(LOG_CSV_HEADER) + "\n";
+        memcpy(buffer, header.c_str() + position, chunk);
+      } else {
+        chunk = file.read(buffer, chunk);
+        if (chunk == 0) break; // Archivo truncado desde que se midió
+      }
+
+      if (gzip) {
+        downloadGzip.write(buffer, chunk);
+      } else if (client.write(buffer, chunk) != chunk) {
+        break;
+      }
+      position += chunk;
+      sent += chunk;
+      processLoRaData();
+    }
+    if (file) file.close();
+    segmentStart = segmentEnd;
+  }
+
+  if (gzip && client.connected()) downloadGzip.finish();
+  return sent;
+}
+
+void sendGzipChunk(const uint8_t* data, size_t length, void* context) {
+  server.sendContent((const char*)data, length);
+}
+
+void handleAPI_GetRanges() {
+  ApiBuffer buffer;
+  if (!buffer.data) return sendApiBusy();
+  JsonWriter json(buffer.text(), API_BUFFER_SIZE);
+  json.beginObject();
+  json.field("tempMin", sensorRanges.tempMin);
+  json.field("tempMax", sensorRanges.tempMax);
+  json.field("humMin", sensorRanges.humMin);
+  json.field("humMax", sensorRanges.humMax);
+  json.field("luxMin", sensorRanges.luxMin);
+  json.field("luxMax", sensorRanges.luxMax);
+  json.field("soilMin", sensorRanges.soilMin);
+  json.field("soilMax", sensorRanges.soilMax);
+  json.endObject();
+  sendApiJson(200, json);
+}
 
-  if (error) {
-    Serial.print(F("deserializeJson() failed: "));
-    Serial.println(error.f_str());
+void handleAPI_SetRanges() {
+  // Campo ausente = 0, como antes con ArduinoJson; la validación de abajo lo rechaza
+  float newTempMin = 0, newTempMax = 0, newHumMin = 0, newHumMax = 0, newLuxMin = 0, newLuxMax = 0;
+  int newSoilMin = 0, newSoilMax = 0;
+  const char* keys[] = {"tempMin", "tempMax", "humMin", "humMax", "luxMin", "luxMax"};
+  float* targets[] = {&newTempMin, &newTempMax, &newHumMin, &newHumMax, &newLuxMin, &newLuxMax};
+
+  const String* body = server.argValue("plain");
+  JsonFlatReader reader(body ? body->c_str() : "", body ? body->length() : 0);
+  JsonField field;
+  double value;
+  while (reader.next(field)) {
+    if (!field.number(value)) continue;
+    for (int i = 0; i < 6; i++) {
+      if (field.is(keys[i])) *targets[i] = value;
+    }
+    if (field.is("soilMin")) newSoilMin = (int)value;
+    if (field.is("soilMax")) newSoilMax = (int)value;
+  }
+  if (reader.error()) {
+    Serial.println("POST /api/ranges: JSON inválido");
     server.send(400, "application/json", "{\"success\":false,\"message\":\"JSON inválido\"}");
     return;
   }
 
-  float newTempMin = doc["tempMin"].as<float>();
-  float newTempMax = doc["tempMax"].as<float>();
-  float newHumMin = doc["humMin"].as<float>();
-  float newHumMax = doc["humMax"].as<float>();
-  float newLuxMin = doc["luxMin"].as<float>();
-  float newLuxMax = doc["luxMax"].as<float>();
-  int newSoilMin = doc["soilMin"].as<int>();
-  int newSoilMax = doc["soilMax"].as<int>();
-
   // Server-side validation
   if (newTempMin >= newTempMax ||
       newHumMin >= newHumMax ||
@@ -1474,12 +4409,480 @@ void handleAPI_SetRanges() {
   sensorRanges.soilMin = newSoilMin;
   sensorRanges.soilMax = newSoilMax;
 
-  saveSensorRanges();
+  saveConfig();
   server.send(200, "application/json", "{\"success\":true,\"message\":\"Rangos actualizados con éxito.\"}");
   Serial.println("Rangos recibidos y actualizados desde la web.");
 }
 
+// Devuelve en CSV los registros del historial en RAM posteriores a ?since=<epoch>, con el mismo
+// formato que los archivos diarios, para que otro receptor o la herramienta de fusión los incorpore.
+void handleAPISync() {
+  if (!timeSynchronized) {
+    server.send(503, "text/plain", "Hora no sincronizada");
+    return;
+  }
+
+  const String* sinceArg = server.argValue("since");
+  time_t since = sinceArg ? (time_t)sinceArg->toInt() : 0;
+  time_t nowEpoch = clockNow();
+  unsigned long nowMillis = millis();
+
+  // Todo el historial cabe en un búfer de la API (MAX_HISTORY líneas de ~75 bytes)
+  ApiBuffer buffer;
+  if (!buffer.data) return sendApiBusy();
+  char* out = buffer.text();
+  size_t length = strlcpy(out, LOG_CSV_HEADER, API_BUFFER_SIZE);
+  out[length++] = '\n';
+  for (int i = 0; i < historyCount; i++) {
+    int index = (historyIndex - historyCount + i + MAX_HISTORY) % MAX_HISTORY;
+    time_t pointEpoch = nowEpoch - (time_t)((nowMillis - dataHistory[index].timestamp) / 1000);
+    if (pointEpoch < since) continue;
+
+    char timestamp[20];
+    formatTimestamp(pointEpoch, timestamp);
+    size_t line = writeLogLine(out + length, API_BUFFER_SIZE - length - 1, timestamp, dataHistory[index]);
+    if (line == 0) {
+      apiPoolStats.overflows++;
+      server.send(500, "text/plain", "Respuesta mayor que el búfer de la API");
+      return;
+    }
+    length += line;
+    out[length++] = '\n';
+  }
+  server.setContentLength(length);
+  server.send(200, "text/csv", "");
+  server.sendContent(out, length);
+}
+
+void handleAPILink() {
+  ApiBuffer buffer;
+  if (!buffer.data) return sendApiBusy();
+  JsonWriter json(buffer.text(), API_BUFFER_SIZE);
+  json.beginObject();
+  json.beginObject("adr");
+  json.field("rate", adrState.rate);
+  json.field("sf", ADR_RATES[adrState.rate].sf);
+  json.field("bandwidthKHz", (float)(loraBandwidthHz(ADR_RATES[adrState.rate].bwCode) / 1000.0));
+  json.field("targetRate", adrState.targetRate);
+  json.field("airtimeMs", loraAirtimeMs(ADR_RATES[adrState.rate], 40)); // Trama típica de sensores
+  json.endObject();
+  json.beginArray("nodes");
+
+  for (int i = 0; i < MAX_NODES; i++) {
+    const LinkStats& stats = linkStats[i];
+    if (stats.node == -1) continue;
+
+    json.beginObject();
+    json.field("node", stats.node);
+    json.field("packets", stats.packets);
+    json.field("readings", stats.readings);
+    json.field("lostReadings", stats.lost);
+    json.field("duplicates", stats.duplicates);
+    // Pérdidas y recibidas en lecturas: con tramas en lote un salto de secuencia no es una trama
+    json.field("readingLossRate", (stats.readings + stats.lost) > 0 ? (float)stats.lost / (stats.readings + stats.lost) : 0.0f);
+    json.field("rssiMean", stats.rssiMean);
+    json.field("rssiMin", stats.rssiMin);
+    json.field("rssiP10", stats.rssiP10);
+    json.field("snrMean", stats.snrMean);
+    json.field("snrMin", stats.snrMin);
+    json.field("snrP10", stats.snrP10);
+    json.field("meanIntervalMs", stats.meanInterval);
+    json.field("jitterMs", stats.jitter);
+    json.field("lastSeenMs", millis() - stats.lastArrival);
+    json.field("adrSamples", stats.adrSamples);
+    json.field("adrRecommendedRate", adrRecommendedRate(stats.snrP10, adrState.rate));
+    json.field("configPending", stats.pendingConfig.length() > 0);
+    json.field("suspectReadings", stats.suspect);
+    json.endObject();
+  }
+  json.endArray();
+  json.endObject();
+  sendApiJson(200, json);
+}
+
+// {"node":1,"temperature":0.3,"humidity":2,"luxPercent":10,"soil":2,"heartbeat":300}
+// Se entrega al nodo tras su siguiente trama; los campos ausentes no se cambian en el nodo.
+void handleAPINodeConfig() {
+  const char* keys[] = {"temperature", "humidity", "luxPercent", "soil", "heartbeat"};
+  const char* codes[] = {"T", "H", "L", "S", "HB"};
+  bool present[5] = {};
+  float values[5] = {};
+  bool hasNode = false;
+  int node = 0;
+
+  const String* body = server.argValue("plain");
+  JsonFlatReader reader(body ? body->c_str() : "", body ? body->length() : 0);
+  JsonField field;
+  double value;
+  while (reader.next(field)) {
+    if (field.is("node")) {
+      hasNode = true;
+      node = field.number(value) ? (int)value : 0;
+    }
+    for (int i = 0; i < 5; i++) {
+      if (!field.is(keys[i])) continue;
+      present[i] = true;
+      values[i] = field.number(value) ? value : 0; // Como as<float>() de ArduinoJson
+    }
+  }
+  if (reader.error() || !hasNode) {
+    server.send(400, "application/json", "{\"success\":false,\"message\":\"JSON inválido\"}");
+    return;
+  }
+
+  char config[80] = "CFG:";
+  size_t length = 4;
+  for (int i = 0; i < 5; i++) {
+    if (!present[i]) continue;
+    if (values[i] < 0) {
+      server.send(400, "application/json", "{\"success\":false,\"message\":\"Los umbrales no pueden ser negativos.\"}");
+      return;
+    }
+    char number[48];
+    if (i == 4) snprintf(number, sizeof(number), "%ld", (long)values[i]);
+    else dtostrf(values[i], 4, 2, number); // Igual que String(valor, 2)
+    length += snprintf(config + length, sizeof(config) - length, "%s%s=%s", length > 4 ? "," : "", codes[i], number);
+    if (length >= sizeof(config)) {
+      server.send(400, "application/json", "{\"success\":false,\"message\":\"Umbrales fuera de rango.\"}");
+      return;
+    }
+  }
+  if (length == 4) {
+    server.send(400, "application/json", "{\"success\":false,\"message\":\"Sin umbrales que enviar.\"}");
+    return;
+  }
+
+  linkStatsForNode(node)->pendingConfig = config; // Se guarda hasta que el nodo lo confirme
+  Serial.print("Nodo ");
+  Serial.print(node);
+  Serial.print(": configuración pendiente ");
+  Serial.println(config);
+  server.send(200, "application/json", "{\"success\":true,\"message\":\"Se enviará tras la próxima trama del nodo.\"}");
+}
+
+void handleAPI_GetRules() {
+  ApiBuffer buffer;
+  if (!buffer.data) return sendApiBusy();
+  JsonWriter json(buffer.text(), API_BUFFER_SIZE);
+  json.beginObject();
+  json.field("webhook", webhookUrl.c_str());
+  json.field("webhookSent", webhookSent);
+  json.field("webhookFailed", webhookFailed);
+  json.field("webhookDropped", webhookDropped);
+  int sseCount = 0;
+  for (int i = 0; i < MAX_SSE_CLIENTS; i++) sseCount += sseClients[i].connected() ? 1 : 0;
+  json.field("sseClients", sseCount);
+
+  json.beginArray("rules");
+  for (int i = 0; i < alertRuleCount; i++) {
+    const AlertRule& rule = alertRules[i];
+    json.beginObject();
+    json.field("node", rule.node == ALERT_ANY_NODE ? -1 : (int)rule.node);
+    json.field("sensor", ALERT_SENSOR_NAMES[rule.sensor]);
+    json.field("min", rule.min);
+    json.field("max", rule.max);
+    json.field("hysteresis", rule.hysteresis);
+    json.field("dwell", rule.dwellS);
+    json.beginArray("actions");
+    for (int a = 0; a < 4; a++) {
+      if (rule.actions & (1 << a)) json.field(nullptr, ALERT_ACTION_NAMES[a]);
+    }
+    json.endArray();
+    if (rule.actions & ALERT_ACTION_GPIO) json.field("gpio", rule.gpio);
+    // Nodos con la regla en alerta
+    json.beginArray("activeNodes");
+    for (int n = 0; n < MAX_NODES; n++) {
+      if (alertStates[i][n].active && linkStats[n].node != -1) json.field(nullptr, linkStats[n].node);
+    }
+    json.endArray();
+    json.endObject();
+  }
+  json.endArray();
+  json.endObject();
+  sendApiJson(200, json);
+}
+
+// {"webhook":"http://192.168.1.10:8080/alertas","rules":[{"node":-1,"sensor":"temperature","min":5,"max":35,
+//   "hysteresis":0.5,"dwell":60,"actions":["gpio","log","sse","webhook"],"gpio":4}, ...]}
+// node -1 = cualquier nodo. Reemplaza la tabla completa; las alertas activas se reinician.
+void handleAPI_SetRules() {
+  DynamicJsonDocument doc(4096);
+  DeserializationError error = deserializeJson(doc, server.arg("plain"));
+  if (error || !doc["rules"].is<JsonArray>()) {
+    server.send(400, "application/json", "{\"success\":false,\"message\":\"JSON inválido\"}");
+    return;
+  }
+  JsonArray array = doc["rules"].as<JsonArray>();
+  if (array.size() > MAX_ALERT_RULES) {
+    server.send(400, "application/json", "{\"success\":false,\"message\":\"Demasiadas reglas (máximo " + String(MAX_ALERT_RULES) + ").\"}");
+    return;
+  }
+
+  if (doc.containsKey("webhook") && doc["webhook"].as<String>().length() >= WEBHOOK_URL_MAX) {
+    server.send(400, "application/json", "{\"success\":false,\"message\":\"URL del webhook demasiado larga.\"}");
+    return;
+  }
+
+  AlertRule parsed[MAX_ALERT_RULES];
+  int count = 0;
+  for (JsonObject entry : array) {
+    AlertRule& rule = parsed[count];
+    memset(&rule, 0, sizeof(rule));
+    int node = entry.containsKey("node") ? entry["node"].as<int>() : -1;
+    rule.node = node < 0 ? ALERT_ANY_NODE : (uint16_t)node;
+
+    String sensor = entry["sensor"].as<String>();
+    int sensorIndex = -1;
+    for (int i = 0; i < ALERT_SENSORS; i++) {
+      if (sensor == ALERT_SENSOR_NAMES[i]) sensorIndex = i;
+    }
+    rule.sensor = sensorIndex;
+    rule.min = entry.containsKey("min") ? entry["min"].as<float>() : -1e9;
+    rule.max = entry.containsKey("max") ? entry["max"].as<float>() : 1e9;
+    rule.hysteresis = entry["hysteresis"].as<float>();
+    long dwell = entry["dwell"].as<long>();
+    rule.dwellS = constrain(dwell, 0L, 65535L);
+
+    for (JsonVariant action : entry["actions"].as<JsonArray>()) {
+      for (int a = 0; a < 4; a++) {
+        if (action.as<String>() == ALERT_ACTION_NAMES[a]) rule.actions |= 1 << a;
+      }
+    }
+    int gpio = entry.containsKey("gpio") ? entry["gpio"].as<int>() : -1;
+
+    String problem = "";
+    if (sensorIndex < 0) problem = "Sensor desconocido: " + sensor;
+    else if (rule.min >= rule.max) problem = "El mínimo debe ser menor que el máximo.";
+    else if (rule.hysteresis < 0 || rule.min + rule.hysteresis > rule.max - rule.hysteresis) problem = "Histéresis inválida para el rango.";
+    else if (rule.actions == 0) problem = "La regla no tiene acciones.";
+    else if ((rule.actions & ALERT_ACTION_GPIO) &&
+             !alertPinAllowed(gpio)) problem = "Pin GPIO no disponible.";
+    if (problem.length() > 0) {
+      server.send(400, "application/json", "{\"success\":false,\"message\":\"Regla " + String(count) + ": " + problem + "\"}");
+      return;
+    }
+    rule.gpio = gpio < 0 ? 0 : gpio;
+    count++;
+  }
+
+  // Los pines que dejan de usarse se apagan antes de compilar la tabla nueva
+  for (int i = 0; i < alertRuleCount; i++) {
+    if (compiledAlerts[i].actions & ALERT_ACTION_GPIO) digitalWrite(compiledAlerts[i].gpio, LOW);
+  }
+  memcpy(alertRules, parsed, count * sizeof(AlertRule));
+  alertRuleCount = count;
+  if (doc.containsKey("webhook")) webhookUrl = doc["webhook"].as<String>();
+  saveConfig();
+  compileAlertRules();
+  server.send(200, "application/json", "{\"success\":true,\"message\":\"Reglas actualizadas con éxito.\"}");
+  Serial.println("Reglas de alerta actualizadas desde la web: " + String(alertRuleCount));
+}
+
+// Suscripción a las alertas con Server-Sent Events. El socket se conserva en sseClients y
+// broadcastSse() escribe en él; WebServer suelta su copia al terminar la petición.
+void handleAPIEvents() {
+  int slot = -1;
+  for (int i = 0; i < MAX_SSE_CLIENTS; i++) {
+    if (!sseClients[i].connected()) {
+      slot = i;
+      break;
+    }
+  }
+  if (slot < 0) {
+    server.send(503, "text/plain", "Demasiados clientes de eventos");
+    return;
+  }
+  sseClients[slot] = server.client();
+  sseClients[slot].print("HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nCache-Control: no-cache\r\n"
+                         "Connection: keep-alive\r\nAccess-Control-Allow-Origin: *\r\n\r\n: conectado\n\n");
+  Serial.println("Cliente de eventos conectado (" + String(slot) + ")");
+}
+
+void handleAPIMqtt() {
+  ApiBuffer buffer;
+  if (!buffer.data) return sendApiBusy();
+  char broker[80];
+  snprintf(broker, sizeof(broker), "%s:%d", MQTT_HOST, (int)MQTT_PORT);
+  JsonWriter json(buffer.text(), API_BUFFER_SIZE);
+  json.beginObject();
+  json.field("enabled", MQTT_ENABLED && mqttQueue != nullptr);
+  json.field("broker", broker);
+  json.field("topic", MQTT_TOPIC);
+  json.field("connected", (bool)mqttConnected);
+  json.field("connects", (unsigned long)mqttStats.connects);
+  json.field("connectFailures", (unsigned long)mqttStats.connectFailures);
+  json.field("publishedBatches", (unsigned long)mqttStats.batches);
+  json.field("publishedReadings", (unsigned long)mqttStats.readings);
+  json.field("publishedBytes", (unsigned long)mqttStats.bytes);
+  json.field("publishErrors", (unsigned long)mqttStats.publishErrors);
+  json.field("readingsPerMin", mqttStats.readingsPerMin);
+  json.field("lastPublishUs", (unsigned long)mqttStats.lastPublishUs);
+  json.field("maxPublishUs", (unsigned long)mqttStats.maxPublishUs);
+  json.field("queueDepth", mqttQueue ? (unsigned long)uxQueueMessagesWaiting(mqttQueue) : 0UL);
+  json.field("queueCapacity", MQTT_QUEUE_DEPTH);
+  json.field("batchReadings", mqttBatch.readings); // Lote en construcción
+  json.beginObject("outbox");
+  json.field("ready", mqttOutboxReady);
+  json.field("depth", (unsigned long)(mqttOutbox.head - mqttOutbox.tail));
+  json.field("capacity", MQTT_OUTBOX_SLOTS);
+  json.field("stored", (unsigned long)mqttStats.outboxed);
+  json.field("drained", (unsigned long)mqttStats.drained);
+  json.field("overwritten", (unsigned long)mqttOutbox.overwritten);
+  json.endObject();
+  json.field("directBatches", (unsigned long)mqttStats.direct);
+  json.field("lostReadings", (unsigned long)mqttStats.lost);
+  json.endObject();
+  sendApiJson(200, json);
+}
+
+// Formulario de credenciales; la lista de redes y el estado se refrescan desde /api/wifi
+void handlePortal() {
+  server.send_P(200, "text/html", R"(<!DOCTYPE html>
+<html lang='es'>
+<head>
+    <meta charset='UTF-8'>
+    <meta name='viewport' content='width=device-width, initial-scale=1.0'>
+    <title>Configuración WiFi</title>
+    <style>
+        body { font-family: sans-serif; max-width: 420px; margin: 2em auto; padding: 0 1em; }
+        input, button { width: 100%; padding: 0.6em; margin: 0.3em 0; box-sizing: border-box; }
+        #status { margin-top: 1em; color: #555; }
+    </style>
+</head>
+<body>
+    <h2>Receptor de telemetría</h2>
+    <p>Red WiFi a la que debe conectarse el receptor:</p>
+    <form method='POST' action='/api/wifi'>
+        <input name='ssid' list='networks' placeholder='Nombre de la red (SSID)' maxlength='32' required>
+        <datalist id='networks'></datalist>
+        <input name='password' type='password' placeholder='Contraseña' maxlength='63'>
+        <button type='submit'>Conectar</button>
+    </form>
+    <div id='status'></div>
+    <script>
+    async function refresh() {
+        try {
+            const wifi = await (await fetch('/api/wifi')).json();
+            const list = document.getElementById('networks');
+            list.replaceChildren(...wifi.networks.map(n => {
+                const option = document.createElement('option');
+                option.value = n.ssid;
+                option.label = n.rssi + ' dBm';
+                return option;
+            }));
+            const failed = wifi.portal.credentialsFailed ? 'No se pudo conectar con la red indicada; se mantiene la anterior. ' : '';
+            document.getElementById('status').textContent = failed + (wifi.connected
+                ? `Conectado a ${wifi.ssid} en ${wifi.lastConnectMs} ms: http://${wifi.ip}/ (este punto de acceso se cierra en un minuto)`
+                : (wifi.ssid ? `Conectando a ${wifi.ssid}...` : 'Sin configurar'));
+        } catch (e) {}
+    }
+    refresh();
+    setInterval(refresh, 3000);
+    </script>
+</body>
+</html>
+)");
+}
+
+void handleAPIWifiStatus() {
+  ApiBuffer buffer;
+  if (!buffer.data) return sendApiBusy();
+  if (portal.active && WiFi.scanComplete() == WIFI_SCAN_FAILED) WiFi.scanNetworks(true);
+
+  JsonWriter json(buffer.text(), API_BUFFER_SIZE);
+  json.beginObject();
+  json.field("connected", wifiConnected);
+  json.field("ssid", ssid.c_str());
+  if (wifiConnected) {
+    json.field("ip", WiFi.localIP().toString().c_str());
+    json.field("rssi", (int)WiFi.RSSI());
+    json.field("channel", (int)WiFi.channel());
+    json.field("bssid", WiFi.BSSIDstr().c_str());
+  }
+  json.field("cached", wifiCache.channel != 0);
+  json.field("staticIp", WIFI_CACHE_STATIC_IP);
+  json.field("bootToOnlineMs", wifiStats.bootToOnlineMs);
+  json.field("lastConnectMs", wifiStats.lastConnectMs);
+  json.field("lastConnectFast", wifiStats.lastFast);
+  json.field("connects", wifiStats.connects);
+  json.field("fastConnects", wifiStats.fastConnects);
+  json.field("fastFailures", wifiStats.fastFailures);
+  json.beginObject("outages");
+  json.field("count", wifiStats.outages);
+  json.field("currentMs", wifiStats.outageActive ? millis() - wifiStats.outageStart : 0UL);
+  json.field("lastMs", wifiStats.lastOutageMs);
+  json.field("totalMs", wifiStats.totalOutageMs);
+  json.field("readingsReceived", wifiStats.readingsDuringOutages);
+  json.field("readingsLost", wifiStats.readingsLostDuringOutages);
+  json.endObject();
+  json.beginObject("portal");
+  json.field("active", portal.active);
+  json.field("credentialsPending", portal.credentialsPending);
+  json.field("credentialsFailed", portal.credentialsFailed);
+  if (portal.active) {
+    json.field("ssid", portal.apSsid);
+    json.field("ip", WiFi.softAPIP().toString().c_str());
+  }
+  json.endObject();
+  json.beginArray("networks");
+  int found = WiFi.scanComplete();
+  for (int i = 0; i < found && i < 20; i++) {
+    json.beginObject();
+    json.field("ssid", WiFi.SSID(i).c_str());
+    json.field("rssi", (int)WiFi.RSSI(i));
+    json.endObject();
+  }
+  json.endArray();
+  json.endObject();
+  sendApiJson(200, json);
+}
+
+// Formulario del portal (ssid, password); se guardan en NVS cuando la conexión funciona
+// Solo con el portal abierto: quien llega por la red local no puede cambiar la red del receptor.
+// Las credenciales nuevas se prueban WIFI_CREDENTIALS_TIMEOUT; si no conectan se vuelve a las anteriores.
+void handleAPIWifiSet() {
+  if (!portal.active) {
+    server.send(403, "text/plain", "Las credenciales WiFi solo se cambian desde el portal de configuración");
+    return;
+  }
+  const String* newSsid = server.argValue("ssid");
+  const String* newPassword = server.argValue("password");
+  size_t passwordLength = newPassword ? newPassword->length() : 0;
+  if (!newSsid || newSsid->length() == 0 || newSsid->length() > 32 ||
+      (passwordLength > 0 && (passwordLength < 8 || passwordLength > 63))) {
+    server.send(400, "text/plain", "SSID de 1 a 32 caracteres y contraseña vacía o de 8 a 63");
+    return;
+  }
+
+  if (!portal.credentialsPending) { // Con un cambio ya en prueba, las anteriores siguen siendo las buenas
+    portal.previousSsid = ssid;
+    portal.previousPassword = password;
+    portal.previousCache = wifiCache;
+  }
+  ssid = *newSsid;
+  password = newPassword ? *newPassword : String("");
+  portal.credentialsPending = true;
+  portal.credentialsAt = millis();
+  portal.credentialsFailed = false;
+  portal.closing = false; // El portal sigue abierto hasta que la red nueva conecte
+  wifiCache = WifiCache(); // Otra red: nada de la caché anterior sirve
+  if (wifiConnected) { // Se deja la red actual: cuenta como corte (y abre la vía al portal por tiempo)
+    wifiConnected = false;
+    wifiStats.outages++;
+    wifiStats.outageActive = true;
+    wifiStats.outageStart = millis();
+    linkTotals(wifiStats.readingsAtOutage, wifiStats.lostAtOutage);
+  }
+  beginWiFiConnect(false);
+  server.sendHeader("Location", "/portal");
+  server.send(303, "text/plain", "");
+}
 
 void handleNotFound() {
+  if (portal.active) { // Comprobaciones de portal cautivo (generate_204, hotspot-detect...) y demás
+    server.sendHeader("Location", "http://" + WiFi.softAPIP().toString() + "/portal");
+    server.send(302, "text/plain", "");
+    return;
+  }
   server.send(404, "text/plain", "Not Found");
 }
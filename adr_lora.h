@@ -0,0 +1,69 @@
+// Tasa de datos adaptativa (ADR) para la red LoRa RYLR998
+//
+// Compartido por el transmisor, el receptor y la simulación en Linux (herramientas/simulacion_adr.cpp).
+// Solo contiene cálculos puros: tabla de tasas, margen de enlace y tiempo en el aire.
+//
+// El RYLR998 recibe únicamente con el SF/BW configurado, así que la tasa es común a toda la
+// red: el receptor calcula la tasa recomendada para cada nodo y aplica la más lenta de ellas.
+
+#ifndef ADR_LORA_H
+#define ADR_LORA_H
+
+#include <stdint.h>
+#include <math.h>
+
+// Parámetros de AT+PARAMETER=<SF>,<BW>,<CR>,<Preámbulo>. BW: 4=31.25 kHz, 7=125 kHz, 8=250 kHz, 9=500 kHz
+struct LoRaRate {
+  uint8_t sf;
+  uint8_t bwCode;
+};
+
+// Ordenadas de más lenta (mayor alcance) a más rápida. La primera es la configuración
+// original de ambos sketches (AT+PARAMETER=12,4,1,7).
+const LoRaRate ADR_RATES[] = {{12, 4}, {12, 7}, {11, 7}, {10, 7}, {9, 7}, {8, 7}, {7, 7}, {7, 8}, {7, 9}};
+const int ADR_RATE_COUNT = sizeof(ADR_RATES) / sizeof(ADR_RATES[0]);
+const int ADR_DEFAULT_RATE = 0;
+const uint8_t LORA_CODING_RATE = 1;            // 4/5
+const uint8_t LORA_PREAMBLE = 7;
+const float ADR_INSTALLATION_MARGIN_DB = 5.0;  // Reserva frente a desvanecimientos
+const float ADR_HYSTERESIS_DB = 3.0;            // Margen extra exigido para subir de tasa
+const int ADR_MIN_SAMPLES = 20;                // Tramas mínimas con la tasa actual antes de decidir
+
+inline float loraBandwidthHz(uint8_t bwCode) {
+  static const float BANDWIDTHS[] = {7800, 10400, 15600, 20800, 31250, 41700, 62500, 125000, 250000, 500000};
+  return BANDWIDTHS[bwCode <= 9 ? bwCode : 7];
+}
+
+// SNR mínima de demodulación del SX1262 según el SF
+inline float loraRequiredSnrDb(uint8_t sf) {
+  return -20.0f + (12 - sf) * 2.5f;
+}
+
+// Margen (dB) que tendría con `target` un enlace medido con `snrDb` usando `current`.
+// Al duplicar el ancho de banda el ruido sube 3 dB, así que la SNR medida se ajusta.
+inline float adrLinkMarginDb(float snrDb, const LoRaRate& current, const LoRaRate& target) {
+  float snrAtTarget = snrDb - 10.0f * log10f(loraBandwidthHz(target.bwCode) / loraBandwidthHz(current.bwCode));
+  return snrAtTarget - loraRequiredSnrDb(target.sf) - ADR_INSTALLATION_MARGIN_DB;
+}
+
+// Índice de la tasa más rápida que mantiene margen positivo; ADR_DEFAULT_RATE si ninguna lo hace.
+// Subir de tasa exige además ADR_HYSTERESIS_DB para no oscilar con el ruido de la estimación.
+inline int adrRecommendedRate(float snrDb, int currentRate) {
+  for (int rate = ADR_RATE_COUNT - 1; rate > ADR_DEFAULT_RATE; rate--) {
+    float required = rate > currentRate ? ADR_HYSTERESIS_DB : 0.0f;
+    if (adrLinkMarginDb(snrDb, ADR_RATES[currentRate], ADR_RATES[rate]) >= required) return rate;
+  }
+  return ADR_DEFAULT_RATE;
+}
+
+// Tiempo en el aire (ms) de una trama LoRa con cabecera explícita y CRC (fórmula de Semtech AN1200.13)
+inline float loraAirtimeMs(const LoRaRate& rate, int payloadBytes) {
+  float symbolMs = (float)(1UL << rate.sf) / loraBandwidthHz(rate.bwCode) * 1000.0f;
+  int lowDataRateOptimize = symbolMs > 16.0f ? 1 : 0;
+  float preambleMs = (LORA_PREAMBLE + 4.25f) * symbolMs;
+  float numerator = 8.0f * payloadBytes - 4.0f * rate.sf + 28 + 16;
+  float payloadSymbols = 8 + fmaxf(ceilf(numerator / (4.0f * (rate.sf - 2 * lowDataRateOptimize))) * (LORA_CODING_RATE + 4), 0);
+  return preambleMs + payloadSymbols * symbolMs;
+}
+
+#endif
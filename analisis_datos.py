@@ -1,9 +1,10 @@
 import statistics
 import csv
+import sys
 import matplotlib.pyplot as plt # pip install matplotlib
 
 tiempo = 0
-var =  # Modificar segun sea nesesario [1 - 3]
+var = 1 # Modificar segun sea nesesario [1 - 3], o pasarlo como segundo argumento
 
 def extraer_datos_sensor(sensores):
   datos_columna_1 = []
@@ -55,7 +56,11 @@ def graficar_datos(tiempos, valores, etiqueta_x, etiqueta_y):
   plt.legend()
   plt.show()
 
-sensores = 'sensors_2025-06-22.csv'
+# Uso: python analisis_datos.py [archivo.csv] [columna]
+# Tambien sirve la serie de herramientas/analisis_archivo (--csv), p. ej. columna 3 = temperature_mean
+sensores = sys.argv[1] if len(sys.argv) > 1 else 'sensors_2025-06-22.csv'
+if len(sys.argv) > 2:
+  var = int(sys.argv[2])
 # Desempaquetamos los datos y los nombres de las columnas
 nombre_col1, datos_col1, nombre_col3, datos_col3 = extraer_datos_sensor(sensores)
 
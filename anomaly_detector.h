@@ -0,0 +1,137 @@
+// Detección en línea de lecturas sospechosas por nodo y sensor
+//
+// Compartido por el receptor y la reproducción en Linux (herramientas/replay_anomalias.cpp).
+// Cada flujo (nodo x sensor) guarda solo media y varianza (Welford con ventana acotada), el último
+// valor aceptado y desde cuándo no cambia: memoria fija, sin muestras. Una lectura se marca como:
+//   - ZERO: cero del DHT. El transmisor convierte un fallo del DHT22 en 0 °C / 0 %; humedad 0 es
+//     siempre sospechosa y temperatura 0 solo si la humedad también lo es.
+//   - STUCK: el mismo valor durante más de stuckS segundos (sensor colgado, suelo en el tope por
+//     calibración desplazada). La luz a 0 (noche) no cuenta.
+//   - RATE: cambio respecto al último valor aceptado mayor que maxStep + maxRatePerMin x minutos.
+//   - OUTLIER: a más de zLimit desviaciones de la media (tras warmup lecturas). No se aplica a la
+//     luz, que pasa de 0 a decenas de miles de lux cada día.
+// Las lecturas marcadas no entran en la media; si reseed lecturas seguidas marcadas por RATE u
+// OUTLIER son coherentes entre sí, se acepta el nuevo nivel (cambio real, p. ej. riego).
+//
+// Resultado: 4 bits por sensor, (flags >> (4 * sensor)) & 0xF, con el orden de ALERT_SENSOR_NAMES.
+
+#ifndef ANOMALY_DETECTOR_H
+#define ANOMALY_DETECTOR_H
+
+#include <stdint.h>
+#include <math.h>
+
+enum { ANOMALY_TEMP, ANOMALY_HUM, ANOMALY_LUX, ANOMALY_SOIL, ANOMALY_SENSORS };
+
+const uint16_t ANOMALY_ZERO = 0x1;
+const uint16_t ANOMALY_STUCK = 0x2;
+const uint16_t ANOMALY_RATE = 0x4;
+const uint16_t ANOMALY_OUTLIER = 0x8;
+const char* const ANOMALY_REASON_NAMES[4] = {"zero", "stuck", "rate", "outlier"};
+
+struct AnomalySensorConfig {
+  float maxStep;       // Salto admitido entre lecturas seguidas
+  float maxRatePerMin; // Más lo que puede cambiar por minuto transcurrido (0 = sin límite de ritmo)
+  float zLimit;        // Desviaciones admitidas respecto a la media (0 = sin z-score)
+  float minStd;        // Desviación mínima para el z-score (evita marcar ruido en flujos muy estables)
+  uint32_t stuckS;     // 0 = sin detección de valor fijo
+};
+
+struct AnomalyConfig {
+  AnomalySensorConfig sensors[ANOMALY_SENSORS] = {
+      {1.5, 0.5, 6, 0.5, 4 * 3600},   // Temperatura (°C)
+      {8.0, 2.0, 6, 2.0, 4 * 3600},   // Humedad (%)
+      {0, 0, 0, 50.0, 4 * 3600},      // Luz (lux): cambia de golpe con nubes o focos
+      {30.0, 2.0, 6, 6.0, 24 * 3600}, // Humedad del suelo (%): el riego es un salto real
+  };
+  uint16_t window = 240; // Lecturas de la media móvil (~1 h a 15 s)
+  uint16_t warmup = 30;
+  uint8_t reseed = 4;
+};
+
+struct AnomalyStream {
+  float mean = 0, m2 = 0;
+  float accepted = 0;       // Último valor aceptado
+  uint32_t acceptedMs = 0;
+  float stuckValue = 0;
+  uint32_t stuckSinceMs = 0;
+  float lastRejected = 0;
+  uint32_t lastRejectedMs = 0;
+  uint16_t count = 0;
+  uint8_t rejected = 0;     // Lecturas seguidas marcadas por RATE/OUTLIER
+};
+
+struct AnomalyState {
+  AnomalyStream streams[ANOMALY_SENSORS];
+};
+
+inline bool anomalySuspect(uint16_t flags, int sensor) { return (flags >> (4 * sensor)) & 0xF; }
+
+inline void anomalyAccept(AnomalyStream& s, const AnomalyConfig& config, float value, uint32_t nowMs) {
+  if (s.count < config.window) s.count++;
+  else s.m2 -= s.m2 / config.window; // Ventana acotada: lo antiguo pierde peso
+  float delta = value - s.mean;
+  s.mean += delta / s.count;
+  s.m2 += delta * (value - s.mean);
+  s.accepted = value;
+  s.acceptedMs = nowMs;
+  s.rejected = 0;
+}
+
+// Marca de un sensor; actualiza su flujo
+inline uint16_t anomalyCheckSensor(AnomalyStream& s, const AnomalyConfig& config, int sensor, float value,
+                                   uint32_t nowMs, bool zero) {
+  const AnomalySensorConfig& sc = config.sensors[sensor];
+  uint16_t reasons = zero ? ANOMALY_ZERO : 0;
+
+  if (s.count == 0 || value != s.stuckValue) {
+    s.stuckValue = value;
+    s.stuckSinceMs = nowMs;
+  } else if (sc.stuckS > 0 && !(sensor == ANOMALY_LUX && value == 0) &&
+             nowMs - s.stuckSinceMs > sc.stuckS * 1000UL) {
+    reasons |= ANOMALY_STUCK;
+  }
+  if (s.count == 0) {
+    if (!reasons) anomalyAccept(s, config, value, nowMs);
+    return reasons;
+  }
+
+  float minutes = (nowMs - s.acceptedMs) / 60000.0f;
+  if (sc.maxStep > 0 && fabsf(value - s.accepted) > sc.maxStep + sc.maxRatePerMin * minutes) reasons |= ANOMALY_RATE;
+  if (sc.zLimit > 0 && s.count >= config.warmup) {
+    float std = fmaxf(sqrtf(s.m2 / (s.count - 1)), sc.minStd);
+    if (fabsf(value - s.mean) > sc.zLimit * std) reasons |= ANOMALY_OUTLIER;
+  }
+
+  if (!reasons) {
+    anomalyAccept(s, config, value, nowMs);
+  } else if (!(reasons & (ANOMALY_ZERO | ANOMALY_STUCK))) {
+    // ¿Nuevo nivel? Las rechazadas seguidas deben ser coherentes entre sí
+    float limit = sc.maxStep > 0 ? sc.maxStep + sc.maxRatePerMin * (nowMs - s.lastRejectedMs) / 60000.0f
+                                 : sc.zLimit * sc.minStd;
+    s.rejected = (s.rejected > 0 && fabsf(value - s.lastRejected) <= limit) ? s.rejected + 1 : 1;
+    s.lastRejected = value;
+    s.lastRejectedMs = nowMs;
+    if (s.rejected >= config.reseed) {
+      s.count = 0;
+      s.mean = s.m2 = 0;
+      anomalyAccept(s, config, value, nowMs);
+    }
+  }
+  return reasons;
+}
+
+// values en el orden ANOMALY_*; nowMs puede desbordar (solo se usan diferencias)
+inline uint16_t anomalyCheck(AnomalyState& state, const AnomalyConfig& config, const float values[ANOMALY_SENSORS],
+                             uint32_t nowMs) {
+  bool humZero = values[ANOMALY_HUM] == 0;
+  bool dhtZero = humZero && values[ANOMALY_TEMP] == 0;
+  uint16_t flags = 0;
+  for (int i = 0; i < ANOMALY_SENSORS; i++) {
+    bool zero = (i == ANOMALY_TEMP && dhtZero) || (i == ANOMALY_HUM && humZero);
+    flags |= anomalyCheckSensor(state.streams[i], config, i, values[i], nowMs, zero) << (4 * i);
+  }
+  return flags;
+}
+
+#endif
@@ -0,0 +1,142 @@
+// Codificaciones compactas de la API para clientes máquina: CBOR (RFC 8949) y registros binarios fijos
+//
+// Compartido por el receptor (/api/data y /api/history con Accept: application/cbor, ?format=cbor o
+// ?format=bin) y la herramienta de Linux herramientas/decodificar_api.cpp. Todo se escribe sobre un
+// búfer del llamador, sin memoria dinámica ni documento intermedio; si no cabe, overflow queda a true.
+//
+// CBOR: los float se escriben en media precisión cuando no pierden nada (0, 25.5, 1024...) y si no en
+// precisión simple. El historial va como {"fields":[...], "rows":[[...], ...]}: los nombres una sola
+// vez en lugar de en cada punto.
+//
+// Binario: ApiBinaryHeader seguido de count registros ApiBinaryRecord, little-endian (el del ESP32 y
+// el de x86/ARM), campos alineados y sin relleno para leerlos con un memcpy o un struct.unpack.
+
+#ifndef API_ENCODING_H
+#define API_ENCODING_H
+
+#include <stdint.h>
+#include <string.h>
+
+// === CBOR ===
+struct CborWriter {
+  uint8_t* out;
+  size_t capacity;
+  size_t length = 0;
+  bool overflow = false;
+
+  CborWriter(uint8_t* buffer, size_t size) : out(buffer), capacity(size) {}
+
+  void put(const void* data, size_t n) {
+    if (length + n > capacity) {
+      overflow = true;
+      return;
+    }
+    memcpy(out + length, data, n);
+    length += n;
+  }
+
+  // Tipo mayor y argumento en la forma más corta
+  void head(uint8_t major, uint64_t value) {
+    uint8_t bytes[9];
+    size_t n;
+    bytes[0] = major << 5;
+    if (value < 24) {
+      bytes[0] |= value;
+      n = 1;
+    } else if (value <= 0xFF) {
+      bytes[0] |= 24;
+      n = 2;
+    } else if (value <= 0xFFFF) {
+      bytes[0] |= 25;
+      n = 3;
+    } else if (value <= 0xFFFFFFFFULL) {
+      bytes[0] |= 26;
+      n = 5;
+    } else {
+      bytes[0] |= 27;
+      n = 9;
+    }
+    for (size_t i = 1; i < n; i++) bytes[i] = value >> (8 * (n - 1 - i)); // Big-endian
+    put(bytes, n);
+  }
+
+  void integer(int64_t value) { value < 0 ? head(1, -1 - value) : head(0, value); }
+  void text(const char* value) {
+    size_t n = strlen(value);
+    head(3, n);
+    put(value, n);
+  }
+  void array(size_t count) { head(4, count); }
+  void map(size_t count) { head(5, count); }
+  void boolean(bool value) { head(7, value ? 21 : 20); }
+  void null() { head(7, 22); }
+
+  void number(float value) {
+    uint16_t half;
+    uint8_t bytes[5];
+    if (halfExact(value, half)) {
+      bytes[0] = 0xF9;
+      bytes[1] = half >> 8;
+      bytes[2] = half;
+      put(bytes, 3);
+      return;
+    }
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    bytes[0] = 0xFA;
+    for (int i = 0; i < 4; i++) bytes[1 + i] = bits >> (24 - 8 * i);
+    put(bytes, 5);
+  }
+
+  // Media precisión sin pérdida: ±0, inf, NaN y normales con exponente en rango y mantisa de 10 bits
+  static bool halfExact(float value, uint16_t& half) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint16_t sign = (bits >> 16) & 0x8000;
+    int exponent = (bits >> 23) & 0xFF;
+    uint32_t mantissa = bits & 0x7FFFFF;
+    if (exponent == 0 && mantissa == 0) {
+      half = sign;
+      return true;
+    }
+    if (exponent == 0xFF) {
+      half = sign | 0x7C00 | (mantissa ? 0x200 : 0);
+      return true;
+    }
+    int halfExponent = exponent - 127 + 15;
+    if (halfExponent < 1 || halfExponent > 30 || (mantissa & 0x1FFF) != 0) return false;
+    half = sign | (halfExponent << 10) | (mantissa >> 13);
+    return true;
+  }
+};
+
+// === Registros binarios ===
+const char API_BINARY_MAGIC[4] = {'T', 'L', 'M', '1'};
+const uint32_t API_STATUS_VALID = 0x1;       // Hay una lectura válida (solo /api/data)
+const uint32_t API_STATUS_SD = 0x2;          // SD disponible
+const uint32_t API_STATUS_TIME_SYNC = 0x4;   // Hora NTP sincronizada
+const uint32_t API_STATUS_LED = 0x8;         // LED de fuera de rango encendido
+
+struct ApiBinaryHeader {
+  char magic[4];       // "TLM1"
+  uint16_t recordSize; // sizeof(ApiBinaryRecord): un cliente antiguo puede saltar campos nuevos
+  uint16_t count;
+  uint32_t uptime;     // millis() del receptor al responder
+  uint32_t status;     // API_STATUS_*
+};
+
+struct ApiBinaryRecord {
+  uint32_t timestamp;  // millis() del receptor al recibir la lectura
+  float temperature, humidity, lux;
+  int32_t seq;         // -1 si el transmisor no la envía
+  int16_t soilMoisture;
+  int16_t rssi;
+  uint16_t flags;      // Marcas de anomaly_detector.h
+  uint8_t node;
+  int8_t snr;
+};
+
+static_assert(sizeof(ApiBinaryHeader) == 16, "Cabecera binaria con relleno inesperado");
+static_assert(sizeof(ApiBinaryRecord) == 28, "Registro binario con relleno inesperado");
+
+#endif
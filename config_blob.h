@@ -0,0 +1,81 @@
+// Configuración persistente como un único blob versionado en NVS (Preferences)
+//
+// Compartido por el receptor y el transmisor. Cada sketch agrupa su configuración en una estructura
+// y la guarda con una sola putBytes() precedida de una cabecera {magic, versión, tamaño, CRC32}.
+// NVS escribe el índice del blob después de los datos, así que un corte de corriente a mitad de
+// escritura deja el blob anterior completo; el CRC descarta cualquier otro daño.
+//
+// Migración: los campos nuevos se añaden al final de la estructura y se sube la versión. Un blob
+// de una versión anterior se copia sobre la estructura con sus valores por defecto, de modo que los
+// campos añadidos conservan el valor por defecto; el sketch puede corregir después lo que haga falta
+// según la versión leída.
+
+#ifndef CONFIG_BLOB_H
+#define CONFIG_BLOB_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+const uint32_t CONFIG_BLOB_MAGIC = 0x31474643; // "CFG1" en little endian
+const size_t CONFIG_BLOB_MAX = 1024;           // Tamaño máximo de la estructura guardada
+
+struct ConfigBlobHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t size;  // Bytes de la estructura que siguen a la cabecera
+  uint32_t crc;   // CRC32 de esos bytes
+};
+
+const int CONFIG_BLOB_MISSING = 0;  // No hay blob: usar las claves antiguas o los valores por defecto
+const int CONFIG_BLOB_INVALID = -1; // Blob dañado o de una versión posterior
+
+// CRC32 (polinomio 0xEDB88320) bit a bit; la configuración se lee una vez al arrancar
+inline uint32_t configBlobCrc32(const uint8_t* data, size_t length) {
+  uint32_t crc = 0xFFFFFFFF;
+  for (size_t i = 0; i < length; i++) {
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; bit++) crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+  }
+  return ~crc;
+}
+
+// Guarda `config` bajo `key` con una única escritura. Retorna false si NVS no la aceptó.
+template <typename Store, typename Config>
+bool saveConfigBlob(Store& store, const char* key, uint16_t version, const Config& config) {
+  static_assert(sizeof(Config) <= CONFIG_BLOB_MAX, "Configuración demasiado grande para el blob");
+  uint8_t buffer[sizeof(ConfigBlobHeader) + sizeof(Config)];
+  ConfigBlobHeader header = {CONFIG_BLOB_MAGIC, version, (uint16_t)sizeof(Config), 0};
+  memcpy(buffer + sizeof(header), &config, sizeof(Config));
+  header.crc = configBlobCrc32(buffer + sizeof(header), sizeof(Config));
+  memcpy(buffer, &header, sizeof(header));
+  return store.putBytes(key, buffer, sizeof(buffer)) == sizeof(buffer);
+}
+
+// Lee el blob con una única lectura sobre `config`, que debe llegar con sus valores por defecto.
+// Retorna la versión leída (<= version), CONFIG_BLOB_MISSING o CONFIG_BLOB_INVALID (config intacta).
+template <typename Store, typename Config>
+int loadConfigBlob(Store& store, const char* key, uint16_t version, Config& config) {
+  uint8_t buffer[sizeof(ConfigBlobHeader) + CONFIG_BLOB_MAX];
+  size_t length = store.getBytesLength(key);
+  if (length == 0) return CONFIG_BLOB_MISSING;
+  if (length < sizeof(ConfigBlobHeader) || length > sizeof(buffer)) return CONFIG_BLOB_INVALID;
+  if (store.getBytes(key, buffer, length) != length) return CONFIG_BLOB_INVALID;
+
+  ConfigBlobHeader header;
+  memcpy(&header, buffer, sizeof(header));
+  if (header.magic != CONFIG_BLOB_MAGIC || header.version == 0 || header.version > version ||
+      header.size != length - sizeof(header)) {
+    return CONFIG_BLOB_INVALID;
+  }
+  if (configBlobCrc32(buffer + sizeof(header), header.size) != header.crc) return CONFIG_BLOB_INVALID;
+  // Una versión igual debe tener el mismo tamaño; una anterior solo puede ser más corta
+  if (header.version == version ? header.size != sizeof(Config) : header.size > sizeof(Config)) {
+    return CONFIG_BLOB_INVALID;
+  }
+
+  memcpy(&config, buffer + sizeof(header), header.size);
+  return header.version;
+}
+
+#endif
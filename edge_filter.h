@@ -0,0 +1,105 @@
+// Filtrado en el nodo y envío por cambio (send-on-delta)
+//
+// Compartido por el transmisor y la reproducción en Linux (herramientas/replay_filtro.cpp).
+// Cada sensor pasa por una mediana de 3 (quita picos sueltos) y una media móvil exponencial.
+// La lectura filtrada se envía si algún sensor se aleja del último valor enviado más que su
+// umbral, o si pasó el intervalo de latido (heartbeat) sin enviar nada.
+
+#ifndef EDGE_FILTER_H
+#define EDGE_FILTER_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+enum { FILTER_TEMP, FILTER_HUM, FILTER_LUX, FILTER_SOIL, FILTER_SENSORS };
+
+const float EDGE_FILTER_EMA_ALPHA = 0.5;  // Peso de la lectura nueva
+const float EDGE_FILTER_MIN_LUX = 5.0;    // Umbral mínimo de luz en valor absoluto (noche)
+
+// Umbrales; se cambian con el downlink "CFG:T=<°C>,H=<%>,L=<% relativo>,S=<%>,HB=<s>"
+struct EdgeFilterConfig {
+  float tempDelta = 0.3;
+  float humDelta = 2.0;
+  float luxPercent = 10.0;
+  float soilDelta = 2.0;
+  uint32_t heartbeatS = 300;
+};
+
+struct EdgeFilterState {
+  float history[FILTER_SENSORS][3];
+  uint8_t filled = 0;               // Lecturas en la ventana de la mediana (hasta 3)
+  float ema[FILTER_SENSORS];
+  float sent[FILTER_SENSORS];       // Último valor enviado de cada sensor
+  bool hasSent = false;
+  uint32_t lastSentS = 0;
+};
+
+inline float edgeFilterMedian3(float a, float b, float c) {
+  if (a > b) { float t = a; a = b; b = t; }
+  if (b > c) b = c;
+  return a > b ? a : b;
+}
+
+// Filtra `values` en el sitio y decide si la lectura se envía; nowS en segundos
+inline bool edgeFilterUpdate(EdgeFilterState& state, const EdgeFilterConfig& config, float values[FILTER_SENSORS],
+                             uint32_t nowS) {
+  for (int i = 0; i < FILTER_SENSORS; i++) {
+    state.history[i][0] = state.history[i][1];
+    state.history[i][1] = state.history[i][2];
+    state.history[i][2] = values[i];
+  }
+  if (state.filled < 3) state.filled++;
+
+  for (int i = 0; i < FILTER_SENSORS; i++) {
+    float median = state.filled < 3 ? values[i]
+                                    : edgeFilterMedian3(state.history[i][0], state.history[i][1], state.history[i][2]);
+    state.ema[i] = state.filled == 1 ? median : state.ema[i] + EDGE_FILTER_EMA_ALPHA * (median - state.ema[i]);
+    values[i] = state.ema[i];
+  }
+
+  bool send = !state.hasSent || nowS - state.lastSentS >= config.heartbeatS;
+  if (!send) {
+    float luxThreshold = fmaxf(fabsf(state.sent[FILTER_LUX]) * config.luxPercent / 100.0f, EDGE_FILTER_MIN_LUX);
+    send = fabsf(values[FILTER_TEMP] - state.sent[FILTER_TEMP]) >= config.tempDelta ||
+           fabsf(values[FILTER_HUM] - state.sent[FILTER_HUM]) >= config.humDelta ||
+           fabsf(values[FILTER_LUX] - state.sent[FILTER_LUX]) >= luxThreshold ||
+           fabsf(values[FILTER_SOIL] - state.sent[FILTER_SOIL]) >= config.soilDelta;
+  }
+  if (send) {
+    memcpy(state.sent, values, sizeof(state.sent));
+    state.hasSent = true;
+    state.lastSentS = nowS;
+  }
+  return send;
+}
+
+// "T=0.3,H=2,L=10,S=2,HB=300"; las claves ausentes conservan su valor. false si algo no es válido.
+inline bool parseEdgeFilterConfig(const char* text, EdgeFilterConfig& config) {
+  EdgeFilterConfig parsed = config;
+  const char* p = text;
+  while (*p) {
+    const char* equals = strchr(p, '=');
+    if (!equals) return false;
+    size_t keyLength = equals - p;
+    char* end;
+    float value = strtof(equals + 1, &end);
+    if (end == equals + 1 || value < 0) return false;
+
+    if (keyLength == 1 && *p == 'T') parsed.tempDelta = value;
+    else if (keyLength == 1 && *p == 'H') parsed.humDelta = value;
+    else if (keyLength == 1 && *p == 'L') parsed.luxPercent = value;
+    else if (keyLength == 1 && *p == 'S') parsed.soilDelta = value;
+    else if (keyLength == 2 && strncmp(p, "HB", 2) == 0) parsed.heartbeatS = (uint32_t)value;
+    else return false;
+
+    if (*end == ',') end++;
+    else if (*end != '\0') return false;
+    p = end;
+  }
+  config = parsed;
+  return true;
+}
+
+#endif
@@ -0,0 +1,236 @@
+// Compresor gzip en streaming para descargas desde el receptor
+//
+// Compartido por el receptor y la prueba en Linux (herramientas/prueba_gzip.cpp). Deflate con
+// LZ77 de ventana fija (1 << WINDOW_BITS bytes) y códigos Huffman fijos (bloque tipo 1): sin tablas
+// dinámicas ni asignaciones, con memoria constante (~5 x ventana) y un coste por byte acotado por
+// GZIP_MAX_CHAIN. Con una ventana de 2 KB los CSV del registro quedan en ~28 % de su tamaño
+// (gzip -1: ~25 %), porque fecha y valores se repiten de una línea a la siguiente.
+//
+// Uso: begin(sink, contexto); write(datos, n) tantas veces como haga falta; finish(). El sink
+// recibe la salida comprimida en trozos de hasta GZIP_OUT_BUFFER bytes.
+
+#ifndef GZIP_STREAM_H
+#define GZIP_STREAM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+const int GZIP_MIN_MATCH = 3;
+const int GZIP_MAX_MATCH = 258;
+const int GZIP_MAX_CHAIN = 16;        // Candidatos revisados por posición
+const size_t GZIP_OUT_BUFFER = 512;
+
+typedef void (*GzipSink)(const uint8_t* data, size_t length, void* context);
+
+// Tablas de deflate (RFC 1951, 3.2.5)
+const uint16_t GZIP_LENGTH_BASE[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                       35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+const uint8_t GZIP_LENGTH_EXTRA[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                       3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+const uint16_t GZIP_DIST_BASE[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                                     257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+                                     8193, 12289, 16385, 24577};
+const uint8_t GZIP_DIST_EXTRA[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+                                     7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+template <int WINDOW_BITS>
+class GzipStream {
+  // Posiciones de 16 bits en un búfer de dos ventanas
+  static_assert(WINDOW_BITS >= 9 && WINDOW_BITS <= 14, "Ventana entre 512 B y 16 KB");
+
+ public:
+  static const size_t WINDOW = (size_t)1 << WINDOW_BITS;
+  static const int HASH_BITS = WINDOW_BITS - 1;
+
+  void begin(GzipSink sink, void* context) {
+    sink_ = sink;
+    context_ = context;
+    buildTables();
+    memset(head_, 0, sizeof(head_));
+    memset(prev_, 0, sizeof(prev_));
+    inLength_ = 0;
+    pos_ = 0;
+    outLength_ = 0;
+    bitBuffer_ = 0;
+    bitCount_ = 0;
+    crc_ = 0xFFFFFFFF;
+    totalIn_ = 0;
+    totalOut_ = 0;
+
+    // Cabecera gzip: sin nombre ni fecha, sistema desconocido
+    const uint8_t header[10] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 0xff};
+    for (uint8_t b : header) putByte(b);
+    putBits(0, 1); // BFINAL = 0; el bloque final vacío se añade en finish()
+    putBits(1, 2); // BTYPE = 01, Huffman fijo
+  }
+
+  void write(const uint8_t* data, size_t length) {
+    for (size_t i = 0; i < length; i++) crc_ = crcTable_[(crc_ ^ data[i]) & 0xff] ^ (crc_ >> 8);
+    totalIn_ += length;
+    while (length > 0) {
+      if (inLength_ == sizeof(in_)) slide();
+      size_t chunk = sizeof(in_) - inLength_;
+      if (chunk > length) chunk = length;
+      memcpy(in_ + inLength_, data, chunk);
+      inLength_ += chunk;
+      data += chunk;
+      length -= chunk;
+      compress(false);
+    }
+  }
+
+  void finish() {
+    compress(true);
+    putSymbol(256);  // Fin del bloque de datos
+    putBits(1, 1);   // Bloque final vacío
+    putBits(1, 2);
+    putSymbol(256);
+    if (bitCount_ > 0) putBits(0, 8 - bitCount_);
+    for (int i = 0; i < 4; i++) putByte((~crc_ >> (8 * i)) & 0xff);
+    for (int i = 0; i < 4; i++) putByte((totalIn_ >> (8 * i)) & 0xff);
+    flush();
+  }
+
+  uint32_t totalIn() const { return totalIn_; }
+  uint32_t totalOut() const { return totalOut_; }
+
+ private:
+  // Comprime hasta dejar GZIP_MAX_MATCH bytes de margen (o todo si `all`)
+  void compress(bool all) {
+    size_t limit = all ? inLength_ : (inLength_ > (size_t)GZIP_MAX_MATCH ? inLength_ - GZIP_MAX_MATCH : 0);
+    while (pos_ < limit) {
+      size_t available = inLength_ - pos_;
+      int bestLength = 0;
+      size_t bestDistance = 0;
+      if (available >= (size_t)GZIP_MIN_MATCH) {
+        uint32_t hash = hashAt(pos_);
+        size_t maxLength = available < (size_t)GZIP_MAX_MATCH ? available : GZIP_MAX_MATCH;
+        uint16_t candidate = head_[hash];
+        for (int chain = 0; candidate != 0 && chain < GZIP_MAX_CHAIN; chain++) {
+          size_t match = candidate - 1;
+          size_t distance = pos_ - match;
+          if (distance > WINDOW) break;
+          if (in_[match + bestLength] == in_[pos_ + bestLength]) {
+            size_t length = 0;
+            while (length < maxLength && in_[match + length] == in_[pos_ + length]) length++;
+            if ((int)length > bestLength) {
+              bestLength = length;
+              bestDistance = distance;
+              if (length == maxLength) break;
+            }
+          }
+          candidate = prev_[match & (WINDOW - 1)];
+        }
+      }
+
+      if (bestLength >= GZIP_MIN_MATCH) {
+        putMatch(bestLength, bestDistance);
+        for (int i = 0; i < bestLength; i++) insert(pos_ + i);
+        pos_ += bestLength;
+      } else {
+        putSymbol(in_[pos_]);
+        insert(pos_);
+        pos_++;
+      }
+    }
+  }
+
+  // Descarta la mitad antigua del búfer; las posiciones guardadas se desplazan WINDOW bytes
+  void slide() {
+    memmove(in_, in_ + WINDOW, WINDOW);
+    inLength_ -= WINDOW;
+    pos_ -= WINDOW;
+    for (size_t i = 0; i < (1u << HASH_BITS); i++) head_[i] = head_[i] > WINDOW ? head_[i] - WINDOW : 0;
+    for (size_t i = 0; i < WINDOW; i++) prev_[i] = prev_[i] > WINDOW ? prev_[i] - WINDOW : 0;
+  }
+
+  uint32_t hashAt(size_t p) const {
+    return ((in_[p] << (2 * HASH_BITS / 3)) ^ (in_[p + 1] << (HASH_BITS / 3)) ^ in_[p + 2]) & ((1u << HASH_BITS) - 1);
+  }
+
+  // head_/prev_ guardan posición + 1 (0 = vacío)
+  void insert(size_t p) {
+    if (p + GZIP_MIN_MATCH > inLength_) return;
+    uint32_t hash = hashAt(p);
+    prev_[p & (WINDOW - 1)] = head_[hash];
+    head_[hash] = p + 1;
+  }
+
+  void putMatch(int length, size_t distance) {
+    int code = 28;
+    while (GZIP_LENGTH_BASE[code] > length) code--;
+    putSymbol(257 + code);
+    putBits(length - GZIP_LENGTH_BASE[code], GZIP_LENGTH_EXTRA[code]);
+
+    code = 29;
+    while (GZIP_DIST_BASE[code] > distance) code--;
+    putBits(reverse(code, 5), 5);
+    putBits(distance - GZIP_DIST_BASE[code], GZIP_DIST_EXTRA[code]);
+  }
+
+  void putSymbol(int symbol) { putBits(codes_[symbol], lengths_[symbol]); }
+
+  void putBits(uint32_t value, int count) {
+    bitBuffer_ |= value << bitCount_;
+    bitCount_ += count;
+    while (bitCount_ >= 8) {
+      putByte(bitBuffer_ & 0xff);
+      bitBuffer_ >>= 8;
+      bitCount_ -= 8;
+    }
+  }
+
+  void putByte(uint8_t b) {
+    out_[outLength_++] = b;
+    if (outLength_ == GZIP_OUT_BUFFER) flush();
+  }
+
+  void flush() {
+    if (outLength_ == 0) return;
+    sink_(out_, outLength_, context_);
+    totalOut_ += outLength_;
+    outLength_ = 0;
+  }
+
+  static uint16_t reverse(uint16_t code, int length) {
+    uint16_t result = 0;
+    for (int i = 0; i < length; i++) result |= ((code >> i) & 1) << (length - 1 - i);
+    return result;
+  }
+
+  // Códigos Huffman fijos ya invertidos (deflate escribe los códigos del bit más significativo)
+  // y tabla del CRC32 de gzip
+  void buildTables() {
+    for (int s = 0; s < 288; s++) {
+      if (s < 144) { codes_[s] = 0x30 + s; lengths_[s] = 8; }
+      else if (s < 256) { codes_[s] = 0x190 + s - 144; lengths_[s] = 9; }
+      else if (s < 280) { codes_[s] = s - 256; lengths_[s] = 7; }
+      else { codes_[s] = 0xc0 + s - 280; lengths_[s] = 8; }
+      codes_[s] = reverse(codes_[s], lengths_[s]);
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t c = i;
+      for (int bit = 0; bit < 8; bit++) c = (c >> 1) ^ (0xEDB88320 & (0 - (c & 1)));
+      crcTable_[i] = c;
+    }
+  }
+
+  GzipSink sink_ = nullptr;
+  void* context_ = nullptr;
+  uint8_t in_[2 * WINDOW];            // Ventana ya comprimida + datos por comprimir
+  size_t inLength_ = 0, pos_ = 0;
+  uint16_t head_[1u << HASH_BITS];    // Última posición con cada hash
+  uint16_t prev_[WINDOW];             // Posición anterior con el mismo hash
+  uint8_t out_[GZIP_OUT_BUFFER];
+  size_t outLength_ = 0;
+  uint32_t bitBuffer_ = 0;
+  int bitCount_ = 0;
+  uint32_t crc_ = 0xFFFFFFFF;
+  uint32_t totalIn_ = 0, totalOut_ = 0;
+  uint16_t codes_[288];
+  uint8_t lengths_[288];
+  uint32_t crcTable_[256];
+};
+
+#endif
@@ -0,0 +1,529 @@
+// Estadísticas y series remuestreadas de meses de registros de uno o varios receptores
+//
+// Lee los CSV diarios (/data/sensors_AAAA-MM-DD.csv) de uno o varios directorios de receptores
+// proyectándolos en memoria (mmap) y los reparte por fecha entre varios hilos. Las tramas que
+// llegan a más de un receptor, o que el receptor vuelve a guardar sin haber recibido otra, cuentan
+// una sola vez: dentro de cada fecha se descartan los (node, seq) repetidos en pocos minutos.
+// Para cada sensor, en total y por nodo, calcula número de lecturas, mínimo, máximo, media,
+// desviación típica y percentiles 5/50/95/99, además de una serie remuestreada cada --step
+// segundos (media, mínimo y máximo por nodo).
+//
+// Análisis del texto sin copias: memchr (vectorizado en la libc) para saltos de línea y comas, y los
+// números se convierten con SWAR, hasta 8 dígitos a la vez en un registro de 64 bits. Las líneas
+// rotas (sin '\n'), el relleno NUL del archivo preasignado de hoy y los archivos antiguos sin
+// columnas node/seq se aceptan.
+//
+// --csv escribe la serie con "time" en la primera columna, que analisis_datos.py grafica
+// directamente; --json escribe resumen y serie juntos.
+//
+// Compilar: g++ -O2 -std=c++17 -pthread analisis_archivo.cpp -o analisis_archivo
+// Uso:      analisis_archivo [--from AAAA-MM-DD] [--to AAAA-MM-DD] [--node n] [--step s] [-j hilos]
+//                            [--csv serie.csv] [--json resumen.json] <dir_o_csv> ...
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+enum { SENSOR_TEMP, SENSOR_HUM, SENSOR_LUX, SENSOR_SOIL, SENSORS };
+const char* SENSOR_COLUMNS[SENSORS] = {"temperature", "humidity", "lux", "soil_moisture"};
+const double PERCENTILES[] = {0.05, 0.50, 0.95, 0.99};
+const int PERCENTILE_COUNT = 4;
+const int64_t DUPLICATE_WINDOW = 600; // s; un contador de secuencia reiniciado no se confunde con copias
+
+// Días desde 1970-01-01 para una fecha civil (algoritmo de Howard Hinnant)
+static int64_t daysFromCivil(int64_t y, unsigned m, unsigned d) {
+  y -= m <= 2;
+  const int64_t era = (y >= 0 ? y : y - 399) / 400;
+  const unsigned yoe = (unsigned)(y - era * 400);
+  const unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + (int64_t)doe - 719468;
+}
+
+static void civilFromEpoch(int64_t t, char out[32]) {
+  int64_t z = (t >= 0 ? t : t - 86399) / 86400 + 719468;
+  int64_t secs = t - (z - 719468) * 86400;
+  const int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+  const unsigned doe = (unsigned)(z - era * 146097);
+  const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  const unsigned mp = (5 * doy + 2) / 153;
+  const unsigned d = doy - (153 * mp + 2) / 5 + 1;
+  const unsigned m = mp < 10 ? mp + 3 : mp - 9;
+  const int64_t y = (int64_t)yoe + era * 400 + (m <= 2);
+  snprintf(out, 32, "%04d-%02u-%02u %02d:%02d:%02d", (int)y, m, d, (int)(secs / 3600), (int)(secs / 60 % 60),
+           (int)(secs % 60));
+}
+
+// "AAAA-MM-DD" -> días desde 1970; -1 si no es una fecha
+static int64_t parseDate(const char* text) {
+  int y, m, d;
+  if (sscanf(text, "%4d-%2d-%2d", &y, &m, &d) != 3 || m < 1 || m > 12 || d < 1 || d > 31) return -1;
+  return daysFromCivil(y, m, d);
+}
+
+// === Conversión de números con SWAR ===
+
+// 8 dígitos ASCII (el primero en el byte bajo) -> entero: 3 multiplicaciones en vez de 8
+static inline uint32_t parseEightDigits(uint64_t chunk) {
+  const uint64_t mask = 0x000000FF000000FF;
+  const uint64_t mul1 = 0x000F424000000064; // 100 + (1000000 << 32)
+  const uint64_t mul2 = 0x0000271000000001; // 1 + (10000 << 32)
+  chunk -= 0x3030303030303030;
+  chunk = chunk * 10 + (chunk >> 8);
+  return (uint32_t)(((chunk & mask) * mul1 + ((chunk >> 16) & mask) * mul2) >> 32);
+}
+
+// Hasta 8 dígitos: se alinean a la derecha sobre ceros ASCII
+static inline uint32_t parseDigits(const char* p, size_t n) {
+  uint64_t chunk = 0x3030303030303030;
+  memcpy((char*)&chunk + (8 - n), p, n);
+  return parseEightDigits(chunk);
+}
+
+static inline bool allDigits(const char* p, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    if ((unsigned)(p[i] - '0') > 9) return false;
+  }
+  return true;
+}
+
+static const double POW10[] = {1, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8};
+
+// "[-]ddd[.ddd]"; cualquier otra forma pasa por strtod. false si el campo está vacío o no es un número.
+static inline bool parseNumber(const char* p, const char* end, double& out) {
+  const char* start = p;
+  bool negative = p < end && *p == '-';
+  if (negative) p++;
+  const char* dot = (const char*)memchr(p, '.', end - p);
+  const char* intEnd = dot ? dot : end;
+  size_t intLength = intEnd - p;
+  size_t fracLength = dot ? end - dot - 1 : 0;
+  if (intLength == 0 || intLength > 8 || fracLength > 8 || !allDigits(p, intLength) ||
+      (dot && !allDigits(dot + 1, fracLength))) {
+    if (start == end) return false;
+    char buffer[48];
+    size_t n = std::min((size_t)(end - start), sizeof(buffer) - 1);
+    memcpy(buffer, start, n);
+    buffer[n] = '\0';
+    char* parsed;
+    out = strtod(buffer, &parsed);
+    return parsed != buffer;
+  }
+  double value = parseDigits(p, intLength);
+  if (fracLength > 0) value += parseDigits(dot + 1, fracLength) / POW10[fracLength];
+  out = negative ? -value : value;
+  return true;
+}
+
+// "AAAA-MM-DD HH:MM:SS" en posiciones fijas; la fecha se reutiliza mientras no cambie
+struct TimestampParser {
+  char lastDate[10] = {};
+  int64_t lastDay = 0;
+
+  bool parse(const char* p, size_t length, int64_t& out) {
+    if (length < 19 || p[4] != '-' || p[7] != '-' || p[10] != ' ' || p[13] != ':' || p[16] != ':') return false;
+    if (memcmp(p, lastDate, 10) != 0) {
+      if (!allDigits(p, 4) || !allDigits(p + 5, 2) || !allDigits(p + 8, 2)) return false;
+      lastDay = daysFromCivil(parseDigits(p, 4), parseDigits(p + 5, 2), parseDigits(p + 8, 2));
+      memcpy(lastDate, p, 10);
+    }
+    if (!allDigits(p + 11, 2) || !allDigits(p + 14, 2) || !allDigits(p + 17, 2)) return false;
+    out = lastDay * 86400 + parseDigits(p + 11, 2) * 3600 + parseDigits(p + 14, 2) * 60 + parseDigits(p + 17, 2);
+    return true;
+  }
+};
+
+// === Acumulación ===
+
+struct Cell {
+  uint32_t samples = 0;
+  double sum[SENSORS] = {};
+  float minValue[SENSORS], maxValue[SENSORS];
+};
+
+struct Accumulator {
+  std::map<int, std::vector<float>> values[SENSORS]; // Por nodo, para percentiles exactos
+  std::unordered_map<uint64_t, Cell> cells;          // (inicio del intervalo, nodo) -> resumen
+  uint64_t records = 0, duplicates = 0, badLines = 0, bytes = 0;
+
+  void add(int node, int64_t time, const double* values_, int64_t step) {
+    int64_t bucket = time - ((time % step) + step) % step;
+    Cell& cell = cells[((uint64_t)bucket << 16) | (uint16_t)node];
+    for (int s = 0; s < SENSORS; s++) {
+      float v = (float)values_[s];
+      values[s][node].push_back(v);
+      cell.minValue[s] = cell.samples == 0 ? v : std::min(cell.minValue[s], v);
+      cell.maxValue[s] = cell.samples == 0 ? v : std::max(cell.maxValue[s], v);
+      cell.sum[s] += values_[s];
+    }
+    cell.samples++;
+    records++;
+  }
+
+  void merge(Accumulator& other) {
+    for (int s = 0; s < SENSORS; s++) {
+      for (auto& entry : other.values[s]) {
+        std::vector<float>& target = values[s][entry.first];
+        target.insert(target.end(), entry.second.begin(), entry.second.end());
+      }
+    }
+    for (const auto& entry : other.cells) {
+      Cell& cell = cells[entry.first];
+      const Cell& add = entry.second;
+      for (int s = 0; s < SENSORS; s++) {
+        cell.minValue[s] = cell.samples == 0 ? add.minValue[s] : std::min(cell.minValue[s], add.minValue[s]);
+        cell.maxValue[s] = cell.samples == 0 ? add.maxValue[s] : std::max(cell.maxValue[s], add.maxValue[s]);
+        cell.sum[s] += add.sum[s];
+      }
+      cell.samples += add.samples;
+    }
+    records += other.records;
+    duplicates += other.duplicates;
+    badLines += other.badLines;
+    bytes += other.bytes;
+  }
+};
+
+struct Options {
+  int64_t fromTime = INT64_MIN, toTime = INT64_MAX;
+  int node = -1;
+  int64_t step = 3600;
+};
+
+// Archivo proyectado en memoria; solo lectura
+class MappedFile {
+ public:
+  explicit MappedFile(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return;
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+      void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data != MAP_FAILED) {
+        data_ = (const char*)data;
+        size_ = info.st_size;
+        madvise(data, size_, MADV_SEQUENTIAL);
+      }
+    }
+    close(fd);
+  }
+  ~MappedFile() {
+    if (data_) munmap((void*)data_, size_);
+  }
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+};
+
+// Analiza un archivo diario. seen guarda la hora de cada (node, seq): una trama repetida en menos de
+// DUPLICATE_WINDOW (otro receptor, o el mismo guardándola de nuevo cada SD_SAVE_INTERVAL) no cuenta
+static void scanFile(const std::string& path, const Options& options, std::unordered_map<uint64_t, int64_t>& seen,
+                     Accumulator& acc) {
+  MappedFile file(path);
+  const char* p = file.data();
+  if (!p) return;
+  const char* end = p + file.size();
+  // El relleno NUL de un archivo preasignado marca el final de los datos
+  const char* nul = (const char*)memchr(p, '\0', file.size());
+  if (nul) end = nul;
+  acc.bytes += end - p;
+
+  // Cabecera: cada archivo trae la suya (los antiguos no tienen node/seq)
+  const char* newline = (const char*)memchr(p, '\n', end - p);
+  if (!newline) return;
+  int columns[SENSORS] = {-1, -1, -1, -1};
+  int nodeCol = -1, seqCol = -1, column = 0;
+  for (const char* field = p; field <= newline; column++) {
+    const char* comma = (const char*)memchr(field, ',', newline - field);
+    const char* fieldEnd = comma ? comma : (newline > field && newline[-1] == '\r' ? newline - 1 : newline);
+    std::string name(field, fieldEnd);
+    for (int s = 0; s < SENSORS; s++) {
+      if (name == SENSOR_COLUMNS[s]) columns[s] = column;
+    }
+    if (name == "node") nodeCol = column;
+    if (name == "seq") seqCol = column;
+    if (!comma) break;
+    field = comma + 1;
+  }
+  for (int c : columns) {
+    if (c < 0) {
+      fprintf(stderr, "%s: faltan columnas de sensores\n", path.c_str());
+      return;
+    }
+  }
+  int lastCol = std::max(std::max(*std::max_element(columns, columns + SENSORS), nodeCol), seqCol);
+
+  TimestampParser timestamps;
+  const char* fields[32];
+  const char* fieldEnds[32];
+  for (p = newline + 1; p < end; p = newline + 1) {
+    newline = (const char*)memchr(p, '\n', end - p);
+    if (!newline) break; // Línea rota al final
+    const char* lineEnd = newline > p && newline[-1] == '\r' ? newline - 1 : newline;
+
+    int count = 0;
+    for (const char* field = p; count <= lastCol && count < 32; count++) {
+      const char* comma = (const char*)memchr(field, ',', lineEnd - field);
+      fields[count] = field;
+      fieldEnds[count] = comma ? comma : lineEnd;
+      if (!comma) {
+        count++;
+        break;
+      }
+      field = comma + 1;
+    }
+    int64_t time;
+    if (count <= lastCol || !timestamps.parse(fields[0], fieldEnds[0] - fields[0], time)) {
+      acc.badLines++;
+      continue;
+    }
+    if (time < options.fromTime || time > options.toTime) continue;
+
+    double node = 0, seq = -1;
+    if (nodeCol >= 0) parseNumber(fields[nodeCol], fieldEnds[nodeCol], node);
+    if (options.node >= 0 && (int)node != options.node) continue;
+    if (seqCol >= 0 && parseNumber(fields[seqCol], fieldEnds[seqCol], seq)) {
+      auto inserted = seen.emplace(((uint64_t)(uint32_t)node << 32) | (uint32_t)seq, time);
+      if (!inserted.second) {
+        bool repeated = llabs(time - inserted.first->second) < DUPLICATE_WINDOW;
+        inserted.first->second = time;
+        if (repeated) {
+          acc.duplicates++;
+          continue;
+        }
+      }
+    }
+
+    double values[SENSORS];
+    bool valid = true;
+    for (int s = 0; s < SENSORS && valid; s++) valid = parseNumber(fields[columns[s]], fieldEnds[columns[s]], values[s]);
+    if (!valid) {
+      acc.badLines++;
+      continue;
+    }
+    acc.add((int)node, time, values, options.step);
+  }
+}
+
+struct Summary {
+  size_t count = 0;
+  double minValue = 0, maxValue = 0, mean = 0, stddev = 0;
+  double percentiles[PERCENTILE_COUNT] = {};
+};
+
+static Summary summarize(std::vector<float>& values) {
+  Summary summary;
+  summary.count = values.size();
+  if (values.empty()) return summary;
+  double sum = 0;
+  summary.minValue = summary.maxValue = values[0];
+  for (float v : values) {
+    sum += v;
+    summary.minValue = std::min(summary.minValue, (double)v);
+    summary.maxValue = std::max(summary.maxValue, (double)v);
+  }
+  summary.mean = sum / values.size();
+  double squares = 0;
+  for (float v : values) squares += (v - summary.mean) * (v - summary.mean);
+  summary.stddev = values.size() > 1 ? sqrt(squares / (values.size() - 1)) : 0;
+  // nth_element en orden creciente de percentil: cada uno parte del tramo ya separado
+  size_t from = 0;
+  for (int i = 0; i < PERCENTILE_COUNT; i++) {
+    size_t k = (size_t)(PERCENTILES[i] * (values.size() - 1));
+    std::nth_element(values.begin() + from, values.begin() + k, values.end());
+    summary.percentiles[i] = values[k];
+    from = k;
+  }
+  return summary;
+}
+
+static void printSummaryJson(FILE* out, const Summary& s) {
+  fprintf(out, "{\"count\":%zu,\"min\":%.3f,\"max\":%.3f,\"mean\":%.4f,\"stddev\":%.4f", s.count, s.minValue,
+          s.maxValue, s.mean, s.stddev);
+  for (int i = 0; i < PERCENTILE_COUNT; i++) fprintf(out, ",\"p%d\":%.3f", (int)(PERCENTILES[i] * 100), s.percentiles[i]);
+  fprintf(out, "}");
+}
+
+int main(int argc, char** argv) {
+  Options options;
+  int64_t fromDay = INT64_MIN, toDay = INT64_MAX;
+  unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+  const char* csvPath = nullptr;
+  const char* jsonPath = nullptr;
+  std::vector<std::string> inputs;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--from") && i + 1 < argc) fromDay = parseDate(argv[++i]);
+    else if (!strcmp(argv[i], "--to") && i + 1 < argc) toDay = parseDate(argv[++i]);
+    else if (!strcmp(argv[i], "--node") && i + 1 < argc) options.node = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--step") && i + 1 < argc) options.step = atol(argv[++i]);
+    else if (!strcmp(argv[i], "-j") && i + 1 < argc) threads = std::max(1, atoi(argv[++i]));
+    else if (!strcmp(argv[i], "--csv") && i + 1 < argc) csvPath = argv[++i];
+    else if (!strcmp(argv[i], "--json") && i + 1 < argc) jsonPath = argv[++i];
+    else if (argv[i][0] != '-' && fs::exists(argv[i])) inputs.push_back(argv[i]);
+    else {
+      fprintf(stderr,
+              "Uso: %s [--from AAAA-MM-DD] [--to AAAA-MM-DD] [--node n] [--step s] [-j hilos]\n"
+              "       [--csv serie.csv] [--json resumen.json] <dir_o_csv> ...\n",
+              argv[0]);
+      return 1;
+    }
+  }
+  if (fromDay == -1 || toDay == -1 || options.step <= 0 || inputs.empty()) {
+    fprintf(stderr, "Fechas, intervalo o entradas no válidos\n");
+    return 1;
+  }
+  if (fromDay != INT64_MIN) options.fromTime = fromDay * 86400;
+  if (toDay != INT64_MAX) options.toTime = toDay * 86400 + 86399;
+
+  // Archivos agrupados por la fecha de su nombre: cada grupo (un día de todos los receptores) es
+  // una unidad de trabajo, así la deduplicación no necesita compartir estado entre hilos
+  std::map<int64_t, std::vector<std::string>> byDay;
+  size_t fileCount = 0;
+  auto addFile = [&](const fs::path& path) {
+    std::string name = path.filename().string();
+    if (name.rfind("sensors_", 0) != 0 || path.extension() != ".csv") return;
+    int64_t day = parseDate(name.c_str() + 8);
+    if (day < 0 || (fromDay != INT64_MIN && day < fromDay - 1) || (toDay != INT64_MAX && day > toDay + 1)) {
+      return; // Se lee un día de más a cada lado por las lecturas atrasadas
+    }
+    byDay[day].push_back(path.string());
+    fileCount++;
+  };
+  for (const std::string& input : inputs) {
+    if (fs::is_directory(input)) {
+      for (const auto& entry : fs::directory_iterator(input)) addFile(entry.path());
+    } else {
+      addFile(input);
+    }
+  }
+  std::vector<const std::vector<std::string>*> groups;
+  for (const auto& entry : byDay) groups.push_back(&entry.second);
+
+  auto started = std::chrono::steady_clock::now();
+  std::vector<Accumulator> partial(threads);
+  std::atomic<size_t> nextGroup(0);
+  std::vector<std::thread> workers;
+  for (unsigned t = 0; t < threads; t++) {
+    workers.emplace_back([&, t]() {
+      std::unordered_map<uint64_t, int64_t> seen;
+      for (size_t g; (g = nextGroup.fetch_add(1)) < groups.size();) {
+        seen.clear();
+        for (const std::string& path : *groups[g]) scanFile(path, options, seen, partial[t]);
+      }
+    });
+  }
+  for (std::thread& worker : workers) worker.join();
+  Accumulator total;
+  for (Accumulator& acc : partial) total.merge(acc);
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+  // Resumen por sensor: todos los nodos y cada nodo
+  Summary overall[SENSORS];
+  std::map<int, Summary> perNode[SENSORS];
+  for (int s = 0; s < SENSORS; s++) {
+    std::vector<float> all;
+    for (auto& entry : total.values[s]) all.insert(all.end(), entry.second.begin(), entry.second.end());
+    overall[s] = summarize(all);
+    for (auto& entry : total.values[s]) perNode[s][entry.first] = summarize(entry.second);
+  }
+
+  printf("%zu archivos, %.1f MB, %llu lecturas (%llu duplicadas entre receptores, %llu líneas inválidas) en %.2f s con %u hilos\n",
+         fileCount, total.bytes / 1e6, (unsigned long long)total.records, (unsigned long long)total.duplicates,
+         (unsigned long long)total.badLines, seconds, threads);
+  printf("%-14s %10s %9s %9s %9s %9s %9s %9s %9s %9s\n", "sensor", "lecturas", "mín", "máx", "media", "desv",
+         "p5", "p50", "p95", "p99");
+  for (int s = 0; s < SENSORS; s++) {
+    const Summary& o = overall[s];
+    printf("%-14s %10zu %9.2f %9.2f %9.2f %9.2f %9.2f %9.2f %9.2f %9.2f\n", SENSOR_COLUMNS[s], o.count, o.minValue,
+           o.maxValue, o.mean, o.stddev, o.percentiles[0], o.percentiles[1], o.percentiles[2], o.percentiles[3]);
+  }
+
+  // Serie ordenada por tiempo y nodo
+  std::vector<std::pair<uint64_t, const Cell*>> series;
+  series.reserve(total.cells.size());
+  for (const auto& entry : total.cells) series.push_back({entry.first, &entry.second});
+  std::sort(series.begin(), series.end(),
+            [](const std::pair<uint64_t, const Cell*>& a, const std::pair<uint64_t, const Cell*>& b) { return a.first < b.first; });
+
+  if (csvPath) {
+    FILE* out = fopen(csvPath, "w");
+    if (!out) {
+      perror(csvPath);
+      return 1;
+    }
+    fprintf(out, "time,node,samples");
+    for (const char* name : SENSOR_COLUMNS) fprintf(out, ",%s_mean,%s_min,%s_max", name, name, name);
+    fprintf(out, "\n");
+    for (const auto& entry : series) {
+      char time[32];
+      civilFromEpoch((int64_t)(entry.first >> 16), time);
+      const Cell& cell = *entry.second;
+      fprintf(out, "%s,%d,%u", time, (int)(entry.first & 0xFFFF), cell.samples);
+      for (int s = 0; s < SENSORS; s++) {
+        fprintf(out, ",%.3f,%.2f,%.2f", cell.sum[s] / cell.samples, cell.minValue[s], cell.maxValue[s]);
+      }
+      fprintf(out, "\n");
+    }
+    fclose(out);
+  }
+
+  if (jsonPath) {
+    FILE* out = fopen(jsonPath, "w");
+    if (!out) {
+      perror(jsonPath);
+      return 1;
+    }
+    fprintf(out, "{\"files\":%zu,\"records\":%llu,\"duplicates\":%llu,\"step\":%lld,\"sensors\":{", fileCount,
+            (unsigned long long)total.records, (unsigned long long)total.duplicates, (long long)options.step);
+    for (int s = 0; s < SENSORS; s++) {
+      fprintf(out, "%s\"%s\":{\"all\":", s ? "," : "", SENSOR_COLUMNS[s]);
+      printSummaryJson(out, overall[s]);
+      fprintf(out, ",\"nodes\":{");
+      bool first = true;
+      for (const auto& entry : perNode[s]) {
+        fprintf(out, "%s\"%d\":", first ? "" : ",", entry.first);
+        printSummaryJson(out, entry.second);
+        first = false;
+      }
+      fprintf(out, "}}");
+    }
+    fprintf(out, "},\"series\":[");
+    for (size_t i = 0; i < series.size(); i++) {
+      char time[32];
+      civilFromEpoch((int64_t)(series[i].first >> 16), time);
+      const Cell& cell = *series[i].second;
+      fprintf(out, "%s{\"time\":\"%s\",\"node\":%d,\"samples\":%u", i ? "," : "", time,
+              (int)(series[i].first & 0xFFFF), cell.samples);
+      for (int s = 0; s < SENSORS; s++) {
+        fprintf(out, ",\"%s\":[%.3f,%.2f,%.2f]", SENSOR_COLUMNS[s], cell.sum[s] / cell.samples, cell.minValue[s],
+                cell.maxValue[s]);
+      }
+      fprintf(out, "}");
+    }
+    fprintf(out, "]}\n");
+    fclose(out);
+  }
+  return 0;
+}
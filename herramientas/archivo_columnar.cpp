@@ -0,0 +1,715 @@
+// Archivo columnar de los registros del receptor: conversión, consultas y comparación con el CSV
+//
+// convert: lee los CSV diarios (/data/sensors_AAAA-MM-DD.csv, directorios o archivos sueltos) línea
+// a línea y escribe un único archivo .scol en grupos de GROUP_ROWS filas; la memoria usada es la de
+// un grupo más el índice final. Cada columna de cada grupo es un bloque propio con dos codificaciones
+// posibles (se guarda la más corta):
+//   - FOR: valor mínimo del bloque y diferencias a él empaquetadas con el mínimo de bits,
+//   - delta: primer valor, diferencia mínima entre filas consecutivas y el resto empaquetado
+//     (la hora, cada 60 s, queda en 0 bits por fila).
+// Los decimales se guardan como enteros con la escala del CSV (temperatura x100, luz x10...).
+// El índice al final del archivo lleva por grupo y columna un mapa de zona {mín, máx, suma}: las
+// consultas saltan los grupos fuera del rango de fechas, del nodo o del umbral, y los grupos
+// contenidos del todo en la consulta se responden sin descomprimir.
+//
+// query: agregados (lecturas, mín, máx, media) de una columna con filtros de fecha, nodo y umbral,
+// en total o por hora/día.
+//
+// bench: misma consulta sobre el .scol y leyendo los CSV, con tiempos y tamaños.
+//
+// Compilar: g++ -O2 -std=c++17 archivo_columnar.cpp -o archivo_columnar
+// Uso:      archivo_columnar convert salida.scol <dir_o_csv> ...
+//           archivo_columnar query archivo.scol [--from AAAA-MM-DD] [--to AAAA-MM-DD] [--node n]
+//                              [--column c] [--where c>v|c<v] [--by hour|day]
+//           archivo_columnar bench archivo.scol <dir_o_csv> ...
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../sd_journal.h" // journalLineValid(): columna crc de las líneas
+
+namespace fs = std::filesystem;
+
+const uint32_t SCOL_MAGIC = 0x4C4F4353; // "SCOL"
+const uint32_t SCOL_VERSION = 1;
+const int GROUP_ROWS = 4096;
+
+enum { COL_TIME, COL_NODE, COL_SEQ, COL_TEMP, COL_HUM, COL_SOIL, COL_LUX, COL_RSSI, COL_SNR, COLUMNS };
+const char* COLUMN_NAMES[COLUMNS] = {"timestamp", "node", "seq", "temperature", "humidity", "soil_moisture",
+                                     "lux", "rssi", "snr"};
+const int COLUMN_SCALE[COLUMNS] = {1, 1, 1, 100, 100, 1, 10, 1, 1}; // Decimales del CSV del receptor
+
+enum { ENCODING_FOR = 0, ENCODING_DELTA = 1 };
+
+struct BlockHeader {
+  uint8_t encoding;
+  uint8_t bits;
+  uint16_t reserved;
+  uint32_t bytes;   // Datos empaquetados que siguen
+  int64_t base;     // FOR: mínimo; delta: primer valor
+  int64_t minDelta; // delta: diferencia mínima
+};
+
+struct ZoneMap {
+  int64_t minValue, maxValue, sum;
+};
+
+struct GroupIndex {
+  uint64_t offset;    // Primer bloque del grupo
+  uint32_t rows;
+  uint32_t blockBytes[COLUMNS];
+  ZoneMap zones[COLUMNS];
+};
+
+struct Footer {
+  uint64_t indexOffset;
+  uint32_t groups;
+  uint32_t magic;
+};
+
+// Días desde 1970-01-01 para una fecha civil (algoritmo de Howard Hinnant)
+static int64_t daysFromCivil(int64_t y, unsigned m, unsigned d) {
+  y -= m <= 2;
+  const int64_t era = (y >= 0 ? y : y - 399) / 400;
+  const unsigned yoe = (unsigned)(y - era * 400);
+  const unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + (int64_t)doe - 719468;
+}
+
+static void civilFromEpoch(int64_t t, char out[32]) {
+  int64_t z = (t >= 0 ? t : t - 86399) / 86400 + 719468;
+  int64_t secs = t - (z - 719468) * 86400;
+  const int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+  const unsigned doe = (unsigned)(z - era * 146097);
+  const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  const unsigned mp = (5 * doy + 2) / 153;
+  const unsigned d = doy - (153 * mp + 2) / 5 + 1;
+  const unsigned m = mp < 10 ? mp + 3 : mp - 9;
+  const int64_t y = (int64_t)yoe + era * 400 + (m <= 2);
+  snprintf(out, 32, "%04d-%02u-%02u %02d:%02d:%02d", (int)y, m, d, (int)(secs / 3600), (int)(secs / 60 % 60),
+           (int)(secs % 60));
+}
+
+static bool parseTimestamp(const char* text, int64_t& out) {
+  int y, mo, d, h, mi, s;
+  if (sscanf(text, "%d-%d-%d %d:%d:%d", &y, &mo, &d, &h, &mi, &s) != 6) return false;
+  out = daysFromCivil(y, mo, d) * 86400 + h * 3600 + mi * 60 + s;
+  return true;
+}
+
+// "AAAA-MM-DD" -> días desde 1970; -1 si no es una fecha
+static int64_t parseDate(const char* text) {
+  int y, m, d;
+  if (sscanf(text, "%4d-%2d-%2d", &y, &m, &d) != 3 || m < 1 || m > 12 || d < 1 || d > 31) return -1;
+  return daysFromCivil(y, m, d);
+}
+
+static int columnIndex(const std::string& name) {
+  for (int c = 0; c < COLUMNS; c++) {
+    if (name == COLUMN_NAMES[c]) return c;
+  }
+  return -1;
+}
+
+static std::vector<std::string> inputFiles(const std::vector<std::string>& inputs) {
+  std::vector<std::string> files;
+  for (const std::string& input : inputs) {
+    if (fs::is_directory(input)) {
+      for (const auto& entry : fs::directory_iterator(input)) {
+        std::string name = entry.path().filename().string();
+        if (name.rfind("sensors_", 0) == 0 && entry.path().extension() == ".csv") files.push_back(entry.path().string());
+      }
+    } else {
+      files.push_back(input);
+    }
+  }
+  std::sort(files.begin(), files.end(), [](const std::string& a, const std::string& b) {
+    return fs::path(a).filename() < fs::path(b).filename(); // AAAA-MM-DD ordena cronológicamente
+  });
+  return files;
+}
+
+// === Empaquetado de bits ===
+
+struct BitWriter {
+  std::vector<uint8_t>& out;
+  uint64_t accumulator = 0;
+  int count = 0;
+  explicit BitWriter(std::vector<uint8_t>& target) : out(target) {}
+  void put(uint64_t value, int bits) {
+    if (bits > 32) {
+      put(value & 0xFFFFFFFF, 32);
+      put(value >> 32, bits - 32);
+      return;
+    }
+    if (bits == 0) return;
+    accumulator |= (value & ((1ULL << bits) - 1)) << count;
+    count += bits;
+    while (count >= 8) {
+      out.push_back(accumulator & 0xFF);
+      accumulator >>= 8;
+      count -= 8;
+    }
+  }
+  void flush() {
+    if (count > 0) out.push_back(accumulator & 0xFF);
+    accumulator = 0;
+    count = 0;
+  }
+};
+
+struct BitReader {
+  const uint8_t* data;
+  const uint8_t* end;
+  uint64_t accumulator = 0;
+  int count = 0;
+  BitReader(const uint8_t* start, size_t length) : data(start), end(start + length) {}
+  uint64_t get(int bits) {
+    if (bits > 32) {
+      uint64_t low = get(32);
+      return low | (get(bits - 32) << 32);
+    }
+    if (bits == 0) return 0;
+    while (count < bits) {
+      accumulator |= (uint64_t)(data < end ? *data++ : 0) << count;
+      count += 8;
+    }
+    uint64_t value = accumulator & ((1ULL << bits) - 1);
+    accumulator >>= bits;
+    count -= bits;
+    return value;
+  }
+};
+
+static int bitsFor(uint64_t range) {
+  int bits = 0;
+  while (bits < 64 && (range >> bits) != 0) bits++;
+  return bits;
+}
+
+// Elige FOR o delta según cuál ocupa menos bits por fila
+static void encodeBlock(const std::vector<int64_t>& values, std::vector<uint8_t>& out, ZoneMap& zone) {
+  BlockHeader header = {};
+  int64_t minValue = values[0], maxValue = values[0], sum = 0;
+  int64_t minDelta = INT64_MAX, maxDelta = INT64_MIN;
+  for (size_t i = 0; i < values.size(); i++) {
+    minValue = std::min(minValue, values[i]);
+    maxValue = std::max(maxValue, values[i]);
+    sum += values[i];
+    if (i > 0) {
+      int64_t delta = values[i] - values[i - 1];
+      minDelta = std::min(minDelta, delta);
+      maxDelta = std::max(maxDelta, delta);
+    }
+  }
+  zone = {minValue, maxValue, sum};
+  int forBits = bitsFor((uint64_t)(maxValue - minValue));
+  int deltaBits = values.size() > 1 ? bitsFor((uint64_t)(maxDelta - minDelta)) : 64;
+
+  std::vector<uint8_t> packed;
+  BitWriter writer(packed);
+  if (deltaBits < forBits) {
+    header.encoding = ENCODING_DELTA;
+    header.bits = deltaBits;
+    header.base = values[0];
+    header.minDelta = minDelta;
+    for (size_t i = 1; i < values.size(); i++) writer.put((uint64_t)(values[i] - values[i - 1] - minDelta), deltaBits);
+  } else {
+    header.encoding = ENCODING_FOR;
+    header.bits = forBits;
+    header.base = minValue;
+    for (int64_t value : values) writer.put((uint64_t)(value - minValue), forBits);
+  }
+  writer.flush();
+  header.bytes = packed.size();
+  const uint8_t* raw = (const uint8_t*)&header;
+  out.insert(out.end(), raw, raw + sizeof(header));
+  out.insert(out.end(), packed.begin(), packed.end());
+}
+
+static void decodeBlock(const uint8_t* block, uint32_t rows, int64_t* values) {
+  BlockHeader header;
+  memcpy(&header, block, sizeof(header));
+  BitReader reader(block + sizeof(header), header.bytes);
+  if (header.encoding == ENCODING_DELTA) {
+    int64_t value = header.base;
+    values[0] = value;
+    for (uint32_t i = 1; i < rows; i++) {
+      value += (int64_t)reader.get(header.bits) + header.minDelta;
+      values[i] = value;
+    }
+  } else {
+    for (uint32_t i = 0; i < rows; i++) values[i] = header.base + (int64_t)reader.get(header.bits);
+  }
+}
+
+// === convert ===
+
+class ScolWriter {
+ public:
+  explicit ScolWriter(FILE* out) : out_(out) {
+    uint32_t header[2] = {SCOL_MAGIC, SCOL_VERSION};
+    fwrite(header, sizeof(header), 1, out_);
+    offset_ = sizeof(header);
+    for (auto& column : columns_) column.reserve(GROUP_ROWS);
+  }
+
+  void add(const int64_t row[COLUMNS]) {
+    for (int c = 0; c < COLUMNS; c++) columns_[c].push_back(row[c]);
+    rows_++;
+    if (columns_[0].size() == (size_t)GROUP_ROWS) flushGroup();
+  }
+
+  uint64_t finish() {
+    flushGroup();
+    Footer footer = {offset_, (uint32_t)index_.size(), SCOL_MAGIC};
+    fwrite(index_.data(), sizeof(GroupIndex), index_.size(), out_);
+    fwrite(&footer, sizeof(footer), 1, out_);
+    return offset_ + index_.size() * sizeof(GroupIndex) + sizeof(footer);
+  }
+
+  uint64_t rows() const { return rows_; }
+
+ private:
+  void flushGroup() {
+    if (columns_[0].empty()) return;
+    GroupIndex group = {};
+    group.offset = offset_;
+    group.rows = columns_[0].size();
+    for (int c = 0; c < COLUMNS; c++) {
+      buffer_.clear();
+      encodeBlock(columns_[c], buffer_, group.zones[c]);
+      fwrite(buffer_.data(), 1, buffer_.size(), out_);
+      group.blockBytes[c] = buffer_.size();
+      offset_ += buffer_.size();
+      columns_[c].clear();
+    }
+    index_.push_back(group);
+  }
+
+  FILE* out_;
+  uint64_t offset_ = 0, rows_ = 0;
+  std::vector<int64_t> columns_[COLUMNS];
+  std::vector<uint8_t> buffer_;
+  std::vector<GroupIndex> index_; // ~250 bytes por grupo de 4096 filas
+};
+
+static int convert(const char* outPath, const std::vector<std::string>& inputs) {
+  std::vector<std::string> files = inputFiles(inputs);
+  FILE* out = fopen(outPath, "wb");
+  if (!out) {
+    perror(outPath);
+    return 1;
+  }
+  ScolWriter writer(out);
+  uint64_t inputBytes = 0, rejected = 0;
+  auto started = std::chrono::steady_clock::now();
+
+  for (const std::string& path : files) {
+    std::ifstream in(path);
+    std::string line;
+    if (!std::getline(in, line)) continue;
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    inputBytes += line.size() + 1;
+
+    // Cada archivo trae su cabecera: los antiguos no tienen node/seq/rssi/snr/crc
+    std::vector<int> map; // columna del CSV -> columna del .scol (-1 = se ignora)
+    bool hasCrc = false;
+    size_t start = 0;
+    while (start <= line.size()) {
+      size_t comma = line.find(',', start);
+      std::string name = line.substr(start, comma == std::string::npos ? std::string::npos : comma - start);
+      map.push_back(columnIndex(name));
+      hasCrc |= name == "crc";
+      if (comma == std::string::npos) break;
+      start = comma + 1;
+    }
+
+    while (std::getline(in, line)) {
+      inputBytes += line.size() + 1;
+      if (!line.empty() && line.back() == '\r') line.pop_back();
+      if (line.empty() || line[0] == '\0') break; // Relleno del archivo preasignado
+      if (hasCrc && !journalLineValid(line.data(), line.size())) {
+        rejected++;
+        continue;
+      }
+      int64_t row[COLUMNS] = {0, 0, -1, 0, 0, 0, 0, 0, 0};
+      bool valid = true;
+      size_t field = 0, column = 0;
+      while (valid && column < map.size()) {
+        size_t comma = line.find(',', field);
+        size_t fieldEnd = comma == std::string::npos ? line.size() : comma;
+        int c = map[column];
+        if (c == COL_TIME) {
+          valid = parseTimestamp(line.c_str() + field, row[c]);
+        } else if (c >= 0 && fieldEnd > field) {
+          row[c] = llround(strtod(line.c_str() + field, nullptr) * COLUMN_SCALE[c]);
+        }
+        column++;
+        if (comma == std::string::npos) break;
+        field = comma + 1;
+      }
+      if (!valid || column < 5) {
+        rejected++;
+        continue;
+      }
+      writer.add(row);
+    }
+  }
+  uint64_t outputBytes = writer.finish();
+  fclose(out);
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+  printf("%zu archivos, %llu filas (%llu líneas rechazadas) en %.2f s\n", files.size(),
+         (unsigned long long)writer.rows(), (unsigned long long)rejected, seconds);
+  printf("CSV %.1f MB -> %s %.1f MB (%.1f%%, %.2f bytes/fila)\n", inputBytes / 1e6, outPath, outputBytes / 1e6,
+         inputBytes ? 100.0 * outputBytes / inputBytes : 0.0, writer.rows() ? (double)outputBytes / writer.rows() : 0.0);
+  return 0;
+}
+
+// === query ===
+
+struct Query {
+  int64_t from = INT64_MIN, to = INT64_MAX;
+  int node = -1;
+  int column = COL_TEMP;
+  int whereColumn = -1;
+  bool whereGreater = true;
+  int64_t whereValue = 0; // Ya escalado
+  int64_t bucket = 0;     // 0 = sin agrupar, 3600 o 86400
+};
+
+struct Aggregate {
+  uint64_t count = 0;
+  int64_t minValue = INT64_MAX, maxValue = INT64_MIN, sum = 0;
+  void add(int64_t v) {
+    count++;
+    minValue = std::min(minValue, v);
+    maxValue = std::max(maxValue, v);
+    sum += v;
+  }
+};
+
+struct QueryStats {
+  uint64_t groups = 0, skipped = 0, fromZoneMaps = 0, decoded = 0, rowsScanned = 0;
+};
+
+static bool parseQueryArgs(int argc, char** argv, int first, Query& query) {
+  for (int i = first; i < argc; i++) {
+    if (!strcmp(argv[i], "--from") && i + 1 < argc) {
+      int64_t day = parseDate(argv[++i]);
+      if (day < 0) return false;
+      query.from = day * 86400;
+    } else if (!strcmp(argv[i], "--to") && i + 1 < argc) {
+      int64_t day = parseDate(argv[++i]);
+      if (day < 0) return false;
+      query.to = day * 86400 + 86399;
+    } else if (!strcmp(argv[i], "--node") && i + 1 < argc) {
+      query.node = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--column") && i + 1 < argc) {
+      query.column = columnIndex(argv[++i]);
+      if (query.column <= COL_TIME) return false;
+    } else if (!strcmp(argv[i], "--where") && i + 1 < argc) {
+      std::string text = argv[++i];
+      size_t op = text.find_first_of("<>");
+      if (op == std::string::npos) return false;
+      query.whereColumn = columnIndex(text.substr(0, op));
+      if (query.whereColumn <= COL_TIME) return false;
+      query.whereGreater = text[op] == '>';
+      query.whereValue = llround(atof(text.c_str() + op + 1) * COLUMN_SCALE[query.whereColumn]);
+    } else if (!strcmp(argv[i], "--by") && i + 1 < argc) {
+      std::string by = argv[++i];
+      if (by == "hour") query.bucket = 3600;
+      else if (by == "day") query.bucket = 86400;
+      else return false;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool whereMatches(const Query& q, int64_t v) { return q.whereGreater ? v > q.whereValue : v < q.whereValue; }
+
+// Resultado por intervalo (clave 0 sin agrupar)
+static std::map<int64_t, Aggregate> runScolQuery(const uint8_t* data, size_t size, const Query& q, QueryStats& stats) {
+  std::map<int64_t, Aggregate> result;
+  Footer footer;
+  memcpy(&footer, data + size - sizeof(footer), sizeof(footer));
+  const GroupIndex* groups = (const GroupIndex*)(data + footer.indexOffset);
+  std::vector<int64_t> times(GROUP_ROWS), nodes(GROUP_ROWS), values(GROUP_ROWS), where(GROUP_ROWS);
+
+  for (uint32_t g = 0; g < footer.groups; g++) {
+    const GroupIndex& group = groups[g];
+    const ZoneMap& time = group.zones[COL_TIME];
+    const ZoneMap& node = group.zones[COL_NODE];
+    stats.groups++;
+    // Mapas de zona: fuera de fechas, sin el nodo o sin ninguna fila que pase el umbral
+    bool outside = time.maxValue < q.from || time.minValue > q.to ||
+                   (q.node >= 0 && (q.node < node.minValue || q.node > node.maxValue));
+    if (!outside && q.whereColumn >= 0) {
+      const ZoneMap& zone = group.zones[q.whereColumn];
+      outside = q.whereGreater ? zone.maxValue <= q.whereValue : zone.minValue >= q.whereValue;
+    }
+    if (outside) {
+      stats.skipped++;
+      continue;
+    }
+    // Grupo contenido entero en la consulta: el mapa de zona ya es la respuesta
+    bool covered = time.minValue >= q.from && time.maxValue <= q.to &&
+                   (q.node < 0 || (node.minValue == q.node && node.maxValue == q.node)) &&
+                   (q.whereColumn < 0 || (q.whereGreater ? group.zones[q.whereColumn].minValue > q.whereValue
+                                                         : group.zones[q.whereColumn].maxValue < q.whereValue));
+    if (covered && (q.bucket == 0 || time.minValue / q.bucket == time.maxValue / q.bucket)) {
+      const ZoneMap& zone = group.zones[q.column];
+      Aggregate& agg = result[q.bucket ? time.minValue / q.bucket * q.bucket : 0];
+      agg.count += group.rows;
+      agg.minValue = std::min(agg.minValue, zone.minValue);
+      agg.maxValue = std::max(agg.maxValue, zone.maxValue);
+      agg.sum += zone.sum;
+      stats.fromZoneMaps++;
+      continue;
+    }
+
+    // Solo se descomprimen las columnas que la consulta usa
+    stats.decoded++;
+    stats.rowsScanned += group.rows;
+    uint64_t offsets[COLUMNS];
+    uint64_t offset = group.offset;
+    for (int c = 0; c < COLUMNS; c++) {
+      offsets[c] = offset;
+      offset += group.blockBytes[c];
+    }
+    decodeBlock(data + offsets[COL_TIME], group.rows, times.data());
+    decodeBlock(data + offsets[q.column], group.rows, values.data());
+    if (q.node >= 0) decodeBlock(data + offsets[COL_NODE], group.rows, nodes.data());
+    if (q.whereColumn >= 0) decodeBlock(data + offsets[q.whereColumn], group.rows, where.data());
+    for (uint32_t i = 0; i < group.rows; i++) {
+      if (times[i] < q.from || times[i] > q.to) continue;
+      if (q.node >= 0 && nodes[i] != q.node) continue;
+      if (q.whereColumn >= 0 && !whereMatches(q, where[i])) continue;
+      result[q.bucket ? times[i] / q.bucket * q.bucket : 0].add(values[i]);
+    }
+  }
+  return result;
+}
+
+// La misma consulta leyendo los CSV (solo los archivos cuyo nombre cae en el rango de fechas)
+static std::map<int64_t, Aggregate> runCsvQuery(const std::vector<std::string>& files, const Query& q, uint64_t& bytes) {
+  std::map<int64_t, Aggregate> result;
+  for (const std::string& path : files) {
+    std::string name = fs::path(path).filename().string();
+    int64_t day = parseDate(name.c_str() + 8);
+    if (day >= 0 && ((q.to != INT64_MAX && day * 86400 > q.to + 86400) || (q.from != INT64_MIN && day * 86400 + 86400 < q.from - 86400))) {
+      continue; // ±1 día por las lecturas atrasadas
+    }
+    std::ifstream in(path);
+    std::string line;
+    if (!std::getline(in, line)) continue;
+    bytes += line.size() + 1;
+    int csvColumn[COLUMNS];
+    std::fill(csvColumn, csvColumn + COLUMNS, -1);
+    int index = 0;
+    for (size_t start = 0;; index++) {
+      size_t comma = line.find(',', start);
+      std::string header = line.substr(start, comma == std::string::npos ? std::string::npos : comma - start);
+      if (!header.empty() && header.back() == '\r') header.pop_back();
+      int c = columnIndex(header);
+      if (c >= 0) csvColumn[c] = index;
+      if (comma == std::string::npos) break;
+      start = comma + 1;
+    }
+    while (std::getline(in, line)) {
+      bytes += line.size() + 1;
+      if (line.empty() || line[0] == '\0') break;
+      const char* fields[16];
+      int count = 0;
+      fields[count++] = line.c_str();
+      for (char& ch : line) {
+        if (ch == ',' && count < 16) {
+          ch = '\0';
+          fields[count++] = &ch + 1;
+        }
+      }
+      int64_t time;
+      if (!parseTimestamp(fields[0], time) || time < q.from || time > q.to) continue;
+      auto scaled = [&](int c) -> int64_t {
+        return csvColumn[c] >= 0 && csvColumn[c] < count ? llround(strtod(fields[csvColumn[c]], nullptr) * COLUMN_SCALE[c]) : 0;
+      };
+      if (q.node >= 0 && scaled(COL_NODE) != q.node) continue;
+      if (q.whereColumn >= 0 && !whereMatches(q, scaled(q.whereColumn))) continue;
+      result[q.bucket ? time / q.bucket * q.bucket : 0].add(scaled(q.column));
+    }
+  }
+  return result;
+}
+
+static void printResult(const std::map<int64_t, Aggregate>& result, const Query& q) {
+  double scale = COLUMN_SCALE[q.column];
+  printf("%s,count,min,max,mean\n", q.bucket ? "time" : "range");
+  for (const auto& entry : result) {
+    const Aggregate& agg = entry.second;
+    char label[32] = "all";
+    if (q.bucket) civilFromEpoch(entry.first, label);
+    printf("%s,%llu,%.2f,%.2f,%.3f\n", label, (unsigned long long)agg.count, agg.minValue / scale,
+           agg.maxValue / scale, agg.count ? agg.sum / scale / agg.count : 0.0);
+  }
+}
+
+class MappedFile {
+ public:
+  explicit MappedFile(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return;
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+      void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data != MAP_FAILED) {
+        data_ = (const uint8_t*)data;
+        size_ = info.st_size;
+      }
+    }
+    close(fd);
+  }
+  ~MappedFile() {
+    if (data_) munmap((void*)data_, size_);
+  }
+  // Cabecera y pie con la firma SCOL
+  bool valid() const {
+    if (!data_ || size_ < 8 + sizeof(Footer)) return false;
+    Footer footer;
+    memcpy(&footer, data_ + size_ - sizeof(footer), sizeof(footer));
+    return ((const uint32_t*)data_)[0] == SCOL_MAGIC && ((const uint32_t*)data_)[1] == SCOL_VERSION &&
+           footer.magic == SCOL_MAGIC && footer.indexOffset + (uint64_t)footer.groups * sizeof(GroupIndex) + sizeof(footer) == size_;
+  }
+  const uint8_t* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  const uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+};
+
+static int usage(const char* program) {
+  fprintf(stderr,
+          "Uso: %s convert salida.scol <dir_o_csv> ...\n"
+          "     %s query archivo.scol [--from AAAA-MM-DD] [--to AAAA-MM-DD] [--node n]\n"
+          "                           [--column c] [--where c>v|c<v] [--by hour|day]\n"
+          "     %s bench archivo.scol <dir_o_csv> ...\n",
+          program, program, program);
+  return 1;
+}
+
+static double elapsed(std::chrono::steady_clock::time_point since) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - since).count();
+}
+
+int main(int argc, char** argv) {
+  if (argc < 3) return usage(argv[0]);
+  std::string command = argv[1];
+
+  if (command == "convert") {
+    if (argc < 4) return usage(argv[0]);
+    return convert(argv[2], std::vector<std::string>(argv + 3, argv + argc));
+  }
+
+  MappedFile file(argv[2]);
+  if (!file.valid()) {
+    fprintf(stderr, "%s: no es un archivo .scol válido\n", argv[2]);
+    return 1;
+  }
+
+  if (command == "query") {
+    Query query;
+    if (!parseQueryArgs(argc, argv, 3, query)) return usage(argv[0]);
+    QueryStats stats;
+    auto started = std::chrono::steady_clock::now();
+    std::map<int64_t, Aggregate> result = runScolQuery(file.data(), file.size(), query, stats);
+    double seconds = elapsed(started);
+    printResult(result, query);
+    fprintf(stderr, "%llu grupos: %llu saltados, %llu desde el mapa de zona, %llu descomprimidos (%llu filas) en %.3f ms\n",
+            (unsigned long long)stats.groups, (unsigned long long)stats.skipped, (unsigned long long)stats.fromZoneMaps,
+            (unsigned long long)stats.decoded, (unsigned long long)stats.rowsScanned, seconds * 1000);
+    return 0;
+  }
+
+  if (command == "bench") {
+    if (argc < 4) return usage(argv[0]);
+    std::vector<std::string> files = inputFiles(std::vector<std::string>(argv + 3, argv + argc));
+    uint64_t csvSize = 0;
+    for (const std::string& path : files) csvSize += fs::file_size(path);
+
+    // Rango de fechas de los datos, para las consultas de una semana y un mes
+    Footer footer;
+    memcpy(&footer, file.data() + file.size() - sizeof(footer), sizeof(footer));
+    const GroupIndex* groups = (const GroupIndex*)(file.data() + footer.indexOffset);
+    int64_t first = footer.groups ? groups[0].zones[COL_TIME].minValue / 86400 * 86400 : 0;
+
+    struct Case {
+      const char* name;
+      Query query;
+    };
+    std::vector<Case> cases(5);
+    cases[0].name = "media anual de temperatura";
+    cases[1].name = "una semana, por hora";
+    cases[1].query.from = first + 30 * 86400;
+    cases[1].query.to = cases[1].query.from + 7 * 86400 - 1;
+    cases[1].query.bucket = 3600;
+    cases[2].name = "un mes de un nodo";
+    cases[2].query.from = first + 60 * 86400;
+    cases[2].query.to = cases[2].query.from + 30 * 86400 - 1;
+    cases[2].query.node = 3;
+    cases[3].name = "humedad > 99 % (umbral)";
+    cases[3].query.column = COL_HUM;
+    cases[3].query.whereColumn = COL_HUM;
+    cases[3].query.whereValue = 9900;
+    cases[4].name = "luz por día con temp. > 26";
+    cases[4].query.column = COL_LUX;
+    cases[4].query.whereColumn = COL_TEMP;
+    cases[4].query.whereValue = 2600;
+    cases[4].query.bucket = 86400;
+
+    printf("CSV: %zu archivos, %.1f MB; .scol: %.1f MB (%.1f%%)\n\n", files.size(), csvSize / 1e6, file.size() / 1e6,
+           csvSize ? 100.0 * file.size() / csvSize : 0.0);
+    printf("%-28s %10s %10s %8s %22s %s\n", "consulta", "CSV ms", ".scol ms", "x", "grupos salt./zona/desc.", "igual");
+    for (Case& c : cases) {
+      uint64_t bytes = 0;
+      auto started = std::chrono::steady_clock::now();
+      std::map<int64_t, Aggregate> csvResult = runCsvQuery(files, c.query, bytes);
+      double csvSeconds = elapsed(started);
+      QueryStats stats;
+      started = std::chrono::steady_clock::now();
+      std::map<int64_t, Aggregate> scolResult = runScolQuery(file.data(), file.size(), c.query, stats);
+      double scolSeconds = elapsed(started);
+
+      bool same = csvResult.size() == scolResult.size();
+      for (auto a = csvResult.begin(), b = scolResult.begin(); same && a != csvResult.end(); ++a, ++b) {
+        same = a->first == b->first && a->second.count == b->second.count && a->second.sum == b->second.sum &&
+               a->second.minValue == b->second.minValue && a->second.maxValue == b->second.maxValue;
+      }
+      char groupsText[32];
+      snprintf(groupsText, sizeof(groupsText), "%llu/%llu/%llu", (unsigned long long)stats.skipped,
+               (unsigned long long)stats.fromZoneMaps, (unsigned long long)stats.decoded);
+      printf("%-28s %10.1f %10.2f %8.0f %22s %s\n", c.name, csvSeconds * 1000, scolSeconds * 1000,
+             scolSeconds > 0 ? csvSeconds / scolSeconds : 0.0, groupsText, same ? "sí" : "NO");
+    }
+    return 0;
+  }
+  return usage(argv[0]);
+}
@@ -0,0 +1,413 @@
+// Broker MQTT mínimo para probar la publicación del receptor sin instalar Mosquitto
+//
+// MQTT 3.1.1 sobre TCP sin TLS ni autenticación: CONNECT, PUBLISH (QoS 0 y 1), SUBSCRIBE con
+// comodines + y #, PINGREQ y DISCONNECT; sin sesiones persistentes ni mensajes retenidos. Reenvía
+// cada publicación a los suscriptores, así que un backend de pruebas puede conectarse igual que a
+// Mosquitto.
+//
+// Sobre las publicaciones del receptor (líneas CSV del registro con crc) cuenta lecturas, líneas con
+// crc incorrecto, repetidas y fuera de orden por nodo (node, seq), y muestra cada --report segundos
+// el caudal (lotes/s, lecturas/s, KB/s). --flap arriba:abajo simula caídas del broker: acepta
+// conexiones `arriba` segundos, las corta y deja de escuchar `abajo` segundos, para comprobar que la
+// bandeja de salida en SD se vacía al volver y que no se pierde nada.
+//
+// Compilar: g++ -O2 -std=c++17 broker_mqtt.cpp -o broker_mqtt
+// Uso:      broker_mqtt [--port 1883] [--report s] [--flap arriba:abajo] [--out lecturas.csv]
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../sd_journal.h" // journalLineValid(): columna crc de las líneas
+
+enum {
+  CONNECT = 1, CONNACK = 2, PUBLISH = 3, PUBACK = 4, SUBSCRIBE = 8, SUBACK = 9,
+  UNSUBSCRIBE = 10, UNSUBACK = 11, PINGREQ = 12, PINGRESP = 13, DISCONNECT = 14
+};
+
+const size_t MAX_PACKET = 1 << 20;
+
+struct Connection {
+  int fd;
+  std::string clientId;
+  std::vector<uint8_t> input;
+  std::vector<std::string> filters; // Suscripciones
+  bool connected = false;
+};
+
+struct Totals {
+  uint64_t batches = 0, readings = 0, bytes = 0, badCrc = 0, duplicates = 0, outOfOrder = 0;
+};
+
+static double now() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Filtro MQTT: "+" un nivel, "#" el resto
+static bool topicMatches(const std::string& filter, const std::string& topic) {
+  size_t f = 0, t = 0;
+  while (f < filter.size()) {
+    if (filter[f] == '#') return true;
+    if (filter[f] == '+') {
+      while (t < topic.size() && topic[t] != '/') t++;
+      f++;
+    } else {
+      if (t >= topic.size() || filter[f] != topic[t]) return false;
+      f++;
+      t++;
+    }
+  }
+  return t == topic.size();
+}
+
+static void encodeLength(std::vector<uint8_t>& out, size_t length) {
+  do {
+    uint8_t byte = length % 128;
+    length /= 128;
+    out.push_back(length > 0 ? byte | 0x80 : byte);
+  } while (length > 0);
+}
+
+static bool sendAll(int fd, const std::vector<uint8_t>& data) {
+  size_t sent = 0;
+  while (sent < data.size()) {
+    ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    if (n <= 0) return false;
+    sent += n;
+  }
+  return true;
+}
+
+class Broker {
+ public:
+  Broker(int port, FILE* out) : port_(port), out_(out) {}
+
+  bool listenOn() {
+    listenFd_ = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port_);
+    if (bind(listenFd_, (sockaddr*)&address, sizeof(address)) < 0 || listen(listenFd_, 8) < 0) {
+      perror("bind/listen");
+      close(listenFd_);
+      listenFd_ = -1;
+      return false;
+    }
+    return true;
+  }
+
+  // Caída simulada: se cierran las conexiones y el puerto
+  void goDown() {
+    for (Connection& c : connections_) close(c.fd);
+    connections_.clear();
+    if (listenFd_ >= 0) close(listenFd_);
+    listenFd_ = -1;
+  }
+
+  bool listening() const { return listenFd_ >= 0; }
+
+  void poll(int timeoutMs) {
+    std::vector<pollfd> fds;
+    if (listenFd_ >= 0) fds.push_back({listenFd_, POLLIN, 0});
+    for (const Connection& c : connections_) fds.push_back({c.fd, POLLIN, 0});
+    if (fds.empty()) {
+      usleep(timeoutMs * 1000);
+      return;
+    }
+    if (::poll(fds.data(), fds.size(), timeoutMs) <= 0) return;
+
+    size_t index = 0;
+    if (listenFd_ >= 0 && fds[index++].revents & POLLIN) {
+      int fd = accept(listenFd_, nullptr, nullptr);
+      if (fd >= 0) {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        connections_.push_back({fd, "", {}, {}, false});
+      }
+    }
+    std::vector<int> closed;
+    for (; index < fds.size(); index++) {
+      if (!(fds[index].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+      Connection* c = find(fds[index].fd);
+      if (!c) continue;
+      uint8_t buffer[16384];
+      ssize_t n = recv(c->fd, buffer, sizeof(buffer), 0);
+      if (n <= 0) {
+        closed.push_back(c->fd);
+        continue;
+      }
+      c->input.insert(c->input.end(), buffer, buffer + n);
+      if (!processInput(*c)) closed.push_back(c->fd);
+    }
+    for (int fd : closed) drop(fd, "conexión cerrada");
+  }
+
+  const Totals& totals() const { return totals_; }
+  size_t clients() const { return connections_.size(); }
+
+ private:
+  Connection* find(int fd) {
+    for (Connection& c : connections_) {
+      if (c.fd == fd) return &c;
+    }
+    return nullptr;
+  }
+
+  void drop(int fd, const char* reason) {
+    for (size_t i = 0; i < connections_.size(); i++) {
+      if (connections_[i].fd != fd) continue;
+      printf("[%s] %s\n", connections_[i].clientId.c_str(), reason);
+      close(fd);
+      connections_.erase(connections_.begin() + i);
+      return;
+    }
+  }
+
+  // Paquetes completos del búfer de entrada; false = protocolo roto o DISCONNECT
+  bool processInput(Connection& c) {
+    size_t pos = 0;
+    bool keep = true;
+    while (keep) {
+      if (c.input.size() - pos < 2) break;
+      size_t length = 0, multiplier = 1, header = 1;
+      bool complete = false;
+      while (pos + header < c.input.size() && header <= 4) {
+        uint8_t byte = c.input[pos + header++];
+        length += (byte & 0x7F) * multiplier;
+        multiplier *= 128;
+        if (!(byte & 0x80)) {
+          complete = true;
+          break;
+        }
+      }
+      if (!complete) {
+        if (header > 4) return false;
+        break;
+      }
+      if (length > MAX_PACKET) return false;
+      if (c.input.size() - pos < header + length) break;
+      keep = handlePacket(c, c.input[pos], c.input.data() + pos + header, length);
+      pos += header + length;
+    }
+    c.input.erase(c.input.begin(), c.input.begin() + pos);
+    return keep;
+  }
+
+  static std::string readString(const uint8_t*& p, const uint8_t* end) {
+    if (end - p < 2) return "";
+    size_t length = (p[0] << 8) | p[1];
+    p += 2;
+    if ((size_t)(end - p) < length) length = end - p;
+    std::string text((const char*)p, length);
+    p += length;
+    return text;
+  }
+
+  bool handlePacket(Connection& c, uint8_t first, const uint8_t* body, size_t length) {
+    int type = first >> 4;
+    const uint8_t* p = body;
+    const uint8_t* end = body + length;
+    if (!c.connected && type != CONNECT) return false;
+
+    if (type == CONNECT) {
+      std::string protocol = readString(p, end);
+      if (end - p < 4 || protocol != "MQTT") return false;
+      p += 4; // Nivel, flags y keepalive
+      c.clientId = readString(p, end);
+      c.connected = true;
+      printf("[%s] conectado\n", c.clientId.c_str());
+      return sendAll(c.fd, {CONNACK << 4, 2, 0, 0});
+    }
+    if (type == PUBLISH) {
+      int qos = (first >> 1) & 3;
+      std::string topic = readString(p, end);
+      uint16_t packetId = 0;
+      if (qos > 0 && end - p >= 2) {
+        packetId = (p[0] << 8) | p[1];
+        p += 2;
+      }
+      countReadings(p, end - p);
+      forward(first & 0xF9, topic, p, end - p); // A los suscriptores con QoS 0
+      if (qos == 1) return sendAll(c.fd, {PUBACK << 4, 2, (uint8_t)(packetId >> 8), (uint8_t)packetId});
+      return true;
+    }
+    if (type == SUBSCRIBE || type == UNSUBSCRIBE) {
+      if (end - p < 2) return false;
+      uint8_t idHigh = p[0], idLow = p[1];
+      p += 2;
+      std::vector<uint8_t> reply = {(uint8_t)((type == SUBSCRIBE ? SUBACK : UNSUBACK) << 4)};
+      std::vector<uint8_t> payload = {idHigh, idLow};
+      while (p < end) {
+        std::string filter = readString(p, end);
+        if (type == SUBSCRIBE) {
+          if (p < end) p++; // QoS pedida; se concede 0
+          c.filters.push_back(filter);
+          payload.push_back(0);
+          printf("[%s] suscrito a %s\n", c.clientId.c_str(), filter.c_str());
+        } else {
+          for (size_t i = 0; i < c.filters.size(); i++) {
+            if (c.filters[i] == filter) c.filters.erase(c.filters.begin() + i--);
+          }
+        }
+      }
+      encodeLength(reply, payload.size());
+      reply.insert(reply.end(), payload.begin(), payload.end());
+      return sendAll(c.fd, reply);
+    }
+    if (type == PINGREQ) return sendAll(c.fd, {PINGRESP << 4, 0});
+    if (type == DISCONNECT) return false;
+    return true; // PUBACK y demás: sin estado que actualizar
+  }
+
+  void forward(uint8_t first, const std::string& topic, const uint8_t* payload, size_t length) {
+    std::vector<uint8_t> packet;
+    for (Connection& c : connections_) {
+      bool match = false;
+      for (const std::string& filter : c.filters) match |= topicMatches(filter, topic);
+      if (!match) continue;
+      if (packet.empty()) {
+        packet.push_back(first);
+        encodeLength(packet, 2 + topic.size() + length);
+        packet.push_back(topic.size() >> 8);
+        packet.push_back(topic.size() & 0xFF);
+        packet.insert(packet.end(), topic.begin(), topic.end());
+        packet.insert(packet.end(), payload, payload + length);
+      }
+      sendAll(c.fd, packet);
+    }
+  }
+
+  // Líneas del registro: timestamp,temperature,humidity,soil_moisture,lux,node,seq,...,crc
+  void countReadings(const uint8_t* payload, size_t length) {
+    totals_.batches++;
+    totals_.bytes += length;
+    const char* text = (const char*)payload;
+    size_t start = 0;
+    while (start < length) {
+      const char* newline = (const char*)memchr(text + start, '\n', length - start);
+      size_t lineEnd = newline ? newline - text : length;
+      const char* line = text + start;
+      size_t lineLength = lineEnd - start;
+      start = lineEnd + 1;
+      if (lineLength == 0) continue;
+      totals_.readings++;
+      if (out_) fprintf(out_, "%.*s\n", (int)lineLength, line);
+      if (!journalLineValid(line, lineLength)) {
+        totals_.badCrc++;
+        continue;
+      }
+      std::string fields(line, lineLength);
+      int node = 0;
+      long seq = -1;
+      int column = 0;
+      for (size_t pos = 0; column < 7 && pos != std::string::npos; column++) {
+        if (column == 5) node = atoi(fields.c_str() + pos);
+        if (column == 6 && pos < fields.size() && fields[pos] != ',') seq = atol(fields.c_str() + pos);
+        pos = fields.find(',', pos);
+        if (pos != std::string::npos) pos++;
+      }
+      if (seq < 0) continue;
+      // Secuencias de 16 bits: se compara con la distancia circular a la última
+      if (!seen_[node].insert(seq).second) {
+        totals_.duplicates++;
+      } else if (lastSeq_.count(node) && (int16_t)(seq - lastSeq_[node]) < 0) {
+        totals_.outOfOrder++;
+      }
+      lastSeq_[node] = seq;
+    }
+    if (out_) fflush(out_);
+  }
+
+  int port_;
+  FILE* out_;
+  int listenFd_ = -1;
+  std::vector<Connection> connections_;
+  Totals totals_;
+  std::map<int, std::set<long>> seen_;
+  std::map<int, long> lastSeq_;
+};
+
+static volatile bool running = true;
+
+int main(int argc, char** argv) {
+  int port = 1883;
+  double report = 10, up = 0, down = 0;
+  FILE* out = nullptr;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--port") && i + 1 < argc) port = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--report") && i + 1 < argc) report = atof(argv[++i]);
+    else if (!strcmp(argv[i], "--flap") && i + 1 < argc && sscanf(argv[++i], "%lf:%lf", &up, &down) == 2) continue;
+    else if (!strcmp(argv[i], "--out") && i + 1 < argc) {
+      out = fopen(argv[++i], "a");
+      if (!out) {
+        perror(argv[i]);
+        return 1;
+      }
+    } else {
+      fprintf(stderr, "Uso: %s [--port 1883] [--report s] [--flap arriba:abajo] [--out lecturas.csv]\n", argv[0]);
+      return 1;
+    }
+  }
+  signal(SIGINT, [](int) { running = false; });
+  setvbuf(stdout, nullptr, _IOLBF, 0);
+
+  Broker broker(port, out);
+  if (!broker.listenOn()) return 1;
+  printf("Broker MQTT en el puerto %d%s\n", port, up > 0 ? " (con caídas simuladas)" : "");
+
+  double started = now(), lastReport = started, phaseStart = started;
+  Totals previous;
+  while (running) {
+    broker.poll(100);
+    double t = now();
+    if (up > 0 && broker.listening() && t - phaseStart >= up) {
+      printf("--- caída simulada durante %.0f s ---\n", down);
+      broker.goDown();
+      phaseStart = t;
+    } else if (up > 0 && !broker.listening() && t - phaseStart >= down) {
+      if (broker.listenOn()) printf("--- broker de vuelta ---\n");
+      phaseStart = t;
+    }
+    if (t - lastReport >= report) {
+      const Totals& totals = broker.totals();
+      double span = t - lastReport;
+      printf("%6.0f s  %zu clientes  %6.2f lotes/s  %7.1f lecturas/s  %6.1f KB/s  | total %llu lotes, %llu lecturas"
+             " (crc mal %llu, repetidas %llu, fuera de orden %llu)\n",
+             t - started, broker.clients(), (totals.batches - previous.batches) / span,
+             (totals.readings - previous.readings) / span, (totals.bytes - previous.bytes) / span / 1024,
+             (unsigned long long)totals.batches, (unsigned long long)totals.readings,
+             (unsigned long long)totals.badCrc, (unsigned long long)totals.duplicates,
+             (unsigned long long)totals.outOfOrder);
+      previous = totals;
+      lastReport = t;
+    }
+  }
+  const Totals& totals = broker.totals();
+  printf("Total: %llu lotes, %llu lecturas, %.1f KB; crc mal %llu, repetidas %llu, fuera de orden %llu\n",
+         (unsigned long long)totals.batches, (unsigned long long)totals.readings, totals.bytes / 1024.0,
+         (unsigned long long)totals.badCrc, (unsigned long long)totals.duplicates,
+         (unsigned long long)totals.outOfOrder);
+  if (out) fclose(out);
+  return 0;
+}
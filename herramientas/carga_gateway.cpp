@@ -0,0 +1,297 @@
+// Prueba de carga en Linux: cuántos nodos admite un receptor RYLR998
+//
+// Cada transmisor simulado tiene su RYLR998 (sim_rylr998.h) manejado por el motor AT
+// (rylr998_at.h) y envía cada SEND_INTERVAL la misma trama que sendData():
+// "T:<temp>,H:<hum>,L:<lux>,S:<suelo>,Q:<seq>". Su reloj deriva unas ppm y loop() añade la
+// granularidad de su delay(), así que las fases se desplazan como en campo.
+//
+// El canal reparte las tramas con:
+//   - tiempo en el aire según SF/BW (adr_lora.h),
+//   - pérdida de trayecto log-distancia con sombra log-normal por nodo y desvanecimiento por trama,
+//   - colisiones: dos tramas con la misma tasa que se solapan se pierden salvo que una supere a
+//     todas las demás en CAPTURE_THRESHOLD_DB (efecto captura),
+//   - SNR mínima de demodulación por SF.
+// El receptor es el lado LoRa del sketch: motor AT atendido cada --gateway-poll ms (delay(100) de
+// loop()), búfer RX de 1 KB, handleLoRaFrame() y el análisis del payload de parseAndStoreSensorData().
+//
+// Resultado: curva de capacidad, tramas entregadas frente a carga ofrecida (G = N·aire/intervalo),
+// junto a la de ALOHA puro S = G·e^(-2G) como referencia.
+//
+// Compilar: g++ -O2 -std=c++17 carga_gateway.cpp -o carga_gateway
+// Uso:      carga_gateway [--rate i] [--interval s] [--minutes m] [--nodes 10,50,100,...]
+//                         [--radius m] [--gateway-poll ms] [--seed s]
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "../adr_lora.h"
+#include "../rylr998_at.h"
+#include "sim_rylr998.h"
+
+const int GATEWAY_ADDRESS = 2;  // loraConfig.address del receptor
+const int FIRST_NODE_ADDRESS = 100;
+const int NETWORK_ID = 18;
+
+// Modelo de canal (mismo que simulacion_adr.cpp)
+const float TX_POWER_DBM = 22.0;
+const float PATH_LOSS_EXPONENT = 2.7;
+const float SHADOWING_SIGMA_DB = 4.0;
+const float FADING_SIGMA_DB = 2.0;
+const float NOISE_FIGURE_DB = 6.0;
+const float CAPTURE_THRESHOLD_DB = 6.0;
+const float CLOCK_DRIFT_PPM = 30.0;
+const unsigned long NODE_LOOP_MS = 10;  // delay(10) del loop() del transmisor
+
+unsigned long simNow = 0;
+unsigned long simClock() { return simNow; }
+
+struct Transmission {
+  int node;
+  std::string data;
+  unsigned long start, end;
+  LoRaRate rate;
+  float rssiDbm;
+  bool resolved;
+};
+
+struct Node {
+  int address = 0;
+  std::unique_ptr<SimRylr998> module;
+  std::unique_ptr<Rylr998At<SimRylr998>> lora;
+  float distance = 0, shadowDb = 0, driftPpm = 0;
+  double nextSend = 0;
+  uint16_t frameSeq = 0;
+  unsigned long sent = 0;
+};
+
+struct Counters {
+  unsigned long transmitted = 0, collided = 0, belowSensitivity = 0, gatewayBusy = 0;
+  unsigned long delivered = 0, duplicates = 0, parseErrors = 0;
+  double airtimeMs = 0;
+};
+
+std::mt19937 rng;
+std::normal_distribution<float> normal(0.0f, 1.0f);
+std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+
+std::vector<Transmission> onAir;
+Counters counters;
+std::set<std::pair<int, long>> received;
+
+float pathLossDb(float distance) {
+  return 32.4f + 20.0f * log10f(915.0f) + 10.0f * PATH_LOSS_EXPONENT * log10f(std::max(distance, 1.0f) / 1000.0f) + 30.0f;
+}
+
+// Igual que parseAndStoreSensorData(): pares clave:valor separados por comas
+bool parseSensorPayload(const char* payload, long& seq) {
+  bool tempSet = false, humSet = false, luxSet = false, soilSet = false;
+  seq = -1;
+  std::string text = payload;
+  size_t start = 0;
+  while (start <= text.size()) {
+    size_t end = text.find(',', start);
+    std::string param = text.substr(start, end == std::string::npos ? std::string::npos : end - start);
+    if (param.compare(0, 2, "T:") == 0) tempSet = true;
+    else if (param.compare(0, 2, "H:") == 0) humSet = true;
+    else if (param.compare(0, 2, "L:") == 0) luxSet = true;
+    else if (param.compare(0, 2, "S:") == 0) soilSet = true;
+    else if (param.compare(0, 2, "Q:") == 0) seq = atol(param.c_str() + 2);
+    if (end == std::string::npos) break;
+    start = end + 1;
+  }
+  return tempSet && humSet && luxSet && soilSet && seq >= 0;
+}
+
+void handleLoRaFrame(const RylrFrame& frame) {
+  long seq;
+  if (!parseSensorPayload(frame.data, seq)) {
+    counters.parseErrors++;
+    return;
+  }
+  if (!received.insert({frame.address, seq}).second) {
+    counters.duplicates++;
+    return;
+  }
+  counters.delivered++;
+}
+
+// sendData() del transmisor con lecturas plausibles
+void sendData(Node& node) {
+  char payload[64];
+  snprintf(payload, sizeof(payload), "T:%.1f,H:%.1f,L:%d,S:%d,Q:%u", 18.0f + 10.0f * uniform(rng),
+           40.0f + 40.0f * uniform(rng), (int)(20000 * uniform(rng)), (int)(100 * uniform(rng)), node.frameSeq++);
+  float airtime = loraAirtimeMs(node.module->rate, strlen(payload));
+  node.lora->sendFrame(GATEWAY_ADDRESS, payload, strlen(payload), airtime);
+  node.sent++;
+}
+
+// Resuelve las tramas que terminaron: colisión, sensibilidad y disponibilidad del receptor
+void resolveTransmissions(SimRylr998& gateway) {
+  for (Transmission& tx : onAir) {
+    if (tx.resolved || tx.end > simNow) continue;
+    tx.resolved = true;
+    bool captured = true;
+    for (const Transmission& other : onAir) {
+      if (&other == &tx || other.rate.sf != tx.rate.sf || other.rate.bwCode != tx.rate.bwCode) continue;
+      if (other.start >= tx.end || other.end <= tx.start) continue;
+      if (tx.rssiDbm - other.rssiDbm < CAPTURE_THRESHOLD_DB) captured = false;
+    }
+    float rssi = tx.rssiDbm + FADING_SIGMA_DB * normal(rng);
+    float noiseDbm = -174.0f + 10.0f * log10f(loraBandwidthHz(tx.rate.bwCode)) + NOISE_FIGURE_DB;
+    float snr = rssi - noiseDbm;
+    bool sameRate = tx.rate.sf == gateway.rate.sf && tx.rate.bwCode == gateway.rate.bwCode;
+
+    if (!captured) counters.collided++;
+    else if (!sameRate || snr < loraRequiredSnrDb(tx.rate.sf)) counters.belowSensitivity++;
+    else if (!gateway.deliver(tx.end, tx.node, tx.data, (int)lroundf(rssi), (int)lroundf(std::min(snr, 12.0f))))
+      counters.gatewayBusy++;
+  }
+  // Conservar las que aún pueden solaparse con tramas en curso
+  unsigned long earliestActive = simNow;
+  for (const Transmission& tx : onAir) {
+    if (tx.end > simNow) earliestActive = std::min(earliestActive, tx.start);
+  }
+  onAir.erase(std::remove_if(onAir.begin(), onAir.end(),
+                             [&](const Transmission& tx) { return tx.end <= simNow && tx.end <= earliestActive; }),
+              onAir.end());
+}
+
+struct Result {
+  int nodes;
+  double offeredLoad, deliveredRatio, throughput;
+  Counters counters;
+  unsigned long sent, overflowBytes;
+};
+
+Result runScenario(int nodeCount, int rate, unsigned long intervalMs, unsigned long durationMs, float radius,
+                   unsigned long gatewayPollMs, unsigned seed) {
+  rng.seed(seed);
+  simNow = 0;
+  onAir.clear();
+  received.clear();
+  counters = Counters();
+
+  SimRylr998 gatewayModule(simClock, 1024);
+  Rylr998At<SimRylr998> gateway(gatewayModule, simClock);
+  gateway.onFrame(handleLoRaFrame);
+  std::string parameter = "AT+PARAMETER=" + std::to_string(ADR_RATES[rate].sf) + "," +
+                          std::to_string(ADR_RATES[rate].bwCode) + "," + std::to_string(LORA_CODING_RATE) + "," +
+                          std::to_string(LORA_PREAMBLE);
+  gateway.send(("AT+ADDRESS=" + std::to_string(GATEWAY_ADDRESS)).c_str(), 500);
+  gateway.send(parameter.c_str(), 500);
+
+  std::vector<Node> nodes(nodeCount);
+  for (int i = 0; i < nodeCount; i++) {
+    Node& node = nodes[i];
+    node.address = FIRST_NODE_ADDRESS + i;
+    node.module.reset(new SimRylr998(simClock));
+    node.lora.reset(new Rylr998At<SimRylr998>(*node.module, simClock));
+    node.distance = radius * sqrtf(uniform(rng)); // Uniforme en el área
+    node.shadowDb = SHADOWING_SIGMA_DB * normal(rng);
+    node.driftPpm = CLOCK_DRIFT_PPM * (2.0f * uniform(rng) - 1.0f);
+    node.nextSend = 1000 + uniform(rng) * intervalMs; // Encendidos en momentos distintos
+    node.frameSeq = (uint16_t)(rng() & 0xFFFF);
+    node.module->onTransmit = [&node](SimRylr998& radio, int dest, const std::string& data, unsigned long start,
+                                      unsigned long end) {
+      if (dest != GATEWAY_ADDRESS && dest != 0) return;
+      float rssi = TX_POWER_DBM - pathLossDb(node.distance) - node.shadowDb;
+      onAir.push_back({radio.address, data, start, end, radio.rate, rssi, false});
+      counters.transmitted++;
+      counters.airtimeMs += end - start;
+    };
+    node.lora->send(("AT+ADDRESS=" + std::to_string(node.address)).c_str(), 500);
+    node.lora->send(("AT+NETWORKID=" + std::to_string(NETWORK_ID)).c_str(), 500);
+    node.lora->send(parameter.c_str(), 500);
+  }
+
+  unsigned long nextGatewayPoll = 0;
+  for (simNow = 0; simNow < durationMs; simNow++) {
+    for (Node& node : nodes) {
+      // El transmisor mide SEND_INTERVAL con su millis(), que deriva, y lo comprueba cada NODE_LOOP_MS
+      if (simNow >= node.nextSend) {
+        sendData(node);
+        double period = intervalMs * (1.0 + node.driftPpm * 1e-6);
+        node.nextSend += period + NODE_LOOP_MS * uniform(rng);
+      }
+      if (!node.lora->idle()) node.lora->poll();
+    }
+    resolveTransmissions(gatewayModule);
+    if (simNow >= nextGatewayPoll) {
+      gateway.poll();
+      nextGatewayPoll = simNow + gatewayPollMs;
+    }
+  }
+  gateway.poll();
+
+  Result result;
+  result.nodes = nodeCount;
+  result.counters = counters;
+  result.sent = 0;
+  for (const Node& node : nodes) result.sent += node.sent;
+  double airtime = loraAirtimeMs(ADR_RATES[rate], 33);
+  result.offeredLoad = nodeCount * airtime / intervalMs;
+  result.deliveredRatio = result.sent ? (double)counters.delivered / result.sent : 0;
+  result.throughput = result.offeredLoad * result.deliveredRatio;
+  result.overflowBytes = gatewayModule.uartOverflowBytes;
+  return result;
+}
+
+int main(int argc, char** argv) {
+  int rate = ADR_DEFAULT_RATE;
+  unsigned long intervalMs = 15000;
+  unsigned long durationMs = 30 * 60000UL;
+  float radius = 2000;
+  unsigned long gatewayPollMs = 100;
+  unsigned seed = 1;
+  std::vector<int> nodeCounts;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--rate") && i + 1 < argc) rate = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--interval") && i + 1 < argc) intervalMs = (unsigned long)(atof(argv[++i]) * 1000);
+    else if (!strcmp(argv[i], "--minutes") && i + 1 < argc) durationMs = (unsigned long)(atof(argv[++i]) * 60000);
+    else if (!strcmp(argv[i], "--radius") && i + 1 < argc) radius = atof(argv[++i]);
+    else if (!strcmp(argv[i], "--gateway-poll") && i + 1 < argc) gatewayPollMs = atol(argv[++i]);
+    else if (!strcmp(argv[i], "--seed") && i + 1 < argc) seed = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--nodes") && i + 1 < argc) {
+      for (char* token = strtok(argv[++i], ","); token; token = strtok(NULL, ",")) nodeCounts.push_back(atoi(token));
+    } else {
+      fprintf(stderr, "Uso: %s [--rate i] [--interval s] [--minutes m] [--nodes 10,50,...] [--radius m] "
+                      "[--gateway-poll ms] [--seed s]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (rate < 0 || rate >= ADR_RATE_COUNT || gatewayPollMs == 0) {
+    fprintf(stderr, "Tasa fuera de rango (0-%d) o --gateway-poll nulo\n", ADR_RATE_COUNT - 1);
+    return 1;
+  }
+
+  double airtime = loraAirtimeMs(ADR_RATES[rate], 33);
+  if (nodeCounts.empty()) {
+    // Barrer la carga ofrecida G de 0.05 a 3 con la tasa elegida
+    const double LOADS[] = {0.05, 0.1, 0.2, 0.35, 0.5, 0.75, 1.0, 1.5, 2.0, 3.0};
+    for (double g : LOADS) nodeCounts.push_back(std::max(1, (int)lround(g * intervalMs / airtime)));
+    nodeCounts.erase(std::unique(nodeCounts.begin(), nodeCounts.end()), nodeCounts.end());
+  }
+
+  printf("Tasa %d (SF%d, %.1f kHz): %.0f ms de aire por trama, envío cada %.0f s, %.0f min simulados\n\n", rate,
+         ADR_RATES[rate].sf, loraBandwidthHz(ADR_RATES[rate].bwCode) / 1000.0, airtime, intervalMs / 1000.0,
+         durationMs / 60000.0);
+  printf("%6s %7s %8s %8s %8s %8s %8s %8s %8s %9s\n", "nodos", "G", "enviadas", "entreg.", "tasa", "S",
+         "ALOHA", "colis.", "sensib.", "UART perd");
+  for (int count : nodeCounts) {
+    Result r = runScenario(count, rate, intervalMs, durationMs, radius, gatewayPollMs, seed);
+    double aloha = r.offeredLoad * exp(-2.0 * r.offeredLoad);
+    printf("%6d %7.3f %8lu %8lu %7.1f%% %8.3f %8.3f %8lu %8lu %9lu\n", r.nodes, r.offeredLoad, r.sent,
+           r.counters.delivered, 100.0 * r.deliveredRatio, r.throughput, aloha, r.counters.collided,
+           r.counters.belowSensitivity, r.overflowBytes);
+    fflush(stdout);
+  }
+  return 0;
+}
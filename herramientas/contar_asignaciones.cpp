@@ -0,0 +1,739 @@
+// Cuenta las reservas de memoria dinámica de las respuestas de la API del receptor
+//
+// Compila los manejadores de las rutas convertidas del receptor (/api/data, /api/history en JSON,
+// CBOR y binario, /api/ranges GET y POST, /api/sd-info, /api/link, /api/rules, /api/mqtt, POST
+// /api/node-config, /api/sync) con el mismo código: toman un búfer del pool (ApiBuffer), escriben
+// con JsonWriter, CborWriter o writeLogLine(), leen el cuerpo con JsonFlatReader desde argValue() y
+// envían con sendApiJson() a un servidor simulado que copia la respuesta. Sustituye operator new y
+// malloc por versiones que cuentan; cada petición completa debe dar 0 reservas. Quedan fuera las
+// cabeceras que arma WebServer. Como control, /api/data montada con concatenación de cadenas (lo
+// que hacía String) sí reserva, lo que demuestra que el contador funciona.
+//
+// Comprueba además que la salida de JsonWriter coincide con la esperada, que el lector plano
+// rechaza cuerpos mal formados y que las líneas de /api/sync llevan su crc correcto.
+//
+// Compilar: g++ -O2 -std=c++17 contar_asignaciones.cpp -o contar_asignaciones
+// Uso:      contar_asignaciones [peticiones]
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+
+#include "../anomaly_detector.h"
+#include "../api_encoding.h"
+#include "../json_writer.h"
+#include "../sd_journal.h" // journalLineCrc(): columna crc de /api/sync
+
+// === Contador de reservas ===
+static unsigned long allocations = 0;
+
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t count, size_t size);
+extern "C" void* __libc_realloc(void* pointer, size_t size);
+
+extern "C" void* malloc(size_t size) {
+  allocations++;
+  return __libc_malloc(size);
+}
+extern "C" void* calloc(size_t count, size_t size) {
+  allocations++;
+  return __libc_calloc(count, size);
+}
+extern "C" void* realloc(void* pointer, size_t size) {
+  allocations++;
+  return __libc_realloc(pointer, size);
+}
+void* operator new(size_t size) {
+  allocations++;
+  void* pointer = __libc_malloc(size);
+  if (!pointer) throw std::bad_alloc();
+  return pointer;
+}
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* pointer) noexcept { free(pointer); }
+void operator delete[](void* pointer) noexcept { free(pointer); }
+void operator delete(void* pointer, size_t) noexcept { free(pointer); }
+void operator delete[](void* pointer, size_t) noexcept { free(pointer); }
+
+// === Estado simulado del receptor ===
+const int MAX_HISTORY = 50;
+const char* SENSOR_NAMES[] = {"temperature", "humidity", "lux", "soil"};
+
+struct DataPoint {
+  unsigned long timestamp;
+  float temperature, humidity, lux;
+  int soilMoisture;
+  int node;
+  long seq;
+  int16_t rssi;
+  int8_t snr;
+  uint16_t flags;
+};
+
+static DataPoint history[MAX_HISTORY];
+static DataPoint current;
+static float ranges[6] = {-40, 80, 0, 100, 0, 100000};
+static int soilRange[2] = {0, 100};
+
+static void fillHistory() {
+  for (int i = 0; i < MAX_HISTORY; i++) {
+    history[i] = {600000UL + i * 15000UL, 21.37f + i * 0.01f, 55.5f - i * 0.1f, i % 3 ? 1234.5f : 0.0f,
+                  40 + i % 20, 1 + i % 4, 1000L + i, (int16_t)(-70 - i), (int8_t)(i % 10), (uint16_t)(i % 17 ? 0 : 0x40)};
+  }
+  current = history[MAX_HISTORY - 1];
+  current.flags = ANOMALY_ZERO << 4; // Humedad sospechosa: /api/data incluye "suspect"
+}
+
+static void anomalyReasons(uint16_t flags, int sensor, char* out, size_t size) {
+  size_t length = 0;
+  out[0] = '\0';
+  for (int r = 0; r < 4; r++) {
+    if (!((flags >> (4 * sensor + r)) & 1)) continue;
+    length += snprintf(out + length, size - length, "%s%s", length > 0 ? "," : "", ANOMALY_REASON_NAMES[r]);
+    if (length >= size) break;
+  }
+}
+
+// === Servidor y pool de búferes (como ApiServer y apiPool del receptor) ===
+const size_t API_BUFFER_SIZE = 6144;
+const int API_POOL_BUFFERS = 2;
+static uint8_t apiPool[API_POOL_BUFFERS][API_BUFFER_SIZE];
+static bool apiPoolInUse[API_POOL_BUFFERS] = {};
+
+struct ApiBuffer {
+  uint8_t* data = nullptr;
+  int slot = -1;
+
+  ApiBuffer() {
+    for (int i = 0; i < API_POOL_BUFFERS && slot < 0; i++) {
+      if (!apiPoolInUse[i]) slot = i;
+    }
+    if (slot < 0) return;
+    apiPoolInUse[slot] = true;
+    data = apiPool[slot];
+  }
+  ~ApiBuffer() {
+    if (slot >= 0) apiPoolInUse[slot] = false;
+  }
+  char* text() { return (char*)data; }
+};
+
+// Lo que WebServer manda al socket; el cuerpo de la petición vive en el servidor, como plain
+struct FakeServer {
+  char sent[API_BUFFER_SIZE];
+  size_t sentLength = 0;
+  int code = 0;
+  std::string body;
+  std::string since;
+
+  const std::string* argValue(const char* name) {
+    if (!strcmp(name, "plain")) return body.empty() ? nullptr : &body;
+    if (!strcmp(name, "since")) return since.empty() ? nullptr : &since;
+    return nullptr;
+  }
+  void setContentLength(size_t) {}
+  void send(int status, const char*, const char* content) {
+    code = status;
+    sentLength = 0;
+    sendContent(content, strlen(content));
+  }
+  void sendContent(const char* data, size_t length) {
+    if (sentLength + length > sizeof(sent)) length = sizeof(sent) - sentLength;
+    memcpy(sent + sentLength, data, length);
+    sentLength += length;
+  }
+} server;
+
+static void sendApiJson(int code, const JsonWriter& json) {
+  if (json.overflow()) {
+    server.send(500, "text/plain", "Respuesta mayor que el búfer de la API");
+    return;
+  }
+  server.setContentLength(json.length());
+  server.send(code, "application/json", "");
+  server.sendContent(json.c_str(), json.length());
+}
+
+static void sendApiBuffer(const uint8_t* data, size_t length) {
+  if (length == 0) {
+    server.send(500, "text/plain", "Respuesta mayor que el búfer de la API");
+    return;
+  }
+  server.setContentLength(length);
+  server.send(200, "application/cbor", "");
+  server.sendContent((const char*)data, length);
+}
+
+static void sendApiBusy() { server.send(503, "text/plain", "Sin búfer de respuesta libre"); }
+
+// === Estado simulado de enlace, alertas y MQTT ===
+const int MAX_NODES = 8;
+struct LinkStats {
+  int node = -1;
+  unsigned long packets = 0, readings = 0, lost = 0, duplicates = 0;
+  float rssiMean = 0, rssiMin = 0, rssiP10 = 0;
+  float snrMean = 0, snrMin = 0, snrP10 = 0;
+  unsigned long lastArrival = 0;
+  float meanInterval = 0, jitter = 0;
+  int adrSamples = 0;
+  std::string pendingConfig; // String en el receptor
+  unsigned long suspect = 0;
+} linkStats[MAX_NODES];
+
+struct AlertRule {
+  uint16_t node;
+  uint8_t sensor;
+  float min, max, hysteresis;
+  uint16_t dwellS;
+  uint8_t actions, gpio;
+};
+const uint16_t ALERT_ANY_NODE = 0xFFFF;
+const uint8_t ALERT_ACTION_GPIO = 1;
+const char* ALERT_ACTION_NAMES[] = {"gpio", "log", "sse", "webhook"};
+const int MAX_ALERT_RULES = 16;
+static AlertRule alertRules[MAX_ALERT_RULES];
+static bool alertActive[MAX_ALERT_RULES][MAX_NODES];
+static std::string webhookUrl = "http://192.168.1.10:8080/alertas";
+
+static void fillLinkAndRules() {
+  for (int i = 0; i < MAX_NODES; i++) {
+    LinkStats& stats = linkStats[i];
+    stats.node = i + 1;
+    stats.packets = 10000 + i;
+    stats.readings = 40000 + i;
+    stats.lost = 37 * i;
+    stats.rssiMean = -92.4f - i;
+    stats.snrP10 = 3.25f + i;
+    stats.meanInterval = 15021.5f;
+    stats.jitter = 212.75f;
+  }
+  for (int i = 0; i < MAX_ALERT_RULES; i++) {
+    alertRules[i] = {i % 2 ? (uint16_t)(1 + i % MAX_NODES) : ALERT_ANY_NODE, (uint8_t)(i % 4), -5.5f + i, 35.0f + i,
+                     0.5f, (uint16_t)(60 * i), (uint8_t)(i % 2 ? 0x0F : 0x06), 4};
+    for (int n = 0; n < MAX_NODES; n++) alertActive[i][n] = (i + n) % 3 == 0;
+  }
+}
+
+// === Manejadores (mismo código que los del receptor) ===
+static void buildDataJson(JsonWriter& json) {
+  json.beginObject();
+  json.field("temperature", current.temperature);
+  json.field("humidity", current.humidity);
+  json.field("lux", current.lux);
+  json.field("soilMoisture", current.soilMoisture);
+  json.field("flags", current.flags);
+  if (current.flags != 0) {
+    json.beginObject("suspect");
+    for (int s = 0; s < ANOMALY_SENSORS; s++) {
+      if (!anomalySuspect(current.flags, s)) continue;
+      char reasons[32];
+      anomalyReasons(current.flags, s, reasons, sizeof(reasons));
+      json.field(SENSOR_NAMES[s], reasons);
+    }
+    json.endObject();
+  }
+  json.field("lastUpdate", current.timestamp);
+  json.field("valid", true);
+  json.field("uptime", 1234567UL);
+  json.field("sdAvailable", true);
+  json.field("timeSynchronized", true);
+  json.field("ledActive", false);
+  json.endObject();
+}
+
+static void handleAPIData() {
+  ApiBuffer buffer;
+  if (!buffer.data) return sendApiBusy();
+  JsonWriter json(buffer.text(), API_BUFFER_SIZE);
+  buildDataJson(json);
+  sendApiJson(200, json);
+}
+
+static void handleAPIHistory() {
+  ApiBuffer buffer;
+  if (!buffer.data) return sendApiBusy();
+  JsonWriter json(buffer.text(), API_BUFFER_SIZE);
+  json.beginArray();
+  for (const DataPoint& point : history) {
+    json.beginObject();
+    json.field("timestamp", point.timestamp);
+    json.field("temperature", point.temperature);
+    json.field("humidity", point.humidity);
+    json.field("lux", point.lux);
+    json.field("soilMoisture", point.soilMoisture);
+    json.field("flags", point.flags);
+    json.endObject();
+  }
+  json.endArray();
+  sendApiJson(200, json);
+}
+
+static size_t encodeHistoryCbor(uint8_t* out, size_t capacity) {
+  static const char* fields[] = {"timestamp", "temperature", "humidity", "lux", "soilMoisture", "flags"};
+  CborWriter cbor(out, capacity);
+  cbor.map(2);
+  cbor.text("fields");
+  cbor.array(6);
+  for (const char* field : fields) cbor.text(field);
+  cbor.text("rows");
+  cbor.array(MAX_HISTORY);
+  for (const DataPoint& point : history) {
+    cbor.array(6);
+    cbor.integer(point.timestamp);
+    cbor.number(point.temperature);
+    cbor.number(point.humidity);
+    cbor.number(point.lux);
+    cbor.integer(point.soilMoisture);
+    cbor.integer(point.flags);
+  }
+  return cbor.overflow ? 0 : cbor.length;
+}
+
+static void handleAPIHistoryCbor() {
+  ApiBuffer buffer;
+  if (!buffer.data) return sendApiBusy();
+  sendApiBuffer(buffer.data, encodeHistoryCbor(buffer.data, API_BUFFER_SIZE));
+}
+
+static size_t encodeHistoryBinary(uint8_t* out, size_t capacity) {
+  ApiBinaryHeader header;
+  size_t length = sizeof(header) + MAX_HISTORY * sizeof(ApiBinaryRecord);
+  if (length > capacity) return 0;
+  memcpy(header.magic, API_BINARY_MAGIC, sizeof(header.magic));
+  header.recordSize = sizeof(ApiBinaryRecord);
+  header.count = MAX_HISTORY;
+  header.uptime = 1234567;
+  header.status = API_STATUS_SD;
+  memcpy(out, &header, sizeof(header));
+  for (int i = 0; i < MAX_HISTORY; i++) {
+    const DataPoint& p = history[i];
+    ApiBinaryRecord record = {(uint32_t)p.timestamp, p.temperature, p.humidity, p.lux, (int32_t)p.seq,
+                              (int16_t)p.soilMoisture, p.rssi, p.flags, (uint8_t)p.node, p.snr};
+    memcpy(out + sizeof(header) + i * sizeof(record), &record, sizeof(record));
+  }
+  return length;
+}
+
+static void handleAPIHistoryBinary() {
+  ApiBuffer buffer;
+  if (!buffer.data) return sendApiBusy();
+  sendApiBuffer(buffer.data, encodeHistoryBinary(buffer.data, API_BUFFER_SIZE));
+}
+
+static void handleAPI_GetRanges() {
+  ApiBuffer buffer;
+  if (!buffer.data) return sendApiBusy();
+  JsonWriter json(buffer.text(), API_BUFFER_SIZE);
+  json.beginObject();
+  json.field("tempMin", ranges[0]);
+  json.field("tempMax", ranges[1]);
+  json.field("humMin", ranges[2]);
+  json.field("humMax", ranges[3]);
+  json.field("luxMin", ranges[4]);
+  json.field("luxMax", ranges[5]);
+  json.field("soilMin", soilRange[0]);
+  json.field("soilMax", soilRange[1]);
+  json.endObject();
+  sendApiJson(200, json);
+}
+
+static const char RANGES_BODY[] =
+    "{\"tempMin\":-5.5,\"tempMax\":42,\"humMin\":10,\"humMax\":95.25,\"luxMin\":0,\"luxMax\":80000,"
+    "\"soilMin\":15,\"soilMax\":85}";
+
+// Cuerpo de POST /api/ranges leído en su sitio
+static void handleAPI_SetRanges() {
+  const char* keys[] = {"tempMin", "tempMax", "humMin", "humMax", "luxMin", "luxMax"};
+  const std::string* body = server.argValue("plain");
+  JsonFlatReader reader(body ? body->c_str() : "", body ? body->length() : 0);
+  JsonField field;
+  double value;
+  while (reader.next(field)) {
+    if (!field.number(value)) continue;
+    for (int i = 0; i < 6; i++) {
+      if (field.is(keys[i])) ranges[i] = value;
+    }
+    if (field.is("soilMin")) soilRange[0] = (int)value;
+    if (field.is("soilMax")) soilRange[1] = (int)value;
+  }
+  if (reader.error()) {
+    server.send(400, "application/json", "{\"success\":false,\"message\":\"JSON inválido\"}");
+    return;
+  }
+  server.send(200, "application/json", "{\"success\":true,\"message\":\"Rangos actualizados con éxito.\"}");
+}
+
+static void handleSDInfo() {
+  static const char currentFile[] = "/data/sensors_2026-10-18.csv";
+  ApiBuffer buffer;
+  if (!buffer.data) return sendApiBusy();
+  JsonWriter json(buffer.text(), API_BUFFER_SIZE);
+  json.beginObject();
+  json.field("available", true);
+  json.field("cardSize", 30436UL);
+  json.field("usedSpace", 1289UL);
+  json.field("currentFile", currentFile);
+  json.field("totalEntries", 4211UL);
+  json.field("indexing", false);
+  json.field("freePercent", 95);
+  json.field("lowSpace", false);
+  json.field("writeErrors", 0UL);
+  json.field("daysRolledUp", 12UL);
+  json.field("monthsDeleted", 0UL);
+  json.field("journal", true);
+  json.field("recoveredLines", 0U);
+  json.field("droppedLines", 0U);
+  json.field("preallocated", true);
+  json.beginObject("writeLatency");
+  json.field("samples", 512U);
+  json.field("p50Us", 1830U);
+  json.field("p99Us", 9120U);
+  json.field("maxUs", 24100U);
+  json.endObject();
+  json.endObject();
+  sendApiJson(200, json);
+}
+
+static void handleAPILink() {
+  ApiBuffer buffer;
+  if (!buffer.data) return sendApiBusy();
+  JsonWriter json(buffer.text(), API_BUFFER_SIZE);
+  json.beginObject();
+  json.beginObject("adr");
+  json.field("rate", 3);
+  json.field("sf", 10);
+  json.field("bandwidthKHz", 125.0f);
+  json.field("targetRate", -1);
+  json.field("airtimeMs", 370.69f);
+  json.endObject();
+  json.beginArray("nodes");
+  for (int i = 0; i < MAX_NODES; i++) {
+    const LinkStats& stats = linkStats[i];
+    if (stats.node == -1) continue;
+
+    json.beginObject();
+    json.field("node", stats.node);
+    json.field("packets", stats.packets);
+    json.field("readings", stats.readings);
+    json.field("lostReadings", stats.lost);
+    json.field("duplicates", stats.duplicates);
+    json.field("readingLossRate", (stats.readings + stats.lost) > 0 ? (float)stats.lost / (stats.readings + stats.lost) : 0.0f);
+    json.field("rssiMean", stats.rssiMean);
+    json.field("rssiMin", stats.rssiMin);
+    json.field("rssiP10", stats.rssiP10);
+    json.field("snrMean", stats.snrMean);
+    json.field("snrMin", stats.snrMin);
+    json.field("snrP10", stats.snrP10);
+    json.field("meanIntervalMs", stats.meanInterval);
+    json.field("jitterMs", stats.jitter);
+    json.field("lastSeenMs", 1234567UL - stats.lastArrival);
+    json.field("adrSamples", stats.adrSamples);
+    json.field("adrRecommendedRate", 4);
+    json.field("configPending", stats.pendingConfig.length() > 0);
+    json.field("suspectReadings", stats.suspect);
+    json.endObject();
+  }
+  json.endArray();
+  json.endObject();
+  sendApiJson(200, json);
+}
+
+static void handleAPI_GetRules() {
+  ApiBuffer buffer;
+  if (!buffer.data) return sendApiBusy();
+  JsonWriter json(buffer.text(), API_BUFFER_SIZE);
+  json.beginObject();
+  json.field("webhook", webhookUrl.c_str());
+  json.field("webhookSent", 12UL);
+  json.field("webhookFailed", 1UL);
+  json.field("webhookDropped", 0UL);
+  json.field("sseClients", 2);
+
+  json.beginArray("rules");
+  for (int i = 0; i < MAX_ALERT_RULES; i++) {
+    const AlertRule& rule = alertRules[i];
+    json.beginObject();
+    json.field("node", rule.node == ALERT_ANY_NODE ? -1 : (int)rule.node);
+    json.field("sensor", SENSOR_NAMES[rule.sensor]);
+    json.field("min", rule.min);
+    json.field("max", rule.max);
+    json.field("hysteresis", rule.hysteresis);
+    json.field("dwell", rule.dwellS);
+    json.beginArray("actions");
+    for (int a = 0; a < 4; a++) {
+      if (rule.actions & (1 << a)) json.field(nullptr, ALERT_ACTION_NAMES[a]);
+    }
+    json.endArray();
+    if (rule.actions & ALERT_ACTION_GPIO) json.field("gpio", rule.gpio);
+    json.beginArray("activeNodes");
+    for (int n = 0; n < MAX_NODES; n++) {
+      if (alertActive[i][n] && linkStats[n].node != -1) json.field(nullptr, linkStats[n].node);
+    }
+    json.endArray();
+    json.endObject();
+  }
+  json.endArray();
+  json.endObject();
+  sendApiJson(200, json);
+}
+
+static void handleAPIMqtt() {
+  ApiBuffer buffer;
+  if (!buffer.data) return sendApiBusy();
+  char broker[80];
+  snprintf(broker, sizeof(broker), "%s:%d", "192.168.1.50", 1883);
+  JsonWriter json(buffer.text(), API_BUFFER_SIZE);
+  json.beginObject();
+  json.field("enabled", true);
+  json.field("broker", broker);
+  json.field("topic", "telemetria/lecturas");
+  json.field("connected", true);
+  json.field("connects", 3UL);
+  json.field("connectFailures", 1UL);
+  json.field("publishedBatches", 5210UL);
+  json.field("publishedReadings", 41680UL);
+  json.field("publishedBytes", 3126000UL);
+  json.field("publishErrors", 0UL);
+  json.field("readingsPerMin", 32.0f);
+  json.field("lastPublishUs", 2310UL);
+  json.field("maxPublishUs", 81250UL);
+  json.field("queueDepth", 0UL);
+  json.field("queueCapacity", 8);
+  json.field("batchReadings", 3);
+  json.beginObject("outbox");
+  json.field("ready", true);
+  json.field("depth", 0UL);
+  json.field("capacity", 2048U);
+  json.field("stored", 12UL);
+  json.field("drained", 12UL);
+  json.field("overwritten", 0UL);
+  json.endObject();
+  json.field("directBatches", 5198UL);
+  json.field("lostReadings", 0UL);
+  json.endObject();
+  sendApiJson(200, json);
+}
+
+static const char NODE_CONFIG_BODY[] = "{\"node\":3,\"temperature\":0.3,\"humidity\":2,\"luxPercent\":10,\"heartbeat\":300}";
+
+// dtostrf() de Arduino: mismo texto que printf("%*.*f") para valores finitos
+static char* dtostrf(double value, signed char width, unsigned char precision, char* out) {
+  sprintf(out, "%*.*f", width, precision, value);
+  return out;
+}
+
+static void handleAPINodeConfig() {
+  const char* keys[] = {"temperature", "humidity", "luxPercent", "soil", "heartbeat"};
+  const char* codes[] = {"T", "H", "L", "S", "HB"};
+  bool present[5] = {};
+  float values[5] = {};
+  bool hasNode = false;
+  int node = 0;
+
+  const std::string* body = server.argValue("plain");
+  JsonFlatReader reader(body ? body->c_str() : "", body ? body->length() : 0);
+  JsonField field;
+  double value;
+  while (reader.next(field)) {
+    if (field.is("node")) {
+      hasNode = true;
+      node = field.number(value) ? (int)value : 0;
+    }
+    for (int i = 0; i < 5; i++) {
+      if (!field.is(keys[i])) continue;
+      present[i] = true;
+      values[i] = field.number(value) ? value : 0;
+    }
+  }
+  if (reader.error() || !hasNode) {
+    server.send(400, "application/json", "{\"success\":false,\"message\":\"JSON inválido\"}");
+    return;
+  }
+
+  char config[80] = "CFG:";
+  size_t length = 4;
+  for (int i = 0; i < 5; i++) {
+    if (!present[i]) continue;
+    if (values[i] < 0) {
+      server.send(400, "application/json", "{\"success\":false,\"message\":\"Los umbrales no pueden ser negativos.\"}");
+      return;
+    }
+    char number[48];
+    if (i == 4) snprintf(number, sizeof(number), "%ld", (long)values[i]);
+    else dtostrf(values[i], 4, 2, number);
+    length += snprintf(config + length, sizeof(config) - length, "%s%s=%s", length > 4 ? "," : "", codes[i], number);
+    if (length >= sizeof(config)) {
+      server.send(400, "application/json", "{\"success\":false,\"message\":\"Umbrales fuera de rango.\"}");
+      return;
+    }
+  }
+  if (length == 4) {
+    server.send(400, "application/json", "{\"success\":false,\"message\":\"Sin umbrales que enviar.\"}");
+    return;
+  }
+  linkStats[(node - 1) % MAX_NODES].pendingConfig = config; // Misma longitud: reutiliza su capacidad
+  server.send(200, "application/json", "{\"success\":true,\"message\":\"Se enviará tras la próxima trama del nodo.\"}");
+}
+
+static size_t writeLogLine(char* out, size_t size, const char* timestamp, const DataPoint& point) {
+  char temperature[48], humidity[48], lux[48], seq[24] = "";
+  dtostrf(point.temperature, 4, 2, temperature);
+  dtostrf(point.humidity, 4, 2, humidity);
+  dtostrf(point.lux, 3, 1, lux);
+  if (point.seq >= 0) snprintf(seq, sizeof(seq), "%ld", (long)point.seq);
+  int length = snprintf(out, size, "%s,%s,%s,%d,%s,%d,%s,%d,%d,%x", timestamp, temperature, humidity,
+                        point.soilMoisture, lux, point.node, seq, point.rssi, point.snr, point.flags);
+  if (length < 0 || (size_t)length + 6 > size) { // Sitio para ",xxxx" y el '\0'
+    if (size > 0) out[0] = '\0';
+    return 0;
+  }
+  journalLineCrc(out, length, out + length);
+  return length + 5;
+}
+
+static const char LOG_CSV_HEADER[] = "timestamp,temperature,humidity,soil_moisture,lux,node,seq,rssi,snr,flags,crc";
+
+static void handleAPISync() {
+  const std::string* sinceArg = server.argValue("since");
+  long since = sinceArg ? atol(sinceArg->c_str()) : 0;
+  long nowEpoch = 1792300000;
+  unsigned long nowMillis = 1400000;
+
+  ApiBuffer buffer;
+  if (!buffer.data) return sendApiBusy();
+  char* out = buffer.text();
+  size_t length = strlen(LOG_CSV_HEADER); // strlcpy() en el receptor
+  memcpy(out, LOG_CSV_HEADER, length);
+  out[length++] = '\n';
+  for (const DataPoint& point : history) {
+    long pointEpoch = nowEpoch - (long)((nowMillis - point.timestamp) / 1000);
+    if (pointEpoch < since) continue;
+
+    char timestamp[32]; // formatTimestamp() en el receptor
+    snprintf(timestamp, sizeof(timestamp), "2026-10-18 %02lu:%02lu:%02lu", (unsigned long)pointEpoch / 3600 % 24,
+             (unsigned long)pointEpoch / 60 % 60, (unsigned long)pointEpoch % 60);
+    size_t line = writeLogLine(out + length, API_BUFFER_SIZE - length - 1, timestamp, point);
+    if (line == 0) {
+      server.send(500, "text/plain", "Respuesta mayor que el búfer de la API");
+      return;
+    }
+    length += line;
+    out[length++] = '\n';
+  }
+  server.setContentLength(length);
+  server.send(200, "text/csv", "");
+  server.sendContent(out, length);
+}
+
+// Control: /api/data con concatenación de cadenas, como un String
+static void dataConcatenated() {
+  std::string response = "{\"temperature\":" + std::to_string(current.temperature) +
+                         ",\"humidity\":" + std::to_string(current.humidity) +
+                         ",\"lux\":" + std::to_string(current.lux) + ",\"uptime\":" + std::to_string(1234567) + "}";
+  server.send(200, "application/json", response.c_str());
+}
+
+static int failures = 0;
+
+static void expect(bool condition, const char* what) {
+  if (!condition) {
+    printf("FALLO: %s\n", what);
+    failures++;
+  }
+}
+
+// Petición completa: manejador, pool y envío; body es el cuerpo del POST (nullptr en un GET)
+static void measure(const char* name, void (*handler)(), const char* body, int requests, bool expectZero) {
+  server.body = body ? body : "";
+  handler(); // Primera llamada fuera de la medida
+  unsigned long before = allocations;
+  for (int i = 0; i < requests; i++) handler();
+  unsigned long counted = allocations - before;
+  printf("  %-26s %3d %6zu bytes  %8.2f reservas/petición\n", name, server.code, server.sentLength,
+         (double)counted / requests);
+  if (expectZero) {
+    expect(server.code == 200 && server.sentLength > 0, name);
+    expect(counted == 0, name);
+  }
+}
+
+int main(int argc, char** argv) {
+  int requests = argc > 1 ? atoi(argv[1]) : 10000;
+  if (requests <= 0) requests = 10000;
+  fillHistory();
+  fillLinkAndRules();
+
+  // Formato: mismo texto que producía ArduinoJson para estos valores
+  char small[256];
+  JsonWriter json(small, sizeof(small));
+  json.beginObject();
+  json.field("t", 23.45f);
+  json.field("h", -0.5f);
+  json.field("z", 0.0f);
+  json.field("n", -7);
+  json.field("big", 4294967295UL);
+  json.field("s", "a\"b\\c\n");
+  json.beginArray("list");
+  json.field(nullptr, 1);
+  json.null();
+  json.endArray();
+  json.field("nan", NAN);
+  json.endObject();
+  expect(!strcmp(small, "{\"t\":23.45,\"h\":-0.5,\"z\":0,\"n\":-7,\"big\":4294967295,\"s\":\"a\\\"b\\\\c\\u000a\","
+                        "\"list\":[1,null],\"nan\":null}"),
+         "salida de JsonWriter");
+  JsonWriter tiny(small, 8);
+  tiny.beginObject();
+  tiny.field("temperature", 1.0f);
+  tiny.endObject();
+  expect(tiny.overflow(), "overflow de JsonWriter");
+
+  // Lector plano: cuerpos válidos e inválidos
+  const char* invalid[] = {"", "[1]", "{\"a\":1", "{\"a\":{\"b\":1}}", "{\"a\" 1}", "{\"a\":1,}", "{a:1}"};
+  for (const char* body : invalid) {
+    JsonFlatReader reader(body, strlen(body));
+    JsonField field;
+    while (reader.next(field)) {
+    }
+    expect(reader.error(), body);
+  }
+  JsonField field = {"x", 1, "1e3x", 4, 'n'};
+  double value;
+  expect(!field.number(value), "número con basura al final");
+  server.body = RANGES_BODY;
+  handleAPI_SetRanges();
+  expect(server.code == 200 && ranges[0] == -5.5f && ranges[3] == 95.25f && soilRange[1] == 85, "POST /api/ranges");
+  server.body = NODE_CONFIG_BODY;
+  handleAPINodeConfig();
+  expect(server.code == 200 && linkStats[2].pendingConfig == "CFG:T=0.30,H=2.00,L=10.00,HB=300", "POST /api/node-config");
+  server.body = "";
+  handleAPISync();
+  expect(server.code == 200 && !memcmp(server.sent, LOG_CSV_HEADER, strlen(LOG_CSV_HEADER)), "GET /api/sync");
+  for (const char* line = strchr(server.sent, '\n') + 1; line < server.sent + server.sentLength;) {
+    const char* newline = (const char*)memchr(line, '\n', server.sent + server.sentLength - line);
+    if (!newline || !journalLineValid(line, newline - line)) {
+      expect(false, "línea de /api/sync");
+      break;
+    }
+    line = newline + 1;
+  }
+
+  printf("%d peticiones por ruta\n", requests);
+  measure("GET /api/data", handleAPIData, nullptr, requests, true);
+  measure("GET /api/history", handleAPIHistory, nullptr, requests, true);
+  measure("GET /api/history cbor", handleAPIHistoryCbor, nullptr, requests, true);
+  measure("GET /api/history bin", handleAPIHistoryBinary, nullptr, requests, true);
+  measure("GET /api/ranges", handleAPI_GetRanges, nullptr, requests, true);
+  measure("POST /api/ranges", handleAPI_SetRanges, RANGES_BODY, requests, true);
+  measure("GET /api/sd-info", handleSDInfo, nullptr, requests, true);
+  measure("GET /api/link", handleAPILink, nullptr, requests, true);
+  measure("GET /api/rules", handleAPI_GetRules, nullptr, requests, true);
+  measure("GET /api/mqtt", handleAPIMqtt, nullptr, requests, true);
+  measure("POST /api/node-config", handleAPINodeConfig, NODE_CONFIG_BODY, requests, true);
+  measure("GET /api/sync", handleAPISync, nullptr, requests, true);
+  measure("control: concatenación", dataConcatenated, nullptr, requests, false);
+  printf("%s\n", failures == 0 ? "Sin reservas en las rutas de la API" : "HAY FALLOS");
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,364 @@
+// Decodifica las respuestas compactas de /api/data y /api/history y compara tamaños y tiempos con JSON
+//
+// Sin argumentos de formato detecta el tipo por el contenido: registros binarios ("TLM1", ver
+// ../api_encoding.h) salen como CSV; CBOR sale en notación de diagnóstico (RFC 8949 §8), salvo el
+// historial {"fields", "rows"}, que también sale como CSV.
+//
+//   curl -s -H 'Accept: application/cbor' http://telemetria.local/api/history -o h.cbor
+//   curl -s 'http://telemetria.local/api/history?format=bin' -o h.bin
+//
+// --bench codifica un historial sintético con el mismo código que el receptor (CborWriter y
+// ApiBinaryRecord) y con un JSON equivalente al de ArduinoJson, comprueba que CBOR y binario se
+// decodifican a los mismos valores y muestra bytes y ns por codificación. La medida de referencia es
+// la del propio ESP32: GET /api/encode-bench.
+//
+// Compilar: g++ -O2 -std=c++17 decodificar_api.cpp -o decodificar_api
+// Uso:      decodificar_api respuesta.(cbor|bin)
+//           decodificar_api --bench [--points 50]
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../api_encoding.h"
+
+// === Lectura de CBOR ===
+struct CborReader {
+  const uint8_t* p;
+  const uint8_t* end;
+  bool error = false;
+
+  bool head(int& major, uint64_t& value) {
+    if (p >= end) return !(error = true);
+    major = *p >> 5;
+    int info = *p++ & 0x1F;
+    if (info < 24) {
+      value = info;
+      return true;
+    }
+    if (info > 27 || end - p < (1 << (info - 24))) return !(error = true);
+    value = 0;
+    for (int i = 0; i < (1 << (info - 24)); i++) value = (value << 8) | *p++;
+    return true;
+  }
+
+  static double halfToDouble(uint16_t half) {
+    int exponent = (half >> 10) & 0x1F, mantissa = half & 0x3FF;
+    double value = exponent == 0    ? ldexp(mantissa, -24)
+                   : exponent == 31 ? (mantissa ? NAN : INFINITY)
+                                    : ldexp(mantissa + 1024, exponent - 25);
+    return half & 0x8000 ? -value : value;
+  }
+
+  // Número (entero o float) como double; false si el elemento no es numérico
+  bool number(double& value) {
+    int major;
+    uint64_t raw;
+    const uint8_t* start = p;
+    if (!head(major, raw)) return false;
+    int info = start[0] & 0x1F;
+    if (major == 0) value = raw;
+    else if (major == 1) value = -1.0 - raw;
+    else if (major == 7 && info == 25) value = halfToDouble(raw);
+    else if (major == 7 && info == 26) {
+      uint32_t bits = raw;
+      float f;
+      memcpy(&f, &bits, sizeof(f));
+      value = f;
+    } else if (major == 7 && info == 27) memcpy(&value, &raw, sizeof(value));
+    else {
+      p = start;
+      return false;
+    }
+    return true;
+  }
+
+  bool text(std::string& value) {
+    int major;
+    uint64_t length;
+    if (!head(major, length) || major != 3 || (uint64_t)(end - p) < length) return !(error = true);
+    value.assign((const char*)p, length);
+    p += length;
+    return true;
+  }
+
+  // Notación de diagnóstico de un elemento
+  void diagnostic(std::string& out) {
+    double number;
+    if (this->number(number)) {
+      char text[32];
+      snprintf(text, sizeof(text), "%.9g", number);
+      out += text;
+      return;
+    }
+    int major;
+    uint64_t value;
+    if (!head(major, value)) return;
+    if (major == 2 || major == 3) {
+      if ((uint64_t)(end - p) < value) {
+        error = true;
+        return;
+      }
+      out += major == 3 ? "\"" + std::string((const char*)p, value) + "\"" : "h'...'";
+      p += value;
+    } else if (major == 4 || major == 5) {
+      out += major == 4 ? "[" : "{";
+      for (uint64_t i = 0; i < value && !error; i++) {
+        if (i) out += ", ";
+        diagnostic(out);
+        if (major == 5) {
+          out += ": ";
+          diagnostic(out);
+        }
+      }
+      out += major == 4 ? "]" : "}";
+    } else if (major == 7) {
+      out += value == 20 ? "false" : value == 21 ? "true" : value == 22 ? "null" : "simple";
+    } else {
+      out += "tag(" + std::to_string(value) + ")";
+      diagnostic(out);
+    }
+  }
+};
+
+// Historial {"fields":[...], "rows":[[...]]} como CSV; false si no tiene esa forma
+static bool printCborHistory(const uint8_t* data, size_t size) {
+  CborReader cbor{data, data + size};
+  int major;
+  uint64_t count;
+  std::string key;
+  if (!cbor.head(major, count) || major != 5 || count != 2 || !cbor.text(key) || key != "fields") return false;
+  if (!cbor.head(major, count) || major != 4) return false;
+  std::vector<std::string> fields(count);
+  for (std::string& field : fields) {
+    if (!cbor.text(field)) return false;
+  }
+  if (!cbor.text(key) || key != "rows" || !cbor.head(major, count) || major != 4) return false;
+  for (size_t i = 0; i < fields.size(); i++) printf("%s%s", i ? "," : "", fields[i].c_str());
+  printf("\n");
+  for (uint64_t row = 0; row < count; row++) {
+    uint64_t columns;
+    if (!cbor.head(major, columns) || major != 4) return false;
+    for (uint64_t c = 0; c < columns; c++) {
+      double value;
+      if (!cbor.number(value)) return false;
+      printf("%s%.9g", c ? "," : "", value);
+    }
+    printf("\n");
+  }
+  return !cbor.error;
+}
+
+static bool readBinary(const uint8_t* data, size_t size, ApiBinaryHeader& header, std::vector<ApiBinaryRecord>& records) {
+  if (size < sizeof(header)) return false;
+  memcpy(&header, data, sizeof(header));
+  if (memcmp(header.magic, API_BINARY_MAGIC, 4) != 0 || header.recordSize < sizeof(ApiBinaryRecord) ||
+      size < sizeof(header) + (size_t)header.count * header.recordSize) {
+    return false;
+  }
+  records.resize(header.count);
+  for (size_t i = 0; i < header.count; i++) {
+    memcpy(&records[i], data + sizeof(header) + i * header.recordSize, sizeof(ApiBinaryRecord));
+  }
+  return true;
+}
+
+static int decodeFile(const char* path) {
+  FILE* file = fopen(path, "rb");
+  if (!file) {
+    perror(path);
+    return 1;
+  }
+  std::vector<uint8_t> data;
+  uint8_t buffer[4096];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) data.insert(data.end(), buffer, buffer + n);
+  fclose(file);
+
+  ApiBinaryHeader header;
+  std::vector<ApiBinaryRecord> records;
+  if (readBinary(data.data(), data.size(), header, records)) {
+    printf("# uptime %u ms, estado 0x%x, %u registros de %u bytes\n", header.uptime, header.status, header.count,
+           header.recordSize);
+    printf("timestamp,temperature,humidity,lux,soilMoisture,flags,node,seq,rssi,snr\n");
+    for (const ApiBinaryRecord& r : records) {
+      printf("%u,%.2f,%.2f,%.1f,%d,%u,%u,%d,%d,%d\n", r.timestamp, r.temperature, r.humidity, r.lux, r.soilMoisture,
+             r.flags, r.node, r.seq, r.rssi, r.snr);
+    }
+    return 0;
+  }
+  if (printCborHistory(data.data(), data.size())) return 0;
+  CborReader cbor{data.data(), data.data() + data.size()};
+  std::string out;
+  cbor.diagnostic(out);
+  if (cbor.error) {
+    fprintf(stderr, "%s: ni registros TLM1 ni CBOR válido\n", path);
+    return 1;
+  }
+  printf("%s\n", out.c_str());
+  return 0;
+}
+
+// === Comparación de codificaciones ===
+struct Point {
+  uint32_t timestamp;
+  float temperature, humidity, lux;
+  int soilMoisture;
+  int node;
+  long seq;
+  int16_t rssi;
+  int8_t snr;
+  uint16_t flags;
+};
+
+// Lo que produce serializeJson con el historial (ArduinoJson escribe los float sin ceros finales)
+static size_t encodeJson(const std::vector<Point>& points, char* out, size_t capacity) {
+  size_t length = 0;
+  out[length++] = '[';
+  for (size_t i = 0; i < points.size(); i++) {
+    const Point& p = points[i];
+    length += snprintf(out + length, capacity - length,
+                       "%s{\"timestamp\":%u,\"temperature\":%g,\"humidity\":%g,\"lux\":%g,\"soilMoisture\":%d,\"flags\":%u}",
+                       i ? "," : "", p.timestamp, p.temperature, p.humidity, p.lux, p.soilMoisture, p.flags);
+  }
+  out[length++] = ']';
+  return length;
+}
+
+// Copia de encodeHistoryCbor() del receptor
+static size_t encodeCbor(const std::vector<Point>& points, uint8_t* out, size_t capacity) {
+  static const char* fields[] = {"timestamp", "temperature", "humidity", "lux", "soilMoisture", "flags"};
+  CborWriter cbor(out, capacity);
+  cbor.map(2);
+  cbor.text("fields");
+  cbor.array(6);
+  for (const char* field : fields) cbor.text(field);
+  cbor.text("rows");
+  cbor.array(points.size());
+  for (const Point& p : points) {
+    cbor.array(6);
+    cbor.integer(p.timestamp);
+    cbor.number(p.temperature);
+    cbor.number(p.humidity);
+    cbor.number(p.lux);
+    cbor.integer(p.soilMoisture);
+    cbor.integer(p.flags);
+  }
+  return cbor.overflow ? 0 : cbor.length;
+}
+
+// Copia de encodeHistoryBinary() del receptor
+static size_t encodeBinary(const std::vector<Point>& points, uint8_t* out, size_t capacity) {
+  ApiBinaryHeader header;
+  size_t length = sizeof(header) + points.size() * sizeof(ApiBinaryRecord);
+  if (length > capacity) return 0;
+  memcpy(header.magic, API_BINARY_MAGIC, sizeof(header.magic));
+  header.recordSize = sizeof(ApiBinaryRecord);
+  header.count = points.size();
+  header.uptime = 123456;
+  header.status = API_STATUS_SD | API_STATUS_TIME_SYNC;
+  memcpy(out, &header, sizeof(header));
+  for (size_t i = 0; i < points.size(); i++) {
+    const Point& p = points[i];
+    ApiBinaryRecord record = {p.timestamp, p.temperature, p.humidity, p.lux, (int32_t)p.seq, (int16_t)p.soilMoisture,
+                              p.rssi, p.flags, (uint8_t)p.node, p.snr};
+    memcpy(out + sizeof(header) + i * sizeof(record), &record, sizeof(record));
+  }
+  return length;
+}
+
+template <class F>
+static double nsPerCall(F encode) {
+  const int rounds = 20000;
+  auto start = std::chrono::steady_clock::now();
+  size_t sink = 0;
+  for (int i = 0; i < rounds; i++) sink += encode();
+  auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  if (sink == 1) printf(" ");
+  return elapsed / rounds;
+}
+
+static int bench(int count) {
+  // Lecturas típicas: dos decimales en temperatura y humedad, una en luz
+  std::mt19937 random(7);
+  std::vector<Point> points(count);
+  for (int i = 0; i < count; i++) {
+    Point& p = points[i];
+    p.timestamp = 600000 + i * 15000;
+    p.temperature = roundf((18 + 6 * sinf(i / 40.0f) + (random() % 100) / 100.0f) * 100) / 100;
+    p.humidity = roundf((60 + 15 * cosf(i / 50.0f) + (random() % 100) / 100.0f) * 100) / 100;
+    p.lux = i % 3 == 0 ? 0 : roundf((random() % 300000) / 10.0f) / 10;
+    p.soilMoisture = 40 + random() % 30;
+    p.node = 1 + i % 4;
+    p.seq = 1000 + i / 4;
+    p.rssi = -60 - random() % 50;
+    p.snr = random() % 12 - 2;
+    p.flags = i % 17 == 0 ? 0x40 : 0; // RATE en humedad
+  }
+
+  static char json[1 << 16];
+  static uint8_t cbor[1 << 16], binary[1 << 16];
+  size_t jsonBytes = encodeJson(points, json, sizeof(json));
+  size_t cborBytes = encodeCbor(points, cbor, sizeof(cbor));
+  size_t binaryBytes = encodeBinary(points, binary, sizeof(binary));
+
+  // Ida y vuelta: ambos formatos deben devolver exactamente los mismos valores
+  int mismatches = 0;
+  CborReader reader{cbor, cbor + cborBytes};
+  int major;
+  uint64_t n;
+  std::string key;
+  reader.head(major, n);
+  reader.text(key);
+  reader.head(major, n);
+  for (uint64_t i = 0; i < n; i++) reader.text(key);
+  reader.text(key);
+  reader.head(major, n);
+  ApiBinaryHeader header;
+  std::vector<ApiBinaryRecord> records;
+  bool binaryOk = readBinary(binary, binaryBytes, header, records) && records.size() == points.size();
+  for (size_t i = 0; i < points.size(); i++) {
+    double v[6];
+    reader.head(major, n);
+    for (double& value : v) reader.number(value);
+    const Point& p = points[i];
+    mismatches += v[0] != p.timestamp || (float)v[1] != p.temperature || (float)v[2] != p.humidity ||
+                  (float)v[3] != p.lux || v[4] != p.soilMoisture || v[5] != p.flags;
+    if (binaryOk) {
+      const ApiBinaryRecord& r = records[i];
+      mismatches += r.timestamp != p.timestamp || r.temperature != p.temperature || r.humidity != p.humidity ||
+                    r.lux != p.lux || r.soilMoisture != p.soilMoisture || r.seq != p.seq || r.node != p.node ||
+                    r.rssi != p.rssi || r.snr != p.snr || r.flags != p.flags;
+    }
+  }
+
+  double jsonNs = nsPerCall([&] { return encodeJson(points, json, sizeof(json)); });
+  double cborNs = nsPerCall([&] { return encodeCbor(points, cbor, sizeof(cbor)); });
+  double binaryNs = nsPerCall([&] { return encodeBinary(points, binary, sizeof(binary)); });
+
+  printf("Historial de %d puntos\n", count);
+  printf("  %-7s %6zu bytes  %8.0f ns\n", "JSON", jsonBytes, jsonNs);
+  printf("  %-7s %6zu bytes  %8.0f ns  (%.0f %% del JSON)\n", "CBOR", cborBytes, cborNs, 100.0 * cborBytes / jsonBytes);
+  printf("  %-7s %6zu bytes  %8.0f ns  (%.0f %% del JSON)\n", "binario", binaryBytes, binaryNs,
+         100.0 * binaryBytes / jsonBytes);
+  printf("Ida y vuelta: %s\n", mismatches == 0 && binaryOk && !reader.error ? "valores idénticos" : "DIFERENCIAS");
+  return mismatches == 0 && binaryOk && !reader.error ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+  if (argc >= 2 && !strcmp(argv[1], "--bench")) {
+    int points = 50; // MAX_HISTORY del receptor
+    if (argc >= 4 && !strcmp(argv[2], "--points")) points = atoi(argv[3]);
+    return bench(points > 0 ? points : 50);
+  }
+  if (argc != 2) {
+    fprintf(stderr, "Uso: %s respuesta.(cbor|bin)\n       %s --bench [--points 50]\n", argv[0], argv[0]);
+    return 1;
+  }
+  return decodeFile(argv[1]);
+}
@@ -0,0 +1,248 @@
+// Fusión de los archivos de varios receptores LoRa RYLR998
+//
+// Cada receptor guarda sus propios /data/sensors_AAAA-MM-DD.csv. Cuando varios receptores
+// cubren el mismo campo, una misma trama aparece en más de un archivo. Esta herramienta
+// mezcla los archivos de todos los receptores en orden de tiempo y elimina duplicados por
+// (node, seq), conservando la copia con mejor RSSI cuando la columna "rssi" existe.
+//
+// Funciona en streaming: solo mantiene en memoria las tramas dentro de la ventana de
+// deduplicación, por lo que admite millones de registros con memoria acotada.
+//
+// Compilar: g++ -O2 -std=c++17 fusion_gateways.cpp -o fusion_gateways
+// Uso:      fusion_gateways [-w segundos] [-o salida.csv] <dir_o_csv_receptor1> <dir_o_csv_receptor2> ...
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <queue>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// Días desde 1970-01-01 para una fecha civil (algoritmo de Howard Hinnant)
+static int64_t daysFromCivil(int64_t y, unsigned m, unsigned d) {
+  y -= m <= 2;
+  const int64_t era = (y >= 0 ? y : y - 399) / 400;
+  const unsigned yoe = (unsigned)(y - era * 400);
+  const unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + (int64_t)doe - 719468;
+}
+
+// "AAAA-MM-DD HH:MM:SS" -> segundos epoch (en la misma zona horaria que el archivo)
+static bool parseTimestamp(const std::string& text, int64_t& out) {
+  int y, mo, d, h, mi, s;
+  if (sscanf(text.c_str(), "%d-%d-%d %d:%d:%d", &y, &mo, &d, &h, &mi, &s) != 6) return false;
+  out = daysFromCivil(y, mo, d) * 86400 + h * 3600 + mi * 60 + s;
+  return true;
+}
+
+static std::vector<std::string> splitCsv(const std::string& line) {
+  std::vector<std::string> fields;
+  std::string field;
+  std::istringstream in(line);
+  while (std::getline(in, field, ',')) fields.push_back(field);
+  if (!line.empty() && line.back() == ',') fields.push_back("");
+  return fields;
+}
+
+struct Record {
+  int64_t time = 0;
+  int node = 0;
+  long seq = -1;
+  double rssi = NAN;
+  int source = 0;
+  int copies = 1;
+  std::vector<std::string> fields; // Columnas en el orden de la cabecera de salida
+};
+
+// Lector secuencial de los archivos diarios de un receptor
+class Source {
+ public:
+  Source(int id, const std::string& path, const std::vector<std::string>& outColumns)
+      : id_(id), outColumns_(outColumns) {
+    if (fs::is_directory(path)) {
+      for (const auto& entry : fs::directory_iterator(path)) {
+        std::string name = entry.path().filename().string();
+        if (name.rfind("sensors_", 0) == 0 && entry.path().extension() == ".csv") {
+          files_.push_back(entry.path().string());
+        }
+      }
+      std::sort(files_.begin(), files_.end()); // El nombre AAAA-MM-DD ordena cronológicamente
+    } else {
+      files_.push_back(path);
+    }
+    name_ = fs::path(path).filename().string();
+  }
+
+  const std::string& name() const { return name_; }
+
+  // Lee el siguiente registro válido; false al terminar todos los archivos
+  bool next(Record& rec) {
+    std::string line;
+    while (true) {
+      if (!in_.is_open() || !std::getline(in_, line)) {
+        if (!openNextFile()) return false;
+        continue;
+      }
+      if (!line.empty() && line.back() == '\r') line.pop_back();
+      if (line.empty()) continue;
+
+      std::vector<std::string> fields = splitCsv(line);
+      if (fields.size() < columnMap_.size() || !parseTimestamp(fields[0], rec.time)) continue;
+
+      rec.source = id_;
+      rec.copies = 1;
+      rec.node = nodeCol_ >= 0 ? atoi(fields[nodeCol_].c_str()) : 0;
+      rec.seq = (seqCol_ >= 0 && !fields[seqCol_].empty()) ? atol(fields[seqCol_].c_str()) : -1;
+      rec.rssi = (rssiCol_ >= 0 && !fields[rssiCol_].empty()) ? atof(fields[rssiCol_].c_str()) : NAN;
+      rec.fields.assign(outColumns_.size(), "");
+      for (size_t i = 0; i < columnMap_.size(); i++) {
+        if (columnMap_[i] >= 0) rec.fields[columnMap_[i]] = fields[i];
+      }
+      return true;
+    }
+  }
+
+ private:
+  bool openNextFile() {
+    if (in_.is_open()) in_.close();
+    while (fileIndex_ < files_.size()) {
+      in_.open(files_[fileIndex_++]);
+      std::string header;
+      if (in_ && std::getline(in_, header)) {
+        if (!header.empty() && header.back() == '\r') header.pop_back();
+        mapColumns(splitCsv(header));
+        return true;
+      }
+      in_.close();
+    }
+    return false;
+  }
+
+  // Cada archivo trae su cabecera: los archivos antiguos no tienen node/seq/rssi
+  void mapColumns(const std::vector<std::string>& header) {
+    columnMap_.assign(header.size(), -1);
+    nodeCol_ = seqCol_ = rssiCol_ = -1;
+    for (size_t i = 0; i < header.size(); i++) {
+      for (size_t j = 0; j < outColumns_.size(); j++) {
+        if (header[i] == outColumns_[j]) columnMap_[i] = (int)j;
+      }
+      if (header[i] == "node") nodeCol_ = (int)i;
+      if (header[i] == "seq") seqCol_ = (int)i;
+      if (header[i] == "rssi") rssiCol_ = (int)i;
+    }
+  }
+
+  int id_;
+  std::string name_;
+  const std::vector<std::string>& outColumns_;
+  std::vector<std::string> files_;
+  size_t fileIndex_ = 0;
+  std::ifstream in_;
+  std::vector<int> columnMap_;
+  int nodeCol_ = -1, seqCol_ = -1, rssiCol_ = -1;
+};
+
+static uint64_t dedupKey(const Record& rec) {
+  return ((uint64_t)(uint32_t)rec.node << 32) | (uint32_t)rec.seq;
+}
+
+int main(int argc, char** argv) {
+  int64_t window = 120; // Diferencia máxima entre relojes de receptores para la misma trama
+  std::string outPath;
+  std::vector<std::string> inputs;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-w") && i + 1 < argc) window = atol(argv[++i]);
+    else if (!strcmp(argv[i], "-o") && i + 1 < argc) outPath = argv[++i];
+    else inputs.push_back(argv[i]);
+  }
+  if (inputs.empty()) {
+    fprintf(stderr, "Uso: %s [-w segundos] [-o salida.csv] <dir_o_csv> ...\n", argv[0]);
+    return 1;
+  }
+
+  const std::vector<std::string> outColumns = {"timestamp", "temperature", "humidity", "soil_moisture",
+                                               "lux", "node", "seq", "rssi", "snr"};
+  std::vector<Source> sources;
+  for (size_t i = 0; i < inputs.size(); i++) sources.emplace_back((int)i, inputs[i], outColumns);
+
+  std::ofstream outFile;
+  if (!outPath.empty()) outFile.open(outPath);
+  std::ostream& out = outPath.empty() ? std::cout : outFile;
+  for (const auto& col : outColumns) out << col << ",";
+  out << "gateway,copies\n";
+
+  // Mezcla k-vías por tiempo: un registro pendiente por receptor
+  auto later = [](const Record& a, const Record& b) { return a.time > b.time; };
+  std::priority_queue<Record, std::vector<Record>, decltype(later)> heap(later);
+  for (auto& source : sources) {
+    Record rec;
+    if (source.next(rec)) heap.push(std::move(rec));
+  }
+
+  // Ventana de deduplicación: tramas en orden de llegada y su índice por (node, seq)
+  std::deque<Record> pending;
+  std::unordered_map<uint64_t, size_t> index; // clave -> posición absoluta en pending
+  size_t pendingBase = 0;                      // posición absoluta de pending.front()
+  uint64_t total = 0, written = 0, duplicates = 0;
+  size_t maxPending = 0;
+
+  auto emitFront = [&]() {
+    const Record& rec = pending.front();
+    for (const auto& field : rec.fields) out << field << ",";
+    out << sources[rec.source].name() << "," << rec.copies << "\n";
+    if (rec.seq >= 0) {
+      auto it = index.find(dedupKey(rec));
+      if (it != index.end() && it->second == pendingBase) index.erase(it);
+    }
+    pending.pop_front();
+    pendingBase++;
+    written++;
+  };
+
+  while (!heap.empty()) {
+    Record rec = heap.top();
+    heap.pop();
+    Record nextRec;
+    if (sources[rec.source].next(nextRec)) heap.push(std::move(nextRec));
+    total++;
+
+    while (!pending.empty() && pending.front().time < rec.time - window) emitFront();
+
+    if (rec.seq >= 0) {
+      auto it = index.find(dedupKey(rec));
+      if (it != index.end()) {
+        Record& kept = pending[it->second - pendingBase];
+        duplicates++;
+        int copies = kept.copies + 1;
+        if (!std::isnan(rec.rssi) && (std::isnan(kept.rssi) || rec.rssi > kept.rssi)) {
+          int64_t firstTime = kept.time; // Mantener el orden de salida
+          kept = std::move(rec);
+          kept.time = firstTime;
+        }
+        kept.copies = copies;
+        continue;
+      }
+      index[dedupKey(rec)] = pendingBase + pending.size();
+    }
+    pending.push_back(std::move(rec));
+    maxPending = std::max(maxPending, pending.size());
+  }
+  while (!pending.empty()) emitFront();
+
+  fprintf(stderr, "Registros leídos: %llu | escritos: %llu | duplicados eliminados: %llu | ventana máx.: %zu\n",
+          (unsigned long long)total, (unsigned long long)written, (unsigned long long)duplicates, maxPending);
+  return 0;
+}
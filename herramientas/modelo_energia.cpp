@@ -0,0 +1,154 @@
+// Modelo en Linux del consumo del transmisor en modo deep sleep
+//
+// Reconstruye la línea de tiempo de un ciclo de runWakeCycle() (arranque, calentamiento del
+// DHT22, lectura, envío, ventana de recepción y sueño) con los mismos consumos que el
+// estimador del firmware, y calcula la energía por lectura y la autonomía con batería para
+// cada tasa de ADR_RATES y varios tamaños de lote. Compara además con el modo continuo.
+//
+// Compilar: g++ -O2 -std=c++17 modelo_energia.cpp -o modelo_energia
+// Uso:      modelo_energia [--rate i] [--batch n] [--interval s] [--battery mAh]
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "../adr_lora.h"
+
+// Constantes del firmware
+const float SUPPLY_VOLTAGE = 3.3;
+const float CURRENT_ESP32_ACTIVE_MA = 45.0;
+const float CURRENT_SENSORS_MA = 1.7;
+const float CURRENT_LORA_TX_MA = 140.0;
+const float CURRENT_LORA_RX_MA = 17.0;
+const float CURRENT_SLEEP_MA = 0.015;
+const float DHT_WARMUP_MS = 1200;
+const float RX_WINDOW_MS = 3000;
+
+// Duraciones medidas aproximadas en placa
+const float BOOT_MS = 180;          // Despertar del deep sleep hasta setup()
+const float READ_MS = 6;            // DHT22 tras el calentamiento; BH1750 y suelo se solapan con él
+const float RADIO_WAKE_MS = 100;    // "AT" + "AT+MODE=0"
+const float RADIO_SLEEP_MS = 50;    // "AT+MODE=1"
+const float IDLE_ESP32_MA = 40.0;   // loop() con delay(100), modo continuo
+
+struct Phase {
+  const char* name;
+  float ms;
+  float ma;
+};
+
+// Tamaño del payload igual que sendData()/sendBatch()
+int payloadBytes(int batchSize) {
+  if (batchSize <= 1) return 33;                 // "T:23.5,H:45.2,L:1234,S:67,Q:12345"
+  return 28 + (batchSize - 1) * 17;              // Cabecera + primera lectura absoluta + deltas
+}
+
+std::vector<Phase> cycleTimeline(int rate, int batchSize, bool sends) {
+  std::vector<Phase> phases;
+  phases.push_back({"arranque", BOOT_MS, CURRENT_ESP32_ACTIVE_MA});
+  phases.push_back({"calentamiento DHT22", DHT_WARMUP_MS - BOOT_MS, CURRENT_ESP32_ACTIVE_MA + CURRENT_SENSORS_MA});
+  phases.push_back({"lectura DHT22", READ_MS, CURRENT_ESP32_ACTIVE_MA + CURRENT_SENSORS_MA});
+  if (sends) {
+    float airtime = loraAirtimeMs(ADR_RATES[rate], payloadBytes(batchSize));
+    phases.push_back({"despertar radio", RADIO_WAKE_MS, CURRENT_ESP32_ACTIVE_MA + CURRENT_LORA_RX_MA});
+    phases.push_back({"transmisión", airtime, CURRENT_ESP32_ACTIVE_MA + CURRENT_LORA_TX_MA});
+    phases.push_back({"ventana RX", RX_WINDOW_MS, CURRENT_ESP32_ACTIVE_MA + CURRENT_LORA_RX_MA});
+    phases.push_back({"dormir radio", RADIO_SLEEP_MS, CURRENT_ESP32_ACTIVE_MA});
+  }
+  return phases;
+}
+
+float phasesMs(const std::vector<Phase>& phases) {
+  float total = 0;
+  for (const Phase& p : phases) total += p.ms;
+  return total;
+}
+
+// mA·ms·V = µJ
+float phasesUj(const std::vector<Phase>& phases) {
+  float total = 0;
+  for (const Phase& p : phases) total += p.ms * p.ma * SUPPLY_VOLTAGE;
+  return total;
+}
+
+// Energía media por lectura (mJ): batchSize-1 ciclos sin envío y uno con envío
+float energyPerSampleMj(int rate, int batchSize, float intervalMs) {
+  float total = 0;
+  for (int i = 0; i < batchSize; i++) {
+    std::vector<Phase> phases = cycleTimeline(rate, batchSize, i == batchSize - 1);
+    float awake = phasesMs(phases);
+    float sleep = intervalMs > awake ? intervalMs - awake : 0;
+    total += phasesUj(phases) + sleep * CURRENT_SLEEP_MA * SUPPLY_VOLTAGE;
+  }
+  return total / batchSize / 1000.0f;
+}
+
+// Modo continuo: ESP32, sensores y radio en recepción todo el intervalo
+float continuousPerSampleMj(int rate, int batchSize, float intervalMs) {
+  float airtime = loraAirtimeMs(ADR_RATES[rate], payloadBytes(batchSize)) / batchSize;
+  float uj = (intervalMs * (IDLE_ESP32_MA + CURRENT_SENSORS_MA + CURRENT_LORA_RX_MA) +
+              airtime * (CURRENT_LORA_TX_MA - CURRENT_LORA_RX_MA)) * SUPPLY_VOLTAGE;
+  return uj / 1000.0f;
+}
+
+float batteryDays(float mjPerSample, float intervalMs, float batteryMah) {
+  float batteryMj = batteryMah * 3.6f * SUPPLY_VOLTAGE * 1000.0f;
+  return batteryMj / mjPerSample * (intervalMs / 1000.0f) / 86400.0f;
+}
+
+int main(int argc, char** argv) {
+  int rate = ADR_DEFAULT_RATE;
+  int batchSize = 4;
+  float intervalMs = 15000;
+  float batteryMah = 2500;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--rate") && i + 1 < argc) rate = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--batch") && i + 1 < argc) batchSize = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--interval") && i + 1 < argc) intervalMs = atof(argv[++i]) * 1000.0f;
+    else if (!strcmp(argv[i], "--battery") && i + 1 < argc) batteryMah = atof(argv[++i]);
+    else {
+      fprintf(stderr, "Uso: %s [--rate i] [--batch n] [--interval s] [--battery mAh]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (rate < 0 || rate >= ADR_RATE_COUNT || batchSize < 1 || batchSize > 16) {
+    fprintf(stderr, "Tasa (0-%d) o lote (1-16) fuera de rango\n", ADR_RATE_COUNT - 1);
+    return 1;
+  }
+
+  printf("Línea de tiempo del ciclo con envío (SF%d, %.1f kHz, lote de %d, %d bytes):\n",
+         ADR_RATES[rate].sf, loraBandwidthHz(ADR_RATES[rate].bwCode) / 1000.0f, batchSize, payloadBytes(batchSize));
+  float t = 0;
+  std::vector<Phase> phases = cycleTimeline(rate, batchSize, true);
+  for (const Phase& p : phases) {
+    printf("  %8.0f ms  %-20s %8.0f ms  %6.1f mA  %8.2f mJ\n", t, p.name, p.ms, p.ma,
+           p.ms * p.ma * SUPPLY_VOLTAGE / 1000.0f);
+    t += p.ms;
+  }
+  float sleepMs = intervalMs > t ? intervalMs - t : 0;
+  printf("  %8.0f ms  %-20s %8.0f ms  %6.3f mA  %8.2f mJ\n\n", t, "deep sleep", sleepMs, CURRENT_SLEEP_MA,
+         sleepMs * CURRENT_SLEEP_MA * SUPPLY_VOLTAGE / 1000.0f);
+
+  printf("Energía por lectura (mJ) y autonomía (días, %.0f mAh) cada %.0f s:\n", batteryMah, intervalMs / 1000.0f);
+  printf("  %-14s", "tasa");
+  const int BATCHES[] = {1, 2, 4, 8, 16};
+  for (int b : BATCHES) printf("   lote %-2d       ", b);
+  printf("\n");
+  for (int r = 0; r < ADR_RATE_COUNT; r++) {
+    printf("  SF%-2d %6.1fkHz", ADR_RATES[r].sf, loraBandwidthHz(ADR_RATES[r].bwCode) / 1000.0f);
+    for (int b : BATCHES) {
+      float mj = energyPerSampleMj(r, b, intervalMs);
+      printf("  %6.1f %6.0fd  ", mj, batteryDays(mj, intervalMs, batteryMah));
+    }
+    printf("\n");
+  }
+
+  float sleeping = energyPerSampleMj(rate, batchSize, intervalMs);
+  float continuous = continuousPerSampleMj(rate, batchSize, intervalMs);
+  printf("\nModo continuo: %.1f mJ/lectura (%.1f días); deep sleep: %.1f mJ/lectura (%.0f días), %.1fx menos\n",
+         continuous, batteryDays(continuous, intervalMs, batteryMah), sleeping,
+         batteryDays(sleeping, intervalMs, batteryMah), continuous / sleeping);
+  return 0;
+}
@@ -0,0 +1,90 @@
+// Prueba en Linux del compresor gzip de las descargas (gzip_stream.h)
+//
+// Comprime archivos CSV del receptor con varios tamaños de ventana y muestra la relación de
+// compresión, la velocidad y la memoria que ocupa el compresor en el ESP32. Con -o escribe la
+// salida de la ventana elegida para comprobarla con "gzip -t" o descomprimirla.
+//
+// Compilar: g++ -O2 -std=c++17 prueba_gzip.cpp -o prueba_gzip
+// Uso:      prueba_gzip [--window bits] [-o salida.gz] <csv> ...
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "../gzip_stream.h"
+
+void writeToFile(const uint8_t* data, size_t length, void* context) {
+  fwrite(data, 1, length, (FILE*)context);
+}
+
+void discard(const uint8_t*, size_t, void*) {}
+
+// Trozos de 1460 bytes, como los lee handleDownload() de la SD
+template <int BITS>
+void measure(const std::vector<uint8_t>& input, FILE* output) {
+  static GzipStream<BITS> gzip;
+  auto start = std::chrono::steady_clock::now();
+  gzip.begin(output ? writeToFile : discard, output);
+  for (size_t offset = 0; offset < input.size(); offset += 1460) {
+    gzip.write(input.data() + offset, std::min<size_t>(1460, input.size() - offset));
+  }
+  gzip.finish();
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  printf("  ventana %6zu B  %10u -> %9u bytes  %5.1f%%  %7.1f MB/s  memoria %6zu B\n", GzipStream<BITS>::WINDOW,
+         gzip.totalIn(), gzip.totalOut(), 100.0 * gzip.totalOut() / std::max<uint32_t>(gzip.totalIn(), 1),
+         input.size() / seconds / 1e6, sizeof(GzipStream<BITS>));
+}
+
+int main(int argc, char** argv) {
+  int windowBits = 11;
+  const char* outputPath = nullptr;
+  std::vector<uint8_t> input;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--window") && i + 1 < argc) windowBits = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-o") && i + 1 < argc) outputPath = argv[++i];
+    else {
+      std::ifstream in(argv[i], std::ios::binary);
+      if (!in) {
+        fprintf(stderr, "Uso: %s [--window bits] [-o salida.gz] <csv> ...\n", argv[0]);
+        return 1;
+      }
+      input.insert(input.end(), std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+  }
+  if (input.empty() || windowBits < 9 || windowBits > 14) {
+    fprintf(stderr, "Sin datos o ventana fuera de rango (9-14)\n");
+    return 1;
+  }
+
+  printf("%zu bytes de entrada:\n", input.size());
+  measure<9>(input, nullptr);
+  measure<10>(input, nullptr);
+  measure<11>(input, nullptr);
+  measure<12>(input, nullptr);
+  measure<13>(input, nullptr);
+  measure<14>(input, nullptr);
+
+  if (outputPath) {
+    FILE* output = fopen(outputPath, "wb");
+    if (!output) {
+      fprintf(stderr, "No se pudo crear %s\n", outputPath);
+      return 1;
+    }
+    printf("\nEscribiendo %s:\n", outputPath);
+    switch (windowBits) {
+      case 9: measure<9>(input, output); break;
+      case 10: measure<10>(input, output); break;
+      case 11: measure<11>(input, output); break;
+      case 12: measure<12>(input, output); break;
+      case 13: measure<13>(input, output); break;
+      default: measure<14>(input, output); break;
+    }
+    fclose(output);
+  }
+  return 0;
+}
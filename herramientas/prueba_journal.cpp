@@ -0,0 +1,286 @@
+// Inyección de cortes de corriente sobre el registro con diario de sd_journal.h
+//
+// Simula la tarjeta en memoria y corta la alimentación en un byte aleatorio de las escrituras:
+// lo escrito hasta ese byte queda, el resto no, y en la mitad de los cortes durante un append
+// el archivo queda además extendido con ceros o basura hasta el final del sector (FAT ya había
+// actualizado el tamaño). Tras cada corte se "reinicia" (a veces con un segundo corte durante la
+// propia recuperación; otras veces con una línea a medias escrita sin diario) y se comprueba:
+//   - todas las líneas del CSV terminan en '\n' y tienen CRC correcto,
+//   - las lecturas presentes siguen el orden en que se intentaron, sin repetir ni inventar,
+//   - ninguna lectura confirmada (append() retornó true) se perdió,
+//   - la recuperación leyó como mucho diario + cabecera + último lote + JOURNAL_TAIL_BYTES, aunque
+//     el archivo del día ya tenga varios MB.
+// Mide además las escrituras (abrir/escribir/cerrar en la SD) que cuesta cada append sin cortes.
+//
+// Compilar: g++ -O2 -std=c++17 prueba_journal.cpp -o prueba_journal
+// Uso:      prueba_journal [--trials n] [--seed s] [--prefill bytes]
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../sd_journal.h"
+
+const char* JOURNAL_FILE = "/data/journal.bin";
+const char* HEADER = "timestamp,temperature,humidity,soil_moisture,lux,node,seq,rssi,snr,crc\n";
+const uint32_t DAY0 = 19723 * 86400; // 2024-01-01
+
+struct PowerCut {};
+
+// Tarjeta en memoria con un presupuesto de bytes escritos antes del corte
+struct MemoryFs {
+  std::map<std::string, std::string> files;
+  long budget = -1;         // -1 = sin corte
+  bool garbage = false;     // Al cortar un append, rellenar el sector con basura
+  std::mt19937* rng = nullptr;
+  uint64_t bytesRead = 0;
+  uint64_t writes = 0;      // Llamadas a write() y append()
+
+  long size(const char* path) {
+    auto it = files.find(path);
+    return it == files.end() ? -1 : (long)it->second.size();
+  }
+  size_t read(const char* path, uint32_t offset, uint8_t* data, size_t length) {
+    auto it = files.find(path);
+    if (it == files.end() || offset >= it->second.size()) return 0;
+    size_t n = std::min(length, it->second.size() - offset);
+    memcpy(data, it->second.data() + offset, n);
+    bytesRead += n;
+    return n;
+  }
+  // Bytes que se pueden escribir antes del corte; lanza PowerCut después de aplicarlos
+  size_t allowance(size_t length) {
+    if (budget < 0 || (size_t)budget >= length) {
+      if (budget >= 0) budget -= length;
+      return length;
+    }
+    return (size_t)budget;
+  }
+  bool write(const char* path, uint32_t offset, const uint8_t* data, size_t length) {
+    writes++;
+    std::string& file = files[path];
+    size_t n = allowance(length);
+    if (file.size() < offset + n) file.resize(offset + n, '\0');
+    memcpy(&file[offset], data, n);
+    if (n < length) throw PowerCut();
+    return true;
+  }
+  bool append(const char* path, const uint8_t* data, size_t length, uint32_t& newSize) {
+    writes++;
+    std::string& file = files[path];
+    size_t n = allowance(length);
+    file.append((const char*)data, n);
+    if (n < length) {
+      if (garbage) {
+        size_t sectorEnd = (file.size() + 511) / 512 * 512;
+        bool zeros = (*rng)() % 2;
+        while (file.size() < sectorEnd) file.push_back(zeros ? '\0' : (char)(*rng)());
+      }
+      throw PowerCut();
+    }
+    newSize = file.size();
+    return true;
+  }
+  bool truncate(const char* path, uint32_t length) {
+    if (budget == 0) throw PowerCut();
+    files[path].resize(length);
+    return true;
+  }
+  void dayPath(uint32_t day, char* out, size_t outSize) {
+    snprintf(out, outSize, "/data/sensors_%u.csv", day / 86400);
+  }
+};
+
+static std::string recordLine(long id) {
+  char body[96];
+  snprintf(body, sizeof(body), "2024-01-01 00:00:00,%.2f,%.2f,%ld,%.1f,1,%ld,-80,7", 20 + id % 50 / 10.0,
+           50 + id % 30 / 10.0, id % 100, id % 1000 * 1.5, id);
+  char crc[7];
+  journalLineCrc(body, strlen(body), crc);
+  return std::string(body) + crc + "\n";
+}
+
+// Comprueba los archivos diarios; ids recibe el campo seq de cada línea en orden. El relleno
+// inicial (`prefix` del primer archivo) solo se compara: no debe cambiar.
+static bool checkFiles(MemoryFs& fs, const std::string& firstPath, const std::string& prefix, std::vector<long>& ids,
+                       std::string& error) {
+  for (const auto& entry : fs.files) {
+    if (entry.first == JOURNAL_FILE) continue;
+    const std::string& text = entry.second;
+    const std::string& expected = entry.first == firstPath ? prefix : HEADER;
+    if (text.compare(0, expected.size(), expected) != 0) {
+      error = entry.first + ": cabecera o datos previos dañados";
+      return false;
+    }
+    size_t pos = expected.size();
+    while (pos < text.size()) {
+      size_t newline = text.find('\n', pos);
+      if (newline == std::string::npos) {
+        error = entry.first + ": línea sin terminar en el byte " + std::to_string(pos);
+        return false;
+      }
+      if (!journalLineValid(text.data() + pos, newline - pos)) {
+        error = entry.first + ": CRC incorrecto en el byte " + std::to_string(pos);
+        return false;
+      }
+      std::string line = text.substr(pos, newline - pos);
+      int commas = 0;
+      size_t field = 0;
+      for (size_t i = 0; i < line.size() && commas < 6; i++) {
+        if (line[i] == ',' && ++commas == 6) field = i + 1;
+      }
+      long id = atol(line.c_str() + field);
+      ids.push_back(id);
+      pos = newline + 1;
+    }
+  }
+  return true;
+}
+
+int main(int argc, char** argv) {
+  int trials = 2000;
+  unsigned seed = 1;
+  size_t prefill = 1 << 20;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--trials") && i + 1 < argc) trials = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--seed") && i + 1 < argc) seed = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--prefill") && i + 1 < argc) prefill = atol(argv[++i]);
+    else {
+      fprintf(stderr, "Uso: %s [--trials n] [--seed s] [--prefill bytes]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  std::mt19937 rng(seed);
+  // Archivo del primer día ya grande: la recuperación no debe leerlo entero
+  std::string filled = HEADER;
+  while (filled.size() < prefill) filled += recordLine(0);
+
+  int failures = 0, doubleCuts = 0;
+  long replayed = 0, dropped = 0, lostUnconfirmed = 0;
+  uint64_t maxRead = 0;
+  const uint64_t readBound =
+      JOURNAL_SLOTS * JOURNAL_SLOT_SIZE + JOURNAL_LINE_MAX + JOURNAL_MAX_BATCH * JOURNAL_LINE_MAX + JOURNAL_TAIL_BYTES;
+
+  // Coste de un append de una lectura (lo que hace saveToSD()), tras el primero de cada día
+  double writesPerAppend;
+  {
+    MemoryFs fs;
+    char path[JOURNAL_PATH_MAX];
+    fs.dayPath(DAY0, path, sizeof(path));
+    fs.files[path] = HEADER;
+    SdJournal<MemoryFs> journal(fs, JOURNAL_FILE);
+    journal.begin();
+    const int appends = 1000;
+    uint32_t newSize;
+    std::string line = recordLine(1);
+    journal.append(DAY0, line.data(), line.size(), newSize);
+    fs.writes = 0;
+    for (int i = 0; i < appends; i++) journal.append(DAY0, line.data(), line.size(), newSize);
+    writesPerAppend = (double)fs.writes / appends;
+  }
+
+  for (int trial = 0; trial < trials; trial++) {
+    MemoryFs fs;
+    fs.rng = &rng;
+    fs.garbage = rng() % 2;
+    char path[JOURNAL_PATH_MAX];
+    fs.dayPath(DAY0, path, sizeof(path));
+    const std::string firstPath = path;
+    fs.files[path] = filled;
+
+    std::vector<long> attempted;
+    long confirmed = 0, id = 1;
+    uint32_t day = DAY0;
+    fs.budget = rng() % 60000;
+    try {
+      SdJournal<MemoryFs> journal(fs, JOURNAL_FILE);
+      journal.begin();
+      for (;;) {
+        if (rng() % 50 == 0) { // Cambio de día: ensureLogFile() crea la cabecera fuera del diario
+          day += 86400;
+          fs.dayPath(day, path, sizeof(path));
+          fs.files[path] = HEADER;
+        }
+        std::string batch;
+        int lines = 1 + rng() % 40;
+        for (int i = 0; i < lines; i++, id++) {
+          batch += recordLine(id);
+          attempted.push_back(id);
+        }
+        uint32_t newSize;
+        if (!journal.append(day, batch.data(), batch.size(), newSize)) break;
+        confirmed = attempted.size();
+      }
+    } catch (const PowerCut&) {
+    }
+    // Uno de cada ocho: además una línea a medias escrita sin pasar por el diario (firmware anterior)
+    if (rng() % 8 == 0) {
+      std::string line = recordLine(0);
+      fs.files[path] += line.substr(0, 1 + rng() % (line.size() - 1));
+    }
+
+    // Reinicio; en uno de cada cuatro ensayos la recuperación también se corta. Después se registra
+    // una lectura más en el día en curso, como haría el receptor.
+    JournalRecovery result;
+    uint64_t recoveryRead = 0;
+    fs.garbage = false;
+    fs.budget = rng() % 4 == 0 ? (long)(rng() % 8000) : -1;
+    std::string error;
+    for (int boot = 0; boot < 2; boot++) {
+      try {
+        fs.bytesRead = 0;
+        SdJournal<MemoryFs> journal(fs, JOURNAL_FILE);
+        journal.begin();
+        journal.recover();
+        recoveryRead = fs.bytesRead;
+        std::string line = recordLine(id);
+        attempted.push_back(id++);
+        uint32_t newSize;
+        if (!journal.append(day, line.data(), line.size(), newSize)) error = "append tras la recuperación";
+        result = journal.stats();
+        break;
+      } catch (const PowerCut&) {
+        doubleCuts++;
+        fs.budget = -1;
+      }
+    }
+    maxRead = std::max(maxRead, recoveryRead);
+
+    std::vector<long> ids;
+    bool ok = error.empty() && checkFiles(fs, firstPath, filled, ids, error);
+    // Lo presente: un prefijo de lo intentado antes del corte (con todo lo confirmado), quizá la
+    // lectura de un arranque cortado y, al final, la lectura del último arranque
+    if (ok && (ids.empty() || ids.back() != id - 1)) error = "falta la lectura posterior al reinicio", ok = false;
+    if (ok && ids.size() < (size_t)confirmed + 1) error = "lecturas confirmadas perdidas", ok = false;
+    for (size_t i = 0, j = 0; ok && i < ids.size(); i++, j++) {
+      while (j < attempted.size() && attempted[j] != ids[i] && j >= (size_t)confirmed) j++;
+      if (j >= attempted.size() || attempted[j] != ids[i]) error = "orden o repetición en la posición " + std::to_string(i), ok = false;
+    }
+    if (ok && recoveryRead > readBound) error = "recuperación leyó " + std::to_string(recoveryRead) + " bytes", ok = false;
+    if (!ok) {
+      failures++;
+      if (failures <= 10) printf("ensayo %d: %s\n", trial, error.c_str());
+      continue;
+    }
+    replayed += result.replayed;
+    dropped += result.droppedLines;
+    lostUnconfirmed += attempted.size() - ids.size();
+  }
+
+  printf("%d cortes (%d también durante la recuperación), archivo inicial de %zu bytes\n", trials, doubleCuts,
+         filled.size());
+  printf("Líneas reescritas desde el diario: %ld; líneas rotas quitadas: %ld\n", replayed, dropped);
+  printf("Lecturas sin confirmar perdidas en el corte: %ld (%.1f por corte)\n", lostUnconfirmed,
+         trials ? (double)lostUnconfirmed / trials : 0.0);
+  printf("Escrituras por append de una lectura: %.2f\n", writesPerAppend);
+  printf("Máximo leído al recuperar: %llu bytes (límite %llu)\n", (unsigned long long)maxRead,
+         (unsigned long long)readBound);
+  printf("%s: %d ensayos con error\n", failures ? "FALLO" : "OK", failures);
+  return failures ? 1 : 0;
+}
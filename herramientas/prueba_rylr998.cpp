@@ -0,0 +1,185 @@
+// Prueba en Linux del motor AT (rylr998_at.h) contra el RYLR998 simulado (sim_rylr998.h)
+//
+// Escenarios: configuración inicial como initializeLoRa()/setupLoRa(), errores +ERR, módulo que
+// no contesta, envío seguido de cambio de tasa (+ERR=17 si no se espera el tiempo en el aire),
+// tramas +RCV que llegan con un comando en curso y ráfagas que desbordan el búfer de la UART
+// según cada cuánto se atiende el puerto. Termina con código 1 si algún escenario falla.
+//
+// Compilar: g++ -O2 -std=c++17 prueba_rylr998.cpp -o prueba_rylr998
+// Uso:      prueba_rylr998
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "../rylr998_at.h"
+#include "sim_rylr998.h"
+
+unsigned long simNow = 0;
+unsigned long simClock() { return simNow; }
+
+std::vector<int> results;
+std::vector<std::string> framesReceived;
+
+void recordResult(const char*, int result) { results.push_back(result); }
+void recordFrame(const RylrFrame& frame) { framesReceived.push_back(frame.data); }
+
+int failures = 0;
+
+void check(bool ok, const char* scenario, const std::string& detail) {
+  printf("%s %-44s %s\n", ok ? "OK   " : "FALLO", scenario, detail.c_str());
+  if (!ok) failures++;
+}
+
+// Avanza el reloj virtual atendiendo el motor cada pollMs, como haría loop()
+template <typename Engine>
+void run(Engine& engine, unsigned long durationMs, unsigned long pollMs = 1) {
+  unsigned long end = simNow + durationMs;
+  while (simNow < end) {
+    engine.poll();
+    simNow += pollMs;
+  }
+  engine.poll();
+}
+
+template <typename Engine>
+unsigned long runUntilIdle(Engine& engine, unsigned long maxMs) {
+  unsigned long start = simNow;
+  while (!engine.idle() && simNow - start < maxMs) {
+    engine.poll();
+    simNow++;
+  }
+  return simNow - start;
+}
+
+void reset() {
+  results.clear();
+  framesReceived.clear();
+}
+
+int main() {
+  // 1. Secuencia de initializeLoRa(): antes 1000 + 2000 + 3 x 500 ms de esperas fijas
+  {
+    reset();
+    SimRylr998 module(simClock);
+    Rylr998At<SimRylr998> lora(module, simClock);
+    lora.send("AT+RESET", 2000, recordResult);
+    lora.send("AT+ADDRESS=2", 500, recordResult);
+    lora.send("AT+NETWORKID=18", 500, recordResult);
+    lora.send("AT+PARAMETER=12,4,1,7", 500, recordResult);
+    unsigned long elapsed = runUntilIdle(lora, 5000);
+    bool ok = results == std::vector<int>{RYLR_OK, RYLR_OK, RYLR_OK, RYLR_OK} && module.address == 2 &&
+              module.rate.sf == 12 && module.rate.bwCode == 4;
+    check(ok, "configuración inicial", std::to_string(elapsed) + " ms (antes 4500 ms)");
+  }
+
+  // 2. Parámetro inválido y consulta con valor
+  {
+    reset();
+    SimRylr998 module(simClock);
+    Rylr998At<SimRylr998> lora(module, simClock);
+    lora.send("AT+PARAMETER=13,7,1,7", 500, recordResult);
+    lora.send("AT+ADDRESS=7", 500, recordResult);
+    lora.send("AT+ADDRESS?", 500, [](const char*, int result) { results.push_back(result); });
+    runUntilIdle(lora, 2000);
+    bool ok = results.size() == 3 && results[0] == 4 && results[1] == RYLR_OK && results[2] == RYLR_OK &&
+              lora.stats().errors == 1;
+    check(ok, "+ERR=4 y comandos posteriores", "errores=" + std::to_string(lora.stats().errors));
+  }
+
+  // 3. Módulo que no contesta: cada comando vence su plazo y la cola sigue
+  {
+    reset();
+    SimRylr998 module(simClock);
+    module.muted = true;
+    Rylr998At<SimRylr998> lora(module, simClock);
+    lora.send("AT+ADDRESS=2", 300, recordResult);
+    lora.send("AT+NETWORKID=18", 300, recordResult);
+    unsigned long elapsed = runUntilIdle(lora, 2000);
+    bool ok = results == std::vector<int>{RYLR_TIMEOUT, RYLR_TIMEOUT} && elapsed >= 600 && elapsed < 700;
+    check(ok, "plazos vencidos sin bloquear", std::to_string(elapsed) + " ms");
+  }
+
+  // 4. Confirmación ADR seguida de cambio de tasa: la cola espera a que termine la emisión
+  {
+    reset();
+    SimRylr998 module(simClock);
+    Rylr998At<SimRylr998> lora(module, simClock);
+    const char* ack = "ACK:ADR,3";
+    float airtime = loraAirtimeMs(module.rate, strlen(ack));
+    lora.sendFrame(2, ack, strlen(ack), airtime, recordResult);
+    lora.send("AT+PARAMETER=10,7,1,7", 500, recordResult);
+    unsigned long elapsed = runUntilIdle(lora, 5000);
+    bool ok = results == std::vector<int>{RYLR_OK, RYLR_OK} && module.rate.sf == 10;
+    check(ok, "AT+SEND y AT+PARAMETER sin +ERR=17",
+          std::to_string(elapsed) + " ms, aire " + std::to_string((int)airtime) + " ms");
+
+    // Sin reservar el tiempo en el aire el módulo rechaza el segundo comando
+    reset();
+    SimRylr998 module2(simClock);
+    Rylr998At<SimRylr998> lora2(module2, simClock);
+    lora2.send(("AT+SEND=2," + std::to_string(strlen(ack)) + "," + ack).c_str(), 1000, recordResult);
+    lora2.send("AT+PARAMETER=10,7,1,7", 500, recordResult);
+    runUntilIdle(lora2, 5000);
+    check(results.size() == 2 && results[1] == 17, "sin espera: +ERR=17 (referencia)",
+          "resultado=" + std::to_string(results.size() == 2 ? results[1] : 0));
+  }
+
+  // 5. Tramas +RCV durante comandos en curso: todas se entregan y ninguna cierra un comando
+  {
+    reset();
+    SimRylr998 module(simClock);
+    Rylr998At<SimRylr998> lora(module, simClock);
+    lora.onFrame(recordFrame);
+    lora.send("AT+RESET", 2000, recordResult);
+    lora.send("AT+ADDRESS=2", 500, recordResult);
+    lora.send("AT+PARAMETER=9,7,1,7", 500, recordResult);
+    unsigned long start = simNow;
+    int delivered = 0;
+    for (int i = 0; i < 20; i++) {
+      // Una trama cada 17 ms, cayendo también entre +RESET y +READY y antes de cada +OK
+      while (simNow < start + i * 17) {
+        lora.poll();
+        simNow++;
+      }
+      std::string payload = "T:21.5,H:40.0,L:100,S:50,Q:" + std::to_string(i);
+      if (module.deliver(simNow, 1, payload, -80, 9)) delivered++;
+    }
+    runUntilIdle(lora, 3000);
+    run(lora, 50);
+    bool ok = (int)framesReceived.size() == delivered && delivered == 20 &&
+              results == std::vector<int>{RYLR_OK, RYLR_OK, RYLR_OK} && lora.stats().badLines == 0;
+    check(ok, "+RCV intercalados con comandos",
+          std::to_string(framesReceived.size()) + "/" + std::to_string(delivered) + " tramas");
+  }
+
+  // 6. Ráfaga de tramas largas a la tasa más rápida (una tras otra en el aire) frente a la frecuencia
+  //    de atención del puerto y el tamaño del búfer RX. Con 1024 B se aguantan 100 ms sin atender.
+  const unsigned long POLL_PERIODS[] = {1, 10, 100};
+  const size_t BUFFERS[] = {256, 1024};
+  for (size_t buffer : BUFFERS) {
+    for (unsigned long period : POLL_PERIODS) {
+      reset();
+      SimRylr998 module(simClock, buffer);
+      Rylr998At<SimRylr998> lora(module, simClock);
+      lora.onFrame(recordFrame);
+      std::string payload(120, 'x');
+      unsigned long spacing = (unsigned long)loraAirtimeMs(ADR_RATES[ADR_RATE_COUNT - 1], payload.size());
+      for (int i = 1; i <= 10; i++) module.deliver(simNow + i * spacing, 1, payload, -90, 2);
+      run(lora, 12 * spacing, period);
+      char detail[96];
+      snprintf(detail, sizeof(detail), "%zu/10 tramas, %lu bytes perdidos", framesReceived.size(),
+               module.uartOverflowBytes);
+      std::string scenario = "ráfaga, búfer " + std::to_string(buffer) + " B, poll " + std::to_string(period) + " ms";
+      if (buffer == 1024 || period == 1) {
+        check(framesReceived.size() == 10, scenario.c_str(), detail);
+      } else {
+        printf("info  %-44s %s\n", scenario.c_str(), detail);
+      }
+    }
+  }
+
+  printf("\n%s\n", failures == 0 ? "Todas las pruebas superadas" : "Hay pruebas fallidas");
+  return failures == 0 ? 0 : 1;
+}
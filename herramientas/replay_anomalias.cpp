@@ -0,0 +1,277 @@
+// Reproducción en Linux de la detección de lecturas sospechosas sobre registros históricos
+//
+// Lee los CSV diarios del receptor (/data/sensors_AAAA-MM-DD.csv, un directorio o archivos
+// sueltos), pasa las lecturas de cada nodo por anomalyCheck() (anomaly_detector.h, el mismo código
+// que el receptor) y mide:
+//   - coste: ns por lectura y bytes de estado por flujo (nodo x sensor),
+//   - lecturas marcadas por sensor y motivo; en un registro sin fallos son falsos positivos.
+// Con --inject añade fallos conocidos a las lecturas antes de reproducirlas y mide por tipo qué
+// episodios se detectan, con qué retraso (lecturas) y qué parte de las lecturas dañadas se marca:
+//   - dht: fallo del DHT22; el transmisor envía 0 y su filtro lo acerca a 0 a mitades,
+//   - pico: una lectura suelta fuera de lugar en temperatura, humedad o suelo,
+//   - fijo: temperatura o humedad congelada 8 h,
+//   - deriva: el suelo sube 2 %/h hasta el tope (calibración desplazada) durante 2 días.
+//
+// Compilar: g++ -O2 -std=c++17 replay_anomalias.cpp -o replay_anomalias
+// Uso:      replay_anomalias [--inject] [--seed s] <dir_o_csv> ...
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../anomaly_detector.h"
+
+namespace fs = std::filesystem;
+
+enum { FAULT_NONE, FAULT_DHT, FAULT_SPIKE, FAULT_STUCK, FAULT_DRIFT, FAULT_TYPES };
+const char* FAULT_NAMES[FAULT_TYPES] = {"", "dht", "pico", "fijo", "deriva"};
+const char* SENSOR_NAMES[ANOMALY_SENSORS] = {"temperatura", "humedad", "luz", "suelo"};
+
+struct Reading {
+  int64_t time;
+  long seq;
+  float values[ANOMALY_SENSORS];
+  uint8_t fault[ANOMALY_SENSORS]; // FAULT_* inyectado en cada sensor
+  uint16_t flags;
+};
+
+struct Episode {
+  int type, sensor;
+  size_t first, last; // Índices dentro de las lecturas del nodo
+  int node;
+};
+
+// Días desde 1970-01-01 para una fecha civil (algoritmo de Howard Hinnant)
+static int64_t daysFromCivil(int64_t y, unsigned m, unsigned d) {
+  y -= m <= 2;
+  const int64_t era = (y >= 0 ? y : y - 399) / 400;
+  const unsigned yoe = (unsigned)(y - era * 400);
+  const unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + (int64_t)doe - 719468;
+}
+
+static bool parseTimestamp(const std::string& text, int64_t& out) {
+  int y, mo, d, h, mi, s;
+  if (sscanf(text.c_str(), "%d-%d-%d %d:%d:%d", &y, &mo, &d, &h, &mi, &s) != 6) return false;
+  out = daysFromCivil(y, mo, d) * 86400 + h * 3600 + mi * 60 + s;
+  return true;
+}
+
+static std::vector<std::string> splitCsv(const std::string& line) {
+  std::vector<std::string> fields;
+  std::string field;
+  std::istringstream in(line);
+  while (std::getline(in, field, ',')) fields.push_back(field);
+  return fields;
+}
+
+// Agrupa las lecturas por nodo; los archivos antiguos sin columna node cuentan como nodo 0
+static bool loadCsv(const fs::path& path, std::map<int, std::vector<Reading>>& byNode) {
+  std::ifstream in(path);
+  std::string line;
+  if (!std::getline(in, line)) return false;
+  if (!line.empty() && line.back() == '\r') line.pop_back();
+  std::vector<std::string> header = splitCsv(line);
+  int columns[ANOMALY_SENSORS] = {-1, -1, -1, -1};
+  int nodeCol = -1, seqCol = -1;
+  for (size_t i = 0; i < header.size(); i++) {
+    if (header[i] == "temperature") columns[ANOMALY_TEMP] = i;
+    else if (header[i] == "humidity") columns[ANOMALY_HUM] = i;
+    else if (header[i] == "lux") columns[ANOMALY_LUX] = i;
+    else if (header[i] == "soil_moisture") columns[ANOMALY_SOIL] = i;
+    else if (header[i] == "node") nodeCol = i;
+    else if (header[i] == "seq") seqCol = i;
+  }
+  for (int column : columns) {
+    if (column < 0) {
+      fprintf(stderr, "%s: faltan columnas de sensores\n", path.c_str());
+      return false;
+    }
+  }
+
+  while (std::getline(in, line)) {
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    if (line.empty() || line[0] == '\0') break; // Relleno del archivo preasignado
+    std::vector<std::string> fields = splitCsv(line);
+    Reading reading = {};
+    if (fields.size() < header.size() || !parseTimestamp(fields[0], reading.time)) continue;
+    for (int s = 0; s < ANOMALY_SENSORS; s++) reading.values[s] = atof(fields[columns[s]].c_str());
+    reading.seq = seqCol >= 0 && !fields[seqCol].empty() ? atol(fields[seqCol].c_str()) : -1;
+    int node = nodeCol >= 0 ? atoi(fields[nodeCol].c_str()) : 0;
+    byNode[node].push_back(reading);
+  }
+  return true;
+}
+
+// Un episodio de cada tipo cada ~3 días por nodo, sin solaparse
+static void injectFaults(int node, std::vector<Reading>& readings, std::mt19937& rng, std::vector<Episode>& episodes) {
+  if (readings.size() < 2) return;
+  double perReading = (double)(readings.back().time - readings.front().time) / (readings.size() - 1);
+  size_t gap = std::max<size_t>(1, (size_t)(3 * 86400 / FAULT_TYPES / perReading));
+  size_t i = gap / 2;
+  while (i < readings.size()) {
+    Episode episode = {1 + (int)(rng() % (FAULT_TYPES - 1)), 0, i, i, node};
+    if (episode.type == FAULT_DHT) {
+      size_t length = 20 + rng() % 180;
+      float t = readings[i].values[ANOMALY_TEMP], h = readings[i].values[ANOMALY_HUM];
+      for (size_t k = i; k < std::min(readings.size(), i + length); k++) {
+        t /= 2; // Mitad por lectura, con la décima que envía el transmisor
+        h /= 2;
+        readings[k].values[ANOMALY_TEMP] = roundf(t * 10) / 10;
+        readings[k].values[ANOMALY_HUM] = roundf(h * 10) / 10;
+        readings[k].fault[ANOMALY_TEMP] = readings[k].fault[ANOMALY_HUM] = FAULT_DHT;
+        episode.last = k;
+      }
+    } else if (episode.type == FAULT_SPIKE) {
+      const int sensors[] = {ANOMALY_TEMP, ANOMALY_HUM, ANOMALY_SOIL};
+      const float sizes[] = {8, 30, 40};
+      int pick = rng() % 3;
+      episode.sensor = sensors[pick];
+      float& value = readings[i].values[episode.sensor];
+      value += (value > (pick == 0 ? 20 : 50) ? -1 : 1) * sizes[pick];
+      readings[i].fault[episode.sensor] = FAULT_SPIKE;
+    } else if (episode.type == FAULT_STUCK) {
+      episode.sensor = rng() % 2 ? ANOMALY_TEMP : ANOMALY_HUM;
+      float frozen = readings[i].values[episode.sensor];
+      for (size_t k = i; k < readings.size() && readings[k].time - readings[i].time < 8 * 3600; k++) {
+        readings[k].values[episode.sensor] = frozen;
+        readings[k].fault[episode.sensor] = FAULT_STUCK;
+        episode.last = k;
+      }
+    } else {
+      episode.sensor = ANOMALY_SOIL;
+      for (size_t k = i; k < readings.size() && readings[k].time - readings[i].time < 2 * 86400; k++) {
+        float offset = (readings[k].time - readings[i].time) / 3600.0f * 2;
+        readings[k].values[ANOMALY_SOIL] = std::min(100.0f, roundf(readings[k].values[ANOMALY_SOIL] + offset));
+        readings[k].fault[ANOMALY_SOIL] = FAULT_DRIFT;
+        episode.last = k;
+      }
+    }
+    episodes.push_back(episode);
+    i = episode.last + gap;
+  }
+}
+
+int main(int argc, char** argv) {
+  bool inject = false;
+  unsigned seed = 1;
+  std::vector<fs::path> files;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--inject")) inject = true;
+    else if (!strcmp(argv[i], "--seed") && i + 1 < argc) seed = atoi(argv[++i]);
+    else if (fs::is_directory(argv[i])) {
+      for (const auto& entry : fs::directory_iterator(argv[i])) {
+        if (entry.path().extension() == ".csv") files.push_back(entry.path());
+      }
+    } else if (fs::exists(argv[i])) {
+      files.push_back(argv[i]);
+    } else {
+      fprintf(stderr, "Uso: %s [--inject] [--seed s] <dir_o_csv> ...\n", argv[0]);
+      return 1;
+    }
+  }
+  if (files.empty()) {
+    fprintf(stderr, "Sin archivos CSV\n");
+    return 1;
+  }
+
+  std::map<int, std::vector<Reading>> byNode;
+  std::sort(files.begin(), files.end());
+  for (const fs::path& file : files) loadCsv(file, byNode);
+  // Orden de tiempo y sin las copias que el receptor vuelve a guardar cada SD_SAVE_INTERVAL
+  for (auto& entry : byNode) {
+    std::vector<Reading>& readings = entry.second;
+    std::stable_sort(readings.begin(), readings.end(),
+                     [](const Reading& a, const Reading& b) { return a.time < b.time; });
+    readings.erase(std::unique(readings.begin(), readings.end(),
+                               [](const Reading& a, const Reading& b) {
+                                 return a.seq >= 0 && a.seq == b.seq;
+                               }),
+                   readings.end());
+  }
+
+  std::mt19937 rng(seed);
+  std::vector<Episode> episodes;
+  if (inject) {
+    for (auto& entry : byNode) injectFaults(entry.first, entry.second, rng, episodes);
+  }
+
+  // Reproducción cronometrada: solo anomalyCheck(), con las lecturas ya en memoria
+  AnomalyConfig config;
+  size_t total = 0;
+  auto started = std::chrono::steady_clock::now();
+  for (auto& entry : byNode) {
+    AnomalyState state;
+    for (Reading& reading : entry.second) {
+      reading.flags = anomalyCheck(state, config, reading.values, (uint32_t)(reading.time * 1000));
+    }
+    total += entry.second.size();
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+  printf("%zu lecturas de %zu nodos: %.1f ns/lectura, %zu bytes de estado por flujo (%zu por nodo)\n\n", total,
+         byNode.size(), total ? seconds * 1e9 / total : 0.0, sizeof(AnomalyStream), sizeof(AnomalyState));
+
+  // Marcas en lecturas sin fallo inyectado, por sensor y motivo
+  printf("%-12s %10s %9s", "sensor", "limpias", "marcadas");
+  for (const char* reason : ANOMALY_REASON_NAMES) printf(" %8s", reason);
+  printf("\n");
+  for (int s = 0; s < ANOMALY_SENSORS; s++) {
+    size_t clean = 0, flagged = 0, reasons[4] = {0, 0, 0, 0};
+    for (const auto& entry : byNode) {
+      for (const Reading& reading : entry.second) {
+        if (reading.fault[s] != FAULT_NONE) continue;
+        clean++;
+        uint16_t bits = (reading.flags >> (4 * s)) & 0xF;
+        if (bits) flagged++;
+        for (int r = 0; r < 4; r++) reasons[r] += (bits >> r) & 1;
+      }
+    }
+    printf("%-12s %10zu %8.3f%%", SENSOR_NAMES[s], clean, clean ? 100.0 * flagged / clean : 0.0);
+    for (size_t count : reasons) printf(" %8zu", count);
+    printf("\n");
+  }
+  if (!inject) return 0;
+
+  printf("\n%-8s %9s %10s %18s %16s\n", "fallo", "episodios", "detectados", "retraso p50/máx", "lecturas marcadas");
+  for (int type = 1; type < FAULT_TYPES; type++) {
+    size_t count = 0, detected = 0, faulty = 0, marked = 0;
+    std::vector<size_t> delays;
+    for (const Episode& episode : episodes) {
+      if (episode.type != type) continue;
+      count++;
+      const std::vector<Reading>& readings = byNode[episode.node];
+      bool found = false;
+      for (size_t k = episode.first; k <= episode.last; k++) {
+        for (int s = 0; s < ANOMALY_SENSORS; s++) {
+          if (readings[k].fault[s] != type) continue;
+          faulty++;
+          if (anomalySuspect(readings[k].flags, s)) {
+            marked++;
+            if (!found) delays.push_back(k - episode.first);
+            found = true;
+          }
+        }
+      }
+      if (found) detected++;
+    }
+    std::sort(delays.begin(), delays.end());
+    char delayText[32];
+    snprintf(delayText, sizeof(delayText), "%zu/%zu", delays.empty() ? 0 : delays[delays.size() / 2],
+             delays.empty() ? 0 : delays.back());
+    printf("%-8s %9zu %9.1f%% %18s %15.1f%%\n", FAULT_NAMES[type], count, count ? 100.0 * detected / count : 0.0,
+           delayText, faulty ? 100.0 * marked / faulty : 0.0);
+  }
+  return 0;
+}
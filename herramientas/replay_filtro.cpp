@@ -0,0 +1,207 @@
+// Reproducción en Linux del filtrado en el nodo sobre registros históricos
+//
+// Lee los CSV diarios del receptor (/data/sensors_AAAA-MM-DD.csv, un directorio o archivos
+// sueltos), pasa las lecturas de cada nodo por edgeFilterUpdate() (edge_filter.h, el mismo
+// código que el transmisor) y calcula:
+//   - tramas ahorradas: lecturas que el nodo no habría enviado,
+//   - error de reconstrucción: el receptor mantiene el último valor recibido hasta el siguiente,
+//     comparado con la lectura original (RMS, percentil 95 y máximo por sensor).
+// Con --sweep repite el cálculo escalando los umbrales para elegir un punto de trabajo.
+//
+// Compilar: g++ -O2 -std=c++17 replay_filtro.cpp -o replay_filtro
+// Uso:      replay_filtro [-T °C] [-H %] [-L %] [-S %] [--heartbeat s] [--sweep] <dir_o_csv> ...
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../edge_filter.h"
+
+namespace fs = std::filesystem;
+
+struct Reading {
+  int64_t time;
+  long seq;
+  float values[FILTER_SENSORS];
+};
+
+// Días desde 1970-01-01 para una fecha civil (algoritmo de Howard Hinnant)
+static int64_t daysFromCivil(int64_t y, unsigned m, unsigned d) {
+  y -= m <= 2;
+  const int64_t era = (y >= 0 ? y : y - 399) / 400;
+  const unsigned yoe = (unsigned)(y - era * 400);
+  const unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + (int64_t)doe - 719468;
+}
+
+static bool parseTimestamp(const std::string& text, int64_t& out) {
+  int y, mo, d, h, mi, s;
+  if (sscanf(text.c_str(), "%d-%d-%d %d:%d:%d", &y, &mo, &d, &h, &mi, &s) != 6) return false;
+  out = daysFromCivil(y, mo, d) * 86400 + h * 3600 + mi * 60 + s;
+  return true;
+}
+
+static std::vector<std::string> splitCsv(const std::string& line) {
+  std::vector<std::string> fields;
+  std::string field;
+  std::istringstream in(line);
+  while (std::getline(in, field, ',')) fields.push_back(field);
+  return fields;
+}
+
+// Agrupa las lecturas por nodo; los archivos antiguos sin columna node cuentan como nodo 0
+static bool loadCsv(const fs::path& path, std::map<int, std::vector<Reading>>& byNode) {
+  std::ifstream in(path);
+  std::string line;
+  if (!std::getline(in, line)) return false;
+  if (!line.empty() && line.back() == '\r') line.pop_back();
+  std::vector<std::string> header = splitCsv(line);
+  int columns[FILTER_SENSORS] = {-1, -1, -1, -1};
+  int nodeCol = -1, seqCol = -1;
+  for (size_t i = 0; i < header.size(); i++) {
+    if (header[i] == "temperature") columns[FILTER_TEMP] = i;
+    else if (header[i] == "humidity") columns[FILTER_HUM] = i;
+    else if (header[i] == "lux") columns[FILTER_LUX] = i;
+    else if (header[i] == "soil_moisture") columns[FILTER_SOIL] = i;
+    else if (header[i] == "node") nodeCol = i;
+    else if (header[i] == "seq") seqCol = i;
+  }
+  for (int column : columns) {
+    if (column < 0) {
+      fprintf(stderr, "%s: faltan columnas de sensores\n", path.c_str());
+      return false;
+    }
+  }
+
+  while (std::getline(in, line)) {
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    std::vector<std::string> fields = splitCsv(line);
+    Reading reading;
+    if (fields.size() < header.size() || !parseTimestamp(fields[0], reading.time)) continue;
+    for (int s = 0; s < FILTER_SENSORS; s++) reading.values[s] = atof(fields[columns[s]].c_str());
+    reading.seq = seqCol >= 0 && !fields[seqCol].empty() ? atol(fields[seqCol].c_str()) : -1;
+    int node = nodeCol >= 0 ? atoi(fields[nodeCol].c_str()) : 0;
+    byNode[node].push_back(reading);
+  }
+  return true;
+}
+
+struct ReplayResult {
+  size_t readings = 0, sent = 0;
+  std::vector<float> errors[FILTER_SENSORS];
+};
+
+static ReplayResult replay(const std::map<int, std::vector<Reading>>& byNode, const EdgeFilterConfig& config) {
+  ReplayResult result;
+  for (const auto& entry : byNode) {
+    EdgeFilterState state;
+    float held[FILTER_SENSORS] = {0, 0, 0, 0};
+    for (const Reading& reading : entry.second) {
+      float values[FILTER_SENSORS];
+      memcpy(values, reading.values, sizeof(values));
+      if (edgeFilterUpdate(state, config, values, (uint32_t)reading.time)) {
+        memcpy(held, values, sizeof(held));
+        result.sent++;
+      }
+      for (int s = 0; s < FILTER_SENSORS; s++) result.errors[s].push_back(fabsf(held[s] - reading.values[s]));
+      result.readings++;
+    }
+  }
+  return result;
+}
+
+static void errorSummary(std::vector<float>& errors, float& rms, float& p95, float& maximum) {
+  double sumSquares = 0;
+  for (float e : errors) sumSquares += (double)e * e;
+  rms = errors.empty() ? 0 : sqrt(sumSquares / errors.size());
+  std::sort(errors.begin(), errors.end());
+  p95 = errors.empty() ? 0 : errors[(size_t)(0.95 * (errors.size() - 1))];
+  maximum = errors.empty() ? 0 : errors.back();
+}
+
+static void printResult(const char* label, ReplayResult& result) {
+  printf("%-22s %8zu %8zu %7.1f%%", label, result.readings, result.sent,
+         result.readings ? 100.0 * (result.readings - result.sent) / result.readings : 0.0);
+  for (int s = 0; s < FILTER_SENSORS; s++) {
+    float rms, p95, maximum;
+    errorSummary(result.errors[s], rms, p95, maximum);
+    printf("  %8.2f %8.2f %8.1f", rms, p95, maximum);
+  }
+  printf("\n");
+}
+
+int main(int argc, char** argv) {
+  EdgeFilterConfig config;
+  bool sweep = false;
+  std::vector<fs::path> files;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-T") && i + 1 < argc) config.tempDelta = atof(argv[++i]);
+    else if (!strcmp(argv[i], "-H") && i + 1 < argc) config.humDelta = atof(argv[++i]);
+    else if (!strcmp(argv[i], "-L") && i + 1 < argc) config.luxPercent = atof(argv[++i]);
+    else if (!strcmp(argv[i], "-S") && i + 1 < argc) config.soilDelta = atof(argv[++i]);
+    else if (!strcmp(argv[i], "--heartbeat") && i + 1 < argc) config.heartbeatS = atol(argv[++i]);
+    else if (!strcmp(argv[i], "--sweep")) sweep = true;
+    else if (fs::is_directory(argv[i])) {
+      for (const auto& entry : fs::directory_iterator(argv[i])) {
+        if (entry.path().extension() == ".csv") files.push_back(entry.path());
+      }
+    } else if (fs::exists(argv[i])) {
+      files.push_back(argv[i]);
+    } else {
+      fprintf(stderr, "Uso: %s [-T °C] [-H %%] [-L %%] [-S %%] [--heartbeat s] [--sweep] <dir_o_csv> ...\n", argv[0]);
+      return 1;
+    }
+  }
+  if (files.empty()) {
+    fprintf(stderr, "Sin archivos CSV\n");
+    return 1;
+  }
+
+  std::map<int, std::vector<Reading>> byNode;
+  std::sort(files.begin(), files.end());
+  for (const fs::path& file : files) loadCsv(file, byNode);
+  // Orden de tiempo y sin las copias que el receptor vuelve a guardar cada SD_SAVE_INTERVAL
+  for (auto& entry : byNode) {
+    std::vector<Reading>& readings = entry.second;
+    std::stable_sort(readings.begin(), readings.end(),
+                     [](const Reading& a, const Reading& b) { return a.time < b.time; });
+    readings.erase(std::unique(readings.begin(), readings.end(),
+                               [](const Reading& a, const Reading& b) {
+                                 return a.seq >= 0 && a.seq == b.seq;
+                               }),
+                   readings.end());
+  }
+
+  printf("%-22s %8s %8s %8s", "umbrales", "lecturas", "enviadas", "ahorro");
+  const char* names[] = {"T", "H", "L", "S"};
+  for (const char* name : names) printf("  %4s rms %4s p95 %4s max", name, name, name);
+  printf("\n");
+
+  const float SCALES[] = {0.5f, 1.0f, 2.0f, 4.0f};
+  std::vector<float> scales = sweep ? std::vector<float>(SCALES, SCALES + 4) : std::vector<float>{1.0f};
+  for (float scale : scales) {
+    EdgeFilterConfig scaled = config;
+    scaled.tempDelta *= scale;
+    scaled.humDelta *= scale;
+    scaled.luxPercent *= scale;
+    scaled.soilDelta *= scale;
+    char label[64];
+    snprintf(label, sizeof(label), "%.2g/%.2g/%.0f%%/%.2g x%.1f", scaled.tempDelta, scaled.humDelta,
+             scaled.luxPercent, scaled.soilDelta, scale);
+    ReplayResult result = replay(byNode, scaled);
+    printResult(label, result);
+  }
+  printf("\nLatido cada %u s. Error: valor mantenido por el receptor frente a la lectura original.\n",
+         config.heartbeatS);
+  return 0;
+}
@@ -0,0 +1,196 @@
+// RYLR998 simulado para las herramientas de Linux
+//
+// Hace de lado "módulo" de la UART: se le escriben comandos AT como a LoRaSerial y devuelve
+// las respuestas cuando toca según un reloj virtual. Reproduce los tiempos del módulo real
+// (latencia de los comandos, +RESET/+READY, +OK de AT+SEND al aceptar la trama, +ERR=17 si
+// llega otro comando durante la emisión), el tiempo en el aire según SF/BW (adr_lora.h) y el
+// búfer RX limitado de la UART del ESP32, que pierde bytes si no se lee a tiempo.
+//
+// La radio se conecta con onTransmit (tramas emitidas) y deliver() (tramas recibidas).
+
+#ifndef SIM_RYLR998_H
+#define SIM_RYLR998_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <map>
+#include <string>
+
+#include "../adr_lora.h"
+
+const unsigned long SIM_COMMAND_LATENCY_MS = 8;   // Respuesta a un comando de configuración
+const unsigned long SIM_RESET_MS = 12;            // Hasta "+RESET"
+const unsigned long SIM_READY_MS = 320;           // Hasta "+READY" tras el reinicio
+const unsigned long SIM_SEND_ACCEPT_MS = 10;      // Hasta el +OK de AT+SEND, luego empieza a emitir
+const unsigned long SIM_RCV_LATENCY_MS = 3;       // Fin de la trama en el aire -> "+RCV=" en la UART
+const size_t SIM_UART_BUFFER = 256;               // Búfer RX por defecto de HardwareSerial
+
+class SimRylr998 {
+ public:
+  // dest, datos, inicio y fin de la emisión (ms del reloj virtual)
+  std::function<void(SimRylr998& radio, int dest, const std::string& data, unsigned long start, unsigned long end)> onTransmit;
+
+  int address = 0;
+  int networkId = 18;
+  LoRaRate rate = ADR_RATES[ADR_DEFAULT_RATE];
+  bool sleeping = false;
+  bool muted = false;        // No contesta nada (módulo colgado o desconectado)
+  unsigned long uartOverflowBytes = 0;
+  unsigned long framesMissedBusy = 0;
+
+  SimRylr998(unsigned long (*clock)(), size_t uartBuffer = SIM_UART_BUFFER) : clock(clock), uartBuffer(uartBuffer) {}
+
+  // --- Lado MCU (misma interfaz que HardwareSerial) ---
+  int available() {
+    update();
+    return (int)rx.size();
+  }
+
+  int read() {
+    update();
+    if (rx.empty()) return -1;
+    int c = (unsigned char)rx.front();
+    rx.pop_front();
+    return c;
+  }
+
+  size_t write(const uint8_t* data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+      char c = (char)data[i];
+      if (c == '\n') {
+        handleCommand(commandLine);
+        commandLine.clear();
+      } else if (c != '\r') {
+        commandLine += c;
+      }
+    }
+    return length;
+  }
+
+  // --- Lado radio ---
+  // Puede recibir si está despierto y no emitiendo en ese instante
+  bool canReceive(unsigned long at) const { return !sleeping && (at < txStart || at >= txEnd); }
+
+  // Entrega una trama que terminó de llegar en `at`; false si el módulo no podía recibirla
+  bool deliver(unsigned long at, int from, const std::string& data, int rssi, int snr) {
+    if (!canReceive(at)) {
+      framesMissedBusy++;
+      return false;
+    }
+    schedule(at + SIM_RCV_LATENCY_MS, "+RCV=" + std::to_string(from) + "," + std::to_string(data.size()) + "," +
+                                          data + "," + std::to_string(rssi) + "," + std::to_string(snr));
+    return true;
+  }
+
+  // Pasa a la UART las líneas cuyo momento ya llegó
+  void update() {
+    unsigned long now = clock();
+    while (!outbox.empty() && outbox.begin()->first <= now) {
+      const std::string& line = outbox.begin()->second;
+      for (char c : line + "\r\n") {
+        if (rx.size() < uartBuffer) rx.push_back(c);
+        else uartOverflowBytes++;
+      }
+      outbox.erase(outbox.begin());
+    }
+  }
+
+ private:
+  void schedule(unsigned long at, const std::string& line) {
+    if (!muted) outbox.emplace(at, line);
+  }
+
+  void reply(const std::string& line, unsigned long delayMs = SIM_COMMAND_LATENCY_MS) {
+    schedule(clock() + delayMs, line);
+  }
+
+  void handleCommand(const std::string& command) {
+    unsigned long now = clock();
+    if (command.compare(0, 2, "AT") != 0) {
+      reply("+ERR=2");
+      return;
+    }
+    sleeping = false; // Cualquier comando despierta al módulo de AT+MODE=1
+    if (now < txEnd) {
+      reply("+ERR=17"); // La emisión anterior no ha terminado
+      return;
+    }
+
+    std::string name = command.substr(2);
+    std::string value;
+    size_t equals = name.find('=');
+    if (equals != std::string::npos) {
+      value = name.substr(equals + 1);
+      name = name.substr(0, equals);
+    }
+
+    if (name.empty()) {
+      reply("+OK");
+    } else if (name == "+RESET") {
+      reply("+RESET", SIM_RESET_MS);
+      reply("+READY", SIM_READY_MS);
+    } else if (name == "+ADDRESS" && !value.empty()) {
+      address = atoi(value.c_str());
+      reply("+OK");
+    } else if (name == "+ADDRESS?") {
+      reply("+ADDRESS=" + std::to_string(address));
+    } else if (name == "+NETWORKID" && !value.empty()) {
+      networkId = atoi(value.c_str());
+      reply("+OK");
+    } else if (name == "+PARAMETER") {
+      int sf, bw, cr, preamble;
+      if (sscanf(value.c_str(), "%d,%d,%d,%d", &sf, &bw, &cr, &preamble) != 4 || sf < 5 || sf > 12 ||
+          bw < 0 || bw > 9 || cr < 1 || cr > 4) {
+        reply("+ERR=4");
+        return;
+      }
+      rate = {(uint8_t)sf, (uint8_t)bw};
+      reply("+OK");
+    } else if (name == "+MODE") {
+      reply("+OK");
+      if (value == "1") sleeping = true;
+    } else if (name == "+SEND") {
+      handleSend(value, now);
+    } else {
+      reply("+ERR=4");
+    }
+  }
+
+  // AT+SEND=<dirección>,<longitud>,<datos>
+  void handleSend(const std::string& value, unsigned long now) {
+    size_t first = value.find(',');
+    size_t second = value.find(',', first == std::string::npos ? 0 : first + 1);
+    if (first == std::string::npos || second == std::string::npos) {
+      reply("+ERR=4");
+      return;
+    }
+    int dest = atoi(value.substr(0, first).c_str());
+    int length = atoi(value.substr(first + 1, second - first - 1).c_str());
+    std::string data = value.substr(second + 1);
+    if (length > 240) {
+      reply("+ERR=13");
+      return;
+    }
+    if ((int)data.size() != length) {
+      reply("+ERR=5");
+      return;
+    }
+    reply("+OK", SIM_SEND_ACCEPT_MS);
+    txStart = now + SIM_SEND_ACCEPT_MS;
+    txEnd = txStart + (unsigned long)loraAirtimeMs(rate, length);
+    if (onTransmit) onTransmit(*this, dest, data, txStart, txEnd);
+  }
+
+  unsigned long (*clock)();
+  size_t uartBuffer;
+  std::string commandLine;
+  std::multimap<unsigned long, std::string> outbox; // Líneas pendientes por instante de salida
+  std::deque<char> rx;                               // Búfer RX de la UART del ESP32
+  unsigned long txStart = 0;
+  unsigned long txEnd = 0;
+};
+
+#endif
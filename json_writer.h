@@ -0,0 +1,279 @@
+// JSON sin memoria dinámica para las respuestas y peticiones pequeñas de la API web
+//
+// Compartido por el receptor y la herramienta de Linux herramientas/contar_asignaciones.cpp.
+// JsonWriter escribe sobre un búfer del llamador (comas y anidamiento automáticos, hasta
+// JSON_WRITER_DEPTH niveles); si no cabe, overflow queda a true y la respuesta no debe enviarse.
+// JsonFlatReader recorre un objeto plano {"clave":valor,...} sobre el propio texto de la petición,
+// sin copiarlo: cada campo apunta al texto original.
+//
+// Ni printf ni strtod: en newlib ambos pueden reservar memoria (dtoa) en su primera llamada. Los
+// float se escriben con hasta JSON_FLOAT_DECIMALS decimales sin ceros finales; NaN e infinito, como
+// null (igual que ArduinoJson).
+
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+
+const int JSON_WRITER_DEPTH = 8;
+const int JSON_FLOAT_DECIMALS = 3;
+
+class JsonWriter {
+ public:
+  JsonWriter(char* buffer, size_t capacity) : out_(buffer), capacity_(capacity) {}
+
+  void beginObject(const char* key = nullptr) { open(key, '{'); }
+  void endObject() { close('}'); }
+  void beginArray(const char* key = nullptr) { open(key, '['); }
+  void endArray() { close(']'); }
+
+  void field(const char* key, const char* value) {
+    element(key);
+    string(value);
+  }
+  void field(const char* key, bool value) {
+    element(key);
+    raw(value ? "true" : "false");
+  }
+  void field(const char* key, int value) { field(key, (long long)value); }
+  void field(const char* key, long value) { field(key, (long long)value); }
+  void field(const char* key, unsigned int value) { field(key, (long long)value); }
+  void field(const char* key, unsigned long value) { field(key, (long long)value); }
+  void field(const char* key, long long value) {
+    element(key);
+    integer(value);
+  }
+  void field(const char* key, float value) {
+    element(key);
+    number(value);
+  }
+  void null(const char* key = nullptr) {
+    element(key);
+    raw("null");
+  }
+
+  size_t length() const { return length_; }
+  bool overflow() const { return overflow_; }
+  const char* c_str() const { return out_; } // Terminado en '\0' mientras no haya overflow
+
+ private:
+  void put(char c) {
+    if (length_ + 1 >= capacity_) {
+      overflow_ = true;
+      return;
+    }
+    out_[length_++] = c;
+    out_[length_] = '\0';
+  }
+  void raw(const char* text) {
+    while (*text) put(*text++);
+  }
+
+  // Coma si no es el primer elemento del nivel, y la clave dentro de un objeto
+  void element(const char* key) {
+    if (depth_ > 0) {
+      if (!first_[depth_ - 1]) put(',');
+      first_[depth_ - 1] = false;
+    }
+    if (key) {
+      string(key);
+      put(':');
+    }
+  }
+  void open(const char* key, char bracket) {
+    element(key);
+    put(bracket);
+    if (depth_ < JSON_WRITER_DEPTH) first_[depth_++] = true;
+    else overflow_ = true;
+  }
+  void close(char bracket) {
+    if (depth_ > 0) depth_--;
+    put(bracket);
+  }
+
+  void string(const char* text) {
+    static const char HEX_DIGITS[] = "0123456789abcdef";
+    put('"');
+    for (; *text; text++) {
+      unsigned char c = *text;
+      if (c == '"' || c == '\\') {
+        put('\\');
+        put(c);
+      } else if (c < 0x20) {
+        raw("\\u00");
+        put(HEX_DIGITS[c >> 4]);
+        put(HEX_DIGITS[c & 0xF]);
+      } else {
+        put(c);
+      }
+    }
+    put('"');
+  }
+
+  void integer(long long value) {
+    char digits[24];
+    int n = 0;
+    unsigned long long magnitude = value < 0 ? 0ULL - (unsigned long long)value : value;
+    do {
+      digits[n++] = '0' + magnitude % 10;
+      magnitude /= 10;
+    } while (magnitude > 0);
+    if (value < 0) put('-');
+    while (n > 0) put(digits[--n]);
+  }
+
+  void number(float value) {
+    if (!isfinite(value)) {
+      raw("null");
+      return;
+    }
+    long long scale = 1;
+    for (int i = 0; i < JSON_FLOAT_DECIMALS; i++) scale *= 10;
+    double scaled = fabs((double)value) * scale + 0.5;
+    if (scaled >= 9e18) { // Fuera de long long, muy lejos de cualquier lectura de sensor
+      raw("null");
+      return;
+    }
+    long long fixed = (long long)scaled;
+    if (value < 0 && fixed != 0) put('-');
+    integer(fixed / scale);
+    long long fraction = fixed % scale;
+    if (fraction == 0) return;
+    put('.');
+    int decimals = JSON_FLOAT_DECIMALS;
+    while (fraction % 10 == 0) {
+      fraction /= 10;
+      decimals--;
+    }
+    for (long long digit = scale / 10; decimals-- > 0; digit /= 10) {
+      put('0' + (fixed % scale) / digit % 10);
+    }
+  }
+
+  char* out_;
+  size_t capacity_;
+  size_t length_ = 0;
+  bool overflow_ = false;
+  int depth_ = 0;
+  bool first_[JSON_WRITER_DEPTH];
+};
+
+// === Lectura de objetos planos ===
+struct JsonField {
+  const char* key;
+  size_t keyLength;
+  const char* value; // Sin comillas si es una cadena (sin desescapar)
+  size_t valueLength;
+  char type;         // 'n' número, 's' cadena, 'b' booleano, 'z' null
+
+  bool is(const char* name) const { return strlen(name) == keyLength && memcmp(name, key, keyLength) == 0; }
+
+  // Número decimal con signo, fracción y exponente opcionales, también entre comillas ("25.5"), como
+  // lo convierte ArduinoJson; false si el valor no es un número
+  bool number(double& result) const {
+    if (type != 'n' && type != 's') return false;
+    const char* p = value;
+    const char* end = value + valueLength;
+    bool negative = p < end && *p == '-';
+    if (negative) p++;
+    double mantissa = 0;
+    int exponent = 0, digits = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; p++, digits++) mantissa = mantissa * 10 + (*p - '0');
+    if (p < end && *p == '.') {
+      for (p++; p < end && *p >= '0' && *p <= '9'; p++, digits++) {
+        mantissa = mantissa * 10 + (*p - '0');
+        exponent--;
+      }
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+      p++;
+      bool negativeExponent = p < end && *p == '-';
+      if (p < end && (*p == '-' || *p == '+')) p++;
+      int e = 0;
+      for (; p < end && *p >= '0' && *p <= '9'; p++) e = e * 10 + (*p - '0');
+      exponent += negativeExponent ? -e : e;
+    }
+    if (digits == 0 || p != end) return false;
+    double magnitude = exponent < 0 ? mantissa / pow(10.0, -exponent) : mantissa * pow(10.0, exponent);
+    result = negative ? -magnitude : magnitude;
+    return true;
+  }
+};
+
+class JsonFlatReader {
+ public:
+  JsonFlatReader(const char* json, size_t length) : p_(json), end_(json + length) {
+    skipSpace();
+    if (p_ < end_ && *p_ == '{') p_++;
+    else error_ = true;
+  }
+
+  // Siguiente campo; false al terminar el objeto o ante un error (ver error())
+  bool next(JsonField& field) {
+    if (error_ || done_) return false;
+    skipSpace();
+    if (p_ < end_ && *p_ == '}') {
+      done_ = true;
+      return false;
+    }
+    if (!first_) {
+      if (p_ >= end_ || *p_ != ',') return fail();
+      p_++;
+      skipSpace();
+    }
+    first_ = false;
+    if (!quoted(field.key, field.keyLength)) return fail();
+    skipSpace();
+    if (p_ >= end_ || *p_ != ':') return fail();
+    p_++;
+    skipSpace();
+    if (p_ >= end_) return fail();
+    if (*p_ == '"') {
+      field.type = 's';
+      return quoted(field.value, field.valueLength) || fail();
+    }
+    // Objetos y listas anidados no se admiten: el lector es solo para objetos planos
+    const char* start = p_;
+    while (p_ < end_ && *p_ != ',' && *p_ != '}' && *p_ != ' ' && *p_ != '\t' && *p_ != '\r' && *p_ != '\n') {
+      if (*p_ == '{' || *p_ == '[') return fail();
+      p_++;
+    }
+    field.value = start;
+    field.valueLength = p_ - start;
+    if (field.valueLength == 0) return fail();
+    if (*start == 't' || *start == 'f') field.type = 'b';
+    else if (*start == 'n') field.type = 'z';
+    else field.type = 'n';
+    return true;
+  }
+
+  bool error() const { return error_; }
+
+ private:
+  void skipSpace() {
+    while (p_ < end_ && (*p_ == ' ' || *p_ == '\t' || *p_ == '\r' || *p_ == '\n')) p_++;
+  }
+  bool quoted(const char*& start, size_t& length) {
+    if (p_ >= end_ || *p_ != '"') return false;
+    start = ++p_;
+    while (p_ < end_ && *p_ != '"') p_ += (*p_ == '\\') ? 2 : 1;
+    if (p_ >= end_) return false;
+    length = p_++ - start;
+    return true;
+  }
+  bool fail() {
+    error_ = true;
+    return false;
+  }
+
+  const char* p_;
+  const char* end_;
+  bool first_ = true;
+  bool done_ = false;
+  bool error_ = false;
+};
+
+#endif
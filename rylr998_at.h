@@ -0,0 +1,232 @@
+// Motor de comandos AT no bloqueante para el RYLR998
+//
+// Compartido por el transmisor, el receptor y las herramientas de Linux (herramientas/prueba_rylr998.cpp).
+// Los comandos se encolan y se escriben de uno en uno; cada uno termina con su respuesta
+// (+OK, +READY tras AT+RESET, el valor de una consulta "?"), con +ERR=<n> o al vencer su plazo,
+// y su callback recibe el resultado. El módulo contesta +OK a AT+SEND al aceptar la trama y
+// rechaza con +ERR=17 cualquier comando hasta terminar de emitirla, así que tras un envío la
+// cola espera su tiempo en el aire antes de escribir el siguiente comando.
+// Las tramas +RCV pueden llegar en cualquier momento, también con un comando en curso: se
+// entregan al callback de recepción y nunca cuentan como respuesta.
+//
+// Port es cualquier clase con available(), read() y write(const uint8_t*, size_t), como HardwareSerial.
+
+#ifndef RYLR998_AT_H
+#define RYLR998_AT_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+const int RYLR_MAX_DATA = 240;        // Máximo de AT+SEND
+const int RYLR_LINE_SIZE = 288;       // +RCV=65535,240,<240 bytes>,-120,-20
+const int RYLR_COMMAND_SIZE = 264;    // AT+SEND=65535,240,<240 bytes>
+const int RYLR_QUEUE_SIZE = 8;
+const unsigned long RYLR_SEND_TIMEOUT_MS = 1000; // Hasta el +OK de AT+SEND
+const unsigned long RYLR_TX_GUARD_MS = 50;       // Margen tras el tiempo en el aire
+
+// Resultado de un comando: RYLR_OK, RYLR_TIMEOUT o el código n de +ERR=<n>
+const int RYLR_OK = 0;
+const int RYLR_TIMEOUT = -1;
+
+struct RylrFrame {
+  int address;
+  int length;
+  char data[RYLR_MAX_DATA + 1];
+  int rssi;
+  int snr;
+};
+
+// +RCV=<dirección>,<longitud>,<datos>,<RSSI>,<SNR>. Los datos pueden contener comas, así que se
+// toman por longitud y RSSI/SNR son los campos que siguen.
+inline bool parseRcvLine(const char* line, RylrFrame& frame) {
+  if (strncmp(line, "+RCV=", 5) != 0) return false;
+  char* end;
+  frame.address = strtol(line + 5, &end, 10);
+  if (*end != ',') return false;
+  frame.length = strtol(end + 1, &end, 10);
+  if (*end != ',' || frame.length < 0 || frame.length > RYLR_MAX_DATA) return false;
+  const char* data = end + 1;
+  if (strlen(data) < (size_t)frame.length) return false;
+  memcpy(frame.data, data, frame.length);
+  frame.data[frame.length] = '\0';
+
+  frame.rssi = 0;
+  frame.snr = 0;
+  const char* tail = data + frame.length;
+  if (*tail == ',') {
+    frame.rssi = strtol(tail + 1, &end, 10);
+    if (*end == ',') frame.snr = strtol(end + 1, NULL, 10);
+  }
+  return true;
+}
+
+template <typename Port>
+class Rylr998At {
+ public:
+  typedef void (*CommandCallback)(const char* command, int result);
+  typedef void (*FrameCallback)(const RylrFrame& frame);
+
+  struct Stats {
+    uint32_t commands = 0;
+    uint32_t errors = 0;      // +ERR=<n>
+    uint32_t timeouts = 0;
+    uint32_t frames = 0;      // +RCV entregados
+    uint32_t badLines = 0;    // +RCV mal formados o líneas demasiado largas
+    uint32_t unexpected = 0;  // Líneas sin comando en curso
+    uint32_t queueFull = 0;
+  };
+
+  Rylr998At(Port& port, unsigned long (*clock)()) : port(port), clock(clock) {}
+
+  void onFrame(FrameCallback callback) { frameCallback = callback; }
+
+  // Encola un comando (sin "\r\n"); false si la cola está llena o no cabe
+  bool send(const char* command, unsigned long timeoutMs, CommandCallback callback = NULL) {
+    size_t length = strlen(command);
+    if (length >= (size_t)RYLR_COMMAND_SIZE) return false;
+    Command* slot = reserve();
+    if (!slot) return false;
+    memcpy(slot->text, command, length + 1);
+    slot->timeoutMs = timeoutMs;
+    slot->holdMs = 0;
+    slot->callback = callback;
+    return true;
+  }
+
+  // AT+SEND=<dirección>,<longitud>,<datos>; airtimeMs reserva el módulo mientras emite
+  bool sendFrame(int address, const char* data, int length, float airtimeMs, CommandCallback callback = NULL) {
+    if (length < 0 || length > RYLR_MAX_DATA) return false;
+    Command* slot = reserve();
+    if (!slot) return false;
+    int header = snprintf(slot->text, RYLR_COMMAND_SIZE, "AT+SEND=%d,%d,", address, length);
+    memcpy(slot->text + header, data, length);
+    slot->text[header + length] = '\0';
+    slot->timeoutMs = RYLR_SEND_TIMEOUT_MS;
+    slot->holdMs = (unsigned long)airtimeMs + RYLR_TX_GUARD_MS;
+    slot->callback = callback;
+    return true;
+  }
+
+  // Lee lo que haya en el puerto, resuelve respuestas y plazos y escribe el siguiente comando.
+  // Llamar a menudo desde loop(): entre llamadas el módulo solo cuenta con el búfer de la UART.
+  void poll() {
+    while (port.available() > 0) {
+      int c = port.read();
+      if (c < 0) break;
+      if (c == '\r') continue;
+      if (c == '\n') {
+        if (lineOverflow) {
+          counters.badLines++;
+        } else if (lineLength > 0) {
+          line[lineLength] = '\0';
+          handleLine();
+        }
+        lineLength = 0;
+        lineOverflow = false;
+      } else if (lineLength < RYLR_LINE_SIZE - 1) {
+        line[lineLength++] = (char)c;
+      } else {
+        lineOverflow = true;
+      }
+    }
+
+    if (inFlight && clock() - sentAt >= queue[head].timeoutMs) complete(RYLR_TIMEOUT);
+    if (!inFlight && count > 0 && (long)(clock() - readyAt) >= 0) writeHead();
+  }
+
+  bool idle() const { return count == 0; }
+  int pending() const { return count; }
+  // Valor de la última consulta ("AT+ADDRESS?" -> "+ADDRESS=1"), válido dentro del callback
+  const char* response() const { return lastResponse; }
+  const Stats& stats() const { return counters; }
+
+ private:
+  struct Command {
+    char text[RYLR_COMMAND_SIZE];
+    unsigned long timeoutMs;
+    unsigned long holdMs;  // Tiempo desde la escritura durante el que el módulo sigue ocupado
+    CommandCallback callback;
+  };
+
+  Command* reserve() {
+    if (count == RYLR_QUEUE_SIZE) {
+      counters.queueFull++;
+      return NULL;
+    }
+    return &queue[(head + count++) % RYLR_QUEUE_SIZE];
+  }
+
+  void writeHead() {
+    const char* text = queue[head].text;
+    port.write((const uint8_t*)text, strlen(text));
+    port.write((const uint8_t*)"\r\n", 2);
+    inFlight = true;
+    sentAt = clock();
+    counters.commands++;
+  }
+
+  void handleLine() {
+    if (strncmp(line, "+RCV=", 5) == 0) {
+      RylrFrame frame;
+      if (!parseRcvLine(line, frame)) {
+        counters.badLines++;
+      } else {
+        counters.frames++;
+        if (frameCallback) frameCallback(frame);
+      }
+      return;
+    }
+    if (!inFlight) {
+      counters.unexpected++;
+      return;
+    }
+
+    const char* command = queue[head].text;
+    size_t commandLength = strlen(command);
+    if (strncmp(line, "+ERR=", 5) == 0) {
+      complete(atoi(line + 5));
+    } else if (strcmp(command, "AT+RESET") == 0) {
+      if (strcmp(line, "+READY") == 0) complete(RYLR_OK); // "+RESET" llega antes y no cierra el comando
+    } else if (commandLength > 0 && command[commandLength - 1] == '?') {
+      strncpy(lastResponse, line, sizeof(lastResponse) - 1);
+      lastResponse[sizeof(lastResponse) - 1] = '\0';
+      complete(RYLR_OK);
+    } else if (strcmp(line, "+OK") == 0) {
+      complete(RYLR_OK);
+    }
+  }
+
+  // El callback se llama antes de liberar la posición, así puede encolar otros comandos
+  void complete(int result) {
+    if (result == RYLR_TIMEOUT) counters.timeouts++;
+    else if (result > 0) counters.errors++;
+    inFlight = false;
+    readyAt = result == RYLR_OK ? sentAt + queue[head].holdMs : clock();
+    if (queue[head].callback) queue[head].callback(queue[head].text, result);
+    head = (head + 1) % RYLR_QUEUE_SIZE;
+    count--;
+    lastResponse[0] = '\0';
+  }
+
+  Port& port;
+  unsigned long (*clock)();
+  FrameCallback frameCallback = NULL;
+
+  Command queue[RYLR_QUEUE_SIZE];
+  int head = 0;
+  int count = 0;
+  bool inFlight = false;
+  unsigned long sentAt = 0;
+  unsigned long readyAt = 0;
+
+  char line[RYLR_LINE_SIZE];
+  int lineLength = 0;
+  bool lineOverflow = false;
+  char lastResponse[48] = "";
+
+  Stats counters;
+};
+
+#endif
@@ -0,0 +1,329 @@
+// Registro en SD a prueba de cortes: diario de escritura anticipada (write-ahead) y recuperación
+//
+// Compartido por el receptor y la inyección de fallos en Linux (herramientas/prueba_journal.cpp).
+// Cada línea del CSV termina con una columna crc (CRC-16 en hexadecimal de todo lo anterior), así
+// una línea a medias o un sector lleno de basura tras un corte se reconoce sin más contexto.
+//
+// Antes de añadir un lote a un archivo diario sus líneas se copian al diario, un archivo de tamaño
+// fijo con JOURNAL_SLOTS ranuras usado como anillo. La ranura de confirmación de un lote (tamaño ya
+// escrito) no se escribe aparte: va delante de las ranuras del lote siguiente, en la misma escritura.
+// Cada append cuesta así dos escrituras (diario y CSV) en lugar de tres. Al arrancar, recover():
+//   - lee el diario entero (tamaño fijo) y busca las líneas posteriores a la última confirmación;
+//     si el archivo ya las tiene enteras tras el tamaño previo al lote (lo normal: el último lote
+//     antes de apagar queda sin confirmar) solo confirma; si no, trunca a ese tamaño y las reescribe;
+//   - revisa solo los últimos JOURNAL_TAIL_BYTES del archivo y trunca las líneas finales rotas.
+// La misma revisión de la cola se hace la primera vez que append() toca cada archivo diario (día
+// nuevo, o archivo escrito por un firmware anterior sin diario). El tiempo de recuperación no depende
+// del tamaño de los archivos.
+//
+// Fs es el acceso a la tarjeta (SD en el receptor, memoria en la prueba) con:
+//   long size(path)                          -1 si no existe
+//   size_t read(path, offset, data, length)
+//   bool write(path, offset, data, length)   escritura en su sitio, ya volcada a la tarjeta
+//   bool append(path, data, length, newSize)
+//   bool truncate(path, length)
+//   void dayPath(day, out, outSize)          archivo diario de una medianoche (epoch local)
+
+#ifndef SD_JOURNAL_H
+#define SD_JOURNAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+const int JOURNAL_SLOTS = 64;
+const int JOURNAL_SLOT_SIZE = 128;
+const int JOURNAL_LINE_MAX = JOURNAL_SLOT_SIZE - 16;  // Línea CSV con su '\n'
+const int JOURNAL_MAX_BATCH = JOURNAL_SLOTS / 2 - 1;  // Líneas por lote (con la confirmación anterior, medio anillo)
+const uint32_t JOURNAL_TAIL_BYTES = 2048;             // Cola del CSV revisada al arrancar
+const int JOURNAL_PATH_MAX = 32;
+
+enum { JOURNAL_RECORD = 1, JOURNAL_COMMIT = 2 };
+
+struct JournalSlot {
+  uint32_t seq;      // Creciente; 0 = ranura vacía
+  uint32_t day;      // Archivo diario al que pertenece
+  uint32_t offset;   // RECORD: tamaño del archivo antes del lote; COMMIT: tamaño confirmado
+  uint8_t type;
+  uint8_t length;    // Bytes de line (RECORD)
+  uint16_t crc;      // CRC-16 de la ranura con crc = 0
+  char line[JOURNAL_LINE_MAX];
+};
+static_assert(sizeof(JournalSlot) == JOURNAL_SLOT_SIZE, "Ranura del diario con relleno inesperado");
+
+struct JournalRecovery {
+  int replayed = 0;           // Líneas del diario escritas de nuevo (no cuenta las que ya estaban)
+  int droppedLines = 0;       // Líneas rotas quitadas de la cola del CSV
+  uint32_t truncatedBytes = 0;
+  uint32_t bytesRead = 0;     // Lecturas hechas por la recuperación (acotadas)
+};
+
+// CRC-16/CCITT-FALSE
+inline uint16_t journalCrc16(const uint8_t* data, size_t length, uint16_t crc = 0xFFFF) {
+  for (size_t i = 0; i < length; i++) {
+    crc ^= (uint16_t)data[i] << 8;
+    for (int bit = 0; bit < 8; bit++) crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+}
+
+// Sufijo ",xxxx" (6 caracteres + '\0') para una línea CSV sin su '\n'
+inline void journalLineCrc(const char* line, size_t length, char out[7]) {
+  snprintf(out, 7, ",%04x", journalCrc16((const uint8_t*)line, length));
+}
+
+// true si la línea (sin '\n') termina en ",xxxx" con el CRC de lo anterior
+inline bool journalLineValid(const char* line, size_t length) {
+  if (length < 6 || line[length - 5] != ',') return false;
+  char expected[7];
+  journalLineCrc(line, length - 5, expected);
+  return memcmp(expected, line + length - 5, 5) == 0;
+}
+
+template <typename Fs>
+class SdJournal {
+ public:
+  SdJournal(Fs& fs, const char* journalPath) : fs_(fs), path_(journalPath) {}
+
+  // Crea el diario con su tamaño fijo si falta y busca la ranura más reciente
+  bool begin() {
+    if (fs_.size(path_) != (long)(JOURNAL_SLOTS * JOURNAL_SLOT_SIZE)) {
+      JournalSlot empty;
+      memset(&empty, 0, sizeof(empty));
+      for (int i = 0; i < JOURNAL_SLOTS; i++) {
+        if (!fs_.write(path_, i * JOURNAL_SLOT_SIZE, (const uint8_t*)&empty, sizeof(empty))) return false;
+      }
+    }
+    loadSlots();
+    return true;
+  }
+
+  // Añade `length` bytes de líneas terminadas en '\n' (cada una < JOURNAL_LINE_MAX) al archivo de
+  // `day` en lotes de JOURNAL_MAX_BATCH. Retorna false si la tarjeta falló; newSize es el tamaño final.
+  bool append(uint32_t day, const char* lines, size_t length, uint32_t& newSize) {
+    char path[JOURNAL_PATH_MAX];
+    fs_.dayPath(day, path, sizeof(path));
+    if (day != checkedDay_) {
+      repairTail(day, stats_);
+      checkedDay_ = day;
+    }
+    size_t start = 0;
+    while (start < length) {
+      long base = fs_.size(path);
+      if (base < 0) return false;
+      // Confirmación del lote anterior delante de este, en la misma escritura
+      int count = 0;
+      if (pendingCommit_) {
+        fill(batch_[count], JOURNAL_COMMIT, commitDay_, commitSize_);
+        seal(batch_[count++]);
+      }
+      int first = count;
+      size_t end = start;
+      while (end < length && count - first < JOURNAL_MAX_BATCH) {
+        const char* newline = (const char*)memchr(lines + end, '\n', length - end);
+        if (!newline) return false;
+        size_t lineLength = newline - (lines + end) + 1;
+        if (lineLength > (size_t)JOURNAL_LINE_MAX) return false;
+        JournalSlot& slot = batch_[count++];
+        fill(slot, JOURNAL_RECORD, day, base);
+        slot.length = lineLength;
+        memcpy(slot.line, lines + end, lineLength);
+        seal(slot);
+        end += lineLength;
+      }
+      if (!writeSlots(batch_, count)) return false;
+      pendingCommit_ = false;
+      if (!fs_.append(path, (const uint8_t*)lines + start, end - start, newSize)) return false;
+      pendingCommit_ = true;
+      commitDay_ = day;
+      commitSize_ = newSize;
+      start = end;
+    }
+    return true;
+  }
+
+  JournalRecovery recover() {
+    JournalRecovery& result = stats_;
+    result.bytesRead += JOURNAL_SLOTS * JOURNAL_SLOT_SIZE; // loadSlots() en begin()
+
+    // Líneas posteriores a la última confirmación: van del slot más reciente hacia atrás
+    int pending = 0;
+    uint32_t seq = lastSeq_;
+    int index = lastSlot_;
+    while (seq > 0 && pending < JOURNAL_SLOTS) {
+      const JournalSlot& slot = slots_[index];
+      if (slot.seq != seq || slot.type != JOURNAL_RECORD) break;
+      if (pending > 0 && (slot.day != slots_[(index + 1) % JOURNAL_SLOTS].day ||
+                          slot.offset != slots_[(index + 1) % JOURNAL_SLOTS].offset)) break;
+      pending++;
+      seq--;
+      index = (index + JOURNAL_SLOTS - 1) % JOURNAL_SLOTS;
+    }
+
+    uint32_t day = 0;
+    if (pending > 0) {
+      const JournalSlot& first = slots_[(index + 1) % JOURNAL_SLOTS];
+      day = first.day;
+      char path[JOURNAL_PATH_MAX];
+      fs_.dayPath(day, path, sizeof(path));
+      long size = fs_.size(path);
+      uint32_t newSize = first.offset;
+      bool written = size >= 0; // Archivo borrado después (retención): nada que recuperar
+      for (int i = 0; written && i < pending; i++) {
+        const JournalSlot& slot = slots_[(index + 1 + i) % JOURNAL_SLOTS];
+        written = newSize + slot.length <= (uint32_t)size && sameBytes(path, newSize, slot, result);
+        newSize += slot.length;
+      }
+      if (size >= 0 && !written) {
+        if (size > (long)first.offset) {
+          fs_.truncate(path, first.offset);
+          result.truncatedBytes += size - first.offset;
+        }
+        for (int i = 0; i < pending; i++) {
+          const JournalSlot& slot = slots_[(index + 1 + i) % JOURNAL_SLOTS];
+          if (!fs_.append(path, (const uint8_t*)slot.line, slot.length, newSize)) return result;
+          result.replayed++;
+        }
+      }
+      commit(day, newSize);
+    } else if (lastSeq_ > 0) {
+      day = slots_[lastSlot_].day;
+    } else {
+      return result; // Diario vacío: nada escrito todavía con él
+    }
+
+    repairTail(day, result);
+    checkedDay_ = day;
+    return result;
+  }
+
+  // Acumulado de recover() y de las revisiones de cola hechas por append()
+  const JournalRecovery& stats() const { return stats_; }
+
+  // Día de la última ranura escrita (0 = diario vacío)
+  uint32_t lastDay() const { return lastSeq_ > 0 ? slots_[lastSlot_].day : 0; }
+
+ private:
+  void loadSlots() {
+    lastSeq_ = 0;
+    lastSlot_ = JOURNAL_SLOTS - 1;
+    for (int i = 0; i < JOURNAL_SLOTS; i++) {
+      JournalSlot& slot = slots_[i];
+      if (fs_.read(path_, i * JOURNAL_SLOT_SIZE, (uint8_t*)&slot, sizeof(slot)) != sizeof(slot) || !valid(slot)) {
+        slot.seq = 0;
+        continue;
+      }
+      if (slot.seq > lastSeq_) {
+        lastSeq_ = slot.seq;
+        lastSlot_ = i;
+      }
+    }
+  }
+
+  // Quita de la cola del archivo las líneas sin '\n' o con CRC incorrecto (basura tras un corte)
+  void repairTail(uint32_t day, JournalRecovery& result) {
+    char path[JOURNAL_PATH_MAX];
+    fs_.dayPath(day, path, sizeof(path));
+    long size = fs_.size(path);
+    if (size <= 0) return;
+
+    // Solo los archivos con columna crc se validan línea a línea
+    char header[JOURNAL_LINE_MAX];
+    size_t headerLength = fs_.read(path, 0, (uint8_t*)header, sizeof(header));
+    result.bytesRead += headerLength;
+    const char* headerEnd = (const char*)memchr(header, '\n', headerLength);
+    if (!headerEnd) return;
+    uint32_t bodyStart = headerEnd - header + 1;
+    const char* nameEnd = headerEnd > header && headerEnd[-1] == '\r' ? headerEnd - 1 : headerEnd;
+    bool checkCrc = nameEnd - header >= 4 && memcmp(nameEnd - 4, ",crc", 4) == 0;
+    if ((uint32_t)size <= bodyStart) return;
+
+    uint32_t windowStart = (uint32_t)size > bodyStart + JOURNAL_TAIL_BYTES ? (uint32_t)size - JOURNAL_TAIL_BYTES : bodyStart;
+    size_t windowLength = fs_.read(path, windowStart, tail_, (uint32_t)size - windowStart);
+    result.bytesRead += windowLength;
+
+    // De atrás hacia delante: la primera línea válida marca el nuevo final
+    size_t end = windowLength;
+    int dropped = 0;
+    while (end > 0) {
+      bool terminated = tail_[end - 1] == '\n';
+      size_t lineEnd = terminated ? end - 1 : end;
+      size_t lineStart = lineEnd;
+      while (lineStart > 0 && tail_[lineStart - 1] != '\n') lineStart--;
+      if (lineStart == 0 && windowStart != bodyStart) { // La ventana corta esta línea: no se puede validar
+        if (!terminated) return; // Ni una línea entera en la ventana: mejor no tocar nada
+        break;
+      }
+      if (terminated && (!checkCrc || journalLineValid((const char*)tail_ + lineStart, lineEnd - lineStart))) break;
+      dropped++;
+      end = lineStart;
+    }
+    if (dropped == 0) return;
+    fs_.truncate(path, windowStart + end);
+    result.droppedLines += dropped;
+    result.truncatedBytes += windowLength - end;
+  }
+
+  // true si el archivo tiene la línea de la ranura a partir de offset
+  bool sameBytes(const char* path, uint32_t offset, const JournalSlot& slot, JournalRecovery& result) {
+    size_t n = fs_.read(path, offset, tail_, slot.length);
+    result.bytesRead += n;
+    return n == slot.length && memcmp(tail_, slot.line, n) == 0;
+  }
+
+  bool commit(uint32_t day, uint32_t size) {
+    pendingCommit_ = false;
+    JournalSlot& slot = batch_[0];
+    fill(slot, JOURNAL_COMMIT, day, size);
+    seal(slot);
+    return writeSlots(batch_, 1);
+  }
+
+  void fill(JournalSlot& slot, uint8_t type, uint32_t day, uint32_t offset) {
+    memset(&slot, 0, sizeof(slot));
+    slot.seq = ++lastSeq_;
+    slot.day = day;
+    slot.offset = offset;
+    slot.type = type;
+  }
+
+  static void seal(JournalSlot& slot) {
+    slot.crc = 0;
+    slot.crc = journalCrc16((const uint8_t*)&slot, sizeof(slot));
+  }
+
+  static bool valid(const JournalSlot& slot) {
+    JournalSlot copy = slot;
+    copy.crc = 0;
+    return slot.seq != 0 && slot.length <= JOURNAL_LINE_MAX &&
+           journalCrc16((const uint8_t*)&copy, sizeof(copy)) == slot.crc;
+  }
+
+  // Ranuras consecutivas del anillo, en una o dos escrituras si dan la vuelta
+  bool writeSlots(const JournalSlot* slots, int count) {
+    int first = (lastSlot_ + 1) % JOURNAL_SLOTS;
+    int run = count < JOURNAL_SLOTS - first ? count : JOURNAL_SLOTS - first;
+    if (!fs_.write(path_, first * JOURNAL_SLOT_SIZE, (const uint8_t*)slots, run * JOURNAL_SLOT_SIZE)) return false;
+    if (run < count &&
+        !fs_.write(path_, 0, (const uint8_t*)(slots + run), (count - run) * JOURNAL_SLOT_SIZE)) return false;
+    for (int i = 0; i < count; i++) slots_[(first + i) % JOURNAL_SLOTS] = slots[i];
+    lastSlot_ = (first + count - 1) % JOURNAL_SLOTS;
+    return true;
+  }
+
+  Fs& fs_;
+  const char* path_;
+  JournalSlot slots_[JOURNAL_SLOTS];        // Copia del diario en RAM (8 KB)
+  JournalSlot batch_[JOURNAL_MAX_BATCH + 1]; // Lote y la confirmación del anterior
+  uint8_t tail_[JOURNAL_TAIL_BYTES];
+  uint32_t lastSeq_ = 0;
+  int lastSlot_ = JOURNAL_SLOTS - 1;
+  uint32_t checkedDay_ = 0;                 // Último archivo con la cola ya revisada
+  bool pendingCommit_ = false;              // Último lote escrito, confirmado con el siguiente
+  uint32_t commitDay_ = 0;
+  uint32_t commitSize_ = 0;
+  JournalRecovery stats_;
+};
+
+#endif